@@ -357,43 +357,118 @@ static int textSort(GenObject* obj1, GenObject* obj2, void* context)
 }
 
 
+// Section name index sizes, grown when buckets hold more than 4 sections
+//  up to the largest size a HashList accepts
+static const unsigned int s_indexSizes[] = { 17, 127, 1021, 0 };
+
 Configuration::Configuration()
-    : m_main(false)
+    : m_last(&m_sections), m_index(0),
+      m_pos(0), m_posFirst(0), m_posLen(0), m_posAlloc(0),
+      m_main(false)
 {
 }
 
 Configuration::Configuration(const char* filename, bool warn)
-    : String(filename), m_main(false)
+    : String(filename), m_last(&m_sections), m_index(0),
+      m_pos(0), m_posFirst(0), m_posLen(0), m_posAlloc(0),
+      m_main(false)
 {
     load(warn);
 }
 
-ObjList* Configuration::getSectHolder(const String& sect) const
+Configuration::~Configuration()
 {
-    if (sect.null())
-	return 0;
-    return const_cast<ObjList*>(m_sections.find(sect));
+    clearIndex();
+    delete[] m_pos;
 }
 
-ObjList* Configuration::makeSectHolder(const String& sect)
+// Forget all indexed sections, the section list must be already cleared
+void Configuration::clearIndex()
+{
+    TelEngine::destruct(m_index);
+    m_posFirst = m_posLen = 0;
+    m_last = &m_sections;
+}
+
+// Add a newly appended section to the name and position indexes
+void Configuration::indexSection(NamedList* sect)
+{
+    if (m_posFirst + m_posLen >= m_posAlloc) {
+	if (m_posFirst > m_posLen)
+	    // sections were removed from the head, reuse their room
+	    ::memmove(m_pos,m_pos + m_posFirst,m_posLen * sizeof(NamedList*));
+	else {
+	    m_posAlloc = m_posAlloc ? 2 * m_posAlloc : 16;
+	    NamedList** pos = new NamedList*[m_posAlloc];
+	    if (m_posLen)
+		::memcpy(pos,m_pos + m_posFirst,m_posLen * sizeof(NamedList*));
+	    delete[] m_pos;
+	    m_pos = pos;
+	}
+	m_posFirst = 0;
+    }
+    m_pos[m_posFirst + m_posLen++] = sect;
+    unsigned int size = 0;
+    for (int i = 0; s_indexSizes[i]; i++) {
+	size = s_indexSizes[i];
+	if (m_posLen <= 4 * size)
+	    break;
+    }
+    if (m_index && m_index->length() >= size) {
+	m_index->append(sect)->setDelete(false);
+	return;
+    }
+    TelEngine::destruct(m_index);
+    m_index = new HashList(size);
+    for (unsigned int i = 0; i < m_posLen; i++)
+	m_index->append(m_pos[m_posFirst + i])->setDelete(false);
+}
+
+// Take a section about to be removed out of the indexes
+void Configuration::unindexSection(NamedList* sect)
+{
+    if (m_index)
+	m_index->remove(sect,false,true);
+    if (!m_posLen)
+	return;
+    NamedList** pos = m_pos + m_posFirst;
+    if (pos[0] == sect) {
+	m_posFirst++;
+	m_posLen--;
+	return;
+    }
+    for (unsigned int i = 1; i < m_posLen; i++) {
+	if (pos[i] != sect)
+	    continue;
+	m_posLen--;
+	::memmove(pos + i,pos + i + 1,(m_posLen - i) * sizeof(NamedList*));
+	return;
+    }
+}
+
+NamedList* Configuration::makeSection(const String& sect)
 {
     if (sect.null())
 	return 0;
-    ObjList *l = getSectHolder(sect);
-    if (!l)
-	l = m_sections.append(new NamedList(sect));
-    return l;
+    NamedList* nl = getSection(sect);
+    if (!nl) {
+	nl = new NamedList(sect);
+	m_last = m_last->append(nl);
+	indexSection(nl);
+    }
+    return nl;
 }
 
 NamedList* Configuration::getSection(unsigned int index) const
 {
-    return static_cast<NamedList *>(m_sections[index]);
+    return (index < m_posLen) ? m_pos[m_posFirst + index] : 0;
 }
 
 NamedList* Configuration::getSection(const String& sect) const
 {
-    ObjList *l = getSectHolder(sect);
-    return l ? static_cast<NamedList *>(l->get()) : 0;
+    if (sect.null() || !m_index)
+	return 0;
+    return static_cast<NamedList*>((*m_index)[sect]);
 }
 
 NamedString* Configuration::getKey(const String& sect, const String& key) const
@@ -443,19 +518,26 @@ bool Configuration::getBoolValue(const String& sect, const String& key, bool def
 void Configuration::clearSection(const char* sect)
 {
     if (sect) {
-	ObjList *l = getSectHolder(sect);
-	if (l)
-	    l->remove();
+	NamedList* nl = getSection(String(sect));
+	ObjList* l = nl ? m_sections.find(nl) : 0;
+	if (!l)
+	    return;
+	unindexSection(nl);
+	l->remove();
+	// removing shifts the following node into this one
+	if (!l->next())
+	    m_last = l;
     }
-    else
+    else {
 	m_sections.clear();
+	clearIndex();
+    }
 }
 
 // Make sure a section with a given name exists, create it if required
 NamedList* Configuration::createSection(const String& sect)
 {
-    ObjList* o = makeSectHolder(sect);
-    return o ? static_cast<NamedList*>(o->get()) : 0;
+    return makeSection(sect);
 }
 
 void Configuration::clearKey(const String& sect, const String& key)
@@ -468,10 +550,7 @@ void Configuration::clearKey(const String& sect, const String& key)
 void Configuration::addValue(const String& sect, const char* key, const char* value)
 {
     DDebug(DebugAll,"Configuration::addValue(\"%s\",\"%s\",\"%s\")",sect.c_str(),key,value);
-    ObjList *l = makeSectHolder(sect);
-    if (!l)
-	return;
-    NamedList *n = static_cast<NamedList *>(l->get());
+    NamedList* n = makeSection(sect);
     if (n)
 	n->addParam(key,value);
 }
@@ -479,10 +558,7 @@ void Configuration::addValue(const String& sect, const char* key, const char* va
 void Configuration::setValue(const String& sect, const char* key, const char* value)
 {
     DDebug(DebugAll,"Configuration::setValue(\"%s\",\"%s\",\"%s\")",sect.c_str(),key,value);
-    ObjList *l = makeSectHolder(sect);
-    if (!l)
-	return;
-    NamedList *n = static_cast<NamedList *>(l->get());
+    NamedList* n = makeSection(sect);
     if (n)
 	n->setParam(key,value);
 }
@@ -511,14 +587,14 @@ bool Configuration::load(bool warn)
 	    Debug(DebugNote,"Configuration is using old logic");
     }
     if (s_useOld) {
-	m_sections.clear();
+	clearSection();
 	if (null())
 	    return false;
 	ConfigurationPrivate priv(*this,m_main);
 	return loadFile(c_str(),"",0,warn,&priv);
     }
 
-    m_sections.clear();
+    clearSection();
     if (null())
 	return false;
     ConfigPriv priv(*this,m_main,warn);
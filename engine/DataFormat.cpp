@@ -21,6 +21,12 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RESAMP_X86
+#include <immintrin.h>
+#endif
 
 namespace TelEngine {
 
@@ -47,6 +53,8 @@ static const FormatInfo s_formats[] = {
     FormatInfo("clearmode", 80, 20000, "data", 0, 1, false),
     FormatInfo("plain", 0, 0, "text", 0),
     FormatInfo("raw", 0, 0, "data", 0),
+    FormatInfo("slin/44100", 882, 10000, "audio", 44100, 1, true),
+    FormatInfo("slin/48000", 960, 10000, "audio", 48000, 1, true),
 };
 
 // FIXME: put proper conversion costs everywhere below
@@ -90,13 +98,60 @@ static TranslatorCaps s_simpleCaps32k[] = {
 static TranslatorCaps s_resampCaps[] = {
     { s_formats+0, s_formats+3, 2 },
     { s_formats+0, s_formats+6, 2 },
+    { s_formats+0, s_formats+21, 3 },
+    { s_formats+0, s_formats+22, 2 },
     { s_formats+3, s_formats+0, 2 },
     { s_formats+3, s_formats+6, 2 },
+    { s_formats+3, s_formats+21, 3 },
+    { s_formats+3, s_formats+22, 2 },
     { s_formats+6, s_formats+0, 2 },
     { s_formats+6, s_formats+3, 2 },
+    { s_formats+6, s_formats+21, 3 },
+    { s_formats+6, s_formats+22, 2 },
+    { s_formats+21, s_formats+0, 3 },
+    { s_formats+21, s_formats+3, 3 },
+    { s_formats+21, s_formats+6, 3 },
+    { s_formats+21, s_formats+22, 3 },
+    { s_formats+22, s_formats+0, 2 },
+    { s_formats+22, s_formats+3, 2 },
+    { s_formats+22, s_formats+6, 2 },
+    { s_formats+22, s_formats+21, 3 },
     { 0, 0, 0 }
 };
 
+// Resampler quality levels
+enum ResampQuality {
+    ResampFast = 0,
+    ResampLow,
+    ResampMedium,
+    ResampHigh,
+};
+
+static const TokenDict s_resampQualities[] = {
+    { "fast", ResampFast },
+    { "low", ResampLow },
+    { "medium", ResampMedium },
+    { "high", ResampHigh },
+    { 0, 0 }
+};
+
+// Filter design parameters for each quality level
+static const struct {
+    // taps per polyphase branch, multiplied by the decimation factor
+    unsigned int taps;
+    // Kaiser window shape, controls the stopband attenuation
+    double beta;
+    // cutoff frequency relative to the lower Nyquist frequency
+    double cutoff;
+} s_resampDesign[] = {
+    { 8, 5.0, 0.80 },
+    { 16, 6.0, 0.85 },
+    { 32, 8.0, 0.90 },
+    { 64, 10.0, 0.94 },
+};
+
+static int s_resampQuality = ResampMedium;
+
 static TranslatorCaps s_stereoCaps[] = {
     { s_formats+0, s_formats+9, 1 },
     { s_formats+9, s_formats+0, 2 },
@@ -188,6 +243,7 @@ class ResampTranslator : public DataTranslator
 private:
     int m_sRate, m_dRate;
     short m_last;
+    DataBlock m_buffer;
 public:
     ResampTranslator(const DataFormat& sFormat, const DataFormat& dFormat)
 	: DataTranslator(sFormat,dFormat),
@@ -204,12 +260,12 @@ public:
 	    if (src) {
 		long delta = tStamp - m_timestamp;
 		short* s = (short*) data.data();
-		DataBlock oblock;
+		DataBlock& oblock = m_buffer;
 		if (m_dRate > m_sRate) {
 		    int mul = m_dRate / m_sRate;
 		    // linear interpolation between existing samples
 		    delta *= mul;
-		    oblock.assign(0,2*n*mul);
+		    oblock.resize(2*n*mul,false,false);
 		    short* d = (short*) oblock.data();
 		    while (n--) {
 			short v = *s++;
@@ -223,7 +279,7 @@ public:
 		    // average an integer number of samples
 		    delta /= div;
 		    n /= div;
-		    oblock.assign(0,2*n);
+		    oblock.resize(2*n,false,false);
 		    short* d = (short*) oblock.data();
 		    while (n--) {
 			int v = 0;
@@ -247,6 +303,253 @@ public:
 	}
 };
 
+// Dot product of 16 bit samples with Q14 coefficients, count is a multiple of 8
+typedef int (*ResampDotFunc)(const int16_t* samples, const int16_t* coefs, unsigned int count);
+
+static int resampDotScalar(const int16_t* samples, const int16_t* coefs, unsigned int count)
+{
+    int acc = 0;
+    for (unsigned int i = 0; i < count; i++)
+	acc += samples[i] * coefs[i];
+    return acc;
+}
+
+#ifdef RESAMP_X86
+__attribute__((target("sse2")))
+static int resampDotSse2(const int16_t* samples, const int16_t* coefs, unsigned int count)
+{
+    __m128i acc = _mm_setzero_si128();
+    for (unsigned int i = 0; i < count; i += 8)
+	acc = _mm_add_epi32(acc,_mm_madd_epi16(_mm_loadu_si128((const __m128i*)(samples + i)),
+	    _mm_loadu_si128((const __m128i*)(coefs + i))));
+    acc = _mm_add_epi32(acc,_mm_shuffle_epi32(acc,0x4e));
+    acc = _mm_add_epi32(acc,_mm_shuffle_epi32(acc,0xb1));
+    return _mm_cvtsi128_si32(acc);
+}
+
+__attribute__((target("avx2")))
+static int resampDotAvx2(const int16_t* samples, const int16_t* coefs, unsigned int count)
+{
+    __m256i acc = _mm256_setzero_si256();
+    unsigned int i = 0;
+    for (; i + 16 <= count; i += 16)
+	acc = _mm256_add_epi32(acc,_mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(samples + i)),
+	    _mm256_loadu_si256((const __m256i*)(coefs + i))));
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc),_mm256_extracti128_si256(acc,1));
+    if (i < count)
+	sum = _mm_add_epi32(sum,_mm_madd_epi16(_mm_loadu_si128((const __m128i*)(samples + i)),
+	    _mm_loadu_si128((const __m128i*)(coefs + i))));
+    sum = _mm_add_epi32(sum,_mm_shuffle_epi32(sum,0x4e));
+    sum = _mm_add_epi32(sum,_mm_shuffle_epi32(sum,0xb1));
+    return _mm_cvtsi128_si32(sum);
+}
+#endif
+
+// Pick the fastest dot product the CPU supports
+static ResampDotFunc resampDot()
+{
+    static ResampDotFunc s_dot = 0;
+    if (s_dot)
+	return s_dot;
+    ResampDotFunc dot = resampDotScalar;
+#ifdef RESAMP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+	dot = resampDotAvx2;
+    else if (__builtin_cpu_supports("sse2"))
+	dot = resampDotSse2;
+#endif
+    s_dot = dot;
+    return dot;
+}
+
+// Modified Bessel function of the first kind, order zero
+static double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    double q = x * x / 4.0;
+    for (int k = 1; k < 64; k++) {
+	term *= q / ((double)k * k);
+	sum += term;
+	if (term < sum * 1e-12)
+	    break;
+    }
+    return sum;
+}
+
+// Polyphase filter bank, shared by all resamplers with same ratio and quality
+class ResampFilter : public RefObject
+{
+public:
+    ResampFilter(unsigned int up, unsigned int down, int quality);
+    virtual const String& toString() const
+	{ return m_name; }
+    inline unsigned int up() const
+	{ return m_up; }
+    inline unsigned int down() const
+	{ return m_down; }
+    inline unsigned int taps() const
+	{ return m_taps; }
+    inline const int16_t* phase(unsigned int p) const
+	{ return (const int16_t*)m_coefs.data() + p * m_taps; }
+    static ResampFilter* get(unsigned int up, unsigned int down, int quality);
+private:
+    String m_name;
+    unsigned int m_up;
+    unsigned int m_down;
+    unsigned int m_taps;
+    DataBlock m_coefs;
+};
+
+static ObjList s_resampFilters;
+static Mutex s_resampMutex(false,"ResampFilter");
+
+// Design a Kaiser windowed sinc lowpass at the upsampled rate and split it in phases
+ResampFilter::ResampFilter(unsigned int up, unsigned int down, int quality)
+    : m_up(up), m_down(down), m_taps(0)
+{
+    m_name << up << "/" << down << "/" << quality;
+    // when decimating the filter must span more input samples
+    unsigned int taps = s_resampDesign[quality].taps * ((down + up - 1) / up);
+    m_taps = (taps + 7) & ~7;
+    unsigned int len = m_taps * up;
+    double fc = s_resampDesign[quality].cutoff * 0.5 / ((up > down) ? up : down);
+    double beta = s_resampDesign[quality].beta;
+    double norm = besselI0(beta);
+    double center = (len - 1) / 2.0;
+    double* proto = new double[len];
+    double sum = 0;
+    for (unsigned int i = 0; i < len; i++) {
+	double t = i - center;
+	double x = M_PI * 2 * fc * t;
+	double r = (len > 1) ? (t / center) : 0;
+	double h = 2 * fc * ((t == 0) ? 1.0 : (::sin(x) / x));
+	h *= besselI0(beta * ::sqrt(1 - r * r)) / norm;
+	proto[i] = h;
+	sum += h;
+    }
+    // unity gain for each phase, which means a gain of up for the whole filter
+    double scale = (sum > 0) ? (16384.0 * up / sum) : 0;
+    m_coefs.assign(0,len * sizeof(int16_t));
+    int16_t* c = (int16_t*)m_coefs.data();
+    for (unsigned int p = 0; p < up; p++) {
+	// store each phase reversed so it can be applied in sample order
+	for (unsigned int j = 0; j < m_taps; j++) {
+	    long v = ::lround(proto[(m_taps - 1 - j) * up + p] * scale);
+	    *c++ = (v > 32767) ? 32767 : ((v < -32767) ? -32767 : v);
+	}
+    }
+    delete[] proto;
+    DDebug(DebugAll,"Created resampler filter %s taps=%u [%p]",m_name.c_str(),m_taps,this);
+}
+
+// Get a filter from the cache, create it if needed, returns a referenced object
+ResampFilter* ResampFilter::get(unsigned int up, unsigned int down, int quality)
+{
+    String name;
+    name << up << "/" << down << "/" << quality;
+    Lock lock(s_resampMutex);
+    ResampFilter* f = static_cast<ResampFilter*>(s_resampFilters[name]);
+    if (f && f->ref())
+	return f;
+    f = new ResampFilter(up,down,quality);
+    s_resampFilters.append(f);
+    f->ref();
+    return f;
+}
+
+// slin mono polyphase FIR resampler for any rational ratio
+class PolyResampTranslator : public DataTranslator
+{
+public:
+    PolyResampTranslator(const DataFormat& sFormat, const DataFormat& dFormat, int quality);
+    virtual ~PolyResampTranslator()
+	{ TelEngine::destruct(m_filter); }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags);
+private:
+    ResampFilter* m_filter;
+    ResampDotFunc m_dot;
+    unsigned int m_phase;
+    unsigned int m_stampRem;
+    long m_stampSkip;
+    DataBlock m_input;
+    DataBlock m_output;
+};
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+    while (b) {
+	unsigned int t = a % b;
+	a = b;
+	b = t;
+    }
+    return a;
+}
+
+PolyResampTranslator::PolyResampTranslator(const DataFormat& sFormat, const DataFormat& dFormat, int quality)
+    : DataTranslator(sFormat,dFormat),
+      m_filter(0), m_dot(resampDot()), m_phase(0), m_stampRem(0), m_stampSkip(0)
+{
+    unsigned int sRate = sFormat.sampleRate();
+    unsigned int dRate = dFormat.sampleRate();
+    unsigned int g = gcd(sRate,dRate);
+    if (!g)
+	return;
+    m_filter = ResampFilter::get(dRate / g,sRate / g,quality);
+    // prime the history so the first samples come out after the filter delay
+    m_input.assign(0,(m_filter->taps() - 1) * sizeof(int16_t));
+}
+
+unsigned long PolyResampTranslator::Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+{
+    unsigned int n = data.length();
+    if (!n || (n & 1) || !m_filter || !ref())
+	return 0;
+    unsigned long len = 0;
+    DataSource* src = getTransSource();
+    if (src) {
+	unsigned int up = m_filter->up();
+	unsigned int down = m_filter->down();
+	unsigned int taps = m_filter->taps();
+	m_input.append(data);
+	unsigned int fill = m_input.length() / 2;
+	// number of outputs whose window fits entirely in the input
+	unsigned int count = 0;
+	if (fill >= taps)
+	    count = ((fill - taps + 1) * up - m_phase + down - 1) / down;
+	if (m_output.length() != count * sizeof(int16_t))
+	    m_output.resize(count * sizeof(int16_t),false,false);
+	const int16_t* s = (const int16_t*)m_input.data();
+	int16_t* d = (int16_t*)m_output.data();
+	unsigned int pos = 0;
+	for (unsigned int i = 0; i < count; i++) {
+	    int v = (m_dot(s + pos,m_filter->phase(m_phase),taps) + 8192) >> 14;
+	    // saturate the filtered result
+	    *d++ = (v > 32767) ? 32767 : ((v < -32767) ? -32767 : v);
+	    m_phase += down;
+	    pos += m_phase / up;
+	    m_phase %= up;
+	}
+	// keep the samples still needed by the next outputs
+	m_input.cut(0,pos * sizeof(int16_t),false);
+	long delta = tStamp - m_timestamp;
+	if (delta < 0)
+	    delta = n / 2;
+	u_int64_t scaled = (u_int64_t)delta * up + m_stampRem;
+	m_stampRem = (unsigned int)(scaled % down);
+	// carry the timestamp advance over calls that produced no output
+	delta = m_stampSkip + (long)(scaled / down);
+	m_stampSkip = count ? 0 : delta;
+	if (src->timeStamp() != invalidStamp())
+	    delta += src->timeStamp();
+	if (count)
+	    len = src->Forward(m_output,delta,flags);
+    }
+    deref();
+    return len;
+}
+
 // slin simple mono-stereo converter
 class StereoTranslator : public DataTranslator
 {
@@ -320,7 +623,18 @@ public:
     ResampFactory() : TranslatorFactory("resample")
 	{ }
     virtual DataTranslator* create(const DataFormat& sFormat, const DataFormat& dFormat)
-	{ return converts(sFormat,dFormat) ? new ResampTranslator(sFormat,dFormat) : 0; }
+	{
+	    if (!converts(sFormat,dFormat))
+		return 0;
+	    int sRate = sFormat.sampleRate();
+	    int dRate = dFormat.sampleRate();
+	    int quality = s_resampQuality;
+	    // the basic resampler handles only integer ratios
+	    if ((quality == ResampFast) && sRate && dRate &&
+		!((sRate > dRate) ? (sRate % dRate) : (dRate % sRate)))
+		return new ResampTranslator(sFormat,dFormat);
+	    return new PolyResampTranslator(sFormat,dFormat,quality);
+	}
     virtual const TranslatorCaps* getCapabilities() const
 	{ return s_resampCaps; }
 };
@@ -1210,6 +1524,18 @@ static SimpleFactory s_sFactory32k(s_simpleCaps32k,"g711uwb");
 static ResampFactory s_rFactory;
 static StereoFactory s_stereoFactory;
 
+bool DataTranslator::setResampleQuality(const String& quality)
+{
+    int q = lookup(quality,s_resampQualities,-1);
+    if (q < 0) {
+	if (quality)
+	    Debug(DebugWarn,"Unknown resampler quality '%s'",quality.c_str());
+	return false;
+    }
+    s_resampQuality = q;
+    return true;
+}
+
 void DataTranslator::setMaxChain(unsigned int maxChain)
 {
     if (maxChain < 1)
@@ -17,7 +17,7 @@
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
  */
 
-#include "yatengine.h"
+#include "yatephone.h"
 #include "yateversn.h"
 
 #ifdef _WINDOWS
@@ -99,6 +99,59 @@ public:
     static int count;
 };
 
+// Named class of queued messages served by its own pool of worker threads
+class DispatchClass : public RefObject
+{
+public:
+    DispatchClass(const String& name, int workers);
+    virtual const String& toString() const
+	{ return m_name; }
+    inline const String& threadName() const
+	{ return m_threadName; }
+    inline void setLimits(int maxMsgAge, int maxQueued)
+	{ m_maxMsgAge = maxMsgAge; m_maxQueued = maxQueued; }
+    bool enqueue(Message* msg);
+    bool dequeueOne();
+    void dequeue();
+    void wait();
+    void wake();
+    void startWorkers();
+    void checkCongestion();
+    void status(String& buf);
+    static DispatchClass* find(const String& msgName);
+private:
+    String m_name;
+    String m_threadName;
+    MessageDispatcher m_queue;
+    Semaphore m_semaphore;
+    int m_workers;
+    int m_maxMsgAge;
+    int m_maxQueued;
+    bool m_ageCongested;
+    bool m_queueCongested;
+};
+
+// Message name to dispatch class mapping
+class DispatchClassMsg : public String
+{
+public:
+    inline DispatchClassMsg(const String& name, DispatchClass* cls)
+	: String(name), m_class(cls)
+	{}
+    DispatchClass* m_class;
+};
+
+class DispatchClassWorker : public Thread
+{
+public:
+    inline DispatchClassWorker(DispatchClass* cls)
+	: Thread(cls->threadName()), m_class(cls)
+	{}
+    virtual void run();
+private:
+    RefPointer<DispatchClass> m_class;
+};
+
 class EngineCommand : public MessageHandler
 {
 public:
@@ -315,6 +368,8 @@ static EngineSharedPrivate s_vars;
 static Mutex s_hooksMutex(true,"HooksList");
 static ObjList s_hooks;
 static Semaphore* s_semWorkers = 0;
+static ObjList s_dispatchClasses;
+static HashList s_dispatchMsgs(67);
 static NamedCounter* s_counter = 0;
 static NamedCounter* s_workCnt = 0;
 static String s_applicationStatus;
@@ -555,6 +610,20 @@ bool EngineStatusHandler::received(Message &msg)
 	    return true;
 	}
 	if (sel.startSkip("dispatcher")) {
+	    if (sel == YSTRING("classes")) {
+		msg.retValue() << "name=dispatcher,type=system,"
+		    << "format=Workers|Queued|MaxQueued|MsgAge|Enqueued|Congested;"
+		    << "classes=" << s_dispatchClasses.count();
+		if (details) {
+		    String str;
+		    for (ObjList* o = s_dispatchClasses.skipNull(); o; o = o->skipNext())
+			static_cast<DispatchClass*>(o->get())->status(str);
+		    if (str)
+			msg.retValue() << ';' << str;
+		}
+		msg.retValue() << "\r\n";
+		return true;
+	    }
 	    bool byMsg = sel.startSkip("handlers");
 	    if ((byMsg || sel.startSkip("handlers-trackname")) && sel) {
 		unsigned int count = 0;
@@ -603,6 +672,12 @@ bool EngineStatusHandler::received(Message &msg)
     msg.retValue() << ",messagerate=" << Engine::self()->messageRate();
     msg.retValue() << ",maxmsgrate=" << Engine::self()->messageMaxRate();
     msg.retValue() << ",enqueued=" << enq << ",dequeued=" << deq << ",dispatched=" << disp ;
+    if (disp) {
+	// average handlers visited per dispatch: indexed vs. full linear walk
+	MessageDispatcher* d = Engine::dispatcher();
+	msg.retValue() << ",avgvisited=" << (unsigned int)(d->handlersVisited() / disp);
+	msg.retValue() << ",avglinear=" << (unsigned int)(d->handlersLinear() / disp);
+    }
     msg.retValue() << ",supervised=" << (s_super_handle >= 0);
     msg.retValue() << ",runattempt=" << s_run_attempt;
 #ifndef _WINDOWS
@@ -703,6 +778,8 @@ static const char s_dispatcherHelp[] =
     "Matching value starting with ^ is handled as basic regular expression\r\n"
     "  status dispatcher {handlers|handlers-trackname} <match>\r\n"
     "Show installed handlers by message name or track name. Matching value starting with ^ is handled as basic regular expression\r\n"
+    "  status dispatcher classes\r\n"
+    "Show queue and worker statistics of configured message dispatch classes\r\n"
     ;
 
 // get the base name of a module file
@@ -826,6 +903,7 @@ void EngineCommand::doCompletion(Message &msg, const String& partLine, const Str
     else if (partLine == YSTRING("status dispatcher")) {
 	completeOne(msg.retValue(),YSTRING("handlers"),partWord);
 	completeOne(msg.retValue(),YSTRING("handlers-trackname"),partWord);
+	completeOne(msg.retValue(),YSTRING("classes"),partWord);
     }
     else if (partLine == YSTRING("module")) {
 	completeOne(msg.retValue(),YSTRING("load"),partWord);
@@ -1128,6 +1206,139 @@ void EnginePrivate::run()
 }
 
 
+
+DispatchClass::DispatchClass(const String& name, int workers)
+    : m_name(name), m_threadName("Engine " + name),
+      m_semaphore(workers,"DispatchClass",0),
+      m_workers(workers), m_maxMsgAge(0), m_maxQueued(0),
+      m_ageCongested(false), m_queueCongested(false)
+{
+    m_queue.traceTime(Engine::self() && Engine::dispatcher()->traceTime());
+}
+
+DispatchClass* DispatchClass::find(const String& msgName)
+{
+    DispatchClassMsg* m = static_cast<DispatchClassMsg*>(s_dispatchMsgs[msgName]);
+    return m ? m->m_class : 0;
+}
+
+bool DispatchClass::enqueue(Message* msg)
+{
+    if (!m_queue.enqueue(msg))
+	return false;
+    m_semaphore.unlock();
+    return true;
+}
+
+bool DispatchClass::dequeueOne()
+{
+    Message* msg = m_queue.dequeueMessage();
+    if (!msg)
+	return false;
+    Engine::dispatch(*msg);
+    msg->destruct();
+    return true;
+}
+
+void DispatchClass::dequeue()
+{
+    while (dequeueOne())
+	;
+}
+
+void DispatchClass::wait()
+{
+    m_semaphore.lock(WORKER_SLEEP);
+}
+
+void DispatchClass::wake()
+{
+    for (int i = 0; i < m_workers; i++)
+	m_semaphore.unlock();
+}
+
+void DispatchClass::startWorkers()
+{
+    Debug(DebugInfo,"Creating %d message dispatching threads for class '%s'",
+	m_workers,m_name.c_str());
+    for (int i = 0; i < m_workers; i++)
+	(new DispatchClassWorker(this))->startup();
+}
+
+void DispatchClass::checkCongestion()
+{
+    bool cong = m_maxMsgAge && (m_queue.messageAge() > (unsigned)m_maxMsgAge);
+    if (cong != m_ageCongested) {
+	m_ageCongested = cong;
+	String reason;
+	reason << "message age over limit in class '" << m_name << "'";
+	Engine::setCongestion(cong ? reason.c_str() : 0);
+    }
+    cong = m_maxQueued && (m_queue.messageCount() > (unsigned)m_maxQueued);
+    if (cong != m_queueCongested) {
+	m_queueCongested = cong;
+	String reason;
+	reason << "message queue over limit in class '" << m_name << "'";
+	Engine::setCongestion(cong ? reason.c_str() : 0);
+    }
+}
+
+void DispatchClass::status(String& buf)
+{
+    String tmp;
+    tmp << m_name << "=" << m_workers << "|" << m_queue.messageCount()
+	<< "|" << m_queue.queuedMax() << "|" << m_queue.messageAge()
+	<< "|" << m_queue.enqueueCount()
+	<< "|" << String::boolText(m_ageCongested || m_queueCongested);
+    buf.append(tmp,",");
+}
+
+void DispatchClassWorker::run()
+{
+    for (;;) {
+	m_class->dequeue();
+	m_class->wait();
+	Thread::yield(true);
+    }
+}
+
+// Build dispatch classes from [dispatch NAME] sections or update their limits
+static void initDispatchClasses(bool first)
+{
+    unsigned int n = s_cfg.sections();
+    for (unsigned int i = 0; i < n; i++) {
+	const NamedList* sect = s_cfg.getSection(i);
+	if (!sect)
+	    continue;
+	String name = *sect;
+	if (!(name.startSkip("dispatch") && name.trimBlanks()))
+	    continue;
+	DispatchClass* cls = static_cast<DispatchClass*>(s_dispatchClasses[name]);
+	if (!cls) {
+	    if (!first) {
+		Debug(DebugMild,"Ignoring new dispatch class '%s', classes are not reloadable",
+		    name.c_str());
+		continue;
+	    }
+	    cls = new DispatchClass(name,sect->getIntValue(YSTRING("workers"),1,1,100));
+	    s_dispatchClasses.append(cls);
+	    ObjList msgs;
+	    (*sect)[YSTRING("messages")].split(msgs,',',false,true,true);
+	    for (ObjList* o = msgs.skipNull(); o; o = o->skipNext()) {
+		const String& msg = o->get()->toString();
+		DispatchClass* other = DispatchClass::find(msg);
+		if (other)
+		    Debug(DebugWarn,"Message '%s' already in dispatch class '%s', not adding to '%s'",
+			msg.c_str(),other->toString().c_str(),name.c_str());
+		else
+		    s_dispatchMsgs.append(new DispatchClassMsg(msg,cls));
+	    }
+	}
+	cls->setLimits(sect->getIntValue(YSTRING("maxmsgage"),0,0,5000),
+	    sect->getIntValue(YSTRING("maxqueued"),0,0,10000));
+    }
+}
+
 static bool logFileOpen()
 {
     if (s_logfile) {
@@ -1769,6 +1980,8 @@ int Engine::engineInit()
     s_maxmsgage = s_cfg.getIntValue("general","maxmsgage",s_maxmsgage,0,5000);
     s_maxqueued = s_cfg.getIntValue("general","maxqueued",s_maxqueued,0,10000);
     s_maxevents = s_cfg.getIntValue("general","maxevents",s_maxevents,0,1000);
+    DataTranslator::setResampleQuality(s_cfg.getValue("general","resample"));
+    NamedList::indexThreshold(s_cfg.getIntValue("general","paramindex",16,0,10000));
     s_restarts = s_cfg.getIntValue("general","restarts");
     s_timejump = s_cfg.getIntValue("general","timejump",0,0,MAX_TIME_JUMP);
     if (s_timejump && (s_timejump < MIN_TIME_JUMP))
@@ -1777,6 +1990,7 @@ int Engine::engineInit()
     m_dispatcher.warnTime(1000*(u_int64_t)s_cfg.getIntValue("general","warntime"));
     m_dispatcher.traceTime(s_cfg.getBoolValue("general","trace_msg_time"));
     m_dispatcher.traceHandlerTime(s_cfg.getBoolValue("general","trace_msg_handler_time"));
+    initDispatchClasses(true);
     extraPath(clientMode() ? "client" : "server");
     extraPath(s_cfg.getValue("general","extrapath"));
 
@@ -1842,7 +2056,7 @@ int Engine::engineInit()
     }
 #endif
     // Handle application related parameters. Do not allow them to be overridden by command line
-    NamedList* app = s_cfg.getSection("application");
+    const NamedList* app = s_cfg.getSection("application");
     if (app) {
 	ObjList version;
 	(*app)[YSTRING("report_version")].split(version,',',false);
@@ -2007,10 +2221,13 @@ int Engine::run()
 		= s_cfg.getIntValue("general","maxqueued",s_maxqueued,0,10000))));
 	    s_params.setParam("maxevents",String((s_maxevents
 		= s_cfg.getIntValue("general","maxevents",s_maxevents,0,1000))));
+	    DataTranslator::setResampleQuality(s_cfg.getValue("general","resample"));
+	    NamedList::indexThreshold(s_cfg.getIntValue("general","paramindex",16,0,10000));
 	    s_timejump = s_cfg.getIntValue("general","timejump",s_timejump,0,MAX_TIME_JUMP);
 	    if (s_timejump && (s_timejump < MIN_TIME_JUMP))
 		s_timejump = MIN_TIME_JUMP;
 	    s_timejump *= 1000;
+	    initDispatchClasses(false);
 	    initPlugins();
 	    last = 0;
 	}
@@ -2018,7 +2235,8 @@ int Engine::run()
 	if (s_debug) {
 	    // one-time sending of debug setup messages
 	    s_debug = false;
-	    for (ObjList* o = s_debugInit.paramList()->skipNull(); o; o = o->skipNext()) {
+	    const NamedList& dbg = s_debugInit;
+	    for (const ObjList* o = dbg.paramList()->skipNull(); o; o = o->skipNext()) {
 		const NamedString* str = static_cast<NamedString*>(o->get());
 		if (!(str->name() && *str))
 		    continue;
@@ -2056,6 +2274,8 @@ int Engine::run()
 		    s_semWorkers = new Semaphore(build,"Workers",0);
 		Debug(DebugInfo,"Creating first %d message dispatching threads%s",build,
 		    (s_semWorkers ? " and semaphore" : ""));
+		for (ObjList* o = s_dispatchClasses.skipNull(); o; o = o->skipNext())
+		    static_cast<DispatchClass*>(o->get())->startWorkers();
 	    }
 	    do {
 		(new EnginePrivate)->startup();
@@ -2111,6 +2331,8 @@ int Engine::run()
 	    m_queueCongested = cong;
 	    setCongestion(cong ? "message queue over limit" : 0);
 	}
+	for (ObjList* o = s_dispatchClasses.skipNull(); o; o = o->skipNext())
+	    static_cast<DispatchClass*>(o->get())->checkCongestion();
 
 	// Attempt to sleep until the next full second
 	u_int64_t tstart = Time::now();
@@ -2163,6 +2385,8 @@ int Engine::engineCleanup()
 	for (int i = EnginePrivate::count; i > 0; i--)
 	    s->unlock();
     }
+    for (ObjList* o = s_dispatchClasses.skipNull(); o; o = o->skipNext())
+	static_cast<DispatchClass*>(o->get())->wake();
     Thread::msleep(200);
     m_dispatcher.dequeue();
     checkPoint();
@@ -2170,6 +2394,8 @@ int Engine::engineCleanup()
     abortOnBug(s_sigabrt && s_lateabrt);
     Thread::killall();
     checkPoint();
+    for (ObjList* o = s_dispatchClasses.skipNull(); o; o = o->skipNext())
+	static_cast<DispatchClass*>(o->get())->dequeue();
     m_dispatcher.dequeue();
     ::signal(SIGTERM,SIG_DFL);
 #ifndef _WINDOWS
@@ -2544,6 +2770,11 @@ bool Engine::enqueue(Message* msg, bool skipHooks)
 	    return true;
 	}
     }
+    if (s_self) {
+	DispatchClass* cls = DispatchClass::find(*msg);
+	if (cls)
+	    return cls->enqueue(msg);
+    }
     if (s_self && s_self->m_dispatcher.enqueue(msg)) {
 	Semaphore*s = s_semWorkers;
 	if (s)
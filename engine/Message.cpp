@@ -35,10 +35,83 @@ private:
     RefPointer<MessageQueue> m_queue;
 };
 
+// Handlers installed for one message name, sorted by priority like the main list
+class MessageHandlerIndex : public String
+{
+public:
+    inline MessageHandlerIndex(const String& name)
+	: String(name)
+	{}
+    ObjList m_handlers;
+};
+
+// Check if a handler is sorted before another one (priority, then address)
+static inline bool handlerBefore(const MessageHandler* h1, const MessageHandler* h2)
+{
+    return (h1->priority() < h2->priority()) ||
+	((h1->priority() == h2->priority()) && (h1 < h2));
+}
+
+// Insert a handler in a sorted list, return the position where it was inserted
+static ObjList* insertHandler(ObjList& list, MessageHandler* handler, bool autoDelete = true)
+{
+    ObjList* l = &list;
+    int pos = 0;
+    for (; l; l=l->next(),pos++) {
+	MessageHandler* h = static_cast<MessageHandler*>(l->get());
+	if (!h)
+	    continue;
+	// at the same priority we sort them in pointer address order
+	if (!handlerBefore(h,handler))
+	    break;
+    }
+    if (l) {
+	XDebug(DebugAll,"Inserting handler [%p] on place #%d",handler,pos);
+	l = l->insert(handler);
+    }
+    else {
+	XDebug(DebugAll,"Appending handler [%p] on place #%d",handler,pos);
+	l = list.append(handler);
+    }
+    l->setDelete(autoDelete);
+    return l;
+}
+
+// Retrieve the first handler from two sorted lists, optionally advance past it
+static inline MessageHandler* firstHandler(ObjList*& l1, ObjList*& l2, bool advance = true)
+{
+    ObjList*& l = (l1 && !(l2 && handlerBefore(static_cast<MessageHandler*>(l2->get()),
+	static_cast<MessageHandler*>(l1->get())))) ? l1 : l2;
+    if (!l)
+	return 0;
+    MessageHandler* h = static_cast<MessageHandler*>(l->get());
+    if (advance)
+	l = l->skipNext();
+    return h;
+}
+
+// Skip handlers sorted before or equal to the last called handler
+// The last handler may be already destroyed so only compare its address
+static ObjList* skipHandlers(ObjList* l, const MessageHandler* last, unsigned int prio,
+    bool& found)
+{
+    found = false;
+    for (l = l ? l->skipNull() : 0; l; l = l->skipNext()) {
+	MessageHandler* h = static_cast<MessageHandler*>(l->get());
+	if (h == last) {
+	    found = true;
+	    return l->skipNext();
+	}
+	if ((h->priority() > prio) || ((h->priority() == prio) && (h > last)))
+	    break;
+    }
+    return l;
+}
+
 Message::Message(const char* name, const char* retval, bool broadcast)
     : NamedList(name),
       m_return(retval), m_timeEnqueue((uint64_t)0), m_timeDispatch((uint64_t)0),
-      m_data(0), m_notify(false), m_broadcast(broadcast)
+      m_data(0), m_notify(false), m_broadcast(broadcast), m_queueNext(0)
 {
     XDebug(DebugAll,"Message::Message(\"%s\",\"%s\",%s) [%p]",
 	name,retval,String::boolText(broadcast),this);
@@ -49,7 +122,7 @@ Message::Message(const Message& original)
       m_return(original.retValue()), m_time(original.msgTime()),
       m_timeEnqueue(original.m_timeEnqueue), m_timeDispatch(original.m_timeDispatch),
       m_data(0),
-      m_notify(false), m_broadcast(original.broadcast())
+      m_notify(false), m_broadcast(original.broadcast()), m_queueNext(0)
 {
     XDebug(DebugAll,"Message::Message(&%p) [%p]",&original,this);
 }
@@ -59,7 +132,7 @@ Message::Message(const Message& original, bool broadcast)
       m_return(original.retValue()), m_time(original.msgTime()),
       m_timeEnqueue(original.m_timeEnqueue), m_timeDispatch(original.m_timeDispatch),
       m_data(0),
-      m_notify(false), m_broadcast(broadcast)
+      m_notify(false), m_broadcast(broadcast), m_queueNext(0)
 {
     XDebug(DebugAll,"Message::Message(&%p,%s) [%p]",
 	&original,String::boolText(broadcast),this);
@@ -319,27 +392,39 @@ bool MessageRelay::receivedInternal(Message& msg)
 
 
 MessageDispatcher::MessageDispatcher(const char* trackParam)
-    : m_handlersLock("DispatcherHandlers"), m_messagesLock("DispatcherMsgs"), 
+    : m_handlersIndex(127),
+      m_handlersLock("DispatcherHandlers"), m_messagesLock(false,"DispatcherMsgs"),
       m_hooksLock("DispatcherHooks"),
-      m_msgAppend(&m_messages), m_hookAppend(&m_hooks),
-      m_trackParam(trackParam), m_changes(0), m_warnTime(0),
+      m_msgHead(0), m_msgTail(0), m_msgStub(0), m_hookAppend(&m_hooks),
+      m_trackParam(trackParam), m_changes(0), m_handlerCount(0), m_warnTime(0),
       m_enqueueCount(0), m_dequeueCount(0), m_dispatchCount(0),
-      m_queuedMax(0), m_msgAvgAge(0),
+      m_queuedMax(0), m_msgAvgAge(0), m_handlersVisited(0), m_handlersLinear(0),
       m_traceTime(false), m_traceHandlerTime(false),
       m_hookCount(0), m_hookHole(false)
 {
     XDebug(DebugInfo,"MessageDispatcher::MessageDispatcher('%s') [%p]",trackParam,this);
+    // the queue always holds a placeholder so producers never touch the consumer end
+    m_msgStub = new Message("");
+    m_msgHead = m_msgTail = m_msgStub;
 }
 
 MessageDispatcher::~MessageDispatcher()
 {
     XDebug(DebugInfo,"MessageDispatcher::~MessageDispatcher() [%p]",this);
     clear();
+    Lock lck(m_messagesLock);
+    for (Message* msg = popMessage(); msg; msg = popMessage())
+	msg->destruct();
+    lck.drop();
+    TelEngine::destruct(m_msgStub);
 }
 
 void MessageDispatcher::clear()
 {
     WLock lck(m_handlersLock);
+    m_handlersIndex.clear();
+    m_handlersNull.clear();
+    m_handlerCount = 0;
     m_handlers.clear();
     lck.acquire(m_hooksLock);
     m_hookAppend = &m_hooks;
@@ -355,29 +440,19 @@ bool MessageDispatcher::install(MessageHandler* handler)
     ObjList *l = m_handlers.find(handler);
     if (l)
 	return false;
-    unsigned p = handler->priority();
-    int pos = 0;
-    for (l=&m_handlers; l; l=l->next(),pos++) {
-	MessageHandler *h = static_cast<MessageHandler *>(l->get());
-	if (!h)
-	    continue;
-	if (h->priority() < p)
-	    continue;
-	if (h->priority() > p)
-	    break;
-	// at the same priority we sort them in pointer address order
-	if (h > handler)
-	    break;
-    }
     m_changes++;
-    if (l) {
-	XDebug(DebugAll,"Inserting handler [%p] on place #%d",handler,pos);
-	l->insert(handler);
-    }
+    insertHandler(m_handlers,handler);
+    if (handler->null())
+	insertHandler(m_handlersNull,handler,false);
     else {
-	XDebug(DebugAll,"Appending handler [%p] on place #%d",handler,pos);
-	m_handlers.append(handler);
+	MessageHandlerIndex* idx = static_cast<MessageHandlerIndex*>(m_handlersIndex[*handler]);
+	if (!idx) {
+	    idx = new MessageHandlerIndex(*handler);
+	    m_handlersIndex.append(idx);
+	}
+	insertHandler(idx->m_handlers,handler,false);
     }
+    m_handlerCount++;
     handler->m_dispatcher = this;
     if (handler->null())
 	Debug(DebugInfo,"Registered broadcast message handler %p",handler);
@@ -391,6 +466,30 @@ bool MessageDispatcher::uninstall(MessageHandler* handler)
     handler = static_cast<MessageHandler *>(m_handlers.remove(handler,false));
     if (handler) {
 	m_changes++;
+	m_handlerCount--;
+	if (handler->null())
+	    m_handlersNull.remove(handler,false);
+	else {
+	    MessageHandlerIndex* idx = static_cast<MessageHandlerIndex*>(m_handlersIndex[*handler]);
+	    if (!(idx && idx->m_handlers.find(handler))) {
+		// handler was renamed after being installed - search all names
+		idx = 0;
+		for (unsigned int i = 0; !idx && i < m_handlersIndex.length(); i++) {
+		    for (ObjList* o = m_handlersIndex.getList(i); o; o = o->skipNext()) {
+			MessageHandlerIndex* tmp = static_cast<MessageHandlerIndex*>(o->get());
+			if (tmp && tmp->m_handlers.find(handler)) {
+			    idx = tmp;
+			    break;
+			}
+		    }
+		}
+	    }
+	    if (idx) {
+		idx->m_handlers.remove(handler,false);
+		if (!idx->m_handlers.skipNull())
+		    m_handlersIndex.remove(idx);
+	    }
+	}
 	if (handler->m_unsafe > 0) {
 	    DDebug(DebugNote,"Waiting for unsafe MessageHandler %p '%s'",
 		handler,handler->c_str());
@@ -429,94 +528,90 @@ bool MessageDispatcher::dispatch(Message& msg)
     String hTrackName;
     unsigned int hTrackPos = 0;
     bool hTrackTime = m_traceHandlerTime;
-    ObjList *l = &m_handlers;
     RLock lck(m_handlersLock);
     m_dispatchCount++;
-    for (; l; l=l->next()) {
-	MessageHandler *h = static_cast<MessageHandler*>(l->get());
-	if (h && (h->null() || *h == msg)) {
-	    if (h->filter() && !h->filter()->matchListParam(msg))
-		continue;
-	    if (counting)
-		Thread::setCurrentObjCounter(h->objectsCounter());
-
-	    unsigned int c = m_changes;
-	    unsigned int p = h->priority();
-	    if (trackParam() && h->trackName()) {
-		NamedString* tracked = msg.getParam(trackParam());
-		if (tracked)
-		    tracked->append(h->trackName(),",");
-		else
-		    msg.addParam(trackParam(),h->trackName());
-		if (hTrackTime) {
-		    hTrackName = h->trackName();
-		    hTrackPos = tracked ? tracked->length() : hTrackName.length();
-		}
+    m_handlersLinear += m_handlerCount;
+    // merge handlers of this message name with the ones for all messages
+    unsigned int hash = msg.hash();
+    MessageHandlerIndex* idx = static_cast<MessageHandlerIndex*>(m_handlersIndex[msg]);
+    ObjList* ln = idx ? idx->m_handlers.skipNull() : 0;
+    ObjList* la = m_handlersNull.skipNull();
+    MessageHandler* h;
+    while ((h = firstHandler(ln,la))) {
+	m_handlersVisited++;
+	if (h->filter() && !h->filter()->matchListParam(msg))
+	    continue;
+	if (counting)
+	    Thread::setCurrentObjCounter(h->objectsCounter());
+
+	unsigned int c = m_changes;
+	unsigned int p = h->priority();
+	bool hNull = h->null();
+	if (trackParam() && h->trackName()) {
+	    NamedString* tracked = msg.getParam(trackParam());
+	    if (tracked)
+		tracked->append(h->trackName(),",");
+	    else
+		msg.addParam(trackParam(),h->trackName());
+	    if (hTrackTime) {
+		hTrackName = h->trackName();
+		hTrackPos = tracked ? tracked->length() : hTrackName.length();
 	    }
-	    // mark handler as unsafe to destroy / uninstall
-	    h->m_unsafe++;
-	    lck.drop();
+	}
+	// mark handler as unsafe to destroy / uninstall
+	h->m_unsafe++;
+	lck.drop();
 
-	    u_int64_t tm = (m_warnTime || hTrackTime) ? Time::now() : 0;
+	u_int64_t tm = (m_warnTime || hTrackTime) ? Time::now() : 0;
 
-	    retv = h->receivedInternal(msg) || retv;
+	retv = h->receivedInternal(msg) || retv;
 
-	    if (tm) {
-		tm = Time::now() - tm;
-		if (m_warnTime && tm > m_warnTime) {
-		    lck.acquire(m_handlersLock);
-		    const char* name = (c == m_changes) ? h->trackName().c_str() : 0;
-		    Debug(DebugInfo,"Message '%s' [%p] passed through %p%s%s%s in " FMT64U " usec",
-			msg.c_str(),&msg,h,
-			(name ? " '" : ""),(name ? name : ""),(name ? "'" : ""),tm);
-		}
-		if (hTrackTime && hTrackName) {
-		    NamedString* tracked = msg.getParam(trackParam());
-		    unsigned int start = hTrackPos - hTrackName.length();
-		    if (tracked && start < tracked->length()) {
-			if (0 == ::strncmp(tracked->c_str() + start,hTrackName.c_str(),hTrackName.length())) {
-			    String buf;
-			    buf.printf("#%u.%03u",(unsigned int)(tm / 1000),
-				(unsigned int)(tm % 1000));
-			    char c = (*tracked)[hTrackPos];
-			    if (!c)
-				*tracked << buf;
-			    else if (',' == c) // Message re-dispatched. New handler name added
-				tracked->insert(hTrackPos,buf,buf.length());
-			}
+	if (tm) {
+	    tm = Time::now() - tm;
+	    if (m_warnTime && tm > m_warnTime) {
+		lck.acquire(m_handlersLock);
+		const char* name = (c == m_changes) ? h->trackName().c_str() : 0;
+		Debug(DebugInfo,"Message '%s' [%p] passed through %p%s%s%s in " FMT64U " usec",
+		    msg.c_str(),&msg,h,
+		    (name ? " '" : ""),(name ? name : ""),(name ? "'" : ""),tm);
+	    }
+	    if (hTrackTime && hTrackName) {
+		NamedString* tracked = msg.getParam(trackParam());
+		unsigned int start = hTrackPos - hTrackName.length();
+		if (tracked && start < tracked->length()) {
+		    if (0 == ::strncmp(tracked->c_str() + start,hTrackName.c_str(),hTrackName.length())) {
+			String buf;
+			buf.printf("#%u.%03u",(unsigned int)(tm / 1000),
+			    (unsigned int)(tm % 1000));
+			char c = (*tracked)[hTrackPos];
+			if (!c)
+			    *tracked << buf;
+			else if (',' == c) // Message re-dispatched. New handler name added
+			    tracked->insert(hTrackPos,buf,buf.length());
 		    }
 		}
 	    }
+	}
 
-	    if (retv && !msg.broadcast())
-		break;
-	    lck.acquire(m_handlersLock);
-	    if (c == m_changes)
-		continue;
-	    // the handler list has changed - find again
-	    NDebug(DebugAll,"Rescanning handler list for '%s' [%p] at priority %u",
-		msg.c_str(),&msg,p);
-	    ObjList* l2 = &m_handlers;
-	    for (l = l2; l; l=l->next()) {
-		MessageHandler *mh = static_cast<MessageHandler*>(l->get());
-		if (!mh)
-		    continue;
-		if (mh == h)
-		    // exact match - silently continue where we left
-		    break;
-
-		// gone past last handler priority - exit with last handler
-		if ((mh->priority() > p) || ((mh->priority() == p) && (mh > h))) {
-		    Debug(DebugAll,"Handler list for '%s' [%p] changed, skipping from %p (%u) to %p (%u)",
-			msg.c_str(),&msg,h,p,mh,mh->priority());
-		    // l will advance in the outer for loop so use previous
-		    l = l2;
-		    break;
-		}
-		l2 = l;
-	    }
-	    if (!l)
-		break;
+	if (retv && !msg.broadcast())
+	    break;
+	lck.acquire(m_handlersLock);
+	if (c == m_changes && msg.hash() == hash)
+	    continue;
+	// the handler lists or the message name have changed - find again
+	NDebug(DebugAll,"Rescanning handler list for '%s' [%p] at priority %u",
+	    msg.c_str(),&msg,p);
+	hash = msg.hash();
+	idx = static_cast<MessageHandlerIndex*>(m_handlersIndex[msg]);
+	bool foundN = false;
+	bool foundA = false;
+	ln = skipHandlers(idx ? &idx->m_handlers : 0,h,p,foundN);
+	la = skipHandlers(&m_handlersNull,h,p,foundA);
+	if (!(hNull ? foundA : foundN)) {
+	    MessageHandler* mh = firstHandler(ln,la,false);
+	    if (mh)
+		Debug(DebugAll,"Handler list for '%s' [%p] changed, skipping from %p (%u) to %p (%u)",
+		    msg.c_str(),&msg,h,p,mh,mh->priority());
 	}
     }
     lck.drop();
@@ -542,6 +637,7 @@ bool MessageDispatcher::dispatch(Message& msg)
 	}
     }
 
+    ObjList* l;
     lck.acquire(m_hooksLock);
     if (m_hookHole && !m_hookCount) {
 	// compact the list, remove the holes
@@ -578,33 +674,98 @@ bool MessageDispatcher::dispatch(Message& msg)
     return retv;
 }
 
+// Append a message at the producers end of the queue
+// Producers are not locked against each other or against consumers
+void MessageDispatcher::pushMessage(Message* msg)
+{
+    msg->m_queueNext = 0;
+#ifdef YATOMIC_BUILTIN
+    __sync_synchronize();
+    Message* prev = __sync_lock_test_and_set(&m_msgHead,msg);
+#else
+    Message* prev = m_msgHead;
+    m_msgHead = msg;
+#endif
+    // the message becomes visible to consumers only after linking it
+    prev->m_queueNext = msg;
+}
+
+// Remove a message from the consumers end of the queue, m_messagesLock must be held
+// Returns NULL if empty or if a producer is still linking the next message
+Message* MessageDispatcher::popMessage()
+{
+    Message* tail = m_msgTail;
+    Message* next = tail->m_queueNext;
+    if (tail == m_msgStub) {
+	if (!next)
+	    return 0;
+	m_msgTail = tail = next;
+	next = next->m_queueNext;
+    }
+    if (next) {
+	m_msgTail = next;
+	return tail;
+    }
+    if (tail != m_msgHead)
+	return 0;
+    // tail is the last message, put back the placeholder so it can be removed
+    pushMessage(m_msgStub);
+    next = tail->m_queueNext;
+    if (!next)
+	return 0;
+    m_msgTail = next;
+    return tail;
+}
+
 bool MessageDispatcher::enqueue(Message* msg)
 {
-    WLock lck(m_messagesLock);
-    if (!msg || m_messages.find(msg))
+    // atomically mark the message as queued, reject it if it already was
+    if (!msg || msg->m_queued.preBitOr(1))
 	return false;
     if (m_traceTime)
 	msg->m_timeEnqueue = Time::now();
-    m_msgAppend = m_msgAppend->append(msg);
-    u_int64_t count = (++m_enqueueCount) - m_dequeueCount;
+    // count the message before publishing it so the dequeue count can
+    //  never get ahead, read that one first for the same reason
+    u_int64_t count = m_dequeueCount.valueAtomic();
+    count = (++m_enqueueCount) - count;
+#ifdef YATOMIC_BUILTIN
+    pushMessage(msg);
+#else
+    Lock lck(m_messagesLock);
+    pushMessage(msg);
+#endif
+#ifdef YATOMIC_BUILTIN
+    for (u_int64_t max = m_queuedMax; max < count; max = m_queuedMax)
+	if (__sync_bool_compare_and_swap(&m_queuedMax,max,count))
+	    break;
+#else
     if (m_queuedMax < count)
 	m_queuedMax = count;
+#endif
     return true;
 }
 
-bool MessageDispatcher::dequeueOne()
+Message* MessageDispatcher::dequeueMessage()
 {
-    WLock lck(m_messagesLock);
-    if (m_messages.next() == m_msgAppend)
-	m_msgAppend = &m_messages;
-    Message* msg = static_cast<Message *>(m_messages.remove(false));
+    Lock lck(m_messagesLock);
+    Message* msg = popMessage();
     if (!msg)
-	return false;
+	return 0;
     m_dequeueCount++;
     uint64_t age = Time::now() - msg->msgTime();
     if (age < 60000000)
 	m_msgAvgAge = (3 * m_msgAvgAge + age) >> 2;
     lck.drop();
+    msg->m_queueNext = 0;
+    msg->m_queued.preBitAnd(0);
+    return msg;
+}
+
+bool MessageDispatcher::dequeueOne()
+{
+    Message* msg = dequeueMessage();
+    if (!msg)
+	return false;
     dispatch(*msg);
     msg->destruct();
     return true;
@@ -618,8 +779,9 @@ void MessageDispatcher::dequeue()
 
 unsigned int MessageDispatcher::messageCount()
 {
-    RLock lck(m_messagesLock);
-    return (unsigned int)(m_enqueueCount - m_dequeueCount);
+    // dequeued messages are always counted as enqueued first
+    u_int64_t dequeued = m_dequeueCount.valueAtomic();
+    return (unsigned int)(m_enqueueCount.valueAtomic() - dequeued);
 }
 
 unsigned int MessageDispatcher::handlerCount()
@@ -636,11 +798,10 @@ unsigned int MessageDispatcher::postHookCount()
 
 void MessageDispatcher::getStats(u_int64_t& enqueued, u_int64_t& dequeued, u_int64_t& dispatched, u_int64_t& queueMax)
 {
-    RLock lck(m_messagesLock);
-    enqueued = m_enqueueCount;
-    dequeued = m_dequeueCount;
+    dequeued = m_dequeueCount.valueAtomic();
+    enqueued = m_enqueueCount.valueAtomic();
     queueMax = m_queuedMax;
-    lck.acquire(m_handlersLock);
+    RLock lck(m_handlersLock);
     dispatched = m_dispatchCount;
 }
 
@@ -20,6 +20,8 @@
 #include "yateclass.h"
 #include "yatexml.h"
 
+#include <string.h>
+
 using namespace TelEngine;
 
 static inline const String* validName(const String& str, String& tmp)
@@ -57,18 +59,124 @@ static inline ObjList* listCopyParam(ObjList& list, const NamedList& src, const
 }
 
 static inline ObjList* listAddSubParams(ObjList& list, const NamedList& src,
-    const String& name, char sep)
+    const String& name, char sep, unsigned int& added)
 {
     ObjList* dest = &list;
     for (const ObjList* o = src.paramList()->skipNull(); o; o = o->skipNext()) {
 	const NamedString* s = static_cast<const NamedString*>(o->get());
-	if (isNameSep(name,s->name(),sep))
+	if (isNameSep(name,s->name(),sep)) {
 	    dest = listAddParam(*dest,s->name(),*s);
+	    added++;
+	}
     }
     return dest;
 }
 
 
+namespace TelEngine {
+
+// Open addressing hash of parameter names. It holds the list entry of the
+//  first parameter having each name and the last entry of the list
+class NamedListPrivate
+{
+public:
+    inline NamedListPrivate()
+	: m_last(0), m_slots(0), m_mask(0), m_used(0)
+	{ }
+    inline ~NamedListPrivate()
+	{ delete[] m_slots; }
+    ObjList* find(const String& name) const;
+    void add(ObjList* item);
+    void build(ObjList& list);
+    ObjList* m_last;
+private:
+    struct Slot {
+	unsigned int hash;
+	ObjList* item;
+    };
+    void alloc(unsigned int size);
+    void insert(unsigned int hash, ObjList* item);
+    Slot* m_slots;
+    unsigned int m_mask;
+    unsigned int m_used;
+};
+
+}; // namespace TelEngine
+
+// Number of parameters that triggers building the index, 0 to disable it
+static unsigned int s_indexMin = 16;
+
+ObjList* NamedListPrivate::find(const String& name) const
+{
+    unsigned int hash = name.hash();
+    for (unsigned int i = hash & m_mask; ; i = (i + 1) & m_mask) {
+	const Slot& s = m_slots[i];
+	if (!s.item)
+	    return 0;
+	if (s.hash == hash && static_cast<const NamedString*>(s.item->get())->name() == name)
+	    return s.item;
+    }
+}
+
+// Index a new list entry unless an earlier one has the same name
+void NamedListPrivate::add(ObjList* item)
+{
+    const String& name = static_cast<const NamedString*>(item->get())->name();
+    unsigned int hash = name.hash();
+    unsigned int i = hash & m_mask;
+    for (; m_slots[i].item; i = (i + 1) & m_mask) {
+	const Slot& s = m_slots[i];
+	if (s.hash == hash && static_cast<const NamedString*>(s.item->get())->name() == name)
+	    return;
+    }
+    m_slots[i].hash = hash;
+    m_slots[i].item = item;
+    // keep the table at most half full
+    if (2 * ++m_used <= m_mask)
+	return;
+    Slot* old = m_slots;
+    unsigned int size = m_mask + 1;
+    alloc(2 * size);
+    for (unsigned int j = 0; j < size; j++)
+	if (old[j].item)
+	    insert(old[j].hash,old[j].item);
+    delete[] old;
+}
+
+void NamedListPrivate::build(ObjList& list)
+{
+    unsigned int n = list.count();
+    unsigned int size = 32;
+    while (size < 2 * n)
+	size *= 2;
+    delete[] m_slots;
+    alloc(size);
+    m_used = 0;
+    m_last = &list;
+    for (ObjList* o = &list; o; o = o->next()) {
+	m_last = o;
+	if (o->get())
+	    add(o);
+    }
+}
+
+void NamedListPrivate::alloc(unsigned int size)
+{
+    m_slots = new Slot[size];
+    ::memset(m_slots,0,size * sizeof(Slot));
+    m_mask = size - 1;
+}
+
+inline void NamedListPrivate::insert(unsigned int hash, ObjList* item)
+{
+    unsigned int i = hash & m_mask;
+    while (m_slots[i].item)
+	i = (i + 1) & m_mask;
+    m_slots[i].hash = hash;
+    m_slots[i].item = item;
+}
+
+
 static const NamedList s_empty("");
 
 const NamedList& NamedList::empty()
@@ -77,22 +185,83 @@ const NamedList& NamedList::empty()
 }
 
 NamedList::NamedList(const char* name)
-    : String(name)
+    : String(name), m_index(0), m_indexCheck(0)
 {
 }
 
 NamedList::NamedList(const NamedList& original)
-    : String(original)
+    : String(original), m_index(0), m_indexCheck(0)
 {
     copyParams(false,original);
 }
 
 NamedList::NamedList(const char* name, const NamedList& original, const String& prefix)
-    : String(name)
+    : String(name), m_index(0), m_indexCheck(0)
 {
     copySubParams(original,prefix);
 }
 
+NamedList::~NamedList()
+{
+    delete m_index;
+}
+
+unsigned int NamedList::indexThreshold()
+{
+    return s_indexMin;
+}
+
+void NamedList::indexThreshold(unsigned int count)
+{
+    s_indexMin = count;
+}
+
+// Drop the name index after the list was changed directly
+void NamedList::resetIndex()
+{
+    if (!m_index)
+	return;
+    delete m_index;
+    m_index = 0;
+    // check again on first parameter added
+    m_indexCheck = s_indexMin;
+}
+
+// Account for parameters appended without the index, build it once enough
+//  parameters are present
+void NamedList::checkIndex(unsigned int added)
+{
+    if (m_index || !s_indexMin)
+	return;
+    m_indexCheck += added;
+    if (m_indexCheck < s_indexMin)
+	return;
+    m_indexCheck = 0;
+    if (m_params.count() < s_indexMin)
+	return;
+    m_index = new NamedListPrivate;
+    m_index->build(m_params);
+}
+
+// Parameters were removed, entries may have moved inside the list
+void NamedList::changedIndex()
+{
+    if (m_index)
+	m_index->build(m_params);
+}
+
+ObjList* NamedList::appendParam(NamedString* param)
+{
+    if (!m_index) {
+	ObjList* o = m_params.append(param);
+	checkIndex(1);
+	return o;
+    }
+    m_index->m_last = m_index->m_last->append(param);
+    m_index->add(m_index->m_last);
+    return m_index->m_last;
+}
+
 NamedList& NamedList::operator=(const NamedList& value)
 {
     String::operator=(value);
@@ -112,7 +281,7 @@ NamedList& NamedList::addParam(NamedString* param)
     XDebug(DebugInfo,"NamedList::addParam(%p) [\"%s\",\"%s\"]",
         param,(param ? param->name().c_str() : ""),TelEngine::c_safe(param));
     if (param)
-	m_params.append(param);
+	appendParam(param);
     return *this;
 }
 
@@ -120,22 +289,25 @@ NamedList& NamedList::addParam(const char* name, const char* value, bool emptyOK
 {
     XDebug(DebugInfo,"NamedList::addParam(\"%s\",\"%s\",%s)",name,value,String::boolText(emptyOK));
     if (emptyOK || !TelEngine::null(value))
-	m_params.append(new NamedString(name, value, -1, prefix));
+	appendParam(new NamedString(name, value, -1, prefix));
     return *this;
 }
 
-static inline void nlClearParam(const String& name, ObjList* lst)
+static inline bool nlClearParam(const String& name, ObjList* lst)
 {
+    bool removed = false;
     lst = lst ? lst->skipNull() : 0;
     while (lst) {
         NamedString* ns = static_cast<NamedString*>(lst->get());
         if (ns->name() == name) {
 	    lst->remove();
 	    lst = lst->skipNull();
+	    removed = true;
 	}
 	else
 	    lst = lst->skipNext();
     }
+    return removed;
 }
 
 NamedList& NamedList::setParam(NamedString* param, bool clearOther)
@@ -143,6 +315,17 @@ NamedList& NamedList::setParam(NamedString* param, bool clearOther)
     XDebug(DebugAll,"NamedList::setParam(%p) [%p]",param,this);
     if (!param)
 	return *this;
+    if (m_index) {
+	ObjList* o = m_index->find(param->name());
+	if (!o)
+	    appendParam(param);
+	else {
+	    o->set(param);
+	    if (clearOther && nlClearParam(param->name(),o->skipNext()))
+		changedIndex();
+	}
+	return *this;
+    }
     ObjList* o = m_params.skipNull();
     while (o) {
         NamedString* s = static_cast<NamedString*>(o->get());
@@ -162,14 +345,23 @@ NamedList& NamedList::setParam(NamedString* param, bool clearOther)
 	o->append(param);
     else
 	m_params.append(param);
+    checkIndex(1);
     return *this;
 }
 
-static inline NamedString* nlSetParamCreate(NamedList& list, const String& name, bool clearOther)
+NamedString* NamedList::setParamCreate(const String& name, bool clearOther)
 {
-    ObjList* append = list.paramList()->skipNull();
+    if (m_index) {
+	ObjList* o = m_index->find(name);
+	if (!o)
+	    return static_cast<NamedString*>(appendParam(new NamedString(name))->get());
+	if (clearOther && nlClearParam(name,o->skipNext()))
+	    changedIndex();
+	return static_cast<NamedString*>(o->get());
+    }
+    ObjList* append = m_params.skipNull();
     if (!append)
-	return static_cast<NamedString*>(list.paramList()->append(new NamedString(name))->get());
+	return static_cast<NamedString*>(appendParam(new NamedString(name))->get());
     while (true) {
         NamedString* ns = static_cast<NamedString*>(append->get());
         if (ns->name() == name) {
@@ -182,7 +374,9 @@ static inline NamedString* nlSetParamCreate(NamedList& list, const String& name,
 	    break;
 	append = next;
     }
-    return static_cast<NamedString*>(append->append(new NamedString(name))->get());
+    NamedString* ns = static_cast<NamedString*>(append->append(new NamedString(name))->get());
+    checkIndex(1);
+    return ns;
 }
 
 NamedList& NamedList::setParam(const String& name, unsigned int flags, const TokenDict* tokens,
@@ -190,7 +384,7 @@ NamedList& NamedList::setParam(const String& name, unsigned int flags, const Tok
 {
     XDebug(DebugAll,"NamedList::setParam(%s) flags=%u tokens=%p unkFlag=%u [%p]",
 	name.safe(),flags,tokens,unknownFlag,this);
-    NamedString* ns = nlSetParamCreate(*this,name,clearOther);
+    NamedString* ns = setParamCreate(name,clearOther);
     *static_cast<String*>(ns) = "";
     ns->decodeFlags(flags,tokens,unknownFlag);
     return *this;
@@ -201,7 +395,7 @@ NamedList& NamedList::setParam(const String& name, uint64_t flags, const TokenDi
 {
     XDebug(DebugAll,"NamedList::setParam(%s) flags64=" FMT64U " tokens=%p unkFlag=%u [%p]",
 	name.safe(),flags,tokens,unknownFlag,this);
-    NamedString* ns = nlSetParamCreate(*this,name,clearOther);
+    NamedString* ns = setParamCreate(name,clearOther);
     *static_cast<String*>(ns) = "";
     ns->decodeFlags(flags,tokens,unknownFlag);
     return *this;
@@ -211,13 +405,13 @@ NamedList& NamedList::setParamHex(const String& name, const void* buf, unsigned
     bool upCase, bool clearOther)
 {
     XDebug(DebugAll,"NamedList::setParamHex(%s,%p,%u,%c) [%p]",name.safe(),buf,len,sep,this);
-    NamedString* ns = nlSetParamCreate(*this,name,clearOther);
+    NamedString* ns = setParamCreate(name,clearOther);
     ns->hexify((void*)buf,len,sep,upCase);
     return *this;
 }
 
 #define nlSetParamValue(name,value,clearOther) { \
-    NamedString* ns = nlSetParamCreate(*this,name,clearOther); \
+    NamedString* ns = setParamCreate(name,clearOther); \
     *static_cast<String*>(ns) = value; \
     return *this; \
 }
@@ -261,7 +455,7 @@ NamedList& NamedList::setParam(const String& name, double value, bool clearOther
 NamedString& NamedList::setParamRet(const String& name, const char* value, bool clearOther)
 {
     XDebug(DebugAll,"NamedList::setParamRet(%s,%s) [%p]",name.safe(),TelEngine::c_safe(value),this);
-    NamedString* ns = nlSetParamCreate(*this,name,clearOther);
+    NamedString* ns = setParamCreate(name,clearOther);
     ns->assign(value);
     return *ns;
 }
@@ -270,12 +464,17 @@ NamedList& NamedList::clearParam(const String& name, char childSep, const String
 {
     XDebug(DebugInfo,"NamedList::clearParam(\"%s\",'%.1s',(%p)'%s')",
 	name.c_str(),&childSep,value,TelEngine::c_safe(value));
+    if (m_index && !childSep && !m_index->find(name))
+	return *this;
     ObjList* p = &m_params;
+    bool removed = false;
     if (childSep) {
 	while (p) {
 	    NamedString* s = static_cast<NamedString*>(p->get());
-	    if (s && isNameSep(name,s->name(),childSep) && (!value || value->matches(*s)))
+	    if (s && isNameSep(name,s->name(),childSep) && (!value || value->matches(*s))) {
 		p->remove();
+		removed = true;
+	    }
 	    else
 		p = p->next();
 	}
@@ -283,14 +482,18 @@ NamedList& NamedList::clearParam(const String& name, char childSep, const String
     else if (value) {
 	while (p) {
 	    NamedString* s = static_cast<NamedString*>(p->get());
-	    if (s && (s->name() == name) && value->matches(*s))
+	    if (s && (s->name() == name) && value->matches(*s)) {
 		p->remove();
+		removed = true;
+	    }
 	    else
 		p = p->next();
 	}
     }
     else
-	nlClearParam(name,p);
+	removed = nlClearParam(name,p);
+    if (removed)
+	changedIndex();
     return *this;
 }
 
@@ -299,13 +502,18 @@ NamedList& NamedList::clearParamMatch(const Regexp& name, const String* value)
     XDebug(DebugInfo,"NamedList::clearParamMatch(\"%s\",(%p)'%s')",
 	name.c_str(),value,TelEngine::c_safe(value));
     ObjList* p = &m_params;
+    bool removed = false;
     while (p) {
 	NamedString* s = static_cast<NamedString*>(p->get());
-	if (s && name.matches(s->name()) && (!value || value->matches(*s)))
+	if (s && name.matches(s->name()) && (!value || value->matches(*s))) {
 	    p->remove();
+	    removed = true;
+	}
 	else
 	    p = p->next();
     }
+    if (removed)
+	changedIndex();
     return *this;
 }
 
@@ -315,8 +523,10 @@ NamedList& NamedList::clearParam(NamedString* param, bool delParam)
     if (!param)
 	return *this;
     ObjList* o = m_params.find(param);
-    if (o)
+    if (o) {
 	o->remove(delParam);
+	changedIndex();
+    }
     XDebug(DebugInfo,"NamedList::clearParam(%p) found=%p",param,o);
     return *this;
 }
@@ -332,16 +542,19 @@ NamedList& NamedList::copyParam(const NamedList& original, const String& name, c
 	    if (replace)
 		setParam(name,*s);
 	    else
-		listAddParam(m_params,name,*s);
+		appendParam(new NamedString(name,*s));
 	}
 	else if (replace && clearMissing)
 	    clearParam(name);
     }
-    else if (!replace)
-	listAddSubParams(m_params,original,name,childSep);
-    else if (clearMissing) {
-	clearParam(name,childSep);
-	listAddSubParams(m_params,original,name,childSep);
+    else if (!replace || clearMissing) {
+	if (replace)
+	    clearParam(name,childSep);
+	for (const ObjList* o = original.paramList()->skipNull(); o; o = o->skipNext()) {
+	    const NamedString* ns = static_cast<const NamedString*>(o->get());
+	    if (isNameSep(name,ns->name(),childSep))
+		appendParam(new NamedString(ns->name(),*ns));
+	}
     }
     else {
 	// Replace existing, append all other
@@ -359,36 +572,24 @@ NamedList& NamedList::copyParams(bool replace, const NamedList& original, const
     XDebug(DebugInfo,"NamedList::copyParams(%s,%p,%s) [%p]",
 	String::boolText(replace),&original,TelEngine::c_safe(addPrefix),this);
     ObjList* append = replace ? 0 : &m_params;
+    unsigned int added = 0;
     if (addPrefix && !*addPrefix)
 	addPrefix = 0;
     for (const ObjList* l = original.m_params.skipNull(); l; l = l->skipNext()) {
 	const NamedString* p = static_cast<const NamedString*>(l->get());
-	if (append)
-	    append = append->append(new NamedString(p->name(),*p,p->length(),addPrefix));
+	if (append) {
+	    NamedString* ns = new NamedString(p->name(),*p,p->length(),addPrefix);
+	    append = m_index ? appendParam(ns) : append->append(ns);
+	    added++;
+	}
 	else if (!addPrefix)
 	    setParam(p->name(),*p);
 	else {
-	    ObjList* o = m_params.skipNull();
-	    while (o) {
-		ObjList* next = 0;
-		NamedString* s = static_cast<NamedString*>(o->get());
-		if (s->name() == p->name()) {
-		    o->remove();
-		    next = o->skipNull();
-		}
-		else
-		    next = o->skipNext();
-		if (!next)
-		    break;
-		o = next;
-	    }
-	    NamedString* ns = new NamedString(p->name(),*p,p->length(),addPrefix);
-	    if (o)
-		o->append(ns);
-	    else
-		m_params.append(ns);
+	    clearParam(p->name());
+	    appendParam(new NamedString(p->name(),*p,p->length(),addPrefix));
 	}
     }
+    checkIndex(added);
     return *this;
 }
 
@@ -401,6 +602,7 @@ NamedList& NamedList::copyParams(const NamedList& original, ObjList* list, char
 	return *this;
     String tmp;
     ObjList* append = replace ? 0 : &m_params;
+    unsigned int added = 0;
     for (; list; list = list->next()) {
 	GenObject* obj = list->get();
 	if (!obj)
@@ -410,14 +612,19 @@ NamedList& NamedList::copyParams(const NamedList& original, ObjList* list, char
 	    continue;
 	if (!append)
 	    copyParam(original,*name,childSep,true,clearMissing);
+	else if (m_index)
+	    copyParam(original,*name,childSep,false);
 	else if (!childSep) {
 	    const NamedString* ns = original.getParam(*name);
-	    if (ns)
+	    if (ns) {
 		append = listAddParam(*append,*name,*ns);
+		added++;
+	    }
 	}
 	else
-	    append = listAddSubParams(*append,original,*name,childSep);
+	    append = listAddSubParams(*append,original,*name,childSep,added);
     }
+    checkIndex(added);
     return *this;
 }
 
@@ -444,20 +651,25 @@ NamedList& NamedList::copySubParams(const NamedList& original, const String& pre
     if (prefix) {
 	unsigned int offs = skipPrefix ? prefix.length() : 0;
 	ObjList* dest = replace ? 0 : &m_params;
+	unsigned int added = 0;
 	for (const ObjList* l = original.m_params.skipNull(); l; l = l->skipNext()) {
 	    const NamedString* s = static_cast<const NamedString*>(l->get());
 	    if (s->name().startsWith(prefix)) {
 		const char* name = s->name().c_str() + offs;
 		if (!*name)
 		    continue;
-		if (dest)
-		    dest = dest->append(new NamedString(name,*s));
+		if (dest) {
+		    NamedString* ns = new NamedString(name,*s);
+		    dest = m_index ? appendParam(ns) : dest->append(ns);
+		    added++;
+		}
 		else if (offs)
 		    setParam(name,*s);
 		else
 		    setParam(s->name(),*s);
 	    }
 	}
+	checkIndex(added);
     }
     return *this;
 }
@@ -565,6 +777,10 @@ int NamedList::getIndex(const String& name) const
 NamedString* NamedList::getParam(const String& name) const
 {
     XDebug(DebugInfo,"NamedList::getParam(\"%s\")",name.c_str());
+    if (m_index) {
+	ObjList* o = m_index->find(name);
+	return o ? static_cast<NamedString*>(o->get()) : 0;
+    }
     const ObjList *p = m_params.skipNull();
     for (; p; p=p->skipNext()) {
         NamedString *s = static_cast<NamedString *>(p->get());
@@ -699,6 +915,220 @@ int NamedList::replaceParams(String& str, bool sqlEsc, char extraEsc) const
     return cnt;
 }
 
+
+namespace { // anonymous
+
+// One literal part of a template optionally followed by a parameter reference
+class ParamTemplateItem : public String
+{
+public:
+    inline ParamTemplateItem(const String& text)
+	: String(text), m_param(false), m_escape(ParamTemplate::EscNone), m_extraEsc(0)
+	{ }
+    bool m_param;
+    String m_name;
+    String m_default;
+    int m_escape;
+    char m_extraEsc;
+};
+
+}; // anonymous namespace
+
+ParamTemplate::ParamTemplate(const char* value, int escape, char extraEsc)
+    : String(value),
+      m_params(0), m_malformed(false), m_escape(escape), m_extraEsc(extraEsc)
+{
+    parse();
+}
+
+ParamTemplate::ParamTemplate(const ParamTemplate& original)
+    : String(original),
+      m_params(0), m_malformed(false), m_escape(original.m_escape), m_extraEsc(original.m_extraEsc)
+{
+    parse();
+}
+
+ParamTemplate::~ParamTemplate()
+{
+}
+
+ParamTemplate& ParamTemplate::operator=(const ParamTemplate& original)
+{
+    m_escape = original.m_escape;
+    m_extraEsc = original.m_extraEsc;
+    String::operator=(original);
+    return *this;
+}
+
+void ParamTemplate::changed()
+{
+    // length must be updated before parsing
+    String::changed();
+    parse();
+}
+
+void ParamTemplate::setEscape(int escape, char extraEsc)
+{
+    m_escape = escape;
+    m_extraEsc = extraEsc;
+    for (ObjList* o = m_items.skipNull(); o; o = o->skipNext()) {
+	ParamTemplateItem* item = static_cast<ParamTemplateItem*>(o->get());
+	item->m_escape = escape;
+	item->m_extraEsc = extraEsc;
+    }
+}
+
+bool ParamTemplate::setEscape(unsigned int index, int escape, char extraEsc)
+{
+    for (ObjList* o = m_items.skipNull(); o; o = o->skipNext()) {
+	ParamTemplateItem* item = static_cast<ParamTemplateItem*>(o->get());
+	if (!item->m_param || index--)
+	    continue;
+	item->m_escape = escape;
+	item->m_extraEsc = extraEsc;
+	return true;
+    }
+    return false;
+}
+
+// Split the text in the same way replaceParams() scans it
+void ParamTemplate::parse()
+{
+    m_items.clear();
+    m_params = 0;
+    m_malformed = false;
+    ObjList* a = &m_items;
+    int p0 = 0;
+    int p1;
+    while ((p1 = find("${",p0)) >= 0) {
+	int p2 = find('}',p1+2);
+	if (p2 < 0) {
+	    m_malformed = true;
+	    break;
+	}
+	ParamTemplateItem* item = new ParamTemplateItem(substr(p0,p1-p0));
+	item->m_param = true;
+	item->m_escape = m_escape;
+	item->m_extraEsc = m_extraEsc;
+	item->m_name = substr(p1+2,p2-p1-2);
+	item->m_name.trimBlanks();
+	int pq = item->m_name.find('$');
+	if (pq >= 0) {
+	    // param is in ${<name>$<default>} format
+	    item->m_default = item->m_name.substr(pq+1).trimBlanks();
+	    item->m_name = item->m_name.substr(0,pq).trimBlanks();
+	}
+	a = a->append(item);
+	m_params++;
+	p0 = p2 + 1;
+    }
+    if (p0 < (int)length())
+	a->append(new ParamTemplateItem(substr(p0)));
+}
+
+// Append a parameter value escaped as the template item requires
+static void appendValue(String& str, const ParamTemplateItem* item, const String* ns)
+{
+    switch (item->m_escape) {
+	case ParamTemplate::EscSql:
+	    {
+		const DataBlock* data = 0;
+		if (ns->null()) {
+		    NamedPointer* np = YOBJECT(NamedPointer,ns);
+		    if (np)
+			data = YOBJECT(DataBlock,np->userData());
+		}
+		if (data)
+		    str += data->sqlEscape(item->m_extraEsc);
+		else
+		    str += ns->sqlEscape(item->m_extraEsc);
+	    }
+	    break;
+	case ParamTemplate::EscCsv:
+	    for (const char* s = ns->c_str(); s && *s; ) {
+		const char* q = ::strchr(s,'"');
+		if (!q) {
+		    str += s;
+		    break;
+		}
+		str.append(s,q - s + 1);
+		str += '"';
+		s = q + 1;
+	    }
+	    break;
+	default:
+	    str += *ns;
+    }
+}
+
+int ParamTemplate::render(const NamedList& list, String& str) const
+{
+    for (ObjList* o = m_items.skipNull(); o; o = o->skipNext()) {
+	const ParamTemplateItem* item = static_cast<const ParamTemplateItem*>(o->get());
+	str += *item;
+	if (!item->m_param)
+	    continue;
+	const String* ns = list.getParam(item->m_name);
+	if (ns)
+	    appendValue(str,item,ns);
+	else
+	    str += item->m_default;
+    }
+    return m_malformed ? -1 : (int)m_params;
+}
+
+int ParamTemplate::bind(const NamedList& list, String& query, NamedList& args) const
+{
+    unsigned int n = 0;
+    bool unquote = false;
+    for (ObjList* o = m_items.skipNull(); o; o = o->skipNext()) {
+	const ParamTemplateItem* item = static_cast<const ParamTemplateItem*>(o->get());
+	const char* text = item->c_str();
+	unsigned int len = item->length();
+	if (unquote) {
+	    // skip the closing quote of the previous reference
+	    text++;
+	    len--;
+	}
+	unquote = false;
+	if (item->m_param && len && (text[len - 1] == '\'')) {
+	    // the reference is bound only if it makes up the whole literal
+	    ObjList* next = o->skipNext();
+	    const String* s = next ? static_cast<const String*>(next->get()) : 0;
+	    unquote = s && s->startsWith("'");
+	}
+	if (unquote) {
+	    query.append(text,len - 1);
+	    const String* ns = list.getParam(item->m_name);
+	    String name("arg.");
+	    name << ++n;
+	    if (ns) {
+		NamedPointer* np = YOBJECT(NamedPointer,ns);
+		const DataBlock* data = np ? YOBJECT(DataBlock,np->userData()) : 0;
+		if (data)
+		    args.setParam(new NamedPointer(name,new DataBlock(*data),*ns));
+		else
+		    args.setParam(name,*ns);
+	    }
+	    else
+		args.setParam(name,item->m_default);
+	    query << "$" << n;
+	    continue;
+	}
+	if (len)
+	    query.append(text,len);
+	if (!item->m_param)
+	    continue;
+	const String* ns = list.getParam(item->m_name);
+	if (ns)
+	    appendValue(query,item,ns);
+	else
+	    query += item->m_default;
+    }
+    args.setParam("args",String(n));
+    return m_malformed ? -1 : (int)n;
+}
+
 NamedList& NamedList::moveParamsReplace(NamedList& dest, bool replaceAllExisting)
 {
     NamedString* mark = new NamedString("");
@@ -2550,6 +2550,36 @@ bool Regexp::isCaseInsensitive() const
     return (m_flags & REG_ICASE) != 0;
 }
 
+bool Regexp::literalPrefix(String& prefix) const
+{
+    prefix.clear();
+    const char* s = c_str();
+    if (!s || (*s != '^'))
+	return false;
+    // any alternative may bypass the prefix
+    if (::strchr(s,'|'))
+	return false;
+    bool ext = isExtended();
+    bool icase = isCaseInsensitive();
+    const char* start = ++s;
+    int len = 0;
+    for (;; s++, len++) {
+	char c = *s;
+	// only characters that stand for themselves in both syntaxes
+	if ((c >= '0' && c <= '9') || (c && ::strchr("#@_-:/,;=%!~&",c)))
+	    continue;
+	if (!icase && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')))
+	    continue;
+	break;
+    }
+    // a quantifier makes the last literal optional or repeated
+    if (len && ((*s == '*') || (ext && *s && ::strchr("?+{",*s))
+	    || (!ext && (s[0] == '\\') && s[1] && ::strchr("?+{",s[1]))))
+	len--;
+    prefix.assign(start,len);
+    return true;
+}
+
 
 NamedString::NamedString(const char* name, const char* value, int len,
     const char* namePrefix, int nameLen)
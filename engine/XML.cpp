@@ -2297,7 +2297,8 @@ bool XmlElement::setXmlns(const String& name, bool addAttr, const String& value)
 void XmlElement::replaceParams(const NamedList& params)
 {
     m_children.replaceParams(params);
-    for (ObjList* o = m_element.paramList()->skipNull(); o; o = o->skipNext())
+    const NamedList& attrs = m_element;
+    for (const ObjList* o = attrs.paramList()->skipNull(); o; o = o->skipNext())
 	params.replaceParams(*static_cast<String*>(o->get()));
 }
 
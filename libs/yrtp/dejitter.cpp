@@ -19,6 +19,7 @@
  */
 
 #include <yatertp.h>
+#include <string.h>
 
 using namespace TelEngine;
 
@@ -54,7 +55,8 @@ RTPDejitter::RTPDejitter(RTPReceiver* receiver, unsigned int mindelay, unsigned
     DebugEnabler* dbg, const char* traceId)
     : RTPProcessor(dbg,traceId),
       m_receiver(receiver), m_minDelay(mindelay), m_maxDelay(maxdelay),
-      m_headStamp(0), m_tailStamp(0), m_headTime(0), m_sampRate(125000), m_fastRate(10)
+      m_sampRate(125000), m_fastRate(10), m_late(0), m_dropped(0), m_reordered(0),
+      m_headStamp(0), m_tailStamp(0), m_headTime(0)
 {
     if (m_maxDelay > 1000000)
 	m_maxDelay = 1000000;
@@ -77,6 +79,47 @@ void RTPDejitter::clear()
     m_headStamp = m_tailStamp = 0;
 }
 
+void RTPDejitter::stats(NamedList& stat) const
+{
+    stat.setParam("jitterlate",String(m_late));
+    stat.setParam("jitterdropped",String(m_dropped));
+    stat.setParam("jitterreordered",String(m_reordered));
+}
+
+void RTPDejitter::lostPackets(unsigned int count)
+{
+    if (m_receiver)
+	m_receiver->m_ioLostPkt += count;
+}
+
+// Feed the time per sample estimator, big corrections are applied faster
+//  while the first few measurements come in
+void RTPDejitter::updateRate(int64_t rate)
+{
+    if (rate <= 0)
+	return;
+    if (m_sampRate) {
+	if (m_fastRate) {
+	    m_fastRate--;
+	    rate = (7 * m_sampRate + rate) >> 3;
+	}
+	else
+	    rate = (31 * m_sampRate + rate) >> 5;
+    }
+    if (rate > 150000)
+	rate = 150000; // 6.67 kHz
+    else if (rate < 20000)
+	rate = 20000; // 50 kHz
+    m_sampRate = rate;
+    XDebug(dbg(),DebugAll,"Time per sample " FMT64, rate);
+}
+
+bool RTPDejitter::rtpRecvSeq(bool marker, int payload, unsigned int timestamp,
+    u_int16_t seq, const void* data, int len)
+{
+    return rtpRecv(marker,payload,timestamp,data,len);
+}
+
 bool RTPDejitter::rtpRecv(bool marker, int payload, unsigned int timestamp, const void* data, int len)
 {
     u_int64_t when = 0;
@@ -90,28 +133,12 @@ bool RTPDejitter::rtpRecv(bool marker, int payload, unsigned int timestamp, cons
 	else if (dTs < 0) {
 	    DDebug(dbg(),DebugNote,"Dejitter dropping TS %u, last delivered was %u [%p]",
 		timestamp,m_headStamp,this);
+	    m_late++;
 	    return false;
 	}
 	u_int64_t now = Time::now();
-	int64_t rate = 1000 * (now - m_headTime) / dTs;
-	if (rate > 0) {
-	    if (m_sampRate) {
-		if (m_fastRate) {
-		    m_fastRate--;
-		    rate = (7 * m_sampRate + rate) >> 3;
-		}
-		else
-		    rate = (31 * m_sampRate + rate) >> 5;
-	    }
-	    if (rate > 150000)
-		rate = 150000; // 6.67 kHz
-	    else if (rate < 20000)
-		rate = 20000; // 50 kHz
-	    m_sampRate = rate;
-	    XDebug(dbg(),DebugAll,"Time per sample " FMT64, rate);
-	}
-	else
-	    rate = m_sampRate;
+	updateRate(1000 * (int64_t)(now - m_headTime) / dTs);
+	int64_t rate = m_sampRate;
 	if (rate > 0)
 	    when = m_headTime + (dTs * rate / 1000) + m_minDelay;
 	else
@@ -123,6 +150,7 @@ bool RTPDejitter::rtpRecv(bool marker, int payload, unsigned int timestamp, cons
 		insert = true;
 	    else if (when > now + m_maxDelay) {
 		DDebug(dbg(),DebugNote,"Packet with TS %u falls after max buffer [%p]",timestamp,this);
+		m_dropped++;
 		return false;
 	    }
 	}
@@ -131,6 +159,7 @@ bool RTPDejitter::rtpRecv(bool marker, int payload, unsigned int timestamp, cons
 	if (m_tailStamp && ((int)(timestamp - m_tailStamp)) < 0) {
 	    // until we get some statistics don't attempt to reorder packets
 	    DDebug(dbg(),DebugNote,"Dejitter got TS %u while last queued was %u [%p]",timestamp,m_tailStamp,this);
+	    m_late++;
 	    return false;
 	}
 	// we got no packets out yet so use a fixed interval
@@ -143,13 +172,16 @@ bool RTPDejitter::rtpRecv(bool marker, int payload, unsigned int timestamp, cons
 	    if (pkt->timestamp() == timestamp)
 		return true;
 	    if (pkt->timestamp() > timestamp && pkt->scheduled() > when) {
+		m_reordered++;
 		l->insert(new RTPDelayedData(when,marker,payload,timestamp,data,len));
+		tickAt(static_cast<RTPDelayedData*>(m_packets.get())->scheduled());
 		return true;
 	    }
 	}
     }
     m_tailStamp = timestamp;
     m_packets.append(new RTPDelayedData(when,marker,payload,timestamp,data,len));
+    tickAt(static_cast<RTPDelayedData*>(m_packets.get())->scheduled());
     return true;
 }
 
@@ -160,10 +192,14 @@ void RTPDejitter::timerTick(const Time& when)
 	m_tailStamp = 0;
 	if (m_headStamp && (m_headTime + m_maxDelay < when))
 	    m_headStamp = 0;
+	// sleep until the last delivered timestamp expires or a packet is queued
+	tickAt(m_headStamp ? (m_headTime + m_maxDelay + 1) : (when + m_maxDelay));
 	return;
     }
-    if (packet->scheduled() > when)
+    if (packet->scheduled() > when) {
+	tickAt(packet->scheduled());
 	return;
+    }
     m_packets.remove(packet,false);
     // remember the last delivered
     m_headStamp = packet->timestamp();
@@ -181,9 +217,257 @@ void RTPDejitter::timerTick(const Time& when)
 	m_packets.remove(packet,true);
 	count++;
     }
+    m_dropped += count;
     if (count)
 	TraceDebug(m_traceId,dbg(),(count > 1) ? DebugMild : DebugNote,
 	    "Dropped %u delayed packet%s from buffer [%p]",count,((count > 1) ? "s" : ""),this);
+    tickAt(packet ? packet->scheduled() : (m_headTime + m_maxDelay + 1));
+}
+
+
+namespace { // anonymous
+
+// One packet position in the ring jitter buffer
+class RingSlot
+{
+public:
+    u_int64_t m_scheduled;
+    unsigned int m_timestamp;
+    int m_payload;
+    int m_length;
+    u_int16_t m_seq;
+    bool m_used;
+    bool m_marker;
+};
+
+}; // anonymous namespace
+
+// Ring size limits in packets
+#define RING_MIN 16
+#define RING_MAX 256
+// Initial space per packet, grows if larger packets are received
+#define SLOT_SIZE 320
+
+RTPRingDejitter::RTPRingDejitter(RTPReceiver* receiver, unsigned int mindelay, unsigned int maxdelay,
+    DebugEnabler* dbg, const char* traceId)
+    : RTPDejitter(receiver,mindelay,maxdelay,dbg,traceId),
+      m_mask(0), m_slotSize(0), m_count(0), m_started(false),
+      m_headSeq(0), m_tailSeq(0), m_delivered(false), m_lastStamp(0), m_lastPayload(-1),
+      m_baseSet(false), m_baseStamp(0), m_baseTime(0), m_arrStamp(0), m_arrTime(0),
+      m_transit(0), m_jitter(0), m_delay(m_minDelay), m_lost(0), m_concealed(0)
+{
+    // enough room for the maximum delay of 10ms packets
+    unsigned int size = RING_MIN;
+    while ((size < RING_MAX) && (size * 10000 < m_maxDelay))
+	size <<= 1;
+    m_mask = size - 1;
+    m_slots.assign(0,size * sizeof(RingSlot));
+    resize(SLOT_SIZE);
+}
+
+RTPRingDejitter::~RTPRingDejitter()
+{
+    DDebug(dbg(),DebugInfo,"Ring dejitter destroyed with %u packets [%p]",m_count,this);
+}
+
+// Grow the space of each slot keeping the queued packets
+void RTPRingDejitter::resize(unsigned int slotSize)
+{
+    DataBlock data(0,(m_mask + 1) * slotSize);
+    RingSlot* slots = static_cast<RingSlot*>(m_slots.data());
+    for (unsigned int i = 0; m_count && i <= m_mask; i++) {
+	if (slots[i].m_used)
+	    ::memcpy(data.data(i * slotSize),m_data.data(i * m_slotSize),slots[i].m_length);
+    }
+    // take over the new buffer without copying it again
+    m_data.assign(data.data(),data.length(),false);
+    data.clear(false);
+    m_slotSize = slotSize;
+}
+
+void RTPRingDejitter::clear()
+{
+    RingSlot* slots = static_cast<RingSlot*>(m_slots.data());
+    for (unsigned int i = 0; i <= m_mask; i++)
+	slots[i].m_used = false;
+    m_count = 0;
+    m_started = false;
+    m_delivered = false;
+    m_baseSet = false;
+    m_transit = 0;
+}
+
+void RTPRingDejitter::stats(NamedList& stat) const
+{
+    RTPDejitter::stats(stat);
+    stat.setParam("jitterlost",String(m_lost));
+    stat.setParam("jitterconcealed",String(m_concealed));
+    stat.setParam("jitterdelay",String(m_delay / 1000));
+    stat.setParam("jitter",String(m_jitter / 1000));
+}
+
+bool RTPRingDejitter::rtpRecv(bool marker, int payload, unsigned int timestamp,
+    const void* data, int len)
+{
+    return rtpRecvSeq(marker,payload,timestamp,m_started ? m_tailSeq + 1 : 0,data,len);
+}
+
+bool RTPRingDejitter::rtpRecvSeq(bool marker, int payload, unsigned int timestamp,
+    u_int16_t seq, const void* data, int len)
+{
+    if (len < 0 || (len && !data))
+	return false;
+    u_int64_t now = Time::now();
+    if (m_started) {
+	int16_t ds = seq - m_headSeq;
+	if (ds < 0) {
+	    DDebug(dbg(),DebugNote,"Ring dejitter dropping late SEQ %u, expecting %u [%p]",
+		seq,m_headSeq,this);
+	    m_late++;
+	    return false;
+	}
+	if ((unsigned int)ds > m_mask) {
+	    // too far ahead to fit, start over from this packet
+	    DDebug(dbg(),DebugNote,"Ring dejitter SEQ %u jumped ahead of %u, flushing %u [%p]",
+		seq,m_headSeq,m_count,this);
+	    m_dropped += m_count;
+	    clear();
+	}
+    }
+    if (!m_started) {
+	m_started = true;
+	m_headSeq = seq;
+	m_tailSeq = seq;
+    }
+
+    // track the time per sample and the interarrival jitter (RFC 3550 style)
+    if (m_arrTime) {
+	int dTs = timestamp - m_arrStamp;
+	if (dTs > 0)
+	    updateRate(1000 * (int64_t)(now - m_arrTime) / dTs);
+    }
+    if ((int)(timestamp - m_arrStamp) > 0 || !m_arrTime) {
+	m_arrStamp = timestamp;
+	m_arrTime = now;
+    }
+    // a new talkspurt or an empty buffer is the moment to move the reference
+    //  and apply a new playout delay without disturbing the audio
+    bool rebase = !m_baseSet || (marker && !m_count);
+    int64_t transit = 0;
+    if (!rebase) {
+	transit = (int64_t)now - (int64_t)m_baseTime -
+	    ((int64_t)(int)(timestamp - m_baseStamp) * (int64_t)m_sampRate / 1000);
+	// packets arriving earlier than predicted mean the reference was late
+	if (transit < 0 || (!m_count && transit > (int64_t)m_maxDelay))
+	    rebase = true;
+	else {
+	    int64_t d = transit - m_transit;
+	    if (d < 0)
+		d = -d;
+	    m_jitter += (int)((d - (int64_t)m_jitter) / 16);
+	    m_transit = transit;
+	}
+    }
+    if (rebase) {
+	m_baseSet = true;
+	m_baseStamp = timestamp;
+	m_baseTime = now;
+	m_transit = 0;
+	transit = 0;
+	unsigned int target = 3 * m_jitter;
+	if (target < m_minDelay)
+	    target = m_minDelay;
+	else if (target > m_maxDelay)
+	    target = m_maxDelay;
+	if (target != m_delay)
+	    XDebug(dbg(),DebugAll,"Ring dejitter delay %u -> %u usec [%p]",m_delay,target,this);
+	m_delay = target;
+    }
+    u_int64_t when = now - transit + m_delay;
+
+    RingSlot& slot = static_cast<RingSlot*>(m_slots.data())[seq & m_mask];
+    if (slot.m_used)
+	return slot.m_seq == seq;
+    if ((unsigned int)len > m_slotSize)
+	resize((len + 63) & ~63);
+    if (((int16_t)(seq - m_tailSeq)) < 0)
+	m_reordered++;
+    else
+	m_tailSeq = seq;
+    slot.m_scheduled = when;
+    slot.m_timestamp = timestamp;
+    slot.m_payload = payload;
+    slot.m_length = len;
+    slot.m_seq = seq;
+    slot.m_marker = marker;
+    slot.m_used = true;
+    if (len)
+	::memcpy(m_data.data((seq & m_mask) * m_slotSize),data,len);
+    m_count++;
+    schedule(now);
+    return true;
+}
+
+// Request a timer tick for the first queued packet
+void RTPRingDejitter::schedule(u_int64_t when)
+{
+    RingSlot* slots = static_cast<RingSlot*>(m_slots.data());
+    for (u_int16_t s = m_headSeq; m_count; s++) {
+	const RingSlot& slot = slots[s & m_mask];
+	if (slot.m_used) {
+	    tickAt(slot.m_scheduled);
+	    return;
+	}
+    }
+    tickAt(when + m_maxDelay);
+}
+
+void RTPRingDejitter::timerTick(const Time& when)
+{
+    RingSlot* slots = static_cast<RingSlot*>(m_slots.data());
+    unsigned int delivered = 0;
+    unsigned int dropped = 0;
+    while (m_count) {
+	unsigned int gap = 0;
+	while (!slots[(m_headSeq + gap) & m_mask].m_used)
+	    gap++;
+	RingSlot& slot = slots[(m_headSeq + gap) & m_mask];
+	if (slot.m_scheduled > when)
+	    break;
+	if (gap) {
+	    // packets still missing at playout time are lost
+	    m_lost += gap;
+	    lostPackets(gap);
+	    if (m_delivered && m_receiver) {
+		unsigned int dTs = slot.m_timestamp - m_lastStamp;
+		for (unsigned int i = 1; i <= gap; i++) {
+		    if (m_receiver->rtpConceal(m_lastPayload,m_lastStamp + (dTs * i / (gap + 1))))
+			m_concealed++;
+		}
+	    }
+	}
+	m_headSeq = slot.m_seq + 1;
+	m_count--;
+	slot.m_used = false;
+	m_delivered = true;
+	m_lastStamp = slot.m_timestamp;
+	m_lastPayload = slot.m_payload;
+	// we are too delayed - probably rtpRecv() took too long to complete...
+	if (delivered && (when - slot.m_scheduled > m_minDelay)) {
+	    dropped++;
+	    continue;
+	}
+	delivered++;
+	if (m_receiver)
+	    m_receiver->rtpRecv(slot.m_marker,slot.m_payload,slot.m_timestamp,
+		m_data.data((slot.m_seq & m_mask) * m_slotSize),slot.m_length);
+    }
+    if (dropped) {
+	m_dropped += dropped;
+	TraceDebug(m_traceId,dbg(),(dropped > 1) ? DebugMild : DebugNote,
+	    "Dropped %u delayed packet%s from ring buffer [%p]",dropped,((dropped > 1) ? "s" : ""),this);
+    }
+    schedule(when);
 }
 
 /* vi: set ts=8 sw=4 sts=4 noet: */
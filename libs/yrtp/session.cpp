@@ -330,7 +330,7 @@ void RTPReceiver::rtpData(const void* data, int len)
     m_rollover = rollover;
 
     if (m_dejitter) {
-	if (!m_dejitter->rtpRecv(marker,typ,m_tsLast,pc,len))
+	if (!m_dejitter->rtpRecvSeq(marker,typ,m_tsLast,seq,pc,len))
 	    m_ioLostPkt++;
 	return;
     }
@@ -380,6 +380,11 @@ void RTPReceiver::rtpNewSSRC(u_int32_t newSsrc, bool marker)
 	m_session->rtpNewSSRC(newSsrc,marker);
 }
 
+bool RTPReceiver::rtpConceal(int payload, unsigned int timestamp)
+{
+    return m_session && m_session->rtpConceal(payload,timestamp);
+}
+
 bool RTPReceiver::decodeEvent(bool marker, unsigned int timestamp, const void* data, int len)
 {
     // we support only basic RFC2833, no RFC2198 redundancy
@@ -481,6 +486,8 @@ void RTPReceiver::stats(NamedList& stat) const
     stat.setParam("synclost",String(m_syncLost));
     stat.setParam("wrongssrc",String(m_wrongSSRC));
     stat.setParam("seqslost",String(m_seqLost));
+    if (m_dejitter)
+	m_dejitter->stats(stat);
 }
 
 
@@ -811,6 +818,13 @@ void RTPSession::timerTick(const Time& when)
 	    sendRtcpReport(when);
 	}
     }
+    // nothing else to do until a timer expires or a packet arrives
+    u_int64_t due = INF_TIMEOUT;
+    if (m_timeoutInterval && m_timeoutTime && m_recv)
+	due = m_timeoutTime;
+    if (m_reportInterval && m_reportTime < due)
+	due = m_reportTime;
+    tickAt(due);
 }
 
 void RTPSession::rtpData(const void* data, int len)
@@ -819,6 +833,8 @@ void RTPSession::rtpData(const void* data, int len)
 	return;
     if (m_recv) {
 	m_timeoutTime = 0;
+	if (m_timeoutInterval)
+	    tickAt(0);
 	m_recv->rtpData(data,len);
     }
 }
@@ -828,8 +844,11 @@ void RTPSession::rtcpData(const void* data, int len)
     if ((m_direction & RecvOnly) == 0)
 	return;
     if (m_recv) {
-	if ((m_timeoutTime != INF_TIMEOUT) || m_recv->ssrc())
+	if ((m_timeoutTime != INF_TIMEOUT) || m_recv->ssrc()) {
 	    m_timeoutTime = 0;
+	    if (m_timeoutInterval)
+		tickAt(0);
+	}
 	m_recv->rtcpData(data,len);
     }
 }
@@ -860,6 +879,12 @@ void RTPSession::rtpNewSSRC(u_int32_t newSsrc,bool marker)
 	newSsrc,String::boolText(marker),this);
 }
 
+bool RTPSession::rtpConceal(int payload, unsigned int timestamp)
+{
+    XDebug(dbg(),DebugAll,"RTPSession::rtpConceal(%d,%u) [%p]",payload,timestamp,this);
+    return false;
+}
+
 RTPSender* RTPSession::createSender()
 {
     return new RTPSender(this);
@@ -1130,7 +1155,10 @@ void UDPTLSession::timerTick(const Time& when)
 	}
 	else
 	    m_timeoutTime = when + m_timeoutInterval;
+	tickAt(m_timeoutTime);
     }
+    else
+	tickAt(INF_TIMEOUT);
 }
 
 RTPTransport* UDPTLSession::createTransport()
@@ -1145,6 +1173,8 @@ void UDPTLSession::rtpData(const void* data, int len)
     if ((len < 6) || !data)
 	return;
     m_timeoutTime = 0;
+    if (m_timeoutInterval)
+	tickAt(0);
     const unsigned char* pd = (const unsigned char*)data;
     int pLen = pd[2];
     if (pLen > (len-5)) {
@@ -21,11 +21,79 @@
 #include <yatertp.h>
 #include <string.h>
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#define RTP_EVENTS
+#endif
+
 #define BUF_SIZE 1500
+// Packets read by a single recvmmsg() call
+#define RECV_BATCH 16
+// Socket events retrieved by a single epoll_wait() call
+#define WAIT_EVENTS 64
+// Maximum time an event driven processor can go without a tick
+#define IDLE_TICK 100000
 
 using namespace TelEngine;
 
 static unsigned long s_sleep = 5;
+static bool s_events = false;
+
+// All existing groups and the I/O counters of the destroyed ones
+static ObjList s_groups;
+static Mutex s_groupsMutex(false,"RTPGroups");
+static u_int64_t s_endPackets = 0;
+static u_int64_t s_endSyscalls = 0;
+static u_int64_t s_endWakeups = 0;
+static u_int64_t s_endTicks = 0;
+
+#ifdef RTP_EVENTS
+namespace TelEngine {
+
+// Receive buffers of an event driven group, reused for every batch
+class RTPRecvPool
+{
+public:
+    RTPRecvPool();
+    int recv(Socket& sock);
+    inline const char* data(int i) const
+	{ return m_buf[i]; }
+    inline int length(int i) const
+	{ return m_msgs[i].msg_len; }
+    inline const struct sockaddr* addr(int i) const
+	{ return (const struct sockaddr*)&m_addr[i]; }
+    inline socklen_t addrLen(int i) const
+	{ return m_msgs[i].msg_hdr.msg_namelen; }
+private:
+    struct mmsghdr m_msgs[RECV_BATCH];
+    struct iovec m_iov[RECV_BATCH];
+    struct sockaddr_storage m_addr[RECV_BATCH];
+    char m_buf[RECV_BATCH][BUF_SIZE];
+};
+
+}; // namespace TelEngine
+
+RTPRecvPool::RTPRecvPool()
+{
+    ::memset(m_msgs,0,sizeof(m_msgs));
+    for (int i = 0; i < RECV_BATCH; i++) {
+	m_iov[i].iov_base = m_buf[i];
+	m_iov[i].iov_len = BUF_SIZE;
+	m_msgs[i].msg_hdr.msg_iov = &m_iov[i];
+	m_msgs[i].msg_hdr.msg_iovlen = 1;
+	m_msgs[i].msg_hdr.msg_name = &m_addr[i];
+    }
+}
+
+// Read a batch of datagrams, return how many were received
+int RTPRecvPool::recv(Socket& sock)
+{
+    for (int i = 0; i < RECV_BATCH; i++)
+	m_msgs[i].msg_hdr.msg_namelen = sizeof(m_addr[i]);
+    return ::recvmmsg(sock.handle(),m_msgs,RECV_BATCH,MSG_DONTWAIT,0);
+}
+#endif
 
 // Set IPv6 sin6_scope_id for remote addresses from local address
 // recvFrom() will set the sin6_scope_id of the remote socket address
@@ -45,7 +113,9 @@ static inline void setScopeId(const SocketAddr& local, SocketAddr& sa1,
 
 RTPGroup::RTPGroup(int msec, Priority prio, const String& affinity)
     : Mutex(true,"RTPGroup"),
-      Thread("RTP Group",prio), m_listChanged(false)
+      Thread("RTP Group",prio), m_listChanged(false),
+      m_epoll(-1), m_pool(0), m_nextTick(0),
+      m_packets(0), m_syscalls(0), m_wakeups(0), m_ticks(0)
 {
     DDebug(DebugInfo,"RTPGroup::RTPGroup() [%p]",this);
     if (msec < 1)
@@ -59,11 +129,37 @@ RTPGroup::RTPGroup(int msec, Priority prio, const String& affinity)
 	    Debug(DebugWarn,"Failed to set affinity to '%s', error=%s(%d) [%p]",
 		    affinity.c_str(),::strerror(err),err,this);
     }
+#ifdef RTP_EVENTS
+    if (s_events) {
+	m_epoll = ::epoll_create1(EPOLL_CLOEXEC);
+	if (m_epoll >= 0)
+	    m_pool = new RTPRecvPool;
+	else {
+	    int err = errno;
+	    Debug(DebugWarn,"Failed to create event set, using polled mode, error=%s(%d) [%p]",
+		::strerror(err),err,this);
+	}
+    }
+#endif
+    Lock lck(s_groupsMutex);
+    s_groups.append(this)->setDelete(false);
 }
 
 RTPGroup::~RTPGroup()
 {
     DDebug(DebugInfo,"RTPGroup::~RTPGroup() [%p]",this);
+    s_groupsMutex.lock();
+    s_groups.remove(this,false);
+    s_endPackets += m_packets;
+    s_endSyscalls += m_syscalls;
+    s_endWakeups += m_wakeups;
+    s_endTicks += m_ticks;
+    s_groupsMutex.unlock();
+#ifdef RTP_EVENTS
+    if (m_epoll >= 0)
+	::close(m_epoll);
+    delete m_pool;
+#endif
 }
 
 void RTPGroup::cleanup()
@@ -93,7 +189,12 @@ void RTPGroup::run()
 	unsigned long msec = m_sleep;
 	if (msec < s_sleep)
 	    msec = s_sleep;
+	if (m_pool) {
+	    ok = runEvents(msec);
+	    continue;
+	}
 	lock();
+	m_wakeups++;
 	Time t;
 	ObjList* l = &m_processors;
 	m_listChanged = false;
@@ -101,6 +202,7 @@ void RTPGroup::run()
 	    RTPProcessor* p = static_cast<RTPProcessor*>(l->get());
 	    if (p) {
 		ok = true;
+		m_ticks++;
 		p->timerTick(t);
 		// the list is protected from other threads but can be changed
 		//  from this one so if it happened we just break out and try
@@ -115,12 +217,124 @@ void RTPGroup::run()
     DDebug(DebugInfo,"RTPGroup::run() ran out of processors [%p]",this);
 }
 
+// Run one cycle of an event driven group: wait for socket events or the
+//  earliest processor deadline, drain the ready sockets, tick due processors
+bool RTPGroup::runEvents(unsigned long msec)
+{
+#ifdef RTP_EVENTS
+    lock();
+    // no deadline means a processor joined or the list changed, tick at once
+    int wait = 0;
+    if (m_nextTick) {
+	u_int64_t now = Time::now();
+	if (m_nextTick > now)
+	    wait = (int)((m_nextTick - now + 999) / 1000);
+    }
+    // any change of the processors list invalidates the retrieved events
+    m_listChanged = false;
+    unlock();
+    struct epoll_event ev[WAIT_EVENTS];
+    int n = ::epoll_wait(m_epoll,ev,WAIT_EVENTS,wait);
+    if (Thread::check(false))
+	return false;
+    lock();
+    m_wakeups++;
+    m_syscalls++;
+    for (int i = 0; i < n && !m_listChanged; i++) {
+	// the lowest bit of the pointer tells RTCP from RTP sockets
+	uintptr_t ptr = (uintptr_t)ev[i].data.ptr;
+	RTPTransport* trans = (RTPTransport*)(ptr & ~(uintptr_t)1);
+	trans->recvEvents((ptr & 1) != 0,*m_pool);
+    }
+    Time t;
+    bool ok = false;
+    u_int64_t next = t + IDLE_TICK;
+    m_listChanged = false;
+    for (ObjList* l = m_processors.skipNull(); l; l = l->skipNext()) {
+	RTPProcessor* p = static_cast<RTPProcessor*>(l->get());
+	ok = true;
+	if (p->m_tickDue <= t) {
+	    p->m_tickDue = 0;
+	    m_ticks++;
+	    p->timerTick(t);
+	    if (m_listChanged) {
+		next = 0;
+		break;
+	    }
+	}
+	u_int64_t due = p->m_tickDue ? p->m_tickDue : (t + msec * 1000);
+	if (due < next)
+	    next = due;
+    }
+    m_nextTick = next;
+    unlock();
+    return ok;
+#else
+    return false;
+#endif
+}
+
+// Add or remove a transport socket to the event set
+bool RTPGroup::watch(Socket& sock, RTPTransport* trans, bool rtcp, bool add)
+{
+#ifdef RTP_EVENTS
+    if (m_epoll < 0 || !sock.valid())
+	return false;
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = (void*)((uintptr_t)trans | (rtcp ? 1 : 0));
+    if (!::epoll_ctl(m_epoll,(add ? EPOLL_CTL_ADD : EPOLL_CTL_DEL),sock.handle(),&ev))
+	return true;
+    if (add && (errno == EEXIST))
+	return true;
+    if (add) {
+	int err = errno;
+	Debug(DebugWarn,"Failed to watch socket %d, error=%s(%d) [%p]",
+	    sock.handle(),::strerror(err),err,this);
+    }
+#endif
+    return false;
+}
+
+void RTPGroup::getStats(NamedList& stats) const
+{
+    stats.setParam("iomode",eventDriven() ? "events" : "polled");
+    stats.setParam("iopackets",String(m_packets));
+    stats.setParam("iosyscalls",String(m_syscalls));
+    stats.setParam("iowakeups",String(m_wakeups));
+    stats.setParam("ioticks",String(m_ticks));
+}
+
+void RTPGroup::getTotals(NamedList& stats)
+{
+    Lock lck(s_groupsMutex);
+    u_int64_t packets = s_endPackets;
+    u_int64_t syscalls = s_endSyscalls;
+    u_int64_t wakeups = s_endWakeups;
+    u_int64_t ticks = s_endTicks;
+    for (ObjList* l = s_groups.skipNull(); l; l = l->skipNext()) {
+	const RTPGroup* g = static_cast<const RTPGroup*>(l->get());
+	packets += g->m_packets;
+	syscalls += g->m_syscalls;
+	wakeups += g->m_wakeups;
+	ticks += g->m_ticks;
+    }
+    stats.setParam("iogroups",String(s_groups.count()));
+    stats.setParam("iopackets",String(packets));
+    stats.setParam("iosyscalls",String(syscalls));
+    stats.setParam("iowakeups",String(wakeups));
+    stats.setParam("ioticks",String(ticks));
+}
+
 void RTPGroup::join(RTPProcessor* proc)
 {
     DDebug(DebugAll,"RTPGroup::join(%p) [%p]",proc,this);
     lock();
     m_listChanged = true;
     m_processors.append(proc)->setDelete(false);
+    proc->m_tickDue = 0;
+    m_nextTick = 0;
+    proc->groupChanged(true);
     startup();
     unlock();
 }
@@ -130,6 +344,7 @@ void RTPGroup::part(RTPProcessor* proc)
     DDebug(DebugAll,"RTPGroup::part(%p) [%p]",proc,this);
     lock();
     m_listChanged = true;
+    proc->groupChanged(false);
     m_processors.remove(proc,false);
     unlock();
 }
@@ -143,10 +358,26 @@ void RTPGroup::setMinSleep(int msec)
     s_sleep = msec;
 }
 
+bool RTPGroup::setEventDriven(bool enable)
+{
+#ifdef RTP_EVENTS
+    s_events = enable;
+    return true;
+#else
+    s_events = false;
+    return !enable;
+#endif
+}
+
+bool RTPGroup::eventDrivenDefault()
+{
+    return s_events;
+}
+
 
 RTPProcessor::RTPProcessor(DebugEnabler* dbg, const char* traceId)
     : RTPDebug(dbg,traceId),
-    m_wrongSrc(0), m_group(0)
+    m_wrongSrc(0), m_group(0), m_tickDue(0)
 {
     DDebug(this->dbg(),DebugAll,"RTPProcessor::RTPProcessor() [%p]",this);
 }
@@ -169,6 +400,20 @@ void RTPProcessor::group(RTPGroup* newgrp)
 	m_group->join(this);
 }
 
+void RTPProcessor::groupChanged(bool joined)
+{
+}
+
+void RTPProcessor::tickAt(u_int64_t due)
+{
+    if (due) {
+	u_int64_t max = Time::now() + IDLE_TICK;
+	if (due > max)
+	    due = max;
+    }
+    m_tickDue = due;
+}
+
 void RTPProcessor::rtpData(const void* data, int len)
 {
 }
@@ -212,65 +457,174 @@ void RTPTransport::destruct()
 void RTPTransport::timerTick(const Time& when)
 {
     XDebug(dbg(),DebugAll,"RTPTransport::timerTick() group=%p [%p]",group(),this);
+    RTPGroup* grp = group();
+    if (grp && grp->eventDriven()) {
+	// sockets are read on events, only the filters need timer ticks
+	bool filtered = false;
+	if (m_rtpSock.filtered()) {
+	    filtered = true;
+	    m_rtpSock.timerTick(when);
+	}
+	if (m_rtcpSock.filtered()) {
+	    filtered = true;
+	    m_rtcpSock.timerTick(when);
+	}
+	// check again later in case filters get installed
+	if (!filtered)
+	    tickAt(when + IDLE_TICK);
+	return;
+    }
+    unsigned int calls = 0;
+    unsigned int pkts = 0;
     if (m_rtpSock.valid()) {
 	char buf[BUF_SIZE];
 	int len;
 	while ((len = m_rtpSock.recvFrom(buf,sizeof(buf),m_rxAddrRTP)) > 0) {
-	    XDebug(dbg(),DebugAll,"RTP/UDPTL from '%s:%d' length %d [%p]",
-		m_rxAddrRTP.host().c_str(),m_rxAddrRTP.port(),len,this);
-	    switch (m_type) {
-		case RTP:
-		    if (len < 12)
-			continue;
-		    if (((unsigned char)buf[0] & 0xc0) != 0x80)
-			continue;
-		    break;
-		case UDPTL:
-		    if (len < 6)
-			continue;
-		    break;
-		default:
-		    break;
-	    }
-	    if (!m_remoteAddr.valid())
-		continue;
-	    // looks like it's RTP or UDPTL, at least by length and version
-	    bool preferred = false;
-	    if ((m_autoRemote || (preferred = (m_rxAddrRTP == m_remotePref))) && (m_rxAddrRTP != m_remoteAddr)) {
-		TraceDebug(m_traceId,dbg(),DebugInfo,"Auto changing RTP address from %s:%d to%s %s:%d",
-		    m_remoteAddr.host().c_str(),m_remoteAddr.port(),
-		    (preferred ? " preferred" : ""),
-		    m_rxAddrRTP.host().c_str(),m_rxAddrRTP.port());
-		// if we received from the preferred address don't auto change any more
-		if (preferred)
-		    m_remotePref.clear();
-		remoteAddr(m_rxAddrRTP);
-	    }
-	    m_autoRemote = false;
-	    if (m_rxAddrRTP == m_remoteAddr) {
-		if (m_processor)
-		    m_processor->rtpData(buf,len);
-		if (m_monitor)
-		    m_monitor->rtpData(buf,len);
-	    }
-	    else if (m_processor)
-		m_processor->incWrongSrc();
+	    calls++;
+	    pkts++;
+	    recvRtp(buf,len);
 	}
+	calls++;
 	m_rtpSock.timerTick(when);
     }
     if (m_rtcpSock.valid()) {
 	char buf[BUF_SIZE];
 	int len;
 	while (((len = m_rtcpSock.recvFrom(buf,sizeof(buf),m_rxAddrRTCP)) >= 8) && (m_rxAddrRTCP == m_remoteRTCP)) {
-	    XDebug(dbg(),DebugAll,"RTCP from '%s:%d' length %d [%p]",
-		m_rxAddrRTCP.host().c_str(),m_rxAddrRTCP.port(),len,this);
-	    if (m_processor)
-		m_processor->rtcpData(buf,len);
-	    if (m_monitor)
-		m_monitor->rtcpData(buf,len);
+	    calls++;
+	    pkts++;
+	    recvRtcp(buf,len);
 	}
+	calls++;
 	m_rtcpSock.timerTick(when);
     }
+    if (grp)
+	grp->counted(calls,pkts);
+}
+
+// Process a RTP or UDPTL packet received from m_rxAddrRTP
+void RTPTransport::recvRtp(const char* buf, int len)
+{
+    XDebug(dbg(),DebugAll,"RTP/UDPTL from '%s:%d' length %d [%p]",
+	m_rxAddrRTP.host().c_str(),m_rxAddrRTP.port(),len,this);
+    switch (m_type) {
+	case RTP:
+	    if (len < 12)
+		return;
+	    if (((unsigned char)buf[0] & 0xc0) != 0x80)
+		return;
+	    break;
+	case UDPTL:
+	    if (len < 6)
+		return;
+	    break;
+	default:
+	    break;
+    }
+    if (!m_remoteAddr.valid())
+	return;
+    // looks like it's RTP or UDPTL, at least by length and version
+    bool preferred = false;
+    if ((m_autoRemote || (preferred = (m_rxAddrRTP == m_remotePref))) && (m_rxAddrRTP != m_remoteAddr)) {
+	TraceDebug(m_traceId,dbg(),DebugInfo,"Auto changing RTP address from %s:%d to%s %s:%d",
+	    m_remoteAddr.host().c_str(),m_remoteAddr.port(),
+	    (preferred ? " preferred" : ""),
+	    m_rxAddrRTP.host().c_str(),m_rxAddrRTP.port());
+	// if we received from the preferred address don't auto change any more
+	if (preferred)
+	    m_remotePref.clear();
+	remoteAddr(m_rxAddrRTP);
+    }
+    m_autoRemote = false;
+    if (m_rxAddrRTP == m_remoteAddr) {
+	if (m_processor)
+	    m_processor->rtpData(buf,len);
+	if (m_monitor)
+	    m_monitor->rtpData(buf,len);
+    }
+    else if (m_processor)
+	m_processor->incWrongSrc();
+}
+
+// Process a RTCP packet received from the remote RTCP address
+void RTPTransport::recvRtcp(const char* buf, int len)
+{
+    XDebug(dbg(),DebugAll,"RTCP from '%s:%d' length %d [%p]",
+	m_rxAddrRTCP.host().c_str(),m_rxAddrRTCP.port(),len,this);
+    if (m_processor)
+	m_processor->rtcpData(buf,len);
+    if (m_monitor)
+	m_monitor->rtcpData(buf,len);
+}
+
+// Drain a socket reported readable by the group's event set
+void RTPTransport::recvEvents(bool rtcp, RTPRecvPool& pool)
+{
+    Socket& sock = rtcp ? m_rtcpSock : m_rtpSock;
+    SocketAddr& addr = rtcp ? m_rxAddrRTCP : m_rxAddrRTP;
+    RTPGroup* grp = group();
+    if (!(grp && sock.valid()))
+	return;
+    unsigned int calls = 0;
+    unsigned int pkts = 0;
+    if (sock.filtered()) {
+	// filters must see each packet so use the plain receive path
+	char buf[BUF_SIZE];
+	int len;
+	// a packet claimed by a filter stops the loop but the socket stays readable
+	while (true) {
+	    calls++;
+	    len = sock.recvFrom(buf,sizeof(buf),addr);
+	    if (len <= 0)
+		break;
+	    pkts++;
+	    if (!rtcp)
+		recvRtp(buf,len);
+	    else if (len >= 8 && addr == m_remoteRTCP)
+		recvRtcp(buf,len);
+	}
+	grp->counted(calls,pkts);
+	return;
+    }
+#ifdef RTP_EVENTS
+    while (true) {
+	calls++;
+	int n = pool.recv(sock);
+	if (n <= 0)
+	    break;
+	for (int i = 0; i < n; i++) {
+	    pkts++;
+	    int len = pool.length(i);
+	    if (len <= 0)
+		continue;
+	    addr.assign(pool.addr(i),pool.addrLen(i));
+	    if (!rtcp)
+		recvRtp(pool.data(i),len);
+	    else if (len >= 8 && addr == m_remoteRTCP)
+		recvRtcp(pool.data(i),len);
+	}
+	// a short batch means the socket queue was drained
+	if (n < RECV_BATCH)
+	    break;
+    }
+#endif
+    grp->counted(calls,pkts);
+}
+
+void RTPTransport::groupChanged(bool joined)
+{
+    watchSockets(joined);
+}
+
+// Add or remove our sockets to the event set of the current group
+void RTPTransport::watchSockets(bool add)
+{
+    RTPGroup* grp = group();
+    if (!(grp && grp->eventDriven()))
+	return;
+    Lock lock(grp);
+    grp->watch(m_rtpSock,this,false,add);
+    grp->watch(m_rtcpSock,this,true,add);
 }
 
 // Send data to remote party
@@ -367,6 +721,7 @@ bool RTPTransport::localAddr(SocketAddr& addr, bool rtcp)
 	    m_rtpSock.getSockName(addr);
 	    m_localAddr = addr;
 	    setScopeId(m_localAddr,m_remoteAddr,m_remotePref);
+	    watchSockets(true);
 	    return true;
 	}
 	if (!p) {
@@ -380,6 +735,7 @@ bool RTPTransport::localAddr(SocketAddr& addr, bool rtcp)
 		    m_rtpSock.setBlocking(false);
 		    m_localAddr = addr;
 		    setScopeId(m_localAddr,m_remoteAddr,m_remoteRTCP,&m_remotePref);
+		    watchSockets(true);
 		    return true;
 		}
 		DDebug(dbg(),DebugMild,"RTP Socket failed with code %d",m_rtpSock.error());
@@ -394,6 +750,7 @@ bool RTPTransport::localAddr(SocketAddr& addr, bool rtcp)
 	    addr.port(p);
 	    m_localAddr = addr;
 	    setScopeId(m_localAddr,m_remoteAddr,m_remoteRTCP,&m_remotePref);
+	    watchSockets(true);
 	    return true;
 	}
 #ifdef DEBUG
@@ -45,6 +45,7 @@
 namespace TelEngine {
 
 class RTPGroup;
+class RTPRecvPool;
 class RTPTransport;
 class RTPSession;
 class RTPSender;
@@ -182,10 +183,27 @@ protected:
      */
     virtual void timerTick(const Time& when) = 0;
 
+    /**
+     * Method called by the RTP group after this processor joined it or before leaving it
+     * @param joined True if the processor just joined the group, false if it is leaving
+     */
+    virtual void groupChanged(bool joined);
+
+    /**
+     * Set the time of the next timer tick needed by this processor.
+     * Event driven groups skip calling timerTick() until that time, polled
+     *  groups ignore it. Must be called from the group's thread.
+     * The deadline is reset on each tick so a processor that doesn't set it
+     *  is ticked on every group cycle.
+     * @param due Time in microseconds of the next tick, 0 for the next group cycle
+     */
+    void tickAt(u_int64_t due);
+
     unsigned int m_wrongSrc;
 
 private:
     RTPGroup* m_group;
+    u_int64_t m_tickDue;
 };
 
 /**
@@ -196,6 +214,7 @@ private:
 class YRTP_API RTPGroup : public GenObject, public Mutex, public Thread
 {
     friend class RTPProcessor;
+    friend class RTPTransport;
 
 public:
     /**
@@ -227,6 +246,70 @@ public:
      */
     static void setMinSleep(int msec);
 
+    /**
+     * Set the system global RTP I/O mode of groups created afterwards.
+     * Event driven groups wait on their sockets with epoll, read them in
+     *  batches with recvmmsg and only tick processors that have a due timer.
+     * Polled groups read every socket and tick every processor in each cycle.
+     * @param enable True to create event driven groups, false for polled ones
+     * @return True if the requested mode is supported on this platform
+     */
+    static bool setEventDriven(bool enable);
+
+    /**
+     * Check if groups created from now on will be event driven
+     * @return True if new groups will wait for socket events
+     */
+    static bool eventDrivenDefault();
+
+    /**
+     * Check if this group waits for socket events instead of polling
+     * @return True if the group is event driven
+     */
+    inline bool eventDriven() const
+	{ return m_epoll >= 0; }
+
+    /**
+     * Get the number of packets received by the transports of this group
+     * @return Number of received packets
+     */
+    inline u_int64_t packets() const
+	{ return m_packets; }
+
+    /**
+     * Get the number of receive and wait system calls made by this group
+     * @return Number of I/O system calls
+     */
+    inline u_int64_t syscalls() const
+	{ return m_syscalls; }
+
+    /**
+     * Get the number of times the group thread woke up
+     * @return Number of group cycles
+     */
+    inline u_int64_t wakeups() const
+	{ return m_wakeups; }
+
+    /**
+     * Get the number of processor timer ticks performed by this group
+     * @return Number of calls to processors' timerTick()
+     */
+    inline u_int64_t ticks() const
+	{ return m_ticks; }
+
+    /**
+     * Retrieve the I/O statistics of this group
+     * @param stats List of parameters to fill
+     */
+    void getStats(NamedList& stats) const;
+
+    /**
+     * Retrieve the I/O statistics summed over all groups, including the
+     *  destroyed ones, and the number of existing groups
+     * @param stats List of parameters to fill
+     */
+    static void getTotals(NamedList& stats);
+
     /**
      * Add a RTP processor to this group
      * @param proc Pointer to the RTP processor to add
@@ -240,9 +323,20 @@ public:
     void part(RTPProcessor* proc);
 
 private:
+    bool runEvents(unsigned long msec);
+    bool watch(Socket& sock, RTPTransport* trans, bool rtcp, bool add);
+    inline void counted(unsigned int syscalls, unsigned int packets)
+	{ m_syscalls += syscalls; m_packets += packets; }
     ObjList m_processors;
     bool m_listChanged;
     unsigned long m_sleep;
+    int m_epoll;
+    RTPRecvPool* m_pool;
+    u_int64_t m_nextTick;
+    u_int64_t m_packets;
+    u_int64_t m_syscalls;
+    u_int64_t m_wakeups;
+    u_int64_t m_ticks;
 };
 
 /**
@@ -251,6 +345,7 @@ private:
  */
 class YRTP_API RTPTransport : public RTPProcessor
 {
+    friend class RTPGroup;
 public:
     /**
      * Activation status of the transport
@@ -372,6 +467,12 @@ protected:
      */
     virtual void timerTick(const Time& when);
 
+    /**
+     * Add or remove the sockets to the event set of the group
+     * @param joined True if the transport just joined the group, false if it is leaving
+     */
+    virtual void groupChanged(bool joined);
+
     /**
      * This method is called to send a RTP packet
      * @param data Pointer to raw RTP data
@@ -389,6 +490,10 @@ protected:
 private:
     bool sendData(Socket& sock, const SocketAddr& to, const void* data, int len,
 	const char* what, bool& flag);
+    void recvRtp(const char* buf, int len);
+    void recvRtcp(const char* buf, int len);
+    void recvEvents(bool rtcp, RTPRecvPool& pool);
+    void watchSockets(bool add);
     Type m_type;
     RTPProcessor* m_processor;
     RTPProcessor* m_monitor;
@@ -442,10 +547,30 @@ public:
     virtual bool rtpRecv(bool marker, int payload, unsigned int timestamp,
 	const void* data, int len);
 
+    /**
+     * Process and store one RTP data packet knowing its sequence number.
+     * The default implementation ignores the sequence and calls rtpRecv()
+     * @param marker True if the marker bit is set in data packet
+     * @param payload Payload number
+     * @param timestamp Sampling instant of the packet data
+     * @param seq Sequence number of the packet
+     * @param data Pointer to data block to process
+     * @param len Length of the data block in bytes
+     * @return True if the data packet was queued
+     */
+    virtual bool rtpRecvSeq(bool marker, int payload, unsigned int timestamp,
+	u_int16_t seq, const void* data, int len);
+
     /**
      * Clear the delayed packets queue and all variables
      */
-    void clear();
+    virtual void clear();
+
+    /**
+     * Retrieve the statistics of this jitter buffer
+     * @param stat List of parameters to fill
+     */
+    virtual void stats(NamedList& stat) const;
 
 protected:
     /**
@@ -454,16 +579,142 @@ protected:
      */
     virtual void timerTick(const Time& when);
 
-private:
-    ObjList m_packets;
+    /**
+     * Account packets the buffer found missing as lost by the receiver
+     * @param count Number of lost packets
+     */
+    void lostPackets(unsigned int count);
+
+    /**
+     * Update the estimated time per sample from a new measurement
+     * @param rate Measured time per sample in nanoseconds
+     */
+    void updateRate(int64_t rate);
+
     RTPReceiver* m_receiver;
     unsigned int m_minDelay;
     unsigned int m_maxDelay;
+    u_int64_t m_sampRate;
+    unsigned char m_fastRate;
+    unsigned int m_late;
+    unsigned int m_dropped;
+    unsigned int m_reordered;
+
+private:
+    ObjList m_packets;
     unsigned int m_headStamp;
     unsigned int m_tailStamp;
     u_int64_t m_headTime;
-    u_int64_t m_sampRate;
-    unsigned char m_fastRate;
+};
+
+/**
+ * A jitter buffer that stores packets in a preallocated ring indexed by
+ *  sequence number so no memory is allocated while packets flow.
+ * The playout delay adapts to the measured interarrival jitter and missing
+ *  packets are reported to the receiver for loss concealment.
+ * @short Adaptive ring buffer dejitter
+ */
+class YRTP_API RTPRingDejitter : public RTPDejitter
+{
+public:
+    /**
+     * Constructor of a new ring jitter buffer
+     * @param receiver RTP receiver which gets the delayed packets
+     * @param mindelay Minimum length of the dejitter buffer in microseconds
+     * @param maxdelay Maximum length of the dejitter buffer in microseconds
+     * @param dbg Dejitter DebugEnabler
+     * @param traceId Dejitter trace ID
+     */
+    RTPRingDejitter(RTPReceiver* receiver, unsigned int mindelay, unsigned int maxdelay,
+	DebugEnabler* dbg = 0, const char* traceId = 0);
+
+    /**
+     * Destructor
+     */
+    virtual ~RTPRingDejitter();
+
+    /**
+     * Store one RTP data packet without knowing its sequence number.
+     * The packet is assumed to follow the last one received
+     * @param marker True if the marker bit is set in data packet
+     * @param payload Payload number
+     * @param timestamp Sampling instant of the packet data
+     * @param data Pointer to data block to process
+     * @param len Length of the data block in bytes
+     * @return True if the data packet was queued
+     */
+    virtual bool rtpRecv(bool marker, int payload, unsigned int timestamp,
+	const void* data, int len);
+
+    /**
+     * Store one RTP data packet in the slot of its sequence number
+     * @param marker True if the marker bit is set in data packet
+     * @param payload Payload number
+     * @param timestamp Sampling instant of the packet data
+     * @param seq Sequence number of the packet
+     * @param data Pointer to data block to process
+     * @param len Length of the data block in bytes
+     * @return True if the data packet was queued
+     */
+    virtual bool rtpRecvSeq(bool marker, int payload, unsigned int timestamp,
+	u_int16_t seq, const void* data, int len);
+
+    /**
+     * Clear the queued packets and the synchronization variables
+     */
+    virtual void clear();
+
+    /**
+     * Retrieve the statistics of this jitter buffer
+     * @param stat List of parameters to fill
+     */
+    virtual void stats(NamedList& stat) const;
+
+    /**
+     * Get the current playout delay
+     * @return Delay applied to packets in microseconds
+     */
+    inline unsigned int delay() const
+	{ return m_delay; }
+
+    /**
+     * Get the measured interarrival jitter
+     * @return Smoothed jitter in microseconds
+     */
+    inline unsigned int jitter() const
+	{ return m_jitter; }
+
+protected:
+    /**
+     * Deliver the packets whose playout time arrived
+     * @param when Time to use as base in all computing
+     */
+    virtual void timerTick(const Time& when);
+
+private:
+    void resize(unsigned int slotSize);
+    void schedule(u_int64_t when);
+    DataBlock m_slots;
+    DataBlock m_data;
+    unsigned int m_mask;
+    unsigned int m_slotSize;
+    unsigned int m_count;
+    bool m_started;
+    u_int16_t m_headSeq;
+    u_int16_t m_tailSeq;
+    bool m_delivered;
+    unsigned int m_lastStamp;
+    int m_lastPayload;
+    bool m_baseSet;
+    unsigned int m_baseStamp;
+    u_int64_t m_baseTime;
+    unsigned int m_arrStamp;
+    u_int64_t m_arrTime;
+    int64_t m_transit;
+    unsigned int m_jitter;
+    unsigned int m_delay;
+    unsigned int m_lost;
+    unsigned int m_concealed;
 };
 
 /**
@@ -715,9 +966,15 @@ public:
      * Allocate and set a new dejitter buffer in this receiver
      * @param mindelay Minimum length of the dejitter buffer in microseconds
      * @param maxdelay Maximum length of the dejitter buffer in microseconds
-     */
-    inline void setDejitter(unsigned int mindelay, unsigned int maxdelay)
-	{ setDejitter(new RTPDejitter(this,mindelay,maxdelay,dbg(),m_traceId)); }
+     * @param adaptive True to use an adaptive ring buffer, false for the plain packet queue
+     */
+    inline void setDejitter(unsigned int mindelay, unsigned int maxdelay, bool adaptive = false)
+	{
+	    if (adaptive)
+		setDejitter(new RTPRingDejitter(this,mindelay,maxdelay,dbg(),m_traceId));
+	    else
+		setDejitter(new RTPDejitter(this,mindelay,maxdelay,dbg(),m_traceId));
+	}
 
     /**
      * Process one RTP payload packet.
@@ -773,6 +1030,16 @@ public:
     */
     virtual void rtpNewSSRC(u_int32_t newSsrc, bool marker);
 
+    /**
+     * Packet loss concealment hook called by jitter buffers for each packet
+     *  found missing when its playout time arrived.
+     * Default behaviour is to call the session's rtpConceal()
+     * @param payload Payload number of the last delivered packet
+     * @param timestamp Estimated sampling instant of the missing data
+     * @return True if the missing data was concealed
+     */
+    virtual bool rtpConceal(int payload, unsigned int timestamp);
+
     /**
      * Retrieve the statistical data from this receiver in a NamedList. Reset all the data.
      * @param stat NamedList to populate with the values for different counters
@@ -1146,6 +1413,15 @@ public:
     */
     virtual void rtpNewSSRC(u_int32_t newSsrc, bool marker);
 
+    /**
+     * Packet loss concealment hook for data missing from the jitter buffer.
+     * The default implementation does nothing
+     * @param payload Payload number of the last delivered packet
+     * @param timestamp Estimated sampling instant of the missing data
+     * @return True if the missing data was concealed
+     */
+    virtual bool rtpConceal(int payload, unsigned int timestamp);
+
     /**
      * Create a new RTP sender for this session.
      * Override this method to create objects derived from RTPSender.
@@ -1248,9 +1524,10 @@ public:
      * Allocate and set a new dejitter buffer for the receiver in the session
      * @param mindelay Minimum length of the dejitter buffer in microseconds
      * @param maxdelay Maximum length of the dejitter buffer in microseconds
+     * @param adaptive True to use an adaptive ring buffer, false for the plain packet queue
      */
-    inline void setDejitter(unsigned int mindelay = 20, unsigned int maxdelay = 50)
-	{ if (m_recv) m_recv->setDejitter(mindelay,maxdelay); }
+    inline void setDejitter(unsigned int mindelay = 20, unsigned int maxdelay = 50, bool adaptive = false)
+	{ if (m_recv) m_recv->setDejitter(mindelay,maxdelay,adaptive); }
 
     /**
      * Set the RTP/RTCP transport of data handled by this session
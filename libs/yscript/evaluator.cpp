@@ -1027,6 +1027,29 @@ ExpOperation* ExpEvaluator::popValue(ObjList& stack, GenObject* context) const
     return ok ? popOne(stack) : 0;
 }
 
+// Push a numeric or boolean result, overwrite one of the operands if possible
+static void pushNumber(ObjList& stack, int64_t val, bool boolean, ExpOperation* op1, ExpOperation* op2 = 0)
+{
+    ExpOperation* res = 0;
+    if (op2 && op2->reusable()) {
+	res = op2;
+	op2 = 0;
+    }
+    else if (op1 && op1->reusable()) {
+	res = op1;
+	op1 = 0;
+    }
+    TelEngine::destruct(op1);
+    TelEngine::destruct(op2);
+    if (res)
+	res->setNumber(val,boolean);
+    else if (boolean)
+	res = new ExpOperation(val != 0);
+    else
+	res = new ExpOperation(val);
+    ExpEvaluator::pushOne(stack,res);
+}
+
 bool ExpEvaluator::runOperation(ObjList& stack, const ExpOperation& oper, GenObject* context) const
 {
     DDebug(this,DebugAll,"runOperation(%p,%u,%p) %s",&stack,oper.opcode(),context,getOperator(oper.opcode()));
@@ -1147,12 +1170,21 @@ bool ExpEvaluator::runOperation(ObjList& stack, const ExpOperation& oper, GenObj
 		    case OpcEq:
 		    case OpcNe:
 		    {
-			ExpWrapper* w1 = YOBJECT(ExpWrapper,op1);
-			ExpWrapper* w2 = YOBJECT(ExpWrapper,op2);
-			if (op1->opcode() == op2->opcode() && w1 && w2)
-			    val = w1->object() == w2->object() ? 1 : 0;
-			else
-			    val = (*op1 == *op2) ? 1 : 0;
+			if (op1->isNumber() && op2->isNumber()) {
+			    // wrapped objects are never numbers
+			    if (op1->isInteger() && op2->isInteger())
+				val = (op1->number() == op2->number()) ? 1 : 0;
+			    else
+				val = (*op1 == *op2) ? 1 : 0;
+			}
+			else {
+			    ExpWrapper* w1 = YOBJECT(ExpWrapper,op1);
+			    ExpWrapper* w2 = YOBJECT(ExpWrapper,op2);
+			    if (op1->opcode() == op2->opcode() && w1 && w2)
+				val = w1->object() == w2->object() ? 1 : 0;
+			    else
+				val = (*op1 == *op2) ? 1 : 0;
+			}
 			if (oper.opcode() == OpcNe)
 			    val = val ? 0 : 1;
 			break;
@@ -1187,16 +1219,13 @@ bool ExpEvaluator::runOperation(ObjList& stack, const ExpOperation& oper, GenObj
 			}
 		    }
 		}
-		TelEngine::destruct(op1);
-		TelEngine::destruct(op2);
-		if (boolRes) {
-		    DDebug(this,DebugAll,"Bool result: '%s'",String::boolText(val != 0));
-		    pushOne(stack,new ExpOperation(val != 0));
-		}
-		else {
-		    DDebug(this,DebugAll,"Numeric result: " FMT64,val);
-		    pushOne(stack,new ExpOperation(val));
-		}
+#ifdef DEBUG
+		if (boolRes)
+		    Debug(this,DebugAll,"Bool result: '%s'",String::boolText(val != 0));
+		else
+		    Debug(this,DebugAll,"Numeric result: " FMT64,val);
+#endif
+		pushNumber(stack,val,boolRes,op1,op2);
 	    }
 	    break;
 	case OpcLAnd:
@@ -1220,10 +1249,8 @@ bool ExpEvaluator::runOperation(ObjList& stack, const ExpOperation& oper, GenObj
 		    default:
 			break;
 		}
-		TelEngine::destruct(op1);
-		TelEngine::destruct(op2);
 		DDebug(this,DebugAll,"Bool result: '%s'",String::boolText(val));
-		pushOne(stack,new ExpOperation(val));
+		pushNumber(stack,val,true,op1,op2);
 	    }
 	    break;
 	case OpcCat:
@@ -1265,19 +1292,21 @@ bool ExpEvaluator::runOperation(ObjList& stack, const ExpOperation& oper, GenObj
 		    return gotError("ExpEvaluator stack underflow",oper.lineNumber());
 		switch (oper.opcode()) {
 		    case OpcNeg:
-			pushOne(stack,new ExpOperation(-op->toNumber()));
+			{
+			    int64_t num = op->toNumber();
+			    pushNumber(stack,(num == ExpOperation::nonInteger()) ? num : -num,false,op);
+			}
 			break;
 		    case OpcNot:
-			pushOne(stack,new ExpOperation(~op->valInteger()));
+			pushNumber(stack,~op->valInteger(),false,op);
 			break;
 		    case OpcLNot:
-			pushOne(stack,new ExpOperation(!op->valBoolean()));
+			pushNumber(stack,op->valBoolean() ? 0 : 1,true,op);
 			break;
 		    default:
-			pushOne(stack,new ExpOperation(op->valInteger()));
+			pushNumber(stack,op->valInteger(),false,op);
 			break;
 		}
-		TelEngine::destruct(op);
 	    }
 	    break;
 	case OpcNullish:
@@ -1611,6 +1640,49 @@ void ExpEvaluator::dump(String& res, bool lineNo) const
     return dump(m_opcodes,res,lineNo);
 }
 
+// Format a number backwards in a local buffer, it's much cheaper than sprintf
+static void formatNumber(String& str, int64_t num)
+{
+    if (num == ExpOperation::nonInteger()) {
+	str = "NaN";
+	return;
+    }
+    char buf[24];
+    char* p = buf + sizeof(buf);
+    uint64_t n = (num < 0) ? -(uint64_t)num : (uint64_t)num;
+    do {
+	*--p = '0' + (char)(n % 10);
+	n /= 10;
+    } while (n);
+    if (num < 0)
+	*--p = '-';
+    str.assign(p,buf + sizeof(buf) - p);
+}
+
+void ExpOperation::setNumber(int64_t num, bool boolean)
+{
+    m_opcode = ExpEvaluator::OpcPush;
+    m_isNumber = true;
+    m_bool = boolean;
+    if (boolean) {
+	m_number = num ? 1 : 0;
+	String::operator=(String::boolText(num != 0));
+    }
+    else {
+	m_number = num;
+	formatNumber(*this,num);
+    }
+}
+
+int64_t ExpOperation::operator=(int64_t num)
+{
+    m_number = num;
+    m_isNumber = true;
+    m_bool = false;
+    formatNumber(*this,num);
+    return num;
+}
+
 int64_t ExpOperation::valInteger(int64_t defVal) const
 {
     return isInteger() ? number() : defVal;
@@ -28,6 +28,7 @@ using namespace TelEngine;
 namespace { // anonymous
 
 class ParseNested;
+class JsFieldSite;
 class JsRunner;
 class JsCodeStats;
 
@@ -51,7 +52,8 @@ public:
     virtual bool runFunction(ObjList& stack, const ExpOperation& oper, GenObject* context);
     virtual bool runField(ObjList& stack, const ExpOperation& oper, GenObject* context);
     virtual bool runAssign(ObjList& stack, const ExpOperation& oper, GenObject* context);
-    GenObject* resolve(ObjList& stack, String& name, GenObject* context);
+    GenObject* resolve(ObjList& stack, String& name, GenObject* context,
+	const JsFieldSite* site = 0, JsFieldCache** field = 0);
     bool runStringFunction(GenObject* obj, const String& name, ObjList& stack, const ExpOperation& oper, GenObject* context);
     bool runStringField(GenObject* obj, const String& name, ObjList& stack, const ExpOperation& oper, GenObject* context);
     void objCreated(GenObject* obj)
@@ -94,6 +96,103 @@ protected:
 	{ obj->ref(); }
 };
 
+// Field access or function call in linked code, holds lookup caches for
+//  each part of the already split name, all shared with its clones
+class JsFieldSite : public ExpOperation
+{
+public:
+    inline explicit JsFieldSite(const ExpOperation& original)
+	: ExpOperation(original), m_caches(0), m_field(0), m_parts(0), m_count(1), m_owned(true)
+	{
+	    if (name().find('.') >= 0) {
+		m_parts = name().split('.',true);
+		m_count = m_parts->count();
+	    }
+	    m_caches = new JsFieldCache[m_count];
+	    // a dotted name is looked up in parts by the context
+	    if (!m_parts)
+		m_field = m_caches;
+	}
+    inline JsFieldSite(const ExpOperation& original, const char* name, JsFieldCache* field)
+	: ExpOperation(original,name), m_caches(0), m_field(field), m_parts(0), m_count(0), m_owned(false)
+	{ }
+    virtual ~JsFieldSite()
+	{
+	    if (!m_owned)
+		return;
+	    delete[] m_caches;
+	    TelEngine::destruct(m_parts);
+	}
+    virtual void* getObject(const String& name) const
+	{
+	    if (name == YATOM("JsFieldCache"))
+		return m_field;
+	    if (name == YATOM("JsFieldSite"))
+		return const_cast<JsFieldSite*>(this);
+	    return ExpOperation::getObject(name);
+	}
+    virtual ExpOperation* clone(const char* name) const
+	{
+	    if (this->name() != name)
+		return ExpOperation::clone(name);
+	    JsFieldSite* site = new JsFieldSite(*this,name,m_field);
+	    site->m_caches = m_caches;
+	    site->m_parts = m_parts;
+	    site->m_count = m_count;
+	    return site;
+	}
+    inline const ObjList* parts() const
+	{ return m_parts; }
+    // Cache for looking up the part of the name at given index
+    inline JsFieldCache* cache(unsigned int index) const
+	{ return (index < m_count) ? m_caches + index : 0; }
+private:
+    JsFieldCache* m_caches;
+    JsFieldCache* m_field;
+    ObjList* m_parts;
+    unsigned int m_count;
+    bool m_owned;
+};
+
+// Sequential reader of a precompiled code image, any overrun marks it failed
+class JsImageReader
+{
+public:
+    inline JsImageReader(const DataBlock& data)
+	: m_buf((const uint8_t*)data.data()), m_len(data.length()), m_ok(true)
+	{ }
+    inline bool ok() const
+	{ return m_ok; }
+    inline bool atEnd() const
+	{ return m_ok && !m_len; }
+    inline unsigned int left() const
+	{ return m_len; }
+    inline bool fail()
+	{ return (m_ok = false); }
+    inline uint8_t get1()
+	{ return check(1) ? (m_len--, *m_buf++) : 0; }
+    inline uint32_t get4()
+	{ return check(4) ? DataBlock::ntoh4advance(m_buf,m_len) : 0; }
+    inline uint64_t get8()
+	{ return check(8) ? DataBlock::ntoh8advance(m_buf,m_len) : 0; }
+    inline bool get(String& str)
+	{
+	    unsigned int len = get4();
+	    if (!check(len))
+		return false;
+	    str.assign((const char*)m_buf,len);
+	    m_buf += len;
+	    m_len -= len;
+	    return true;
+	}
+private:
+    inline bool check(unsigned int len)
+	{ return (m_ok = m_ok && (len <= m_len)); }
+    const uint8_t* m_buf;
+    unsigned int m_len;
+    bool m_ok;
+};
+
 class JsCodeFile : public String
 {
 public:
@@ -187,6 +286,7 @@ public:
 	OpcInclude,
 	OpcRequire,
 	OpcPragma,
+	OpcLocal,
     };
     inline JsCode()
 	: ExpEvaluator(C),
@@ -212,6 +312,7 @@ public:
 	fileLine = getLineNo(line);
     }
     bool link();
+    unsigned int optimize();
     inline bool traceable() const
 	{ return m_traceable; }
     JsObject* parseArray(ParsePoint& expr, bool constOnly, ScriptMutex* mtx);
@@ -228,6 +329,8 @@ public:
     inline const String& getFileName(unsigned int line, bool wholePath = true) const
 	{ return getFileAt(getFileNo(line),wholePath); }
     bool scriptChanged() const;
+    bool saveImage(DataBlock& buf) const;
+    bool loadImage(JsImageReader& img);
 protected:
     inline void trace(bool allowed)
 	{ m_traceable = allowed; }
@@ -251,6 +354,7 @@ protected:
     virtual bool runFunction(ObjList& stack, const ExpOperation& oper, GenObject* context) const;
     virtual bool runField(ObjList& stack, const ExpOperation& oper, GenObject* context) const;
     virtual bool runAssign(ObjList& stack, const ExpOperation& oper, GenObject* context) const;
+    virtual void dump(const ExpOperation& oper, String& res, bool lineNo = false) const;
 private:
     ObjVector m_linked;
     ObjList m_included;
@@ -268,6 +372,17 @@ private:
     bool parseTry(ParsePoint& expr, GenObject* nested);
     bool parseFuncDef(ParsePoint& expr, bool publish);
     bool parseSimple(ParsePoint& expr, bool constOnly, ScriptMutex* mtx = 0);
+    void linkEntries();
+    void linkSites();
+    void linkCompact();
+    bool saveOp(DataBlock& buf, const ExpOperation* op, ObjList& objs) const;
+    bool saveObject(DataBlock& buf, const GenObject* obj, ObjList& objs) const;
+    ExpOperation* loadOp(JsImageReader& img, ObjList& objs);
+    GenObject* loadObject(JsImageReader& img, ObjList& objs);
+    unsigned int optimizeConstants(const bool* target);
+    unsigned int optimizeJumps(const bool* target);
+    unsigned int optimizeBlocks(const bool* target);
+    unsigned int optimizeLocals(const bool* target);
     bool evalList(ObjList& stack, GenObject* context) const;
     bool evalVector(ObjList& stack, GenObject* context) const;
     bool jumpToLabel(long int label, GenObject* context) const;
@@ -574,6 +689,7 @@ static const TokenDict s_internals[] =
     MAKEOP(Field),
     MAKEOP(Func),
     MAKEOP(Push),
+    MAKEOP(Drop),
     MAKEOP(Label),
     MAKEOP(Begin),
     MAKEOP(End),
@@ -584,12 +700,17 @@ static const TokenDict s_internals[] =
     MAKEOP(JRel),
     MAKEOP(JRelTrue),
     MAKEOP(JRelFalse),
+    MAKEOP(Local),
     { 0, 0 }
 };
 #undef MAKEOP
 
 static const ExpNull s_null;
 static const String s_noFile = "[no file]";
+// Precompiled code image header: "YJSI" and format version
+// Version 2 discards images with locals optimized across assignments
+static const uint32_t s_imageMagic = 0x594a5349;
+static const uint32_t s_imageVersion = 2;
 static const NativeFields s_nativeFields;
 
 void JsContext::destroyed()
@@ -611,17 +732,27 @@ GenObject* JsContext::resolveTop(ObjList& stack, const String& name, GenObject*
     return this;
 }
 
-GenObject* JsContext::resolve(ObjList& stack, String& name, GenObject* context)
+GenObject* JsContext::resolve(ObjList& stack, String& name, GenObject* context,
+    const JsFieldSite* site, JsFieldCache** field)
 {
     GenObject* obj = 0;
-    if (name.find('.') < 0)
+    // linked code provides the name already split
+    const ObjList* parts = site ? site->parts() : 0;
+    if (!parts && name.find('.') < 0) {
 	obj = resolveTop(stack,name,context);
+	if (field)
+	    *field = site ? site->cache(0) : 0;
+    }
     else {
-	ObjList* list = name.split('.',true);
+	ObjList* list = parts ? 0 : name.split('.',true);
+	if (!parts)
+	    parts = list;
 	name.clear();
-	for (ObjList* l = list->skipNull(); l; ) {
+	unsigned int idx = 0;
+	JsFieldCache* cache = 0;
+	for (const ObjList* l = parts->skipNull(); l; idx++) {
 	    const String* s = static_cast<const String*>(l->get());
-	    ObjList* l2 = l->skipNext();
+	    const ObjList* l2 = l->skipNext();
 	    if (TelEngine::null(s)) {
 		// consecutive dots - not good
 		obj = 0;
@@ -629,12 +760,15 @@ GenObject* JsContext::resolve(ObjList& stack, String& name, GenObject* context)
 	    }
 	    if (!obj)
 		obj = resolveTop(stack,*s,context);
+	    // caches are kept for single part names only
+	    cache = (site && name.null()) ? site->cache(idx) : 0;
 	    name.append(*s,".");
 	    if (!l2)
 		break;
 	    ExpExtender* ext = YOBJECT(ExpExtender,obj);
 	    if (ext) {
-		GenObject* adv = ext->getField(stack,name,context);
+		const JsObject* jso = cache ? YOBJECT(JsObject,obj) : 0;
+		GenObject* adv = jso ? cache->getField(stack,*jso,name,context) : ext->getField(stack,name,context);
 		XDebug(DebugAll,"JsContext::resolve advanced to '%s' of %p for '%s'",
 		    (adv ? adv->toString().c_str() : ""),ext,s->c_str());
 		if (adv) {
@@ -653,6 +787,8 @@ GenObject* JsContext::resolve(ObjList& stack, String& name, GenObject* context)
 	    }
 	    l = l2;
 	}
+	if (field)
+	    *field = obj ? cache : 0;
 	TelEngine::destruct(list);
     }
     DDebug(DebugAll,"JsContext::resolve got '%s' %p for '%s'",
@@ -664,11 +800,12 @@ bool JsContext::runFunction(ObjList& stack, const ExpOperation& oper, GenObject*
 {
     XDebug(DebugAll,"JsContext::runFunction '%s' line=0x%08x [%p]",oper.name().c_str(),oper.lineNumber(),this);
     String name = oper.name();
-    GenObject* o = resolve(stack,name,context);
+    JsFieldCache* field = 0;
+    GenObject* o = resolve(stack,name,context,YOBJECT(JsFieldSite,&oper),&field);
     if (o && o != this) {
 	ExpExtender* ext = YOBJECT(ExpExtender,o);
 	if (ext) {
-	    ExpOperation op(oper,name);
+	    JsFieldSite op(oper,name,field);
 	    return ext->runFunction(stack,op,context);
 	}
 	if (runStringFunction(o,name,stack,oper,context))
@@ -708,11 +845,15 @@ bool JsContext::runField(ObjList& stack, const ExpOperation& oper, GenObject* co
 {
     XDebug(DebugAll,"JsContext::runField '%s' [%p]",oper.name().c_str(),this);
     String name = oper.name();
-    GenObject* o = resolve(stack,name,context);
+    JsFieldCache* field = 0;
+    GenObject* o = resolve(stack,name,context,YOBJECT(JsFieldSite,&oper),&field);
     if (o && o != this) {
 	ExpExtender* ext = YOBJECT(ExpExtender,o);
 	if (ext) {
-	    ExpOperation op(oper,name);
+	    // a simple name resolves to itself, no need for a renamed copy
+	    if (name == oper.name())
+		return ext->runField(stack,oper,context);
+	    JsFieldSite op(oper,name,field);
 	    return ext->runField(stack,op,context);
 	}
 	if (runStringField(o,name,stack,oper,context))
@@ -977,6 +1118,8 @@ bool JsContext::runAssign(ObjList& stack, const ExpOperation& oper, GenObject* c
     if (o && o != this) {
 	ExpExtender* ext = YOBJECT(ExpExtender,o);
 	if (ext) {
+	    if (name == oper.name())
+		return ext->runAssign(stack,oper,context);
 	    ExpOperation* op = oper.clone(name);
 	    bool ok = ext->runAssign(stack,*op,context);
 	    TelEngine::destruct(op);
@@ -1135,22 +1278,869 @@ bool JsCode::link()
 	    m_linked.set(newJump,j);
 	}
     }
-    if (entries) {
-	m_entries = new JsEntry[entries+1];
-	unsigned int e = 0;
-	for (unsigned int j = 0; j < n; j++) {
-	    const ExpOperation* l = static_cast<const ExpOperation*>(m_linked[j]);
-	    if (l && l->barrier() && l->opcode() == OpcLabel && l->number() >= 0) {
-		m_entries[e].number = (long int)l->number();
-		m_entries[e++].index = j;
+    linkSites();
+    if (entries)
+	linkEntries();
+    return true;
+}
+
+// Give field accesses and function calls in linked code their own lookup cache
+void JsCode::linkSites()
+{
+    unsigned int n = m_linked.length();
+    for (unsigned int k = 0; k < n; k++) {
+	const ExpOperation* o = static_cast<const ExpOperation*>(m_linked[k]);
+	if (!o || o->barrier() || o->name().null())
+	    continue;
+	if (o->opcode() == OpcField || o->opcode() == OpcFunc)
+	    m_linked.set(new JsFieldSite(*o),k);
+    }
+}
+
+// Build the table of function entry points in linked code
+void JsCode::linkEntries()
+{
+    delete[] m_entries;
+    m_entries = 0;
+    unsigned int n = m_linked.length();
+    unsigned int entries = 0;
+    for (unsigned int j = 0; j < n; j++) {
+	const ExpOperation* l = static_cast<const ExpOperation*>(m_linked[j]);
+	if (l && l->barrier() && l->opcode() == OpcLabel && l->number() >= 0)
+	    entries++;
+    }
+    if (!entries)
+	return;
+    m_entries = new JsEntry[entries+1];
+    unsigned int e = 0;
+    for (unsigned int j = 0; j < n; j++) {
+	const ExpOperation* l = static_cast<const ExpOperation*>(m_linked[j]);
+	if (l && l->barrier() && l->opcode() == OpcLabel && l->number() >= 0) {
+	    m_entries[e].number = (long int)l->number();
+	    m_entries[e++].index = j;
+	}
+    }
+    m_entries[entries].number = -1;
+    m_entries[entries].index = 0;
+}
+
+static inline bool isRelJump(const ExpOperation* op)
+{
+    if (!op)
+	return false;
+    switch ((int)op->opcode()) {
+	case JsCode::OpcJRel:
+	case JsCode::OpcJRelTrue:
+	case JsCode::OpcJRelFalse:
+	    return true;
+    }
+    return false;
+}
+
+// Index of the first operation executed after a relative jump, -1 if invalid
+static inline long int relJumpDest(const ExpOperation* op, unsigned int index, unsigned int len)
+{
+    long int dest = (long int)index + 1 + (long int)op->number();
+    return (dest < 0 || dest > (long int)len) ? -1 : dest;
+}
+
+static ExpOperation* relJump(int opcode, long int offs, const ExpOperation& orig)
+{
+    ExpOperation* op = new ExpOperation((ExpEvaluator::Opcode)opcode,0,offs,orig.barrier());
+    op->lineNumber(orig.lineNumber());
+    return op;
+}
+
+// Check if an operation is a constant that can be evaluated at link time
+static inline bool isConstant(const ExpOperation* op)
+{
+    return op && (op->opcode() == ExpEvaluator::OpcPush) && !YOBJECT(ExpWrapper,op);
+}
+
+// Effect on stack of an operation that can be part of straight line code
+// Returns false for operations that do anything else than taking values
+//  from the stack and pushing a result back
+static bool stackEffect(const ExpOperation& op, unsigned int& pops, unsigned int& values, bool& push)
+{
+    int code = op.opcode();
+    pops = values = 0;
+    push = true;
+    switch (code) {
+	case ExpEvaluator::OpcPush:
+	case ExpEvaluator::OpcField:
+	case ExpEvaluator::OpcCopy:
+	case JsCode::OpcLocal:
+	    return true;
+	case ExpEvaluator::OpcNone:
+	case JsCode::OpcVar:
+	    push = false;
+	    return true;
+	case ExpEvaluator::OpcDrop:
+	    pops = 1;
+	    push = false;
+	    return true;
+	case ExpEvaluator::OpcAdd:
+	case ExpEvaluator::OpcSub:
+	case ExpEvaluator::OpcMul:
+	case ExpEvaluator::OpcDiv:
+	case ExpEvaluator::OpcMod:
+	case ExpEvaluator::OpcAnd:
+	case ExpEvaluator::OpcOr:
+	case ExpEvaluator::OpcXor:
+	case ExpEvaluator::OpcShl:
+	case ExpEvaluator::OpcShr:
+	case ExpEvaluator::OpcLAnd:
+	case ExpEvaluator::OpcLOr:
+	case ExpEvaluator::OpcCat:
+	case ExpEvaluator::OpcEq:
+	case ExpEvaluator::OpcNe:
+	case ExpEvaluator::OpcGt:
+	case ExpEvaluator::OpcLt:
+	case ExpEvaluator::OpcGe:
+	case ExpEvaluator::OpcLe:
+	case JsCode::OpcEqIdentity:
+	case JsCode::OpcNeIdentity:
+	    pops = values = 2;
+	    return true;
+	case ExpEvaluator::OpcNeg:
+	case ExpEvaluator::OpcNot:
+	case ExpEvaluator::OpcLNot:
+	case JsCode::OpcTypeof:
+	    pops = values = 1;
+	    return true;
+	case ExpEvaluator::OpcIncPre:
+	case ExpEvaluator::OpcDecPre:
+	case ExpEvaluator::OpcIncPost:
+	case ExpEvaluator::OpcDecPost:
+	    pops = 1;
+	    return true;
+	case JsCode::OpcIndex:
+	    pops = 2;
+	    values = 1;
+	    return true;
+    }
+    if ((code & ExpEvaluator::OpcAssign) && (code < ExpEvaluator::OpcPrivate)) {
+	// the assigned value is resolved, the lvalue field is not
+	pops = 2;
+	values = 1;
+	return true;
+    }
+    return false;
+}
+
+// Remove NULL entries from linked code, adjust the relative jumps over them
+void JsCode::linkCompact()
+{
+    unsigned int n = m_linked.length();
+    unsigned int* pos = new unsigned int[n + 1];
+    unsigned int k = 0;
+    for (unsigned int i = 0; i < n; i++) {
+	pos[i] = k;
+	if (m_linked[i])
+	    k++;
+    }
+    pos[n] = k;
+    if (k < n) {
+	for (unsigned int i = 0; i < n; i++) {
+	    const ExpOperation* o = static_cast<const ExpOperation*>(m_linked[i]);
+	    if (!isRelJump(o))
+		continue;
+	    long int dest = relJumpDest(o,i,n);
+	    if (dest < 0)
+		continue;
+	    long int offs = (long int)pos[dest] - (long int)pos[i] - 1;
+	    if (offs != (long int)o->number())
+		m_linked.set(relJump(o->opcode(),offs,*o),i);
+	}
+	m_linked.compact(true);
+    }
+    delete[] pos;
+}
+
+// Mark the places where execution may arrive other than by falling through
+static bool* linkTargets(const ObjVector& code)
+{
+    unsigned int n = code.length();
+    bool* target = new bool[n + 1];
+    for (unsigned int i = 0; i <= n; i++)
+	target[i] = false;
+    bool labelJumps = false;
+    for (unsigned int i = 0; i < n; i++) {
+	const ExpOperation* o = static_cast<const ExpOperation*>(code[i]);
+	if (!o)
+	    continue;
+	if (isRelJump(o)) {
+	    long int dest = relJumpDest(o,i,n);
+	    if (dest >= 0)
+		target[dest] = true;
+	    continue;
+	}
+	switch ((int)o->opcode()) {
+	    case ExpEvaluator::OpcLabel:
+		if (o->barrier())
+		    target[i] = true;
+		break;
+	    case JsCode::OpcJump:
+	    case JsCode::OpcJumpTrue:
+	    case JsCode::OpcJumpFalse:
+		labelJumps = true;
+		break;
+	}
+    }
+    if (labelJumps) {
+	// unlikely, jumps to labels that were not found at link time
+	for (unsigned int i = 0; i < n; i++) {
+	    const ExpOperation* o = static_cast<const ExpOperation*>(code[i]);
+	    if (o && o->opcode() == ExpEvaluator::OpcLabel)
+		target[i] = true;
+	}
+    }
+    return target;
+}
+
+// Optimize linked code, return number of changes made
+unsigned int JsCode::optimize()
+{
+    if (m_opcodes.skipNull() || !m_linked.length())
+	return 0;
+    unsigned int changes = 0;
+    // each pass may uncover more work for the others, repeat while something changes
+    for (unsigned int pass = 0; ; pass++) {
+	bool* target = linkTargets(m_linked);
+	unsigned int c = 0;
+	if (pass < 10) {
+	    c = optimizeConstants(target);
+	    if (!c)
+		c = optimizeJumps(target);
+	    if (!c)
+		c = optimizeBlocks(target);
+	}
+	if (!c) {
+	    // code flow is final, resolve local variables and stop
+	    changes += optimizeLocals(target);
+	    delete[] target;
+	    break;
+	}
+	delete[] target;
+	linkCompact();
+	changes += c;
+    }
+    linkEntries();
+    DDebug(this,DebugAll,"Optimized linked code with %u changes, %u operations left",
+	changes,m_linked.length());
+    return changes;
+}
+
+// Evaluate operations on constants, remove branches on constant conditions
+unsigned int JsCode::optimizeConstants(const bool* target)
+{
+    unsigned int changes = 0;
+    unsigned int n = m_linked.length();
+    for (unsigned int i = 0; i + 1 < n; i++) {
+	const ExpOperation* c1 = static_cast<const ExpOperation*>(m_linked[i]);
+	const ExpOperation* o = static_cast<const ExpOperation*>(m_linked[i + 1]);
+	if (!(o && isConstant(c1)) || target[i + 1])
+	    continue;
+	const ExpOperation* c2 = 0;
+	switch ((int)o->opcode()) {
+	    case OpcJRelTrue:
+	    case OpcJRelFalse:
+		if (c1->valBoolean() == ((JsOpcode)o->opcode() == OpcJRelTrue))
+		    m_linked.set(relJump(OpcJRel,(long int)o->number(),*o),i + 1);
+		else
+		    m_linked.set(0,i + 1);
+		m_linked.set(0,i);
+		changes++;
+		i++;
+		continue;
+	    case OpcNeg:
+	    case OpcNot:
+	    case OpcLNot:
+		break;
+	    default:
+		if (i + 2 >= n || target[i + 2] || !isConstant(o))
+		    continue;
+		c2 = o;
+		o = static_cast<const ExpOperation*>(m_linked[i + 2]);
+		if (!o)
+		    continue;
+		switch ((int)o->opcode()) {
+		    case OpcDiv:
+		    case OpcMod:
+			if (!c2->toNumber())
+			    continue;
+			// fall through
+		    case OpcAdd:
+		    case OpcSub:
+		    case OpcMul:
+		    case OpcAnd:
+		    case OpcOr:
+		    case OpcXor:
+		    case OpcShl:
+		    case OpcShr:
+		    case OpcLAnd:
+		    case OpcLOr:
+		    case OpcCat:
+		    case OpcEq:
+		    case OpcNe:
+		    case OpcGt:
+		    case OpcLt:
+		    case OpcGe:
+		    case OpcLe:
+			break;
+		    default:
+			continue;
+		}
+	}
+	ObjList stack;
+	pushOne(stack,c1->clone());
+	if (c2)
+	    pushOne(stack,c2->clone());
+	if (!ExpEvaluator::runOperation(stack,*o,0))
+	    continue;
+	ExpOperation* res = popOne(stack);
+	if (!res || stack.skipNull()) {
+	    TelEngine::destruct(res);
+	    continue;
+	}
+	res->lineNumber(o->lineNumber());
+	m_linked.set(res,i);
+	m_linked.set(0,i + 1);
+	if (c2)
+	    m_linked.set(0,++i + 1);
+	changes++;
+	i++;
+    }
+    return changes;
+}
+
+// Thread jumps to jumps, remove useless jumps and labels and unreachable code
+unsigned int JsCode::optimizeJumps(const bool* target)
+{
+    unsigned int changes = 0;
+    unsigned int n = m_linked.length();
+    bool labelJumps = false;
+    for (unsigned int i = 0; i < n && !labelJumps; i++) {
+	const ExpOperation* o = static_cast<const ExpOperation*>(m_linked[i]);
+	switch (o ? (int)o->opcode() : 0) {
+	    case OpcJump:
+	    case OpcJumpTrue:
+	    case OpcJumpFalse:
+		labelJumps = true;
+	}
+    }
+    for (unsigned int i = 0; i < n; i++) {
+	const ExpOperation* o = static_cast<const ExpOperation*>(m_linked[i]);
+	if (!o)
+	    continue;
+	if (isRelJump(o)) {
+	    long int dest = relJumpDest(o,i,n);
+	    if (dest < 0)
+		continue;
+	    long int final = dest;
+	    for (int hops = 0; hops < 16 && final < (long int)n; hops++) {
+		const ExpOperation* j = static_cast<const ExpOperation*>(m_linked[(unsigned int)final]);
+		if (!j || (JsOpcode)j->opcode() != OpcJRel)
+		    break;
+		long int d = relJumpDest(j,final,n);
+		if (d < 0 || d == final)
+		    break;
+		final = d;
+	    }
+	    if (final != dest) {
+		ExpOperation* jmp = relJump(o->opcode(),final - (long int)i - 1,*o);
+		m_linked.set(jmp,i);
+		o = jmp;
+		dest = final;
+		changes++;
+	    }
+	    if ((JsOpcode)o->opcode() != OpcJRel)
+		continue;
+	    if (dest == (long int)i + 1) {
+		m_linked.set(0,i);
+		changes++;
+		continue;
+	    }
+	}
+	else if (o->opcode() == OpcLabel) {
+	    // labels are no longer needed except for function entry points
+	    if (!(o->barrier() || labelJumps)) {
+		m_linked.set(0,i);
+		changes++;
+	    }
+	    continue;
+	}
+	else if ((JsOpcode)o->opcode() != OpcReturn)
+	    continue;
+	// nothing after an unconditional jump or return runs unless jumped to
+	while (i + 1 < n && !target[i + 1]) {
+	    if (m_linked[++i]) {
+		m_linked.set(0,i);
+		changes++;
+	    }
+	}
+    }
+    return changes;
+}
+
+// Remove block markers around straight code that leaves at most one value
+unsigned int JsCode::optimizeBlocks(const bool* target)
+{
+    unsigned int changes = 0;
+    unsigned int n = m_linked.length();
+    for (unsigned int i = 0; i < n; i++) {
+	const ExpOperation* o = static_cast<const ExpOperation*>(m_linked[i]);
+	if (!o || (JsOpcode)o->opcode() != OpcBegin)
+	    continue;
+	unsigned int depth = 0;
+	for (unsigned int j = i + 1; j < n && !target[j]; j++) {
+	    o = static_cast<const ExpOperation*>(m_linked[j]);
+	    if (!o)
+		continue;
+	    JsOpcode code = (JsOpcode)o->opcode();
+	    if (code == OpcEnd || code == OpcFlush) {
+		if (depth > 1)
+		    break;
+		if (code == OpcFlush && depth) {
+		    // flushing one value is same as dropping it
+		    ExpOperation* drop = new ExpOperation(OpcDrop);
+		    drop->lineNumber(o->lineNumber());
+		    m_linked.set(drop,j);
+		}
+		else
+		    m_linked.set(0,j);
+		m_linked.set(0,i);
+		changes++;
+		break;
+	    }
+	    unsigned int pops = 0;
+	    unsigned int values = 0;
+	    bool push = false;
+	    if (!stackEffect(*o,pops,values,push) || pops > depth)
+		break;
+	    depth -= pops;
+	    if (push)
+		depth++;
+	}
+    }
+    return changes;
+}
+
+// Replace fields that are read as values and are declared in the innermost
+//  function with operations that look them up directly in the call context
+// The lookup happens when the field is pushed, not when its value is used,
+//  so fields assigned before their value is used are left alone
+unsigned int JsCode::optimizeLocals(const bool* target)
+{
+    unsigned int n = m_linked.length();
+    // index of the function object of the innermost function owning each operation
+    long int* owner = new long int[n];
+    bool* read = new bool[n];
+    bool* changed = new bool[n];
+    for (unsigned int i = 0; i < n; i++) {
+	owner[i] = -1;
+	read[i] = false;
+	changed[i] = false;
+    }
+    // inner functions are pushed before the outer ones
+    for (unsigned int p = 0; p < n; p++) {
+	const ExpOperation* o = static_cast<const ExpOperation*>(m_linked[p]);
+	const JsFunction* func = (o && o->opcode() == OpcPush) ? YOBJECT(JsFunction,o) : 0;
+	if (!(func && func->label()))
+	    continue;
+	unsigned int entry = p;
+	for (unsigned int i = 0; i < p; i++) {
+	    o = static_cast<const ExpOperation*>(m_linked[i]);
+	    if (o && o->opcode() == OpcLabel && o->barrier() && (long int)o->number() == func->label()) {
+		entry = i;
+		break;
+	    }
+	}
+	for (unsigned int i = entry + 1; i < p; i++) {
+	    if (owner[i] < 0)
+		owner[i] = p;
+	}
+	NamedList locals("");
+	for (unsigned int idx = 0; func->formalName(idx); idx++)
+	    locals.addParam(*func->formalName(idx),"");
+	for (unsigned int i = entry + 1; i < p; i++) {
+	    o = static_cast<const ExpOperation*>(m_linked[i]);
+	    if (o && (owner[i] == (long int)p) && (JsOpcode)o->opcode() == OpcVar)
+		locals.setParam(o->name(),"");
+	}
+	if (!locals.count())
+	    continue;
+	// follow the stack in straight code to find which fields are read
+	long int sim[16];
+	unsigned int depth = 0;
+	for (unsigned int i = entry + 1; i < p; i++) {
+	    if (target[i] || owner[i] != (long int)p)
+		depth = 0;
+	    o = static_cast<const ExpOperation*>(m_linked[i]);
+	    if (!o || owner[i] != (long int)p)
+		continue;
+	    switch ((int)o->opcode()) {
+		case OpcJRelTrue:
+		case OpcJRelFalse:
+		case OpcReturn:
+		    if (depth && ((JsOpcode)o->opcode() != OpcReturn || o->valInteger()) && sim[depth - 1] >= 0)
+			read[sim[depth - 1]] = true;
+		    depth = 0;
+		    continue;
+	    }
+	    unsigned int pops = 0;
+	    unsigned int values = 0;
+	    bool push = false;
+	    if (!stackEffect(*o,pops,values,push) || pops > depth) {
+		depth = 0;
+		continue;
 	    }
+	    long int lvalue = -1;
+	    for (unsigned int v = 0; v < pops; v++) {
+		long int src = sim[--depth];
+		if (src < 0)
+		    continue;
+		if (v < values)
+		    read[src] = true;
+		else
+		    lvalue = src;
+	    }
+	    if (lvalue >= 0 && (o->opcode() != OpcIndex)) {
+		// fields of the same name still on stack would see the old value
+		const String& name = static_cast<const ExpOperation*>(m_linked[(unsigned int)lvalue])->name();
+		for (unsigned int d = 0; d < depth; d++) {
+		    if (sim[d] >= 0 && static_cast<const ExpOperation*>(m_linked[(unsigned int)sim[d]])->name() == name)
+			changed[sim[d]] = true;
+		}
+	    }
+	    if (!push)
+		continue;
+	    if (depth >= 16)
+		depth = 0;
+	    sim[depth++] = (o->opcode() == OpcField && locals.getParam(o->name())) ? (long int)i : -1;
 	}
-	m_entries[entries].number = -1;
-	m_entries[entries].index = 0;
     }
+    unsigned int changes = 0;
+    for (unsigned int i = 0; i < n; i++) {
+	if (!read[i] || changed[i])
+	    continue;
+	const ExpOperation* o = static_cast<const ExpOperation*>(m_linked[i]);
+	ExpOperation* local = new ExpOperation((Opcode)OpcLocal,o->name());
+	local->lineNumber(o->lineNumber());
+	m_linked.set(local,i);
+	changes++;
+    }
+    delete[] changed;
+    delete[] read;
+    delete[] owner;
+    return changes;
+}
+
+static inline void imagePut(DataBlock& buf, const String& str)
+{
+    buf.append4hton(str.length());
+    buf.append(str);
+}
+
+// Write linked code, included files and globals as a precompiled image
+bool JsCode::saveImage(DataBlock& buf) const
+{
+    unsigned int n = m_linked.length();
+    if (!n || m_opcodes.skipNull())
+	return false;
+    buf.append4hton(m_included.count());
+    for (const ObjList* l = m_included.skipNull(); l; l = l->skipNext()) {
+	const JsCodeFile* file = static_cast<const JsCodeFile*>(l->get());
+	// without a file time we could never tell if the image is stale
+	if (!file->fileTime())
+	    return false;
+	imagePut(buf,*file);
+	buf.append4hton(file->fileTime());
+    }
+    buf.append4hton(m_pragmas.count());
+    for (const ObjList* l = m_pragmas.paramList()->skipNull(); l; l = l->skipNext()) {
+	const NamedString* ns = static_cast<const NamedString*>(l->get());
+	imagePut(buf,ns->name());
+	imagePut(buf,*ns);
+    }
+    buf.append4hton(m_lineNo);
+    buf.append8hton((uint64_t)m_label);
+    // functions are shared between code and globals, keep track of them
+    ObjList objs;
+    buf.append4hton(m_globals.count());
+    for (const ObjList* l = m_globals.skipNull(); l; l = l->skipNext())
+	if (!saveOp(buf,static_cast<const ExpOperation*>(l->get()),objs))
+	    return false;
+    buf.append4hton(n);
+    for (unsigned int i = 0; i < n; i++)
+	if (!saveOp(buf,static_cast<const ExpOperation*>(m_linked[i]),objs))
+	    return false;
     return true;
 }
 
+bool JsCode::saveOp(DataBlock& buf, const ExpOperation* op, ObjList& objs) const
+{
+    if (!op) {
+	buf.append1('-');
+	return true;
+    }
+    const ExpWrapper* w = YOBJECT(ExpWrapper,op);
+    if (w) {
+	if (w->object() == s_null.object()) {
+	    buf.append1('N');
+	    buf.append4hton(op->lineNumber());
+	    imagePut(buf,op->name());
+	    return true;
+	}
+	// restored wrappers take their value from the held object
+	if (*op != (w->object() ? w->object()->toString() : String::empty()))
+	    return false;
+	if (op->barrier() && op->opcode() != OpcPush)
+	    return false;
+	buf.append1('W');
+	buf.append4hton(op->opcode());
+	buf.append1(op->barrier() ? 1 : 0);
+	buf.append4hton(op->lineNumber());
+	imagePut(buf,op->name());
+	return saveObject(buf,w->object(),objs);
+    }
+    if (YOBJECT(ExpFunction,op))
+	return false;
+    buf.append1('O');
+    buf.append4hton(op->opcode());
+    buf.append1((op->isNumber() ? 1 : 0) | (op->isBoolean() ? 2 : 0) | (op->barrier() ? 4 : 0));
+    buf.append8hton((uint64_t)op->number());
+    buf.append4hton(op->lineNumber());
+    imagePut(buf,op->name());
+    imagePut(buf,*op);
+    return true;
+}
+
+bool JsCode::saveObject(DataBlock& buf, const GenObject* obj, ObjList& objs) const
+{
+    if (!obj) {
+	buf.append1('-');
+	return true;
+    }
+    const JsFunction* jf = YOBJECT(JsFunction,obj);
+    if (jf) {
+	int idx = objs.index(jf);
+	if (idx >= 0) {
+	    buf.append1('f');
+	    buf.append4hton(idx);
+	    return true;
+	}
+	const String& name = jf->getFunc()->name();
+	// apply, call, length and optional name are set by the constructor
+	if (jf->frozen() || jf->params().count() != (name ? 4u : 3u))
+	    return false;
+	objs.append(const_cast<JsFunction*>(jf))->setDelete(false);
+	unsigned int argc = 0;
+	while (jf->formalName(argc))
+	    argc++;
+	buf.append1('F');
+	imagePut(buf,name);
+	buf.append4hton(jf->lineNo());
+	buf.append8hton((uint64_t)jf->label());
+	buf.append4hton(argc);
+	for (unsigned int i = 0; i < argc; i++)
+	    imagePut(buf,*jf->formalName(i));
+	return true;
+    }
+    const JsRegExp* rex = YOBJECT(JsRegExp,obj);
+    if (rex) {
+	if (rex->frozen() || rex->params().count() != 2)
+	    return false;
+	buf.append1('R');
+	imagePut(buf,rex->toString());
+	imagePut(buf,rex->regexp());
+	buf.append4hton(rex->lineNo());
+	buf.append1((rex->regexp().isCaseInsensitive() ? 1 : 0) | (rex->regexp().isExtended() ? 2 : 0));
+	return true;
+    }
+    // only the constant Array and Object literals built by the parser
+    const JsArray* jsa = YOBJECT(JsArray,obj);
+    const JsObject* jso = jsa ? jsa : YOBJECT(JsObject,obj);
+    if (!jso || jso->frozen()
+	|| (jso->toString() != (jsa ? YSTRING("[object Array]") : YSTRING("[object Object]"))))
+	return false;
+    buf.append1(jsa ? 'A' : 'J');
+    buf.append4hton(jso->lineNo());
+    buf.append4hton(jsa ? jsa->length() : 0);
+    buf.append4hton(jso->params().count());
+    for (const ObjList* l = jso->params().paramList()->skipNull(); l; l = l->skipNext()) {
+	const ExpOperation* op = YOBJECT(ExpOperation,l->get());
+	if (!(op && saveOp(buf,op,objs)))
+	    return false;
+    }
+    return true;
+}
+
+// Restore code saved by saveImage(), fails if any included file changed
+bool JsCode::loadImage(JsImageReader& img)
+{
+    unsigned int n = img.get4();
+    for (unsigned int i = 0; img.ok() && i < n; i++) {
+	String file;
+	img.get(file);
+	unsigned int fTime = img.get4();
+	unsigned int t = 0;
+	if (!(img.ok() && File::getFileTime(file,t) && (t == fTime)))
+	    return false;
+	m_included.append(new JsCodeFile(file,fTime));
+    }
+    n = img.get4();
+    for (unsigned int i = 0; img.ok() && i < n; i++) {
+	String name;
+	String value;
+	img.get(name);
+	if (img.get(value))
+	    m_pragmas.addParam(name,value);
+    }
+    m_lineNo = img.get4();
+    m_label = (long int)img.get8();
+    ObjList objs;
+    n = img.get4();
+    for (unsigned int i = 0; img.ok() && i < n; i++) {
+	ExpOperation* op = loadOp(img,objs);
+	if (op)
+	    m_globals.append(op);
+    }
+    n = img.get4();
+    // every operation takes at least one byte
+    if (!(img.ok() && n && (n <= img.left())))
+	return false;
+    m_linked.resize(n);
+    for (unsigned int i = 0; img.ok() && i < n; i++) {
+	ExpOperation* op = loadOp(img,objs);
+	if (op)
+	    m_linked.set(op,i);
+    }
+    if (!img.atEnd())
+	return false;
+    linkSites();
+    linkEntries();
+    return true;
+}
+
+ExpOperation* JsCode::loadOp(JsImageReader& img, ObjList& objs)
+{
+    String name;
+    switch (img.get1()) {
+	case '-':
+	    return 0;
+	case 'N':
+	    {
+		unsigned int line = img.get4();
+		if (!img.get(name))
+		    return 0;
+		ExpOperation* op = s_null.clone(name);
+		op->lineNumber(line);
+		return op;
+	    }
+	case 'W':
+	    {
+		Opcode oper = (Opcode)img.get4();
+		bool barrier = (0 != img.get1());
+		unsigned int line = img.get4();
+		if (!img.get(name))
+		    return 0;
+		GenObject* obj = loadObject(img,objs);
+		if (!img.ok()) {
+		    TelEngine::destruct(obj);
+		    return 0;
+		}
+		ExpOperation* op = (OpcPush == oper) ? new ExpWrapper(obj,name,barrier) : new ExpWrapper(oper,obj,name);
+		op->lineNumber(line);
+		return op;
+	    }
+	case 'O':
+	    {
+		Opcode oper = (Opcode)img.get4();
+		uint8_t flags = img.get1();
+		int64_t number = (int64_t)img.get8();
+		unsigned int line = img.get4();
+		String value;
+		img.get(name);
+		if (!img.get(value))
+		    return 0;
+		return new ExpOperation(oper,name,value,number,
+		    0 != (flags & 1),0 != (flags & 2),line,0 != (flags & 4));
+	    }
+    }
+    img.fail();
+    return 0;
+}
+
+GenObject* JsCode::loadObject(JsImageReader& img, ObjList& objs)
+{
+    String name;
+    uint8_t type = img.get1();
+    switch (type) {
+	case '-':
+	    return 0;
+	case 'f':
+	    {
+		JsFunction* jf = static_cast<JsFunction*>(objs[(int)img.get4()]);
+		if (jf && jf->ref())
+		    return jf;
+	    }
+	    break;
+	case 'F':
+	    {
+		img.get(name);
+		unsigned int line = img.get4();
+		long int lbl = (long int)img.get8();
+		unsigned int argc = img.get4();
+		ObjList args;
+		for (unsigned int i = 0; img.ok() && i < argc; i++) {
+		    String* arg = new String;
+		    args.append(arg);
+		    img.get(*arg);
+		}
+		if (!img.ok())
+		    return 0;
+		JsFunction* jf = new JsFunction(0,name,line,&args,lbl,this);
+		objs.append(jf)->setDelete(false);
+		return jf;
+	    }
+	case 'R':
+	    {
+		String rex;
+		img.get(name);
+		img.get(rex);
+		unsigned int line = img.get4();
+		uint8_t flags = img.get1();
+		if (!img.ok())
+		    return 0;
+		return new JsRegExp(0,name,line,rex,0 != (flags & 1),0 != (flags & 2));
+	    }
+	case 'A':
+	case 'J':
+	    {
+		unsigned int line = img.get4();
+		int32_t len = (int32_t)img.get4();
+		unsigned int n = img.get4();
+		JsObject* jso = ('A' == type) ? new JsArray(0,"[object Array]",line)
+		    : new JsObject(0,"[object Object]",line);
+		for (unsigned int i = 0; img.ok() && i < n; i++) {
+		    ExpOperation* op = loadOp(img,objs);
+		    if (op)
+			jso->params().addParam(op);
+		}
+		if (!img.ok()) {
+		    TelEngine::destruct(jso);
+		    return 0;
+		}
+		if ('A' == type)
+		    static_cast<JsArray*>(jso)->setLength(len);
+		return jso;
+	    }
+    }
+    img.fail();
+    return 0;
+}
+
 const String& JsCode::getFileAt(unsigned int index, bool wholePath) const
 {
     if (!index)
@@ -2413,6 +3403,29 @@ bool JsCode::runOperation(ObjList& stack, const ExpOperation& oper, GenObject* c
 		}
 	    }
 	    break;
+	case OpcLocal:
+	    {
+		// variable of current function, look it up directly in call context
+		JsObject* ctxt = 0;
+		for (ObjList* l = stack.skipNull(); l; l = l->skipNext()) {
+		    const ExpOperation* op = static_cast<const ExpOperation*>(l->get());
+		    if (op->barrier() && op->name() == YSTRING("()")) {
+			ctxt = YOBJECT(JsObject,op);
+			break;
+		    }
+		}
+		if (ctxt && ctxt->params().getParam(oper.name())) {
+		    if (!ctxt->runField(stack,oper,context))
+			return gotError("Could not evaluate field '" + oper.name() + "'",oper.lineNumber());
+		    break;
+		}
+		// not created yet or not in a function, resolve it the usual way
+		ExpOperation fld(OpcField,oper.name());
+		fld.lineNumber(oper.lineNumber());
+		if (!runField(stack,fld,context))
+		    return gotError("Could not evaluate field '" + oper.name() + "'",oper.lineNumber());
+	    }
+	    break;
 	case OpcNew:
 	    {
 		ExpOperation* op = popOne(stack);
@@ -3057,10 +4070,21 @@ void JsCode::dump(String& res, bool lineNo) const
 	    continue;
 	if (res)
 	    res << " ";
-	ExpEvaluator::dump(*o,res,lineNo);
+	dump(*o,res,lineNo);
     }
 }
 
+void JsCode::dump(const ExpOperation& oper, String& res, bool lineNo) const
+{
+    if ((JsOpcode)oper.opcode() != OpcLocal)
+	return ExpEvaluator::dump(oper,res,lineNo);
+    // show local variables as fields with a marker
+    ExpOperation fld(OpcField,oper.name());
+    fld.lineNumber(oper.lineNumber());
+    res << getOperator(oper.opcode());
+    ExpEvaluator::dump(fld,res,lineNo);
+}
+
 
 ScriptRun::Status JsRunner::reset(bool init)
 {
@@ -3890,6 +4914,7 @@ bool JsParser::parse(const char* text, bool fragment, const char* file, int len)
     if (fragment)
 	return jsc && jsc->compile(expr,this);
     m_parsedFile.clear();
+    m_fromImage = false;
     jsc = new JsCode;
     setCode(jsc);
     jsc->deref();
@@ -3909,6 +4934,8 @@ bool JsParser::parse(const char* text, bool fragment, const char* file, int len)
     DDebug(DebugAll,"Simplified: %s",jsc->ExpEvaluator::dump().c_str());
     if (m_allowLink) {
 	jsc->link();
+	if (m_allowOptimize)
+	    jsc->optimize();
 #ifdef DEBUG
 #ifdef XDEBUG
 	Debug(DebugAll,"Linked: %s",jsc->ExpEvaluator::dump(true).c_str());
@@ -3921,6 +4948,94 @@ bool JsParser::parse(const char* text, bool fragment, const char* file, int len)
     return true;
 }
 
+// Parse a script file or load it from the precompiled image cache
+bool JsParser::parseFile(const char* name, bool fragment)
+{
+    // only linked code can be saved as image
+    if (fragment || !m_allowLink || m_imagePath.null() || TelEngine::null(name))
+	return ScriptParser::parseFile(name,fragment);
+    String image;
+    image << name << "\n" << m_basePath << "\n" << m_includePath;
+    image = m_imagePath + MD5(image).hexDigest() + (m_allowOptimize ? ".jso" : ".jsi");
+    if (loadImage(image,name)) {
+	m_fromImage = true;
+	return true;
+    }
+    if (!ScriptParser::parseFile(name,false))
+	return false;
+    saveImage(image);
+    return true;
+}
+
+// Load code from a precompiled image if it was made from the same script
+bool JsParser::loadImage(const String& file, const char* script)
+{
+    File f;
+    if (!f.openPath(file,false,true,false,false,true))
+	return false;
+    int64_t len = f.length();
+    if (len <= 0 || len > 16 * (int64_t)maxFileLen())
+	return false;
+    DataBlock buf(0,(unsigned int)len);
+    if (f.readData(buf.data(),buf.length()) != len)
+	return false;
+    f.terminate();
+    JsImageReader img(buf);
+    String str;
+    if (img.get4() != s_imageMagic || img.get4() != s_imageVersion
+	|| img.get4() != (uint32_t)JsCode::OpcLocal || img.get1() != (m_allowOptimize ? 1 : 0))
+	return false;
+    if (!(img.get(str) && (str == script) && img.get(str) && (str == m_basePath)
+	&& img.get(str) && (str == m_includePath)))
+	return false;
+    JsCode* jsc = new JsCode;
+    if (!jsc->loadImage(img)) {
+	DDebug(DebugInfo,"Discarding stale or invalid image '%s' of '%s'",file.c_str(),script);
+	TelEngine::destruct(jsc);
+	return false;
+    }
+    m_parsedFile = script;
+    setCode(jsc);
+    jsc->deref();
+    jsc->trace(m_allowTrace);
+    DDebug(DebugAll,"Loaded '%s' from image '%s'",script,file.c_str());
+    return true;
+}
+
+// Save the linked code to a precompiled image file
+bool JsParser::saveImage(const String& file) const
+{
+    const JsCode* jsc = static_cast<const JsCode*>(code());
+    if (!jsc)
+	return false;
+    DataBlock buf;
+    buf.append4hton(s_imageMagic);
+    buf.append4hton(s_imageVersion);
+    buf.append4hton(JsCode::OpcLocal);
+    buf.append1(m_allowOptimize ? 1 : 0);
+    imagePut(buf,m_parsedFile);
+    imagePut(buf,m_basePath);
+    imagePut(buf,m_includePath);
+    if (!jsc->saveImage(buf)) {
+	Debug(DebugNote,"Script '%s' can not be saved as precompiled image",m_parsedFile.c_str());
+	return false;
+    }
+    // write aside and rename so concurrent loaders never see a partial image
+    String tmp;
+    tmp << file << "." << (unsigned int)Random::random();
+    File f;
+    bool ok = f.openPath(tmp,true,false,true,false,true)
+	&& (f.writeData(buf.data(),buf.length()) == (int)buf.length());
+    f.terminate();
+    if (ok)
+	ok = File::rename(tmp,file);
+    if (!ok) {
+	File::remove(tmp);
+	Debug(DebugMild,"Failed to save precompiled image '%s' of '%s'",file.c_str(),m_parsedFile.c_str());
+    }
+    return ok;
+}
+
 // Check if the script, path or any included files have changed
 bool JsParser::scriptChanged(const char* file) const
 {
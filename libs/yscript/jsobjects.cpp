@@ -749,7 +749,8 @@ static bool internalResolveReferences(ExpOperation* root, ExpWrapper* wrap, Recu
 	}
     }
     else if (jso) {
-	for (ObjList* o = jso->params().paramList()->skipNull(); o; o = o->skipNext()) {
+	const NamedList& props = jso->params();
+	for (const ObjList* o = props.paramList()->skipNull(); o; o = o->skipNext()) {
 	    wrap = YOBJECT(ExpWrapper,o->get());
 	    if (!wrap)
 		continue;
@@ -974,7 +975,8 @@ void JsObject::internalToJSON(const GenObject* obj, bool isStr, String& buf, int
 		buf << "{}";
 		return;
 	}
-	ObjList* l = jso->params().paramList()->skipNull();
+	const NamedList& props = jso->params();
+	ObjList* l = props.paramList()->skipNull();
 	String li(' ',indent);
 	String ci(' ',indent + spaces);
 	const char* sep = spaces ? ": " : ":";
@@ -1081,6 +1083,97 @@ NamedString* JsObject::getField(ObjList& stack, const String& name, GenObject* c
     return 0;
 }
 
+// Search native parameters from the end of a prototype chain to its start
+static inline NamedString* nativeField(const ScriptContext* const* objs, unsigned int depth, const String& name)
+{
+    while (depth--) {
+	NamedList* np = objs[depth]->nativeParams();
+	NamedString* fld = np ? np->getParam(name) : 0;
+	if (fld)
+	    return fld;
+    }
+    return 0;
+}
+
+JsFieldCache::JsFieldCache()
+    : m_seq(0), m_depth(0), m_field(0)
+{
+    m_objects[0] = 0;
+}
+
+NamedString* JsFieldCache::getField(ObjList& stack, const JsObject& obj, const String& name, GenObject* context)
+{
+#ifdef ATOMIC_OPS
+    // locals of call frames change too often to be worth caching
+    if (obj.toString() == YSTRING("()"))
+	return obj.getField(stack,name,context);
+    const ScriptContext* objs[MaxDepth];
+    unsigned int vers[MaxDepth];
+    unsigned int depth = 0;
+    NamedString* fld = 0;
+    // the entry is consistent only if no writer changed it while we copied
+    unsigned int seq = m_seq;
+    if (!(seq & 1) && (m_objects[0] == &obj)) {
+	__sync_synchronize();
+	depth = m_depth;
+	fld = m_field;
+	for (unsigned int i = 0; i < depth && i < MaxDepth; i++) {
+	    objs[i] = m_objects[i];
+	    vers[i] = m_versions[i];
+	}
+	__sync_synchronize();
+	if (seq != m_seq || objs[0] != &obj)
+	    depth = 0;
+	// each unchanged object keeps alive the prototype that follows it
+	for (unsigned int i = 0; i < depth; i++) {
+	    if (!objs[i]->fieldsVersion(vers[i])) {
+		depth = 0;
+		break;
+	    }
+	}
+	if (depth)
+	    return fld ? fld : nativeField(objs,depth,name);
+    }
+    // slow path, walk the prototype chain as JsObject::getField() does
+    fld = 0;
+    for (const ScriptContext* o = &obj; o; ) {
+	if (depth >= MaxDepth)
+	    return obj.getField(stack,name,context);
+	objs[depth] = o;
+	vers[depth++] = o->fieldsVersion();
+	fld = o->params().getParam(name);
+	if (fld)
+	    break;
+	o = YOBJECT(ScriptContext,o->params().getParam(JsObject::protoName()));
+	if (o && !YOBJECT(JsObject,o))
+	    return obj.getField(stack,name,context);
+    }
+    seq = m_seq;
+    if (!(seq & 1) && __sync_bool_compare_and_swap(&m_seq,seq,seq + 1)) {
+	m_depth = depth;
+	m_field = fld;
+	for (unsigned int i = 0; i < depth; i++) {
+	    m_objects[i] = objs[i];
+	    m_versions[i] = vers[i];
+	}
+	__sync_synchronize();
+	m_seq = seq + 2;
+    }
+    return fld ? fld : nativeField(objs,depth,name);
+#else
+    return obj.getField(stack,name,context);
+#endif
+}
+
+// Retrieve a field through the inline cache of the code location, if any
+static inline NamedString* siteField(const JsObject& obj, ObjList& stack, const ExpOperation& oper, GenObject* context)
+{
+    JsFieldCache* cache = YOBJECT(JsFieldCache,&oper);
+    if (cache)
+	return cache->getField(stack,obj,oper.name(),context);
+    return obj.getField(stack,oper.name(),context);
+}
+
 JsObject* JsObject::runConstructor(ObjList& stack, const ExpOperation& oper, GenObject* context)
 {
     if (!ref())
@@ -1094,7 +1187,7 @@ bool JsObject::runFunction(ObjList& stack, const ExpOperation& oper, GenObject*
 {
     XDebug(DebugInfo,"JsObject::runFunction() '%s' in '%s' [%p]",
 	oper.name().c_str(),toString().c_str(),this);
-    NamedString* param = getField(stack,oper.name(),context);
+    NamedString* param = siteField(*this,stack,oper,context);
     if (!param)
 	return false;
     ExpFunction* ef = YOBJECT(ExpFunction,param);
@@ -1114,8 +1207,14 @@ bool JsObject::runField(ObjList& stack, const ExpOperation& oper, GenObject* con
 {
     XDebug(DebugAll,"JsObject::runField() '%s' in '%s' [%p]",
 	oper.name().c_str(),toString().c_str(),this);
-    const String* param = getField(stack,oper.name(),context);
+    const String* param = siteField(*this,stack,oper,context);
     if (param) {
+	ExpOperation* o = YOBJECT(ExpOperation,param);
+	if (o && o->isNumber()) {
+	    // numbers and booleans are never functions or wrapped objects
+	    ExpEvaluator::pushOne(stack,new ExpOperation(*o,oper.name(),false));
+	    return true;
+	}
 	ExpFunction* ef = YOBJECT(ExpFunction,param);
 	if (ef)
 	    ExpEvaluator::pushOne(stack,ef->ExpOperation::clone());
@@ -1127,10 +1226,8 @@ bool JsObject::runField(ObjList& stack, const ExpOperation& oper, GenObject* con
 		JsObject* jso = YOBJECT(JsObject,param);
 		if (jso && jso->ref())
 		    ExpEvaluator::pushOne(stack,new ExpWrapper(jso,oper.name()));
-		else {
-		    ExpOperation* o = YOBJECT(ExpOperation,param);
+		else
 		    ExpEvaluator::pushOne(stack,o ? new ExpOperation(*o,oper.name(),false) : new ExpOperation(*param,oper.name(),true));
-		}
 	    }
 	}
     }
@@ -1147,6 +1244,10 @@ bool JsObject::runAssign(ObjList& stack, const ExpOperation& oper, GenObject* co
 	Debug(DebugWarn,"Object '%s' is frozen",toString().c_str());
 	return false;
     }
+    if (oper.isNumber()) {
+	params().setParam(oper.clone());
+	return true;
+    }
     ExpFunction* ef = YOBJECT(ExpFunction,&oper);
     if (ef)
 	params().setParam(ef->ExpOperation::clone());
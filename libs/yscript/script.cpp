@@ -108,11 +108,30 @@ void* ScriptContext::getObject(const String& name) const
 	return const_cast<ScriptContext*>(this);
     if (name == YATOM("ExpExtender"))
 	return const_cast<ExpExtender*>(static_cast<const ExpExtender*>(this));
-    if (name == YATOM("NamedList"))
+    if (name == YATOM("NamedList")) {
+	// caller may modify the list so cached lookups must be invalidated
+	m_fieldsCached = false;
 	return const_cast<NamedList*>(&m_params);
+    }
     return RefObject::getObject(name);
 }
 
+// Unique version of fields, allows caching lookups by object identity
+static unsigned int s_fieldsVersion = 0;
+
+unsigned int ScriptContext::fieldsVersion() const
+{
+    if (!m_fieldsCached) {
+#ifdef ATOMIC_OPS
+	m_fieldsVersion = __sync_add_and_fetch(&s_fieldsVersion,1);
+#else
+	m_fieldsVersion = ++s_fieldsVersion;
+#endif
+	m_fieldsCached = true;
+    }
+    return m_fieldsVersion;
+}
+
 bool ScriptContext::hasField(ObjList& stack, const String& name, GenObject* context) const
 {
     return m_params.getParam(name) != 0;
@@ -138,7 +157,7 @@ bool ScriptContext::runField(ObjList& stack, const ExpOperation& oper, GenObject
 bool ScriptContext::runAssign(ObjList& stack, const ExpOperation& oper, GenObject* context)
 {
     XDebug(DebugAll,"ScriptContext::runAssign '%s'='%s'",oper.name().c_str(),oper.c_str());
-    m_params.setParam(oper.name(),oper);
+    params().setParam(oper.name(),oper);
     return true;
 }
 
@@ -195,7 +214,7 @@ void ScriptContext::addFields(const NamedList& list, const char* skipPrefix)
     for (const ObjList* o = list.paramList()->skipNull(); o; o = o->skipNext()) {
 	const NamedString* p = static_cast<const NamedString*>(o->get());
 	if (!(skipPrefix && p->name().startsWith(skipPrefix)))
-	    m_params.addParam(new ExpOperation(p->c_str(),p->name()));
+	    params().addParam(new ExpOperation(p->c_str(),p->name()));
     }
 }
 
@@ -1179,10 +1179,10 @@ public:
      * @param name Optional of the newly created constant
      */
     inline explicit ExpOperation(int64_t value, const char* name = 0)
-	: NamedString(name,"NaN"),
+	: NamedString(name),
 	  m_opcode(ExpEvaluator::OpcPush),
 	  m_number(value), m_bool(false), m_isNumber(true), m_lineNo(0), m_barrier(false)
-	{ if (value != nonInteger()) String::operator=(value); }
+	{ setNumber(value); }
 
     /**
      * Push Boolean constructor
@@ -1236,6 +1236,24 @@ public:
 	  m_lineNo(0), m_barrier(barrier)
 	{ }
 
+    /**
+     * Constructor from all components, used to restore saved operations
+     * @param oper Operation code
+     * @param name Name of the operation or result
+     * @param value String value of operation
+     * @param number Integer value
+     * @param isNumber True if the operation holds a numeric value
+     * @param isBoolean True if the operation holds a boolean value
+     * @param line Line number in source code
+     * @param barrier True if the operation is an expression barrier on the stack
+     */
+    inline ExpOperation(ExpEvaluator::Opcode oper, const char* name, const char* value,
+	int64_t number, bool isNumber, bool isBoolean, unsigned int line, bool barrier)
+	: NamedString(name,value),
+	  m_opcode(oper), m_number(number), m_bool(isBoolean), m_isNumber(isNumber),
+	  m_lineNo(line), m_barrier(barrier)
+	{ }
+
     /**
      * Retrieve the code of this operation
      * @return Operation code as declared in the expression evaluator
@@ -1292,13 +1310,28 @@ public:
     inline void lineNumber(unsigned int line)
 	{ m_lineNo = line; }
 
+    /**
+     * Check if this is a plain unnamed numeric value that an operation can
+     *  overwrite with its result instead of allocating a new one
+     * @return True if the value can be reused in place
+     */
+    inline bool reusable() const
+	{ return m_isNumber && (ExpEvaluator::OpcPush == m_opcode) && name().null(); }
+
+    /**
+     * Store a number or boolean value and turn this into a pushed value.
+     * The string representation is formatted without going through printf
+     * @param num Numeric value to store, nonInteger() for NaN
+     * @param boolean True to store a boolean value
+     */
+    void setNumber(int64_t num, bool boolean = false);
+
     /**
      * Number assignment operator
      * @param num Numeric value to assign to the operation
      * @return Assigned number
      */
-    inline int64_t operator=(int64_t num)
-	{ m_number = num; String::operator=(num); m_isNumber = true; return num; }
+    int64_t operator=(int64_t num);
 
     /**
      * Retrieve the numeric value of the operation
@@ -1781,7 +1814,8 @@ public:
      * @param name Name of the context
      */
     inline explicit ScriptContext(const char* name = 0)
-	: m_params(name), m_instIdx(0), m_instCount(1), m_terminated(false)
+	: m_params(name), m_instIdx(0), m_instCount(1), m_terminated(false),
+	  m_fieldsVersion(0), m_fieldsCached(false)
 	{ }
 
     /**
@@ -1789,7 +1823,7 @@ public:
      * @return Reference to the internal named list
      */
     inline NamedList& params()
-	{ return m_params; }
+	{ m_fieldsCached = false; return m_params; }
 
     /**
      * Const access to the NamedList operator
@@ -1798,6 +1832,21 @@ public:
     inline const NamedList& params() const
 	{ return m_params; }
 
+    /**
+     * Retrieve the version of the fields for use by field lookup caches.
+     * Any later non-const access to the parameters changes the version
+     * @return Version of the fields, unique among all contexts
+     */
+    unsigned int fieldsVersion() const;
+
+    /**
+     * Check if the fields did not change since a version was retrieved
+     * @param version Version previously returned by fieldsVersion()
+     * @return True if the fields are still at the given version
+     */
+    inline bool fieldsVersion(unsigned int version) const
+	{ return m_fieldsCached && (m_fieldsVersion == version); }
+
     /**
      * Access any native NamedList hold by the context
      * @return Pointer to a native named list
@@ -1986,6 +2035,8 @@ private:
     unsigned int m_instIdx; // instance index
     unsigned int m_instCount; // total number of instances
     bool m_terminated;                   // Context was terminated. Variables were cleared
+    mutable unsigned int m_fieldsVersion; // Version of fields seen by caches
+    mutable bool m_fieldsCached;         // Version was retrieved and fields not changed since
 };
 
 /**
@@ -3139,6 +3190,44 @@ private:
     unsigned int m_lineNo; // creation line for this object;
 };
 
+/**
+ * Inline cache of a field lookup, attached to a field access or function call
+ *  site of linked code. It remembers where a field was last found, along the
+ *  prototype chain or in the native parameters, keyed by identity and fields
+ *  version of the objects involved. Sites can be run by several threads at once
+ * @short Field lookup cache of a code location
+ */
+class YSCRIPT_API JsFieldCache
+{
+public:
+    /**
+     * Maximum number of objects along the prototype chain the cache can follow
+     */
+    enum { MaxDepth = 4 };
+
+    /**
+     * Constructor, creates an empty cache
+     */
+    JsFieldCache();
+
+    /**
+     * Retrieve a field of an object, same as JsObject::getField()
+     * @param stack Evaluation stack in use
+     * @param obj Object to retrieve the field from
+     * @param name Name of the field to retrieve
+     * @param context Pointer to arbitrary object passed from evaluation methods
+     * @return Pointer to field, NULL if not present
+     */
+    NamedString* getField(ObjList& stack, const JsObject& obj, const String& name, GenObject* context);
+
+private:
+    volatile unsigned int m_seq;
+    unsigned int m_depth;
+    const ScriptContext* m_objects[MaxDepth];
+    unsigned int m_versions[MaxDepth];
+    NamedString* m_field;
+};
+
 /**
  * Javascript Function class, implements user defined functions
  * @short Javascript Function
@@ -3686,7 +3775,8 @@ public:
      * @param allowTrace True to allow the script to enable performance tracing
      */
     inline JsParser(bool allowLink = true, bool allowTrace = false)
-	: m_allowLink(allowLink), m_allowTrace(allowTrace)
+	: m_allowLink(allowLink), m_allowTrace(allowTrace), m_allowOptimize(false),
+	  m_fromImage(false)
 	{ }
 
     /**
@@ -3699,6 +3789,16 @@ public:
      */
     virtual bool parse(const char* text, bool fragment = false, const char* file = 0, int len = -1);
 
+    /**
+     * Parse a file as Javascript source code. If an image path is set the
+     *  code is loaded from a precompiled image when neither the file nor
+     *  any of its includes changed, otherwise an image is saved after parsing
+     * @param name Name of the source file
+     * @param fragment True if the code is just an included fragment
+     * @return True if the file was successfully parsed or loaded
+     */
+    virtual bool parseFile(const char* name, bool fragment = false);
+
     /**
      * Create a context adequate for Javascript code
      * @return A new Javascript context
@@ -3803,6 +3903,38 @@ public:
     inline void trace(bool allowed = true)
 	{ m_allowTrace = allowed; }
 
+    /**
+     * Set whether linked Javascript code should be optimized or not.
+     * Optimization folds constants, removes dead branches and redundant jumps
+     *  and resolves reads of function local variables directly in the call
+     *  context. It has effect only if linking is also allowed.
+     * @param allowed True to allow optimization, false otherwise
+     */
+    inline void optimize(bool allowed = true)
+	{ m_allowOptimize = allowed; }
+
+    /**
+     * Retrieve the directory of precompiled script images
+     * @return Directory of the image cache, empty if not used
+     */
+    inline const String& imagePath() const
+	{ return m_imagePath; }
+
+    /**
+     * Set the directory where precompiled images of linked scripts are kept
+     * @param path Directory of the image cache ending in a path separator,
+     *  empty to always parse the source files
+     */
+    inline void imagePath(const char* path)
+	{ m_imagePath = path; }
+
+    /**
+     * Check if the current code was loaded from a precompiled image
+     * @return True if the last file was loaded from image instead of parsed
+     */
+    inline bool fromImage() const
+	{ return m_fromImage; }
+
     /**
      * Parse and run a piece of Javascript code
      * @param text Source code fragment to execute
@@ -3999,11 +4131,16 @@ public:
 	{ return isMissing(oper) ? 0 : oper; }
 
 private:
+    bool loadImage(const String& file, const char* script);
+    bool saveImage(const String& file) const;
     String m_basePath;
     String m_includePath;
     String m_parsedFile;
+    String m_imagePath;
     bool m_allowLink;
     bool m_allowTrace;
+    bool m_allowOptimize;
+    bool m_fromImage;
 };
 
 }; // namespace TelEngine
@@ -29,6 +29,12 @@
 
 using namespace TelEngine;
 
+// Transaction timer wheel layout, must match SIPEngine::m_wheel size
+#define WHEEL_BITS 8
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_SLOTS (3 * WHEEL_SIZE)
+
 static TokenDict sip_responses[] = {
     { "Trying", 100 },
     { "Ringing", 180 },
@@ -160,17 +166,200 @@ SIPEvent::~SIPEvent()
 }
 
 
-SIPEngine::SIPEngine(const char* userAgent)
+SIPShard::SIPShard(unsigned int index)
+    : Mutex(true,"SIPShard"),
+      m_index(index), m_transLast(&m_transList),
+      m_branchHash(1024), m_callIdHash(1024),
+      m_readyHead(0), m_readyTail(0), m_readyCount(0),
+      m_wheelTick(Time::now() / 1000), m_wheelCount(0)
+{
+    for (unsigned int i = 0; i < WHEEL_SLOTS; i++)
+	m_wheel[i] = 0;
+}
+
+SIPShard::~SIPShard()
+{
+    clear();
+}
+
+void SIPShard::clear()
+{
+    Lock mylock(this);
+    for (ObjList* l = m_transList.skipNull(); l; l = l->skipNext()) {
+	SIPTransaction* t = static_cast<SIPTransaction*>(l->get());
+	unqueue(t);
+	t->m_listNode = 0;
+    }
+    m_branchHash.clear();
+    m_callIdHash.clear();
+    m_transList.clear();
+    m_transLast = &m_transList;
+}
+
+// Keep each transaction's list node up to date so removal needs no search
+void SIPShard::listAdd(SIPTransaction* transaction, bool first)
+{
+    if (first) {
+	bool moved = (0 != m_transList.get());
+	m_transList.insert(transaction);
+	transaction->m_listNode = &m_transList;
+	if (moved) {
+	    // ObjList::insert() moved the old head object to a new second node
+	    ObjList* n = m_transList.next();
+	    static_cast<SIPTransaction*>(n->get())->m_listNode = n;
+	    if (m_transLast == &m_transList)
+		m_transLast = n;
+	}
+    }
+    else {
+	m_transLast = m_transLast->append(transaction);
+	transaction->m_listNode = m_transLast;
+    }
+}
+
+void SIPShard::listRemove(SIPTransaction* transaction)
+{
+    ObjList* n = transaction->m_listNode;
+    if (!n)
+	return;
+    transaction->m_listNode = 0;
+    ObjList* next = n->next();
+    n->remove(false);
+    if (!next)
+	return;
+    // ObjList::remove() moved the next object here and deleted its node
+    if (n->get())
+	static_cast<SIPTransaction*>(n->get())->m_listNode = n;
+    if (m_transLast == next)
+	m_transLast = n;
+}
+
+void SIPShard::unqueue(SIPTransaction* transaction)
+{
+    if (!transaction->m_queue)
+	return;
+    if (transaction->m_queuePrev)
+	transaction->m_queuePrev->m_queueNext = transaction->m_queueNext;
+    else
+	*transaction->m_queue = transaction->m_queueNext;
+    if (transaction->m_queue == &m_readyHead) {
+	if (transaction->m_queueNext)
+	    transaction->m_queueNext->m_queuePrev = transaction->m_queuePrev;
+	else
+	    m_readyTail = transaction->m_queuePrev;
+	m_readyCount--;
+    }
+    else {
+	if (transaction->m_queueNext)
+	    transaction->m_queueNext->m_queuePrev = transaction->m_queuePrev;
+	m_wheelCount--;
+    }
+    transaction->m_queue = 0;
+    transaction->m_queuePrev = 0;
+    transaction->m_queueNext = 0;
+}
+
+void SIPShard::queueReady(SIPTransaction* transaction, bool first)
+{
+    unqueue(transaction);
+    transaction->m_queue = &m_readyHead;
+    if (first || !m_readyTail) {
+	transaction->m_queueNext = m_readyHead;
+	if (m_readyHead)
+	    m_readyHead->m_queuePrev = transaction;
+	else
+	    m_readyTail = transaction;
+	m_readyHead = transaction;
+    }
+    else {
+	transaction->m_queuePrev = m_readyTail;
+	m_readyTail->m_queueNext = transaction;
+	m_readyTail = transaction;
+    }
+    m_readyCount++;
+}
+
+// Place a transaction in the timer wheel slot matching its timeout
+void SIPShard::queueTimer(SIPTransaction* transaction)
+{
+    unqueue(transaction);
+    if (!transaction->m_timeout)
+	return;
+    // round up so the timer never fires early
+    u_int64_t expires = (transaction->m_timeout + 999) / 1000;
+    if (expires < m_wheelTick) {
+	queueReady(transaction,false);
+	return;
+    }
+    u_int64_t delta = expires - m_wheelTick;
+    unsigned int slot;
+    if (delta < WHEEL_SIZE)
+	slot = (unsigned int)(expires & WHEEL_MASK);
+    else if (delta < (WHEEL_SIZE << WHEEL_BITS))
+	slot = WHEEL_SIZE + (unsigned int)((expires >> WHEEL_BITS) & WHEEL_MASK);
+    else {
+	// too far in the future - we will recheck when cascading
+	if (delta >= (WHEEL_SIZE << (2 * WHEEL_BITS)))
+	    expires = m_wheelTick + (WHEEL_SIZE << (2 * WHEEL_BITS)) - 1;
+	slot = 2 * WHEEL_SIZE + (unsigned int)((expires >> (2 * WHEEL_BITS)) & WHEEL_MASK);
+    }
+    SIPTransaction*& head = m_wheel[slot];
+    transaction->m_queue = &head;
+    transaction->m_queueNext = head;
+    if (head)
+	head->m_queuePrev = transaction;
+    head = transaction;
+    m_wheelCount++;
+}
+
+// Move all transactions of a higher level slot to lower levels
+void SIPShard::cascadeTimers(unsigned int slot)
+{
+    SIPTransaction* t = m_wheel[slot];
+    while (t) {
+	SIPTransaction* next = t->m_queueNext;
+	queueTimer(t);
+	t = next;
+    }
+}
+
+// Move all transactions whose timer expired to the ready queue
+void SIPShard::advanceTimers(u_int64_t time)
+{
+    u_int64_t tick = time / 1000;
+    while (m_wheelCount && m_wheelTick <= tick) {
+	unsigned int idx = (unsigned int)(m_wheelTick & WHEEL_MASK);
+	if (!idx) {
+	    unsigned int idx1 = (unsigned int)((m_wheelTick >> WHEEL_BITS) & WHEEL_MASK);
+	    if (!idx1)
+		cascadeTimers(2 * WHEEL_SIZE + (unsigned int)((m_wheelTick >> (2 * WHEEL_BITS)) & WHEEL_MASK));
+	    cascadeTimers(WHEEL_SIZE + idx1);
+	}
+	while (SIPTransaction* t = m_wheel[idx])
+	    queueReady(t,false);
+	m_wheelTick++;
+    }
+    // nothing to wait for, just skip over idle time
+    if (m_wheelTick <= tick)
+	m_wheelTick = tick + 1;
+}
+
+
+SIPEngine::SIPEngine(const char* userAgent, unsigned int shards)
     : Mutex(true,"SIPEngine"),
       m_t1(500000), m_t4(5000000), m_reqTransCount(5), m_rspTransCount(6),
       m_maxForwards(70),
       m_flags(0), m_lazyTrying(false),
       m_userAgent(userAgent), m_nc(0), m_nonce_time(0),
       m_nonce_mutex(false,"SIPEngine::nonce"),
-      m_autoChangeParty(false)
+      m_autoChangeParty(false),
+      m_shards(0), m_shardCount(shards ? shards : 1), m_shardNext(0)
 {
     debugName("sipengine");
-    DDebug(this,DebugInfo,"SIPEngine::SIPEngine() [%p]",this);
+    DDebug(this,DebugInfo,"SIPEngine::SIPEngine(%u) [%p]",m_shardCount,this);
+    m_shards = new SIPShard*[m_shardCount];
+    for (unsigned int i = 0; i < m_shardCount; i++)
+	m_shards[i] = new SIPShard(i);
     m_seq = new SIPSequence;
     m_seq->deref();
     if (m_userAgent.null())
@@ -184,6 +373,121 @@ SIPEngine::SIPEngine(const char* userAgent)
 SIPEngine::~SIPEngine()
 {
     DDebug(this,DebugInfo,"SIPEngine::~SIPEngine() [%p]",this);
+    clearTransactions();
+    for (unsigned int i = 0; i < m_shardCount; i++)
+	delete m_shards[i];
+    delete[] m_shards;
+}
+
+// Add a transaction to an index bucket, the index does not own the transaction
+static void indexAdd(HashList& index, SIPTransaction* t, const String& key, bool first)
+{
+    ObjList* l = first ? index.getHashList(key) : 0;
+    if (l)
+	l = l->insert(t);
+    else
+	l = index.append(t,key.hash());
+    l->setDelete(false);
+}
+
+// Try to match a message to the transactions in an index bucket
+// Returns the matched transaction, remembers the last forked INVITE transaction
+static SIPTransaction* indexMatch(const HashList& index, const String& key,
+    SIPMessage* message, const String& branch, SIPTransaction*& forked)
+{
+    for (ObjList* l = index.getHashList(key); l; l = l->next()) {
+	SIPTransaction* t = static_cast<SIPTransaction*>(l->get());
+	if (!t)
+	    continue;
+	switch (t->processMessage(message,branch)) {
+	    case SIPTransaction::Matched:
+		return t;
+	    case SIPTransaction::NoDialog:
+		forked = t;
+		break;
+	    case SIPTransaction::NoMatch:
+	    default:
+		break;
+	}
+    }
+    return 0;
+}
+
+void SIPEngine::append(SIPTransaction* transaction)
+{
+    SIPShard* sh = transaction->m_shard;
+    Lock mylock(sh);
+    sh->listAdd(transaction,false);
+    if (transaction->getBranch())
+	indexAdd(sh->m_branchHash,transaction,transaction->getBranch(),false);
+    indexAdd(sh->m_callIdHash,transaction,transaction->getCallID(),false);
+    sh->queueReady(transaction,false);
+}
+
+void SIPEngine::insert(SIPTransaction* transaction)
+{
+    SIPShard* sh = transaction->m_shard;
+    Lock mylock(sh);
+    sh->listAdd(transaction,true);
+    if (transaction->getBranch())
+	indexAdd(sh->m_branchHash,transaction,transaction->getBranch(),true);
+    indexAdd(sh->m_callIdHash,transaction,transaction->getCallID(),true);
+    sh->queueReady(transaction,true);
+}
+
+void SIPEngine::remove(SIPTransaction* transaction)
+{
+    SIPShard* sh = transaction->m_shard;
+    Lock mylock(sh);
+    sh->unqueue(transaction);
+    sh->listRemove(transaction);
+    if (transaction->getBranch())
+	sh->m_branchHash.remove(transaction,transaction->getBranch().hash(),false);
+    sh->m_callIdHash.remove(transaction,transaction->getCallID().hash(),false);
+}
+
+void SIPEngine::removeTransaction(SIPTransaction* transaction)
+{
+    remove(transaction);
+    TelEngine::destruct(transaction);
+}
+
+void SIPEngine::readyTransaction(SIPTransaction* transaction, bool first)
+{
+    SIPShard* sh = transaction->m_shard;
+    Lock mylock(sh);
+    // ignore transactions not (yet or anymore) in our list
+    if (!transaction->m_listNode)
+	return;
+    if (transaction->m_queue == &sh->m_readyHead) {
+	if (!first || transaction == sh->m_readyHead)
+	    return;
+    }
+    sh->queueReady(transaction,first);
+}
+
+void SIPEngine::changedBranch(SIPTransaction* transaction, const String& oldBranch)
+{
+    SIPShard* sh = transaction->m_shard;
+    Lock mylock(sh);
+    if (oldBranch)
+	sh->m_branchHash.remove(transaction,oldBranch.hash(),false);
+    if (transaction->getBranch() && transaction->m_listNode)
+	indexAdd(sh->m_branchHash,transaction,transaction->getBranch(),false);
+}
+
+void SIPEngine::clearTransactions()
+{
+    for (unsigned int i = 0; i < m_shardCount; i++)
+	m_shards[i]->clear();
+}
+
+unsigned int SIPEngine::transactionCount()
+{
+    unsigned int n = 0;
+    for (unsigned int i = 0; i < m_shardCount; i++)
+	n += m_shards[i]->count();
+    return n;
 }
 
 SIPTransaction* SIPEngine::addMessage(SIPParty* ep, const char* buf, int len)
@@ -220,24 +524,24 @@ SIPTransaction* SIPEngine::addMessage(SIPMessage* message, bool* autoChangeParty
     String branch;
     if (br && br->startsWith("z9hG4bK"))
 	branch = *br;
-    Lock lock(this);
+    const String& callId = message->getHeaderValue("Call-ID");
+    // all transactions of a dialog are in the same shard
+    SIPShard* sh = getShard(callId);
+    Lock lock(sh);
     SIPTransaction* forked = 0;
-    ObjList* l = &m_transList;
-    for (; l; l = l->next()) {
-	SIPTransaction* t = static_cast<SIPTransaction*>(l->get());
-	if (!t)
-	    continue;
-	switch (t->processMessage(message,branch)) {
-	    case SIPTransaction::Matched:
-		return t;
-	    case SIPTransaction::NoDialog:
-		forked = t;
-		break;
-	    case SIPTransaction::NoMatch:
-	    default:
-		break;
-	}
+    SIPTransaction* t = 0;
+    if (branch) {
+	// RFC 3261 - the branch identifies the transaction
+	t = indexMatch(sh->m_branchHash,branch,message,branch,forked);
+	// ACK to a 2xx answer has a new branch, match by Call-ID, CSeq and tag
+	if (!t && message->isACK())
+	    t = indexMatch(sh->m_callIdHash,callId,message,branch,forked);
     }
+    else
+	// RFC 2543 - match by Call-ID, CSeq, From, To and Via
+	t = indexMatch(sh->m_callIdHash,callId,message,branch,forked);
+    if (t)
+	return t;
     if (forked)
 	return forkInvite(message,forked);
 
@@ -272,33 +576,57 @@ bool SIPEngine::process()
 
 SIPEvent* SIPEngine::getEvent()
 {
-    Lock lock(this);
-    ObjList* l = m_transList.skipNull();
-    if (!l)
-	return 0;
-    u_int64_t time = Time::now();
-    for (; l; l = l->skipNext()) {
-	SIPTransaction* t = static_cast<SIPTransaction*>(l->get());
-	SIPEvent* e = t->getEvent(true,time);
-	if (e) {
-	    DDebug(this,DebugInfo,"Got pending event %p (state %s) from transaction %p [%p]",
-		e,SIPTransaction::stateName(e->getState()),t,this);
-	    if (t->getState() == SIPTransaction::Invalid)
-		m_transList.remove(t);
+    lock();
+    unsigned int idx = m_shardNext;
+    if (++m_shardNext >= m_shardCount)
+	m_shardNext = 0;
+    unlock();
+    for (unsigned int n = m_shardCount; n; n--) {
+	SIPEvent* e = getEvent(idx);
+	if (e)
 	    return e;
-	}
+	if (++idx >= m_shardCount)
+	    idx = 0;
     }
-    time = Time::now();
-    for (l = m_transList.skipNull(); l; l = l->skipNext()) {
-	SIPTransaction* t = static_cast<SIPTransaction*>(l->get());
+    return 0;
+}
+
+SIPEvent* SIPEngine::getEvent(unsigned int index)
+{
+    SIPShard* sh = shard(index);
+    if (!sh)
+	return 0;
+    Lock lock(sh);
+    u_int64_t time = Time::now();
+    sh->advanceTimers(time);
+    // look at each ready transaction at most once, the ones that requeue
+    //  themselves while being checked will be handled at the next call
+    for (unsigned int n = sh->m_readyCount; n && sh->m_readyHead; n--) {
+	SIPTransaction* t = sh->m_readyHead;
+	sh->unqueue(t);
 	SIPEvent* e = t->getEvent(false,time);
+	if (!e && (t->m_queue == &sh->m_readyHead) && (t->getState() != SIPTransaction::Invalid)) {
+	    // changed state without producing an event, give it a second chance
+	    sh->unqueue(t);
+	    e = t->getEvent(false,time);
+	}
+	if (t->getState() == SIPTransaction::Invalid) {
+	    DDebug(this,DebugInfo,"Got event %p (state %s) from finished transaction %p [%p]",
+		e,e ? SIPTransaction::stateName(e->getState()) : "",t,this);
+	    removeTransaction(t);
+	    if (e)
+		return e;
+	    continue;
+	}
 	if (e) {
 	    DDebug(this,DebugInfo,"Got event %p (state %s) from transaction %p [%p]",
 		e,SIPTransaction::stateName(e->getState()),t,this);
-	    if (t->getState() == SIPTransaction::Invalid)
-		m_transList.remove(t);
+	    // there may be more events pending so look at it first next time
+	    sh->queueReady(t,true);
 	    return e;
 	}
+	if (!t->m_queue)
+	    sh->queueTimer(t);
     }
     return 0;
 }
@@ -31,9 +31,11 @@ SIPTransaction::SIPTransaction(SIPMessage* message, SIPEngine* engine, bool outg
     bool* autoChangeParty)
     : m_outgoing(outgoing), m_invite(false), m_transmit(false), m_state(Invalid),
       m_response(0), m_timeouts(0), m_timeout(0),
-      m_firstMessage(message), m_lastMessage(0), m_pending(0), m_engine(engine), m_private(0),
+      m_firstMessage(message), m_lastMessage(0), m_pending(0), m_engine(engine), m_shard(0),
+      m_private(0),
       m_autoChangeParty(autoChangeParty ? *autoChangeParty : engine->autoChangeParty()),
-      m_autoAck(true), m_silent(false)
+      m_autoAck(true), m_silent(false),
+      m_listNode(0), m_queue(0), m_queuePrev(0), m_queueNext(0)
 {
     DDebug(getEngine(),DebugAll,"SIPTransaction::SIPTransaction(%p,%p,%d) [%p]",
 	message,engine,outgoing,this);
@@ -66,6 +68,7 @@ SIPTransaction::SIPTransaction(SIPMessage* message, SIPEngine* engine, bool outg
 	    }
 	}
     }
+    m_shard = m_engine->getShard(m_callid);
     m_invite = (getMethod() == YSTRING("INVITE"));
     m_state = Initial;
     m_transCount = outgoing ? m_engine->getReqTransCount() : m_engine->getRspTransCount();
@@ -85,10 +88,11 @@ SIPTransaction::SIPTransaction(SIPTransaction& original, SIPMessage* answer)
       m_response(original.m_response), m_transCount(original.m_transCount),
       m_timeouts(0), m_timeout(0),
       m_firstMessage(original.m_firstMessage), m_lastMessage(original.m_lastMessage),
-      m_pending(0), m_engine(original.m_engine),
+      m_pending(0), m_engine(original.m_engine), m_shard(original.m_shard),
       m_branch(original.m_branch), m_callid(original.m_callid), m_tag(original.m_tag),
       m_private(0), m_autoChangeParty(original.m_autoChangeParty),
-      m_autoAck(original.m_autoAck), m_silent(original.m_silent), m_traceId(original.traceId())
+      m_autoAck(original.m_autoAck), m_silent(original.m_silent), m_traceId(original.traceId()),
+      m_listNode(0), m_queue(0), m_queuePrev(0), m_queueNext(0)
 {
     DDebug(getEngine(),DebugAll,"SIPTransaction::SIPTransaction(&%p,%p) [%p]",
 	&original,answer,this);
@@ -103,6 +107,8 @@ SIPTransaction::SIPTransaction(SIPTransaction& original, SIPMessage* answer)
 	original.m_branch = *ns;
     else
 	original.m_branch.clear();
+    if (original.m_branch != m_branch)
+	m_engine->changedBranch(&original,m_branch);
     ns = msg->getParam("To","tag");
     if (ns)
 	original.m_tag = *ns;
@@ -131,10 +137,11 @@ SIPTransaction::SIPTransaction(const SIPTransaction& original, const String& tag
       m_response(original.m_response), m_transCount(original.m_transCount),
       m_timeouts(0), m_timeout(0),
       m_firstMessage(original.m_firstMessage), m_lastMessage(0),
-      m_pending(0), m_engine(original.m_engine),
+      m_pending(0), m_engine(original.m_engine), m_shard(original.m_shard),
       m_branch(original.m_branch), m_callid(original.m_callid), m_tag(tag),
       m_private(0), m_autoChangeParty(original.m_autoChangeParty),
-      m_autoAck(original.m_autoAck), m_silent(original.m_silent), m_traceId(original.traceId())
+      m_autoAck(original.m_autoAck), m_silent(original.m_silent), m_traceId(original.traceId()),
+      m_listNode(0), m_queue(0), m_queuePrev(0), m_queueNext(0)
 {
     if (m_firstMessage)
 	m_firstMessage->ref();
@@ -199,6 +206,7 @@ bool SIPTransaction::changeState(int newstate)
     DDebug(getEngine(),DebugAll,"SIPTransaction state changed from %s to %s [%p]",
 	stateName(m_state),stateName(newstate),this);
     m_state = newstate;
+    m_engine->readyTransaction(this);
     return true;
 }
 
@@ -245,6 +253,14 @@ void SIPTransaction::setPendingEvent(SIPEvent* event, bool replace)
 	    delete event;
     else
 	m_pending = event;
+    if (m_pending)
+	m_engine->readyTransaction(this);
+}
+
+void SIPTransaction::setTransmit()
+{
+    m_transmit = true;
+    m_engine->readyTransaction(this);
 }
 
 void SIPTransaction::setTransCount(int count)
@@ -269,6 +285,8 @@ void SIPTransaction::setTimeout(u_int64_t delay, unsigned int count)
 	TraceDebugObj(this,getEngine(),DebugAll,"SIPTransaction new %d timeouts initially " FMT64U " usec apart [%p]",
 	    m_timeouts,m_delay,this);
 #endif
+    // the engine will reschedule us after checking for events
+    m_engine->readyTransaction(this);
 }
 
 SIPEvent* SIPTransaction::getEvent(bool pendingOnly, u_int64_t time)
@@ -349,7 +367,7 @@ void SIPTransaction::setResponse(SIPMessage* message)
 	TraceDebugObj(this,getEngine(),DebugWarn,"SIPTransaction::setResponse(%p) in client mode [%p]",message,this);
 	return;
     }
-    Lock lock(m_engine);
+    Lock lock(m_shard);
     setLatestMessage(message);
     setTransmit();
     if (message && (message->code >= 200)) {
@@ -765,7 +783,7 @@ void SIPTransaction::msgTransmitFailed(SIPMessage* msg)
 {
     if (!msg)
 	return;
-    Lock lock(getEngine());
+    Lock lock(m_shard);
     DDebug(getEngine(),DebugNote,
 	"SIPTransaction send failed state=%s msg=%p first=%p last=%p [%p]",
 	stateName(m_state),msg,m_firstMessage,m_lastMessage,this);
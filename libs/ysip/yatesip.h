@@ -52,6 +52,7 @@ extern YSIP_API TokenDict* SIPResponses;
 
 class SIPEngine;
 class SIPEvent;
+class SIPShard;
 
 class YSIP_API SIPParty : public RefObject
 {
@@ -779,6 +780,8 @@ protected:
  */
 class YSIP_API SIPTransaction : public RefObject
 {
+    friend class SIPEngine;
+    friend class SIPShard;
 public:
     /**
      * Current state of the transaction
@@ -886,6 +889,12 @@ public:
     inline SIPEngine* getEngine() const
 	{ return m_engine; }
 
+    /**
+     * The engine shard holding this transaction, its mutex protects the transaction
+     */
+    inline SIPShard* getShard() const
+	{ return m_shard; }
+
     /**
      * Check if this transaction was initiated by the remote peer or locally
      * @return True if the transaction was created by an outgoing message
@@ -957,8 +966,7 @@ public:
      * Set the (re)transmission flag that allows the latest outgoing message
      *  to be send over the wire
      */
-    inline void setTransmit()
-	{ m_transmit = true; }
+    void setTransmit();
 
     /**
      * Change transaction status to Cleared
@@ -1205,6 +1213,7 @@ protected:
     SIPMessage* m_lastMessage;
     SIPEvent* m_pending;
     SIPEngine* m_engine;
+    SIPShard* m_shard;
     String m_branch;
     String m_callid;
     String m_tag;
@@ -1213,6 +1222,13 @@ protected:
     bool m_autoAck;
     bool m_silent;
     String m_traceId;
+
+private:
+    // Engine bookkeeping, protected by the engine mutex
+    ObjList* m_listNode;
+    SIPTransaction** m_queue;
+    SIPTransaction* m_queuePrev;
+    SIPTransaction* m_queueNext;
 };
 
 /**
@@ -1306,16 +1322,91 @@ protected:
 };
 
 /**
- * The SIP engine holds common methods and the list of current transactions
- * @short The SIP engine and transaction list
+ * A partition of the transactions of a SIP engine. All transactions with the
+ *  same Call-ID are kept in the same shard so each dialog is always handled
+ *  by the same shard. The shard mutex protects the transactions it holds.
+ * @short A group of SIP transactions with their own lock and timers
+ */
+class YSIP_API SIPShard : public Mutex
+{
+    friend class SIPEngine;
+public:
+    /**
+     * Constructor
+     * @param index Index of the shard in its engine
+     */
+    SIPShard(unsigned int index);
+
+    /**
+     * Destructor, dereferences all transactions
+     */
+    virtual ~SIPShard();
+
+    /**
+     * Get the index of this shard in its engine
+     * @return Shard index
+     */
+    inline unsigned int index() const
+	{ return m_index; }
+
+    /**
+     * Get the list of transactions. The shard must be kept locked while using it
+     * @return The list holding all transactions of this shard
+     */
+    inline const ObjList& transactions() const
+	{ return m_transList; }
+
+    /**
+     * Get the number of transactions in this shard
+     * @return Count of transactions in the shard
+     */
+    inline unsigned int count()
+	{ Lock mylock(this); return m_transList.count(); }
+
+private:
+    void clear();
+    void listAdd(SIPTransaction* transaction, bool first);
+    void listRemove(SIPTransaction* transaction);
+    void unqueue(SIPTransaction* transaction);
+    void queueReady(SIPTransaction* transaction, bool first);
+    void queueTimer(SIPTransaction* transaction);
+    void cascadeTimers(unsigned int slot);
+    void advanceTimers(u_int64_t time);
+
+    unsigned int m_index;
+    // All transactions, each one remembers its node
+    ObjList m_transList;
+    ObjList* m_transLast;
+    // Transactions indexed by RFC 3261 Via branch
+    HashList m_branchHash;
+    // Transactions indexed by Call-ID for RFC 2543 and 2xx ACK matching
+    HashList m_callIdHash;
+    // Transactions that may have events to retrieve
+    SIPTransaction* m_readyHead;
+    SIPTransaction* m_readyTail;
+    unsigned int m_readyCount;
+    // Hierarchical timer wheel: 3 levels of 256 slots, 1ms resolution
+    SIPTransaction* m_wheel[768];
+    u_int64_t m_wheelTick;
+    unsigned int m_wheelCount;
+};
+
+/**
+ * The SIP engine holds common methods and the current transactions, split in shards.
+ * The transactions are no longer held in a protected m_transList member so this
+ *  class has a different layout than in previous versions. Derived classes must
+ *  use shard() and SIPShard::transactions() instead and must be rebuilt.
+ * @short The SIP engine and transaction shards
  */
 class YSIP_API SIPEngine : public DebugEnabler, public Mutex
 {
 public:
     /**
      * Create the SIP Engine
+     * @param userAgent Default User-Agent, NULL to build one from the version
+     * @param shards Number of independent transaction shards, at least 1
      */
-    SIPEngine(const char* userAgent = 0);
+    SIPEngine(const char* userAgent = 0, unsigned int shards = 1);
 
     /**
      * Destroy the SIP Engine
@@ -1406,10 +1497,20 @@ public:
      * This method mainly looks into the transaction list and get all kind of
      * events, like an incoming request (INVITE, REGISTRATION), a timer, an
      * outgoing message.
+     * All shards are checked, starting with a different one each time.
      * This method is thread safe
      */
     SIPEvent *getEvent();
 
+    /**
+     * Get a SIPEvent from a single shard.
+     * Each shard may be processed by its own thread.
+     * This method is thread safe
+     * @param index Index of the shard to check
+     * @return Pointer to an event or NULL if the shard has none
+     */
+    SIPEvent* getEvent(unsigned int index);
+
     /**
      * This method should be called very often to get the events from the list and
      * to send them to processEvent method.
@@ -1585,38 +1686,79 @@ public:
 	{ return m_allowed; }
 
     /**
-     * Remove a transaction from the list without dereferencing it
+     * Remove a transaction from its shard without dereferencing it
      * @param transaction Pointer to transaction to remove
      */
-    inline void remove(SIPTransaction* transaction)
-	{ lock(); m_transList.remove(transaction,false); unlock(); }
+    void remove(SIPTransaction* transaction);
 
     /**
-     * Append a transaction to the end of the list
+     * Append a transaction to the end of its shard list and ready queue
      * @param transaction Pointer to transaction to append
      */
-    inline void append(SIPTransaction* transaction)
-	{ lock(); m_transList.append(transaction); unlock(); }
+    void append(SIPTransaction* transaction);
 
     /**
-     * Insert a transaction at the start of the list
+     * Insert a transaction at the start of its shard list and ready queue
      * @param transaction Pointer to transaction to insert
      */
-    inline void insert(SIPTransaction* transaction)
-	{ lock(); m_transList.insert(transaction); unlock(); }
+    void insert(SIPTransaction* transaction);
+
+    /**
+     * Mark a transaction as possibly having events to retrieve.
+     * Transactions call this whenever their state, pending event,
+     *  transmission flag or timeout changes
+     * @param transaction Pointer to transaction that changed
+     * @param first True to put it at the start of the ready queue
+     */
+    void readyTransaction(SIPTransaction* transaction, bool first = false);
+
+    /**
+     * Update the lookup index of a transaction whose branch has changed
+     * @param transaction Pointer to transaction that changed its branch
+     * @param oldBranch Branch the transaction was previously indexed by
+     */
+    void changedBranch(SIPTransaction* transaction, const String& oldBranch);
+
+    /**
+     * Remove and dereference all transactions
+     */
+    void clearTransactions();
 
     /**
      * Get the number of active SIP transactions
-     * @return Count of transactions in the list
+     * @return Count of transactions in all shards
      */
-    inline unsigned int transactionCount()
-	{ Lock mylock(this); return m_transList.count(); }
+    unsigned int transactionCount();
+
+    /**
+     * Get the number of transaction shards
+     * @return Number of shards, at least 1
+     */
+    inline unsigned int shards() const
+	{ return m_shardCount; }
+
+    /**
+     * Retrieve a transaction shard by index
+     * @param index Index of the shard
+     * @return Pointer to shard or NULL if index is out of range
+     */
+    inline SIPShard* shard(unsigned int index) const
+	{ return (index < m_shardCount) ? m_shards[index] : 0; }
+
+    /**
+     * Retrieve the shard holding the transactions of a dialog
+     * @param callId Call-ID of the dialog
+     * @return Pointer to the shard, never NULL
+     */
+    inline SIPShard* getShard(const String& callId) const
+	{ return m_shards[(m_shardCount > 1) ? (callId.hash() % m_shardCount) : 0]; }
 
 protected:
     /**
-     * The list that holds all the SIP transactions.
+     * Remove a transaction from its shard and dereference it
+     * @param transaction Pointer to transaction to remove
      */
-    ObjList m_transList;
+    void removeTransaction(SIPTransaction* transaction);
 
     u_int64_t m_t1;
     u_int64_t m_t4;
@@ -1634,6 +1776,11 @@ protected:
     u_int32_t m_nonce_time;
     Mutex m_nonce_mutex;
     bool m_autoChangeParty;
+
+private:
+    SIPShard** m_shards;
+    unsigned int m_shardCount;
+    unsigned int m_shardNext;
 };
 
 }
@@ -19,74 +19,512 @@
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
  */
 
-#include <yatengine.h>
+#include <yatephone.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <stdio.h>
 
 #ifdef _WINDOWS
 #define EOLN "\r\n"
 #else
 #define EOLN "\n"
+#include <sys/uio.h>
 #endif
 
+// Maximum number of lines written by the async writer in one system call
+#define MAX_BATCH 256
+
 using namespace TelEngine;
 namespace { // anonymous
 
 class CdrFileHandler;
 
-class CdrFilePlugin : public Plugin
+class CdrFilePlugin : public Module
 {
 public:
     CdrFilePlugin();
     ~CdrFilePlugin();
     virtual void initialize();
+protected:
+    virtual bool received(Message& msg, int id);
+    virtual void statusParams(String& str);
 private:
+    bool m_first;
     CdrFileHandler *m_handler;
 };
 
 INIT_PLUGIN(CdrFilePlugin);
 
-class CdrFileHandler : public MessageHandler, public Mutex
+// Bounded ring of rendered CDR lines, many producers and a single consumer
+class CdrRing
+{
+public:
+    CdrRing(unsigned int size);
+    ~CdrRing();
+    bool push(String* line);
+    String* pop();
+    unsigned int pending() const;
+    inline unsigned int size() const
+	{ return m_mask + 1; }
+private:
+    struct Slot {
+	volatile unsigned int seq;
+	String* line;
+    };
+    Slot* m_slots;
+    unsigned int m_mask;
+    volatile unsigned int m_head;
+    volatile unsigned int m_tail;
+#ifndef YATOMIC_BUILTIN
+    Mutex m_mutex;
+#endif
+};
+
+class CdrWriter;
+
+class CdrWriterThread : public Thread
+{
+public:
+    inline CdrWriterThread(CdrWriter* writer)
+	: Thread("CDR File"), m_writer(writer)
+	{ }
+    virtual void run();
+private:
+    CdrWriter* m_writer;
+};
+
+// Asynchronous writer owning the CDR file and the queue of lines to write in it
+class CdrWriter
+{
+    friend class CdrWriterThread;
+public:
+    CdrWriter(const String& fname, int mode, const NamedList& params);
+    ~CdrWriter();
+    bool start();
+    void stop();
+    bool push(String* line);
+    void status(String& str) const;
+private:
+    void run();
+    bool open();
+    void flush(String** lines, unsigned int count);
+    void rotate(u_int64_t now);
+    String m_fileName;
+    int m_mode;
+    int m_file;
+    CdrRing m_ring;
+    bool m_drop;
+    unsigned int m_batch;
+    u_int64_t m_flush;
+    u_int64_t m_sync;
+    u_int64_t m_rotateSize;
+    u_int64_t m_rotateTime;
+    u_int64_t m_size;
+    u_int64_t m_opened;
+    u_int64_t m_synced;
+    bool m_dirty;
+    volatile bool m_stop;
+    volatile bool m_running;
+    AtomicUInt64 m_written;
+    AtomicUInt64 m_waited;
+    AtomicUInt64 m_dropped;
+    AtomicUInt64 m_errors;
+    AtomicUInt64 m_rotated;
+};
+
+class CdrFileHandler : public MessageHandler, public RWLock
 {
 public:
     CdrFileHandler(const char *name)
 	: MessageHandler(name,100,__plugin.name()),
-	  Mutex(false,"CdrFileHandler"),
-	  m_file(-1), m_combined(false)
+	  RWLock("CdrFileHandler"),
+	  m_file(-1), m_mode(0), m_combined(false), m_writer(0)
 	{ }
     virtual ~CdrFileHandler();
     virtual bool received(Message &msg);
-    void init(const char *fname, bool tabsep, bool combined, const char* format, int mode);
+    void init(const char *fname, bool tabsep, bool combined, const char* format, int mode,
+	const NamedList& params);
+    void stopWriter(bool reopen = false);
+    void status(String& str);
 private:
+    bool openFile();
+    String m_fileName;
     int m_file;
+    int m_mode;
     bool m_combined;
-    String m_format;
+    ParamTemplate m_format;
+    CdrWriter* m_writer;
 };
 
+
+CdrRing::CdrRing(unsigned int size)
+    : m_slots(0), m_mask(0), m_head(0), m_tail(0)
+#ifndef YATOMIC_BUILTIN
+    , m_mutex(false,"CdrRing")
+#endif
+{
+    unsigned int n = 16;
+    while (n < size)
+	n <<= 1;
+    m_mask = n - 1;
+    m_slots = new Slot[n];
+    for (unsigned int i = 0; i < n; i++) {
+	m_slots[i].seq = i;
+	m_slots[i].line = 0;
+    }
+}
+
+CdrRing::~CdrRing()
+{
+    for (unsigned int i = 0; i <= m_mask; i++)
+	TelEngine::destruct(m_slots[i].line);
+    delete[] m_slots;
+}
+
+// Add a line at the producers end, return false if the ring is full
+bool CdrRing::push(String* line)
+{
+#ifdef YATOMIC_BUILTIN
+    unsigned int pos = m_head;
+    Slot* s;
+    for (;;) {
+	s = m_slots + (pos & m_mask);
+	int dif = (int)(s->seq - pos);
+	if (!dif) {
+	    // slot is free, try to claim it
+	    if (__sync_bool_compare_and_swap(&m_head,pos,pos + 1))
+		break;
+	}
+	else if (dif < 0)
+	    return false;
+	pos = m_head;
+    }
+    s->line = line;
+    // the line becomes visible to the consumer only after it was stored
+    __sync_synchronize();
+    s->seq = pos + 1;
+#else
+    Lock lck(m_mutex);
+    Slot* s = m_slots + (m_head & m_mask);
+    if (s->seq != m_head)
+	return false;
+    s->line = line;
+    s->seq = ++m_head;
+#endif
+    return true;
+}
+
+// Remove a line from the consumer end, return NULL if there is none
+String* CdrRing::pop()
+{
+#ifndef YATOMIC_BUILTIN
+    Lock lck(m_mutex);
+#endif
+    Slot* s = m_slots + (m_tail & m_mask);
+    if (s->seq != m_tail + 1)
+	return 0;
+#ifdef YATOMIC_BUILTIN
+    __sync_synchronize();
+#endif
+    String* line = s->line;
+    s->line = 0;
+#ifdef YATOMIC_BUILTIN
+    __sync_synchronize();
+#endif
+    s->seq = m_tail + m_mask + 1;
+    m_tail++;
+    return line;
+}
+
+unsigned int CdrRing::pending() const
+{
+    unsigned int n = m_head - m_tail;
+    return (n > m_mask) ? m_mask + 1 : n;
+}
+
+
+void CdrWriterThread::run()
+{
+    m_writer->run();
+    // the writer may be deleted as soon as it's no longer running
+    m_writer->m_running = false;
+}
+
+
+CdrWriter::CdrWriter(const String& fname, int mode, const NamedList& params)
+    : m_fileName(fname), m_mode(mode), m_file(-1),
+      m_ring(params.getIntValue(YSTRING("queue"),4096,16,1048576)),
+      m_drop(params[YSTRING("overflow")] == YSTRING("drop")),
+      m_batch(params.getIntValue(YSTRING("batch"),65536,0)),
+      m_flush(1000 * (u_int64_t)params.getIntValue(YSTRING("flush"),500,0,60000)),
+      m_sync(1000 * (u_int64_t)params.getIntValue(YSTRING("datasync"),0,0,3600000)),
+      m_rotateSize(params.getInt64Value(YSTRING("rotate_size"),0,0)),
+      m_rotateTime(1000000 * (u_int64_t)params.getIntValue(YSTRING("rotate_time"),0,0)),
+      m_size(0), m_opened(0), m_synced(0), m_dirty(false),
+      m_stop(false), m_running(false)
+{
+}
+
+CdrWriter::~CdrWriter()
+{
+    if (m_file >= 0)
+	::close(m_file);
+}
+
+bool CdrWriter::open()
+{
+    m_file = ::open(m_fileName,O_WRONLY|O_CREAT|O_APPEND|O_LARGEFILE,m_mode);
+    if (m_file < 0) {
+	Alarm("cdrfile","system",DebugWarn,"Failed to open or create '%s': %s (%d)",
+	    m_fileName.c_str(),::strerror(errno),errno);
+	return false;
+    }
+    struct stat st;
+    m_size = ::fstat(m_file,&st) ? 0 : st.st_size;
+    m_opened = Time::now();
+    return true;
+}
+
+bool CdrWriter::start()
+{
+    if (!open())
+	return false;
+    m_running = true;
+    if ((new CdrWriterThread(this))->startup())
+	return true;
+    m_running = false;
+    Alarm("cdrfile","system",DebugWarn,"Failed to start the CDR writer thread");
+    return false;
+}
+
+// Ask the thread to write all pending lines and wait for it to finish
+void CdrWriter::stop()
+{
+    m_stop = true;
+    while (m_running)
+	Thread::idle();
+}
+
+bool CdrWriter::push(String* line)
+{
+    if (m_ring.push(line))
+	return true;
+    if (m_drop) {
+	m_dropped.inc();
+	TelEngine::destruct(line);
+	return false;
+    }
+    // wait for the writer to make room, the disk is slower than the callers
+    m_waited.inc();
+    do {
+	if (m_stop || !m_running) {
+	    m_dropped.inc();
+	    TelEngine::destruct(line);
+	    return false;
+	}
+	Thread::idle();
+    } while (!m_ring.push(line));
+    return true;
+}
+
+void CdrWriter::status(String& str) const
+{
+    str << ",queue=" << m_ring.size() << ",pending=" << m_ring.pending();
+    str << ",written=" << m_written.valueAtomic() << ",backpressure=" << m_waited.valueAtomic();
+    str << ",dropped=" << m_dropped.valueAtomic() << ",errors=" << m_errors.valueAtomic();
+    str << ",rotated=" << m_rotated.valueAtomic();
+}
+
+void CdrWriter::run()
+{
+    String* lines[MAX_BATCH];
+    unsigned int count = 0;
+    unsigned int bytes = 0;
+    u_int64_t first = 0;
+    for (;;) {
+	bool stop = m_stop;
+	bool idle = true;
+	while (count < MAX_BATCH) {
+	    String* line = m_ring.pop();
+	    if (!line)
+		break;
+	    idle = false;
+	    lines[count++] = line;
+	    bytes += line->length();
+	    if (!first)
+		first = Time::now();
+	}
+	u_int64_t now = Time::now();
+	if (count && (stop || (count >= MAX_BATCH) || (bytes >= m_batch) || (now - first >= m_flush))) {
+	    flush(lines,count);
+	    count = 0;
+	    bytes = 0;
+	    first = 0;
+	}
+	if (m_dirty && (stop || (m_sync && (now - m_synced >= m_sync)))) {
+#ifndef _WINDOWS
+	    ::fdatasync(m_file);
+#endif
+	    m_dirty = false;
+	    m_synced = now;
+	}
+	if (stop && idle && !count)
+	    break;
+	if (!count)
+	    rotate(now);
+	if (idle)
+	    Thread::idle();
+    }
+}
+
+// Write a batch of lines with as few system calls as possible
+void CdrWriter::flush(String** lines, unsigned int count)
+{
+    if (m_file < 0 && !open()) {
+	m_errors.add(count);
+	for (unsigned int i = 0; i < count; i++)
+	    TelEngine::destruct(lines[i]);
+	return;
+    }
+#ifdef _WINDOWS
+    for (unsigned int i = 0; i < count; i++) {
+	int len = lines[i]->length();
+	if (::write(m_file,lines[i]->c_str(),len) == len)
+	    m_size += len;
+	else
+	    m_errors.inc();
+    }
+#else
+    struct iovec iov[MAX_BATCH];
+    for (unsigned int i = 0; i < count; i++) {
+	iov[i].iov_base = (void*)lines[i]->c_str();
+	iov[i].iov_len = lines[i]->length();
+    }
+    struct iovec* v = iov;
+    unsigned int n = count;
+    while (n) {
+	ssize_t w = ::writev(m_file,v,n);
+	if (w < 0) {
+	    if (errno == EINTR)
+		continue;
+	    Alarm("cdrfile","system",DebugWarn,"Failed to write %u CDRs to '%s': %s (%d)",
+		n,m_fileName.c_str(),::strerror(errno),errno);
+	    m_errors.add(n);
+	    count -= n;
+	    break;
+	}
+	m_size += w;
+	// skip over the completely written lines, adjust a partially written one
+	while (n && ((size_t)w >= v->iov_len)) {
+	    w -= v->iov_len;
+	    v++;
+	    n--;
+	}
+	if (n) {
+	    v->iov_base = (char*)v->iov_base + w;
+	    v->iov_len -= w;
+	}
+    }
+#endif
+    m_written.add(count);
+    m_dirty = true;
+    for (unsigned int i = 0; i < count; i++)
+	TelEngine::destruct(lines[i]);
+}
+
+// Rename the file with a timestamp suffix and start a new one if it's too large or old
+void CdrWriter::rotate(u_int64_t now)
+{
+    if (m_file < 0)
+	return;
+    if (!((m_rotateSize && (m_size >= m_rotateSize))
+	    || (m_rotateTime && m_size && (now - m_opened >= m_rotateTime))))
+	return;
+    int year;
+    unsigned int month, day, hour, minute, sec;
+    Time::toDateTime(Time::secNow(),year,month,day,hour,minute,sec);
+    char buf[32];
+    ::snprintf(buf,sizeof(buf),".%04d%02u%02u%02u%02u%02u",year,month,day,hour,minute,sec);
+    String name = m_fileName + buf;
+    struct stat st;
+    // never overwrite a file rotated in the same second
+    for (unsigned int i = 1; !::stat(name,&st); i++) {
+	name = m_fileName + buf;
+	name << "-" << i;
+    }
+    if (m_dirty) {
+#ifndef _WINDOWS
+	::fdatasync(m_file);
+#endif
+	m_dirty = false;
+	m_synced = now;
+    }
+    ::close(m_file);
+    m_file = -1;
+    if (::rename(m_fileName,name))
+	Alarm("cdrfile","system",DebugWarn,"Failed to rename '%s' to '%s': %s (%d)",
+	    m_fileName.c_str(),name.c_str(),::strerror(errno),errno);
+    else {
+	m_rotated.inc();
+	Debug(&__plugin,DebugInfo,"Rotated CDR file to '%s'",name.c_str());
+    }
+    open();
+}
+
+
 CdrFileHandler::~CdrFileHandler()
 {
-    Lock lock(this);
+    stopWriter();
+    WLock lock(this);
     if (m_file >= 0) {
 	::close(m_file);
 	m_file = -1;
     }
 }
 
-void CdrFileHandler::init(const char *fname, bool tabsep, bool combined, const char* format, int mode)
+bool CdrFileHandler::openFile()
+{
+    m_file = ::open(m_fileName,O_WRONLY|O_CREAT|O_APPEND|O_LARGEFILE,m_mode);
+    if (m_file >= 0)
+	return true;
+    Alarm("cdrfile","system",DebugWarn,"Failed to open or create '%s': %s (%d)",
+	m_fileName.c_str(),::strerror(errno),errno);
+    return false;
+}
+
+// Stop the asynchronous writer, optionally keep writing synchronously
+void CdrFileHandler::stopWriter(bool reopen)
+{
+    WLock lock(this);
+    CdrWriter* w = m_writer;
+    m_writer = 0;
+    if (!w)
+	return;
+    w->stop();
+    delete w;
+    if (reopen)
+	openFile();
+}
+
+void CdrFileHandler::init(const char *fname, bool tabsep, bool combined, const char* format, int mode,
+    const NamedList& params)
 {
-    Lock lock(this);
+    stopWriter();
+    WLock lock(this);
     if (m_file >= 0) {
 	::close(m_file);
 	m_file = -1;
     }
-    m_format = format;
+    String fmt = format;
+    m_fileName = fname;
+    m_mode = mode;
     m_combined = combined;
-    if (m_format.null()) {
-	m_format = tabsep
+    if (fmt.null()) {
+	fmt = tabsep
 	    ? (combined
 		? "${time}\t${billid}\t${chan}\t${address}\t${caller}\t${called}"
 		    "\t${billtime}\t${ringtime}\t${duration}\t${status}\t${reason}"
@@ -104,12 +542,18 @@ void CdrFileHandler::init(const char *fname, bool tabsep, bool combined, const c
 		    ",${billtime},${ringtime},${duration},\"${direction}\",\"${status}\",\"${reason}\""
 	      );
     }
-    if (fname) {
-	m_file = ::open(fname,O_WRONLY|O_CREAT|O_APPEND|O_LARGEFILE,mode);
-	if (m_file < 0)
-	    Alarm("cdrfile","system",DebugWarn,"Failed to open or create '%s': %s (%d)",
-		fname,::strerror(errno),errno);
+    m_format = fmt + EOLN;
+    if (m_fileName.null())
+	return;
+    if (params.getBoolValue(YSTRING("async"))) {
+	m_writer = new CdrWriter(m_fileName,mode,params);
+	if (m_writer->start())
+	    return;
+	delete m_writer;
+	m_writer = 0;
+	return;
     }
+    openFile();
 }
 
 bool CdrFileHandler::received(Message &msg)
@@ -122,19 +566,42 @@ bool CdrFileHandler::received(Message &msg)
     if (!msg.getBoolValue("cdrwrite",true))
         return false;
 
-    Lock lock(this);
-    if ((m_file >= 0) && m_format) {
-	String str = m_format;
-	str += EOLN;
-	msg.replaceParams(str);
+    RLock rlock(this);
+    if (m_writer) {
+	// the line is written later by the writer thread
+	String* str = new String;
+	m_format.render(msg,*str);
+	m_writer->push(str);
+	return false;
+    }
+    rlock.drop();
+    WLock lock(this);
+    if (m_writer) {
+	// init() started a writer while no lock was held
+	String* str = new String;
+	m_format.render(msg,*str);
+	m_writer->push(str);
+    }
+    else if ((m_file >= 0) && !m_format.null()) {
+	String str;
+	m_format.render(msg,str);
 	YIGNORE(::write(m_file,str.c_str(),str.length()));
     }
     return false;
 };
 
+void CdrFileHandler::status(String& str)
+{
+    RLock lock(this);
+    str << "async=" << String::boolText(m_writer != 0);
+    if (m_writer)
+	m_writer->status(str);
+}
+
+
 CdrFilePlugin::CdrFilePlugin()
-    : Plugin("cdrfile",true),
-      m_handler(0)
+    : Module("cdrfile","misc",true),
+      m_first(true), m_handler(0)
 {
     Output("Loaded module CdrFile");
 }
@@ -147,18 +614,38 @@ CdrFilePlugin::~CdrFilePlugin()
 void CdrFilePlugin::initialize()
 {
     Output("Initializing module CdrFile");
+    if (m_first) {
+	m_first = false;
+	setup();
+	installRelay(Halt);
+    }
     Configuration cfg(Engine::configFile("cdrfile"));
-    String file = cfg.getValue("general","file");
+    const NamedList& gen = cfg.getSection("general") ? *cfg.getSection("general") : NamedList::empty();
+    String file = gen.getValue("file");
     Engine::self()->runParams().replaceParams(file);
     if (file && !m_handler) {
 	m_handler = new CdrFileHandler("call.cdr");
 	Engine::install(m_handler);
     }
     if (m_handler)
-	m_handler->init(file,cfg.getBoolValue("general","tabs",true),
-	    cfg.getBoolValue("general","combined",false),
-	    cfg.getValue("general","format"),
-	    cfg.getIntValue("general","mode",0640));
+	m_handler->init(file,gen.getBoolValue("tabs",true),
+	    gen.getBoolValue("combined",false),
+	    gen.getValue("format"),
+	    gen.getIntValue("mode",0640),gen);
+}
+
+bool CdrFilePlugin::received(Message& msg, int id)
+{
+    // write out the queued CDRs before the engine kills the threads
+    if ((Halt == id) && m_handler)
+	m_handler->stopWriter(true);
+    return Module::received(msg,id);
+}
+
+void CdrFilePlugin::statusParams(String& str)
+{
+    if (m_handler)
+	m_handler->status(str);
 }
 
 }; // anonymous namespace
@@ -23,6 +23,13 @@
 
 #include <yatephone.h>
 
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MIX_X86
+#include <immintrin.h>
+#endif
+
 using namespace TelEngine;
 namespace { // anonymous
 
@@ -33,6 +40,9 @@ namespace { // anonymous
 #define MAX_SPEAKERS 8
 #define DEF_SPEAKERS 3
 
+// maximum number of loudest smart channels we can limit mixing to
+#define MAX_MIXED 32
+
 // Speaking detector energy square hysteresis
 #define SPEAK_HIST_MIN 16384
 #define SPEAK_HIST_MAX 32768
@@ -66,6 +76,23 @@ class ConfConsumer;
 class ConfSource;
 class ConfChan;
 
+// Sample mixing primitives, all operate on unaligned buffers
+typedef void (*MixAddFunc)(int* acc, const int16_t* src, unsigned int samples);
+typedef void (*MixSatFunc)(int16_t* dst, const int* acc, unsigned int samples);
+typedef void (*MixSubFunc)(int16_t* dst, const int* acc, const int16_t* own, unsigned int samples);
+
+// A set of mixing primitives for one instruction set
+struct MixKernel
+{
+    const char* name;
+    // add signed linear samples into accumulator
+    MixAddFunc add;
+    // saturate accumulator into signed linear samples
+    MixSatFunc saturate;
+    // substract own samples from accumulator and saturate the result
+    MixSubFunc subtract;
+};
+
 // The list of conference rooms
 static ObjList s_rooms;
 
@@ -129,6 +156,9 @@ private:
     ObjList m_owners;
     String m_notify;
     String m_playerId;
+    const MixKernel* m_kernel;
+    DataBlock m_mixBuf;
+    unsigned int m_mixSpeakers;
     bool m_lonely;
     bool m_created;
     ConfChan* m_record;
@@ -188,7 +218,7 @@ class ConfConsumer : public DataConsumer
     YCLASS(ConfConsumer,DataConsumer);
 public:
     ConfConsumer(ConfRoom* room, bool smart = false)
-	: m_room(room), m_src(0), m_muted(false), m_smart(smart), m_speak(false),
+	: m_room(room), m_src(0), m_muted(false), m_mixed(false), m_smart(smart), m_speak(false),
 	  m_energy2(ENERGY_MIN), m_noise2(ENERGY_MIN), m_envelope2(ENERGY_MIN)
 	{ DDebug(DebugAll,"ConfConsumer::ConfConsumer(%p,%s) [%p]",room,String::boolText(smart),this); m_format = room->getFormat(); }
     ~ConfConsumer()
@@ -215,17 +245,19 @@ public:
     inline bool shouldMix() const
 	{ return hasSignal() && (m_buffer.length() > 1); }
 private:
-    void consumed(const int* mixed, unsigned int samples);
-    void dataForward(const int* mixed, unsigned int samples);
+    void consumed(const MixKernel* kernel, const int* mixed, unsigned int samples);
+    void dataForward(const MixKernel* kernel, const int* mixed, unsigned int samples);
     RefPointer<ConfRoom> m_room;
     ConfSource* m_src;
     bool m_muted;
+    bool m_mixed;
     bool m_smart;
     bool m_speak;
     unsigned int m_energy2;
     unsigned int m_noise2;
     unsigned int m_envelope2;
     DataBlock m_buffer;
+    DataBlock m_output;
 };
 
 // Per channel data source with that channel's data removed from the mix
@@ -303,6 +335,168 @@ static unsigned int binLog(unsigned int x)
     return v;
 }
 
+// Saturate symmetrically the result of additions and substractions
+static inline int16_t saturate(int val)
+{
+    return (val < -32767) ? -32767 : ((val > 32767) ? 32767 : val);
+}
+
+static void scalarAdd(int* acc, const int16_t* src, unsigned int samples)
+{
+    for (unsigned int i = 0; i < samples; i++)
+	acc[i] += src[i];
+}
+
+static void scalarSaturate(int16_t* dst, const int* acc, unsigned int samples)
+{
+    for (unsigned int i = 0; i < samples; i++)
+	dst[i] = saturate(acc[i]);
+}
+
+static void scalarSubtract(int16_t* dst, const int* acc, const int16_t* own, unsigned int samples)
+{
+    for (unsigned int i = 0; i < samples; i++)
+	dst[i] = saturate(acc[i] - own[i]);
+}
+
+#ifdef MIX_X86
+
+// SSE2 versions process 8 samples at a time
+__attribute__((target("sse2")))
+static void sse2Add(int* acc, const int16_t* src, unsigned int samples)
+{
+    unsigned int i = 0;
+    for (; i + 8 <= samples; i += 8) {
+	__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+	// sign extend by unpacking with itself then shifting arithmetically
+	__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s,s),16);
+	__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s,s),16);
+	__m128i* a = (__m128i*)(acc + i);
+	_mm_storeu_si128(a,_mm_add_epi32(_mm_loadu_si128(a),lo));
+	_mm_storeu_si128(a + 1,_mm_add_epi32(_mm_loadu_si128(a + 1),hi));
+    }
+    scalarAdd(acc + i,src + i,samples - i);
+}
+
+__attribute__((target("sse2")))
+static void sse2Saturate(int16_t* dst, const int* acc, unsigned int samples)
+{
+    const __m128i floor = _mm_set1_epi16(-32767);
+    unsigned int i = 0;
+    for (; i + 8 <= samples; i += 8) {
+	const __m128i* a = (const __m128i*)(acc + i);
+	__m128i d = _mm_packs_epi32(_mm_loadu_si128(a),_mm_loadu_si128(a + 1));
+	_mm_storeu_si128((__m128i*)(dst + i),_mm_max_epi16(d,floor));
+    }
+    scalarSaturate(dst + i,acc + i,samples - i);
+}
+
+__attribute__((target("sse2")))
+static void sse2Subtract(int16_t* dst, const int* acc, const int16_t* own, unsigned int samples)
+{
+    const __m128i floor = _mm_set1_epi16(-32767);
+    unsigned int i = 0;
+    for (; i + 8 <= samples; i += 8) {
+	__m128i s = _mm_loadu_si128((const __m128i*)(own + i));
+	__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s,s),16);
+	__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s,s),16);
+	const __m128i* a = (const __m128i*)(acc + i);
+	lo = _mm_sub_epi32(_mm_loadu_si128(a),lo);
+	hi = _mm_sub_epi32(_mm_loadu_si128(a + 1),hi);
+	_mm_storeu_si128((__m128i*)(dst + i),_mm_max_epi16(_mm_packs_epi32(lo,hi),floor));
+    }
+    scalarSubtract(dst + i,acc + i,own + i,samples - i);
+}
+
+// AVX2 versions process 16 samples at a time
+__attribute__((target("avx2")))
+static void avx2Add(int* acc, const int16_t* src, unsigned int samples)
+{
+    unsigned int i = 0;
+    for (; i + 16 <= samples; i += 16) {
+	__m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+	__m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i + 8)));
+	__m256i* a = (__m256i*)(acc + i);
+	_mm256_storeu_si256(a,_mm256_add_epi32(_mm256_loadu_si256(a),lo));
+	_mm256_storeu_si256(a + 1,_mm256_add_epi32(_mm256_loadu_si256(a + 1),hi));
+    }
+    sse2Add(acc + i,src + i,samples - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2Saturate(int16_t* dst, const int* acc, unsigned int samples)
+{
+    const __m256i floor = _mm256_set1_epi16(-32767);
+    unsigned int i = 0;
+    for (; i + 16 <= samples; i += 16) {
+	const __m256i* a = (const __m256i*)(acc + i);
+	__m256i d = _mm256_packs_epi32(_mm256_loadu_si256(a),_mm256_loadu_si256(a + 1));
+	// packing works within 128 bit lanes, put the quadwords back in order
+	d = _mm256_permute4x64_epi64(d,0xd8);
+	_mm256_storeu_si256((__m256i*)(dst + i),_mm256_max_epi16(d,floor));
+    }
+    sse2Saturate(dst + i,acc + i,samples - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2Subtract(int16_t* dst, const int* acc, const int16_t* own, unsigned int samples)
+{
+    const __m256i floor = _mm256_set1_epi16(-32767);
+    unsigned int i = 0;
+    for (; i + 16 <= samples; i += 16) {
+	__m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(own + i)));
+	__m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(own + i + 8)));
+	const __m256i* a = (const __m256i*)(acc + i);
+	lo = _mm256_sub_epi32(_mm256_loadu_si256(a),lo);
+	hi = _mm256_sub_epi32(_mm256_loadu_si256(a + 1),hi);
+	__m256i d = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo,hi),0xd8);
+	_mm256_storeu_si256((__m256i*)(dst + i),_mm256_max_epi16(d,floor));
+    }
+    sse2Subtract(dst + i,acc + i,own + i,samples - i);
+}
+
+#endif // MIX_X86
+
+// Available mixing kernels, in order of preference from lowest
+static const MixKernel s_kernels[] = {
+    { "scalar", scalarAdd, scalarSaturate, scalarSubtract },
+#ifdef MIX_X86
+    { "sse2", sse2Add, sse2Saturate, sse2Subtract },
+    { "avx2", avx2Add, avx2Saturate, avx2Subtract },
+#endif
+};
+
+// Index of the best kernel supported by the running CPU
+static int s_bestKernel = -1;
+
+// Detect the best mixing kernel the CPU can run
+static void detectKernel()
+{
+    if (s_bestKernel >= 0)
+	return;
+    s_bestKernel = 0;
+#ifdef MIX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+	s_bestKernel = 1;
+    if (__builtin_cpu_supports("avx2"))
+	s_bestKernel = 2;
+#endif
+    Debug(&__plugin,DebugInfo,"Using '%s' mixing kernel",s_kernels[s_bestKernel].name);
+}
+
+// Find a kernel by name, never returns one not supported by the CPU
+static const MixKernel* findKernel(const String& name)
+{
+    detectKernel();
+    if (name && (name != YSTRING("auto"))) {
+	for (int i = 0; i < s_bestKernel; i++)
+	    if (name == s_kernels[i].name)
+		return s_kernels + i;
+    }
+    return s_kernels + s_bestKernel;
+}
+
 
 // Get a pointer to a conference by name, optionally creates it with given parameters
 // If a pointer is returned it must be dereferenced by the caller
@@ -327,7 +521,8 @@ ConfRoom* ConfRoom::get(const String& name, const NamedList* params)
 
 // Private constructor, always called from ConfRoom::get() with mutex hold
 ConfRoom::ConfRoom(const String& name, const NamedList& params)
-    : m_name(name), m_lonely(false), m_created(true), m_record(0),
+    : m_name(name), m_kernel(0), m_mixSpeakers(0),
+      m_lonely(false), m_created(true), m_record(0),
       m_rate(8000), m_users(0), m_maxusers(10), m_maxLock(200),
       m_expire(0), m_lonelyInterval(0), m_nextNotify(0), m_nextSpeakers(0)
 {
@@ -350,6 +545,8 @@ ConfRoom::ConfRoom(const String& name, const NamedList& params)
     else if (m_trackInterval < MIN_INTERVAL)
 	m_trackInterval = MIN_INTERVAL;
     setLonelyTimeout(params["lonely"]);
+    m_kernel = findKernel(params["mixer"]);
+    m_mixSpeakers = params.getIntValue("mixspeakers",0,0,MAX_MIXED);
     if (m_rate != 8000)
 	m_format << "/" << m_rate;
     // size of the data blocks in bytes - divide by 2 to get samples
@@ -554,6 +751,8 @@ void ConfRoom::msgStatus(Message& msg)
     msg.retValue() << ",users=" << m_users;
     msg.retValue() << ",chans=" << m_chans.count();
     msg.retValue() << ",owners=" << m_owners.count();
+    msg.retValue() << ",mixer=" << m_kernel->name;
+    msg.retValue() << ",mixspeakers=" << m_mixSpeakers;
     if (m_notify)
 	msg.retValue() << ",notify=" << m_notify;
     if (m_playerId)
@@ -658,6 +857,9 @@ void ConfRoom::mix(ConfConsumer* cons)
 {
     unsigned int len = m_maxBuffer;
     unsigned int mlen = 0;
+    // envelopes of the loudest smart channels, sorted descending
+    unsigned int loudest[MAX_MIXED];
+    unsigned int louder = 0;
     Lock mylock(this);
     // find out the minimum and maximum amount of data in buffers
     ObjList* l = m_chans.skipNull();
@@ -670,6 +872,17 @@ void ConfRoom::mix(ConfConsumer* cons)
 		len = buffered;
 	    if (mlen < buffered)
 		mlen = buffered;
+	    if (!(m_mixSpeakers && co->smart() && co->shouldMix()))
+		continue;
+	    // keep the highest envelopes, they set the threshold for mixing
+	    unsigned int env = co->envelope2();
+	    unsigned int i = (louder < m_mixSpeakers) ? louder++ : m_mixSpeakers;
+	    for (; i && (loudest[i-1] < env); i--) {
+		if (i < m_mixSpeakers)
+		    loudest[i] = loudest[i-1];
+	    }
+	    if (i < m_mixSpeakers)
+		loudest[i] = env;
 	}
     }
     XDebug(&__plugin,DebugAll,"ConfRoom::mix() buffer %u - %u [%p]",len,mlen,this);
@@ -693,15 +906,35 @@ void ConfRoom::mix(ConfConsumer* cons)
 	speakVol[spk] = 0;
 	speakChan[spk] = 0;
     }
+    // only smart channels at least as loud as the last of the loudest are mixed
+    unsigned int threshold = 0;
+    unsigned int ties = 0;
+    if (louder >= m_mixSpeakers && louder) {
+	threshold = loudest[louder-1];
+	// at most this many channels exactly on threshold can be mixed
+	for (unsigned int i = louder; i && (loudest[i-1] == threshold); i--)
+	    ties++;
+    }
     len = len * m_dataChunk / sizeof(int16_t);
-    DataBlock mixbuf(0,len*sizeof(int));
-    int* buf = (int*)mixbuf.data();
+    // reuse the accumulator between mixes, it is protected by the room lock
+    if (m_mixBuf.length() < len*sizeof(int))
+	m_mixBuf.assign(0,len*sizeof(int));
+    int* buf = (int*)m_mixBuf.data();
+    ::memset(buf,0,len*sizeof(int));
     for (l = m_chans.skipNull(); l; l = l->skipNext()) {
 	ConfChan* ch = static_cast<ConfChan*>(l->get());
 	ConfConsumer* co = static_cast<ConfConsumer*>(ch->getConsumer());
 	if (co) {
 	    // avoid mixing in noise
-	    if (co->shouldMix()) {
+	    co->m_mixed = co->shouldMix();
+	    if (co->m_mixed && threshold && co->smart()) {
+		unsigned int env = co->envelope2();
+		if (env < threshold)
+		    co->m_mixed = false;
+		else if (env == threshold)
+		    co->m_mixed = ties && ties--;
+	    }
+	    if (co->m_mixed) {
 		unsigned int n = co->m_buffer.length() / 2;
 #ifdef XDEBUG
 		if (ch->debugAt(DebugAll)) {
@@ -719,9 +952,7 @@ void ConfRoom::mix(ConfConsumer* cons)
 #endif
 		if (n > len)
 		    n = len;
-		const int16_t* p = (const int16_t*)co->m_buffer.data();
-		for (unsigned int i=0; i < n; i++)
-		    buf[i] += *p++;
+		m_kernel->add(buf,(const int16_t*)co->m_buffer.data(),n);
 	    }
 	    if (m_trackSpeakers && m_notify && !ch->isUtility() && co->speaking()) {
 		int vol = co->envelope();
@@ -743,16 +974,11 @@ void ConfRoom::mix(ConfConsumer* cons)
 	ConfChan* ch = static_cast<ConfChan*>(l->get());
 	ConfConsumer* co = static_cast<ConfConsumer*>(ch->getConsumer());
 	if (co)
-	    co->consumed(buf,len);
+	    co->consumed(m_kernel,buf,len);
     }
+    // this block is forwarded after unlocking so it cannot be reused
     DataBlock data(0,len*sizeof(int16_t));
-    int16_t* p = (int16_t*)data.data();
-    for (unsigned int i=0; i < len; i++) {
-	int val = buf[i];
-	// saturate symmetrically the result of addition
-	*p++ = (val < -32767) ? -32767 : ((val > 32767) ? 32767 : val);
-    }
-    mixbuf.clear();
+    m_kernel->saturate((int16_t*)data.data(),buf,len);
     Message* m = 0;
     while (m_trackSpeakers && m_notify) {
 	u_int64_t now = Time::now();
@@ -956,11 +1182,11 @@ unsigned long ConfConsumer::Consume(const DataBlock& data, unsigned long tStamp,
 
 // Take out of the buffer the samples mixed in or skipped
 //  this method is called with the room locked
-void ConfConsumer::consumed(const int* mixed, unsigned int samples)
+void ConfConsumer::consumed(const MixKernel* kernel, const int* mixed, unsigned int samples)
 {
     if (!samples)
 	return;
-    dataForward(mixed,samples);
+    dataForward(kernel,mixed,samples);
     unsigned int n = m_buffer.length() / 2;
     if (samples > n) {
 	// buffer underflowed
@@ -980,7 +1206,7 @@ void ConfConsumer::consumed(const int* mixed, unsigned int samples)
 }
 
 // Substract our own data from the mix and send it on the no-echo source
-void ConfConsumer::dataForward(const int* mixed, unsigned int samples)
+void ConfConsumer::dataForward(const MixKernel* kernel, const int* mixed, unsigned int samples)
 {
     if (!(m_src && mixed))
 	return;
@@ -991,19 +1217,18 @@ void ConfConsumer::dataForward(const int* mixed, unsigned int samples)
     if (!src)
 	return;
 
-    int16_t* d = (int16_t*)m_buffer.data();
-    unsigned int n = m_buffer.length() / 2;
-    DataBlock data(0,samples*sizeof(int16_t));
-    int16_t* p = (int16_t*)data.data();
-    for (unsigned int i=0; i < samples; i++) {
-	int val = *mixed++;
-	// substract our own data if we contributed - only as much as we have
-	if ((i < n) && shouldMix())
-	    val -= d[i];
-	// saturate symmetrically the result of additions and substraction
-	*p++ = (val < -32767) ? -32767 : ((val > 32767) ? 32767 : val);
-    }
-    src->Forward(data);
+    // the output block is reused, we are called with the room locked
+    if (m_output.length() != samples*sizeof(int16_t))
+	m_output.assign(0,samples*sizeof(int16_t));
+    int16_t* p = (int16_t*)m_output.data();
+    // substract our own data if we contributed - only as much as we have
+    unsigned int n = m_mixed ? m_buffer.length() / 2 : 0;
+    if (n > samples)
+	n = samples;
+    if (n)
+	kernel->subtract(p,mixed,(const int16_t*)m_buffer.data(),n);
+    kernel->saturate(p + n,mixed + n,samples - n);
+    src->Forward(m_output);
 }
 
 unsigned int ConfConsumer::energy() const
@@ -1370,6 +1595,10 @@ bool ConferenceDriver::received(Message &msg, int id)
 	"notify" - ID used for "chan.notify" room notifications, an empty
 	    string (default) will disable notifications
 	"record" - route that will make an outgoing record-only call
+	"mixspeakers" - mix only this many loudest smart channels, non smart
+	    channels are always mixed; 0 (default) mixes everybody
+	"mixer" - mixing kernel: scalar, sse2, avx2 or auto (default), a kernel
+	    the CPU does not support is replaced with the best available one
     Input parameters - per conference leg:
 	"utility" - true creates a channel that is used for housekeeping
 	    tasks like recording or playing prompts to everybody
@@ -60,9 +60,19 @@ namespace { // anonymous
 // Safety wait time after we flushed watchers, relays or messages (in ms)
 #define WAIT_FLUSH 5
 
+// Size of the hash table holding messages waiting for an answer
+#define WAITING_HASH 127
+
+// Length of the network order size prefix of a binary frame
+#define FRAME_HEADER 4
+
+// Number of buckets in the answer latency histogram
+#define LATENCY_BUCKETS 11
+
 static Configuration s_cfg;
 static ObjList s_chans;
 static ObjList s_modules;
+static ObjList s_pools;
 static Mutex s_mutex(true,"ExtModule");
 static Mutex s_uses(false,"ExtModUse");
 static int s_waitFlush = WAIT_FLUSH;
@@ -85,11 +95,17 @@ static const char* s_cmds[] = {
     0
 };
 
+// Upper bounds of the latency histogram buckets in msec, the last one is unbounded
+static const unsigned int s_latency[LATENCY_BUCKETS - 1] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000
+};
+
 static const char s_helpExternalCmd[] = "external [info] [stop scriptname] [[start|restart] scriptname [parameter]] [execute progname [parameter]]";
 static const char s_helpExternalInfo[] = "List, (re)start and stop scripts or execute an external program";
 
 class ExtModReceiver;
 class ExtModChan;
+class ExtModPool;
 
 static inline unsigned int idleIntervals(unsigned int ms)
 {
@@ -166,6 +182,20 @@ private:
     bool m_waiting;
 };
 
+// Sequential reader of the NUL separated fields of a binary frame
+class FrameReader
+{
+public:
+    inline FrameReader(const char* data, unsigned int len)
+	: m_pos(data), m_end(data + len)
+	{ }
+    bool next(String& field);
+    bool decode(Message& msg);
+private:
+    const char* m_pos;
+    const char* m_end;
+};
+
 // Great idea - thanks, Maciek!
 class ExtMessage : public Message
 {
@@ -182,6 +212,7 @@ public:
 	{ return m_receiver == recv; }
     inline int decode(const char* str)
 	{ return Message::decode(str,m_id); }
+    bool decode(FrameReader& frame);
     inline const String& id() const
 	{ return m_id; }
 private:
@@ -196,10 +227,15 @@ public:
     MsgHolder(Message &msg);
     Message &m_msg;
     bool m_ret;
+    bool m_done;
+    u_int64_t m_start;
     String m_id;
     bool decode(const char *s);
+    bool decode(FrameReader& frame);
     inline const Message* msg() const
 	{ return &m_msg; }
+    virtual const String& toString() const
+	{ return m_id; }
 };
 
 // Yet Another of Maciek's ideas
@@ -232,12 +268,15 @@ public:
     static ExtModReceiver* build(const char *script, const char *args, bool ref = false,
 	File* ain = 0, File* aout = 0, ExtModChan *chan = 0);
     static ExtModReceiver* build(const char* name, Stream* io, ExtModChan* chan = 0,
-	int role = RoleUnknown, const char* conn = 0);
+	int role = RoleUnknown, const char* conn = 0, ExtModPool* pool = 0);
     static ExtModReceiver* find(const String& script, const String& arg);
     virtual void destruct();
     virtual bool received(Message& msg, int id);
+    bool received(Message& msg, int id, bool& sent);
     bool processLine(const char* line);
+    bool processFrame(const char* data, unsigned int len);
     bool outputLine(const char* line);
+    bool outputMessage(const Message& msg, const char* id, int accepted = -1);
     void reportError(const char* line);
     void returnMsg(const Message* msg, const char* id, bool accepted);
     bool addWatched(const String& name);
@@ -259,6 +298,14 @@ public:
 	{ return m_args; }
     inline bool selfWatch() const
 	{ return m_selfWatch; }
+    inline bool reenter() const
+	{ return m_reenter; }
+    inline int queued() const
+	{ return m_qLength; }
+    inline u_int64_t dispatched() const
+	{ return m_dispatched; }
+    inline const String& trackName() const
+	{ return m_trackName; }
     inline void setRestart(bool restart)
 	{ m_restart = restart; }
     inline bool dead() const
@@ -266,17 +313,26 @@ public:
     inline const char* desc() const
 	{ return m_desc; }
     void describe(String& rval) const;
+    void statistics(String& rval) const;
 
 private:
     ExtModReceiver(const char* script, const char* args,
 	File* ain, File* aout, ExtModChan* chan);
     ExtModReceiver(const char* name, Stream* io, ExtModChan* chan,
-	int role, const char* conn);
+	int role, const char* conn, ExtModPool* pool);
     bool create(const char* script, const char* args);
     void closeIn();
     void closeOut();
     void closeAudio();
-    bool outputLineInternal(const char* line, int len);
+    bool lockOutput(int len);
+    void unlockOutput();
+    bool writeData(const void* data, int len);
+    bool writeLine(const char* line, int len);
+    bool switchFraming(const char* line, bool binary);
+    bool startMessage(ExtMessage* m);
+    void answered(MsgHolder* h);
+    inline MsgHolder* findWaiting(const String& id) const
+	{ return static_cast<MsgHolder*>(m_waiting[id]); }
     void debugMsgInstResult(bool ok, const char* oper, const char* name, const char* extra = 0);
 
     int m_role;
@@ -295,15 +351,20 @@ private:
     bool m_reenter;
     bool m_setdata;
     bool m_settime;
-    bool m_writing;
+    bool m_binary;
     int m_maxQueue;
     int m_timeout;
     bool m_timebomb;
     bool m_restart;
     bool m_scripted;
+    ExtModPool* m_pool;
+    u_int64_t m_dispatched;
+    unsigned int m_timeouts;
+    unsigned int m_latency[LATENCY_BUCKETS];
     DataBlock m_buffer;
+    Mutex m_writeMutex;
     String m_script, m_args;
-    ObjList m_waiting;
+    HashList m_waiting;
     ObjList m_relays;
     String m_trackName;
     String m_reason;
@@ -325,6 +386,48 @@ private:
     ExtModReceiver* m_receiver;
 };
 
+// A handler installed by one or more connections of a pool
+class PoolHandler : public String
+{
+public:
+    PoolHandler(const String& name, int prio, const String& fname, const String& fvalue, int id);
+    ~PoolHandler();
+    inline bool matches(const String& name, int prio, const String& fname, const String& fvalue) const
+	{ return (*this == name) && (m_prio == prio) && (m_fname == fname) && (m_fvalue == fvalue); }
+    int m_prio;
+    int m_id;
+    String m_fname;
+    String m_fvalue;
+    MessageRelay* m_relay;
+    ObjList m_members;
+};
+
+// Connections accepted by a pool listener, handlers are installed once for
+//  the whole pool and each message goes to the least loaded connection
+class ExtModPool : public MessageReceiver, public Mutex
+{
+public:
+    ExtModPool(const String& name);
+    ~ExtModPool();
+    virtual bool received(Message& msg, int id);
+    virtual const String& toString() const
+	{ return m_name; }
+    void attach(ExtModReceiver* recv);
+    void detach(ExtModReceiver* recv);
+    bool install(ExtModReceiver* recv, const String& name, int prio,
+	const String& fname, const String& fvalue);
+    bool uninstall(ExtModReceiver* recv, const String& name, int& prio);
+    void statusDetail(String& str);
+    inline unsigned int members() const
+	{ return m_members.count(); }
+private:
+    void release(ObjList* item, ObjList& unused);
+    String m_name;
+    ObjList m_members;
+    ObjList m_handlers;
+    int m_lastId;
+};
+
 class ExtModHandler;
 
 class ExtModulePlugin : public Module
@@ -338,7 +441,9 @@ public:
 protected:
     virtual bool commandExecute(String& retVal, const String& line);
     virtual bool commandComplete(Message& msg, const String& partLine, const String& partWord);
+    virtual void statusModule(String& str);
     virtual void statusParams(String& str);
+    virtual void statusDetail(String& str);
     virtual bool received(Message& msg, int id);
     void cleanup(bool fromDestruct = false);
 
@@ -371,6 +476,7 @@ protected:
     Socket m_socket;
     String m_name;
     int m_role;
+    ExtModPool* m_pool;
 };
 
 
@@ -641,8 +747,95 @@ void ExtModChan::disconnected(bool final, const char *reason)
 }
 
 
+// Build a binary frame carrying a message or a message answer
+static void encodeFrame(DataBlock& frame, const char* keyword, const char* id,
+    const String& extra, const Message& msg)
+{
+    const String& name = msg;
+    unsigned int klen = ::strlen(keyword);
+    unsigned int ilen = TelEngine::null(id) ? 0 : ::strlen(id);
+    unsigned int len = klen + ilen + extra.length() + name.length() +
+	msg.retValue().length() + 4;
+    unsigned int n = msg.length();
+    for (unsigned int i = 0; i < n; i++) {
+	const NamedString* s = msg.getParam(i);
+	if (s)
+	    len += s->name().length() + s->length() + 2;
+    }
+    frame.assign(0,FRAME_HEADER + len);
+    uint8_t* buf = static_cast<uint8_t*>(frame.data());
+    DataBlock::hton4(buf,len);
+    // separators are already zero filled so we just skip over them
+    char* p = reinterpret_cast<char*>(buf + FRAME_HEADER);
+    ::memcpy(p,keyword,klen);
+    p += klen + 1;
+    if (ilen)
+	::memcpy(p,id,ilen);
+    p += ilen + 1;
+    ::memcpy(p,extra.c_str(),extra.length());
+    p += extra.length() + 1;
+    ::memcpy(p,name.c_str(),name.length());
+    p += name.length() + 1;
+    ::memcpy(p,msg.retValue().c_str(),msg.retValue().length());
+    p += msg.retValue().length();
+    for (unsigned int i = 0; i < n; i++) {
+	const NamedString* s = msg.getParam(i);
+	if (!s)
+	    continue;
+	*p++ = 0;
+	::memcpy(p,s->name().c_str(),s->name().length());
+	p += s->name().length();
+	*p++ = '=';
+	::memcpy(p,s->c_str(),s->length());
+	p += s->length();
+    }
+}
+
+
+bool FrameReader::next(String& field)
+{
+    if (m_pos > m_end)
+	return false;
+    const char* sep = static_cast<const char*>(::memchr(m_pos,0,m_end - m_pos));
+    if (!sep)
+	sep = m_end;
+    field.assign(m_pos,sep - m_pos);
+    m_pos = sep + 1;
+    return true;
+}
+
+// Decode the name, return value and parameters of a message, same as commonDecode
+bool FrameReader::decode(Message& msg)
+{
+    String tmp;
+    if (!next(tmp))
+	return true;
+    if (tmp)
+	msg = tmp;
+    if (!next(tmp))
+	return true;
+    msg.retValue() = tmp;
+    while (next(tmp)) {
+	if (tmp.null())
+	    continue;
+	int pos = tmp.find('=');
+	switch (pos) {
+	    case -1:
+		msg.clearParam(tmp);
+		break;
+	    case 0:
+		return false;
+	    default:
+		msg.setParam(tmp.substr(0,pos),tmp.substr(pos + 1));
+	}
+    }
+    return true;
+}
+
+
 MsgHolder::MsgHolder(Message &msg)
-    : m_msg(msg), m_ret(false)
+    : Semaphore(1,"ExtModHolder",0),
+      m_msg(msg), m_ret(false), m_done(false), m_start(Time::now())
 {
     // the address of this object should be unique
     char buf[64];
@@ -655,6 +848,16 @@ bool MsgHolder::decode(const char *s)
     return (m_msg.decode(s,m_ret,m_id) == -2);
 }
 
+// Keyword and id were already matched by the receiver
+bool MsgHolder::decode(FrameReader& frame)
+{
+    String rcvd;
+    if (!(frame.next(rcvd) && rcvd.isBoolean()))
+	return false;
+    m_ret = rcvd.toBoolean();
+    return frame.decode(m_msg);
+}
+
 
 ExtMessage::~ExtMessage()
 {
@@ -664,6 +867,19 @@ ExtMessage::~ExtMessage()
     }
 }
 
+// Keyword was already matched by the receiver
+bool ExtMessage::decode(FrameReader& frame)
+{
+    String tm;
+    if (!(frame.next(m_id) && frame.next(tm)))
+	return false;
+    int64_t t = tm.toInt64(-1,10);
+    if (t < 0)
+	return false;
+    msgTime() = t ? ((u_int64_t)1000000) * t : Time::now();
+    return frame.decode(*this);
+}
+
 void ExtMessage::startup(ExtModReceiver* recv)
 {
     if (recv && m_id && recv->use())
@@ -754,6 +970,175 @@ void MsgWatcher::clear()
 }
 
 
+PoolHandler::PoolHandler(const String& name, int prio, const String& fname,
+    const String& fvalue, int id)
+    : String(name),
+      m_prio(prio), m_id(id), m_fname(fname), m_fvalue(fvalue), m_relay(0)
+{
+}
+
+PoolHandler::~PoolHandler()
+{
+    // same as the receiver relays - don't touch the engine if unloading
+    if (s_pluginSafe)
+	TelEngine::destruct(m_relay);
+}
+
+
+ExtModPool::ExtModPool(const String& name)
+    : Mutex(false,"ExtModPool"),
+      m_name(name), m_lastId(0)
+{
+    DDebug(&__plugin,DebugAll,"ExtModPool '%s' created [%p]",m_name.c_str(),this);
+}
+
+ExtModPool::~ExtModPool()
+{
+    DDebug(&__plugin,DebugAll,"ExtModPool '%s' destroyed [%p]",m_name.c_str(),this);
+}
+
+void ExtModPool::attach(ExtModReceiver* recv)
+{
+    Lock mylock(this);
+    if (!m_members.find(recv))
+	m_members.append(recv)->setDelete(false);
+}
+
+void ExtModPool::detach(ExtModReceiver* recv)
+{
+    // declared first so the handlers are destroyed after unlocking
+    ObjList unused;
+    Lock mylock(this);
+    if (!m_members.remove(recv,false))
+	return;
+    for (ObjList* l = m_handlers.skipNull(); l; ) {
+	PoolHandler* h = static_cast<PoolHandler*>(l->get());
+	h->m_members.remove(recv,false);
+	if (h->m_members.skipNull())
+	    l = l->skipNext();
+	else {
+	    release(l,unused);
+	    l = l->skipNull();
+	}
+    }
+    Debug(&__plugin,DebugInfo,"Pool '%s' lost connection %s, %u left [%p]",
+	m_name.c_str(),recv->commandArg().c_str(),m_members.count(),this);
+}
+
+// Unlink a handler no longer used by any connection, called with pool locked
+// The caller must destroy it only after unlocking as removing the relay waits
+//  for the threads dispatching to it, which may be waiting for the pool lock
+void ExtModPool::release(ObjList* item, ObjList& unused)
+{
+    PoolHandler* h = static_cast<PoolHandler*>(item->remove(false));
+    Debug(&__plugin,DebugAll,"Pool '%s' removing handler '%s' priority %d [%p]",
+	m_name.c_str(),h->c_str(),h->m_prio,this);
+    unused.append(h);
+}
+
+bool ExtModPool::install(ExtModReceiver* recv, const String& name, int prio,
+    const String& fname, const String& fvalue)
+{
+    Lock mylock(this);
+    if (!m_members.find(recv))
+	return false;
+    PoolHandler* found = 0;
+    for (ObjList* l = m_handlers.skipNull(); l; l = l->skipNext()) {
+	PoolHandler* h = static_cast<PoolHandler*>(l->get());
+	if (*h != name)
+	    continue;
+	// like a single connection, each may install a message only once
+	if (h->m_members.find(recv))
+	    return false;
+	if (h->matches(name,prio,fname,fvalue))
+	    found = h;
+    }
+    if (!found) {
+	found = new PoolHandler(name,prio,fname,fvalue,++m_lastId);
+	found->m_relay = new MessageRelay(name,this,found->m_id,prio,recv->trackName());
+	if (fname)
+	    found->m_relay->setFilter(fname,fvalue);
+	m_handlers.append(found);
+	Engine::install(found->m_relay);
+    }
+    found->m_members.append(recv)->setDelete(false);
+    return true;
+}
+
+bool ExtModPool::uninstall(ExtModReceiver* recv, const String& name, int& prio)
+{
+    // declared first so the handler is destroyed after unlocking
+    ObjList unused;
+    Lock mylock(this);
+    for (ObjList* l = m_handlers.skipNull(); l; l = l->skipNext()) {
+	PoolHandler* h = static_cast<PoolHandler*>(l->get());
+	if ((*h != name) || !h->m_members.remove(recv,false))
+	    continue;
+	prio = h->m_prio;
+	if (!h->m_members.skipNull())
+	    release(l,unused);
+	return true;
+    }
+    return false;
+}
+
+bool ExtModPool::received(Message& msg, int id)
+{
+    const ExtMessage* ext = YOBJECT(ExtMessage,&msg);
+    // connections that refused the message, kept in use until we are done
+    ObjList refused;
+    bool ok = false;
+    for (;;) {
+	Lock mylock(this);
+	PoolHandler* h = 0;
+	for (ObjList* l = m_handlers.skipNull(); l; l = l->skipNext()) {
+	    h = static_cast<PoolHandler*>(l->get());
+	    if (h->m_id == id)
+		break;
+	    h = 0;
+	}
+	if (!h)
+	    break;
+	// least outstanding messages first, least used one on a tie
+	ExtModReceiver* recv = 0;
+	for (ObjList* l = h->m_members.skipNull(); l; l = l->skipNext()) {
+	    ExtModReceiver* r = static_cast<ExtModReceiver*>(l->get());
+	    if (r->dead() || refused.find(r) || (ext && !r->reenter() && ext->belongsTo(r)))
+		continue;
+	    if (recv && ((r->queued() > recv->queued()) ||
+		    ((r->queued() == recv->queued()) && (r->dispatched() >= recv->dispatched()))))
+		continue;
+	    recv = r;
+	}
+	if (!(recv && recv->use()))
+	    break;
+	mylock.drop();
+	bool sent = false;
+	ok = recv->received(msg,id,sent);
+	if (sent) {
+	    recv->unuse();
+	    break;
+	}
+	DDebug(&__plugin,DebugInfo,"Pool '%s' connection %s refused message '%s' [%p]",
+	    m_name.c_str(),recv->commandArg().c_str(),msg.c_str(),this);
+	refused.append(recv)->setDelete(false);
+    }
+    for (ObjList* l = refused.skipNull(); l; l = l->skipNext())
+	static_cast<ExtModReceiver*>(l->get())->unuse();
+    return ok;
+}
+
+void ExtModPool::statusDetail(String& str)
+{
+    Lock mylock(this);
+    for (ObjList* l = m_members.skipNull(); l; l = l->skipNext()) {
+	ExtModReceiver* r = static_cast<ExtModReceiver*>(l->get());
+	str.append(m_name,",") << "/" << r->commandArg() << "=";
+	r->statistics(str);
+    }
+}
+
+
 ExtModReceiver* ExtModReceiver::build(const char* script, const char* args, bool ref,
     File* ain, File* aout, ExtModChan* chan)
 {
@@ -770,9 +1155,9 @@ ExtModReceiver* ExtModReceiver::build(const char* script, const char* args, bool
 }
 
 ExtModReceiver* ExtModReceiver::build(const char* name, Stream* io, ExtModChan* chan,
-    int role, const char* conn)
+    int role, const char* conn, ExtModPool* pool)
 {
-    ExtModReceiver* recv = new ExtModReceiver(name,io,chan,role,conn);
+    ExtModReceiver* recv = new ExtModReceiver(name,io,chan,role,conn,pool);
     return recv->start() ? recv : 0;
 }
 
@@ -815,15 +1200,18 @@ ExtModReceiver::ExtModReceiver(const char* script, const char* args, File* ain,
       m_role(RoleUnknown), m_dead(false), m_quit(false), m_use(1), m_qLength(0), m_pid(-1),
       m_in(0), m_out(0), m_ain(ain), m_aout(aout),
       m_chan(chan), m_watcher(0),
-      m_selfWatch(false), m_reenter(false), m_setdata(true), m_settime(s_settime), m_writing(false),
+      m_selfWatch(false), m_reenter(false), m_setdata(true), m_settime(s_settime), m_binary(false),
       m_maxQueue(s_maxQueue), m_timeout(s_timeout), m_timebomb(s_timebomb), m_restart(false), m_scripted(false),
-      m_buffer(0,DEF_INCOMING_LINE), m_script(script), m_args(args), m_trackName(s_trackName)
+      m_pool(0), m_dispatched(0), m_timeouts(0),
+      m_buffer(0,DEF_INCOMING_LINE), m_writeMutex(false,"ExtModWrite"),
+      m_script(script), m_args(args), m_waiting(WAITING_HASH), m_trackName(s_trackName)
 {
     debugChain(&__plugin);
     debugName(m_script);
     m_script.trimBlanks();
     m_args.trimBlanks();
     m_desc << "ExtMod[" << m_script << "]";
+    ::memset(m_latency,0,sizeof(m_latency));
     Debug(&__plugin,DebugAll,"%s args='%s' created [%p]",desc(),m_args.safe(),this);
     m_role = chan ? RoleChannel : RoleGlobal;
     s_mutex.lock();
@@ -831,24 +1219,32 @@ ExtModReceiver::ExtModReceiver(const char* script, const char* args, File* ain,
     s_mutex.unlock();
 }
 
-ExtModReceiver::ExtModReceiver(const char* name, Stream* io, ExtModChan* chan, int role, const char* conn)
+ExtModReceiver::ExtModReceiver(const char* name, Stream* io, ExtModChan* chan, int role,
+    const char* conn, ExtModPool* pool)
     : Mutex(true,"ExtModReceiver"),
       m_role(role), m_dead(false), m_quit(false), m_use(1), m_qLength(0), m_pid(-1),
       m_in(io), m_out(io), m_ain(0), m_aout(0),
       m_chan(chan), m_watcher(0),
-      m_selfWatch(false), m_reenter(false), m_setdata(true), m_settime(s_settime), m_writing(false),
+      m_selfWatch(false), m_reenter(false), m_setdata(true), m_settime(s_settime), m_binary(false),
       m_maxQueue(s_maxQueue), m_timeout(s_timeout), m_timebomb(s_timebomb), m_restart(false), m_scripted(false),
-      m_buffer(0,DEF_INCOMING_LINE), m_script(name), m_args(conn), m_trackName(s_trackName)
+      m_pool(0), m_dispatched(0), m_timeouts(0),
+      m_buffer(0,DEF_INCOMING_LINE), m_writeMutex(false,"ExtModWrite"),
+      m_script(name), m_args(conn), m_waiting(WAITING_HASH), m_trackName(s_trackName)
 {
     debugChain(&__plugin);
     debugName(m_script);
     m_script.trimBlanks();
     m_args.trimBlanks();
     m_desc << "ExtModChan[" << m_script << "]";
-    Debug(&__plugin,DebugAll,"%s args='%s' io=(%p) chan=(%p) created [%p]",
-	desc(),m_args.safe(),io,chan,this);
+    ::memset(m_latency,0,sizeof(m_latency));
+    Debug(&__plugin,DebugAll,"%s args='%s' io=(%p) chan=(%p) pool=(%p) created [%p]",
+	desc(),m_args.safe(),io,chan,pool,this);
     if (chan)
 	m_role = RoleChannel;
+    else if (pool) {
+	m_pool = pool;
+	m_pool->attach(this);
+    }
     s_mutex.lock();
     s_modules.append(this);
     s_mutex.unlock();
@@ -927,6 +1323,9 @@ bool ExtModReceiver::start()
 
 bool ExtModReceiver::flush()
 {
+    // stop getting messages from the pool before releasing the pending ones
+    if (m_pool)
+	m_pool->detach(this);
     lock();
     MsgWatcher* w = m_watcher;
     m_watcher = 0;
@@ -946,8 +1345,18 @@ bool ExtModReceiver::flush()
 	    p->setDelete(false);
     }
     bool flushed = false;
-    if (m_waiting.get()) {
+    if (m_qLength) {
 	Debug(&__plugin,DebugInfo,"%s releasing %u pending messages [%p]",desc(),m_qLength,this);
+	// wake up the waiting threads, they will find their holders done
+	for (unsigned int i = 0; i < m_waiting.length(); i++) {
+	    for (ObjList* l = m_waiting.getList(i); l; l = l->skipNext()) {
+		MsgHolder* h = static_cast<MsgHolder*>(l->get());
+		if (!h)
+		    continue;
+		h->m_done = true;
+		h->unlock();
+	    }
+	}
 	m_waiting.clear();
 	m_qLength = 0;
 	needWait = flushed = true;
@@ -1025,6 +1434,13 @@ void ExtModReceiver::die(bool clearChan)
 }
 
 bool ExtModReceiver::received(Message &msg, int id)
+{
+    bool sent = false;
+    return received(msg,id,sent);
+}
+
+// Queue a message to the external module, sent tells if it was written to it
+bool ExtModReceiver::received(Message &msg, int id, bool& sent)
 {
     if (m_dead || m_quit)
 	return false;
@@ -1055,34 +1471,44 @@ bool ExtModReceiver::received(Message &msg, int id)
     bool fail = false;
     u_int64_t tout = (m_timeout > 0) ? Time::now() + 1000 * m_timeout : 0;
     MsgHolder h(msg);
-    if (outputLine(msg.encode(h.m_id))) {
-	m_qLength++;
-	m_waiting.append(&h)->setDelete(false);
+    // index the holder before sending so the answer can never be missed
+    m_waiting.append(&h)->setDelete(false);
+    m_qLength++;
+    m_dispatched++;
+    unlock();
+    sent = outputMessage(msg,h.m_id);
+    if (sent)
 	DDebug(&__plugin,DebugAll,"%s queued message #%u %p '%s' [%p]",desc(),m_qLength,&msg,msg.c_str(),this);
-    }
     else {
 	Debug(&__plugin,DebugWarn,"%s could not queue message %p '%s' [%p]",desc(),&msg,msg.c_str(),this);
+	lock();
+	if (m_waiting.remove(&h,false,true) && (m_qLength > 0))
+	    m_qLength--;
+	unlock();
 	ok = false;
 	fail = true;
     }
-    unlock();
-    // would be nice to lock the MsgHolder and wait for it to unlock from some
-    //  other thread - unfortunately this does not work with all mutexes
-    // sorry, Maciek - have to do it work in Windows too :-(
+    // the reader thread or a flush signals the holder so we sleep until then
     while (ok) {
-	h.lock(Thread::idleUsec());
-	lock();
-	ok = (m_waiting.find(&h) != 0);
-	if (ok && tout && (Time::now() > tout)) {
+	long maxwait = -1;
+	if (tout) {
+	    u_int64_t now = Time::now();
+	    maxwait = (tout > now) ? (long)(tout - now) : 0;
+	}
+	h.lock(maxwait);
+	Lock mylock(this);
+	if (h.m_done)
+	    break;
+	if (tout && (Time::now() >= tout)) {
 	    Alarm(&__plugin,"performance",DebugWarn,
 		"%s message %p '%s' did not return in %d msec [%p]"
 		,desc(),&msg,msg.c_str(),m_timeout,this);
-	    if (m_waiting.remove(&h,false) && (m_qLength > 0))
+	    if (m_waiting.remove(&h,false,true) && (m_qLength > 0))
 		m_qLength--;
+	    m_timeouts++;
 	    ok = false;
 	    fail = true;
 	}
-	unlock();
     }
     DDebug(&__plugin,DebugAll,"%s message %p '%s' returning %s [%p]",
 	desc(),&msg,msg.c_str(),String::boolText(h.m_ret),this);
@@ -1278,6 +1704,34 @@ void ExtModReceiver::run()
 	}
 	buffer[totalsize] = 0;
 	for (;;) {
+	    if (m_binary) {
+		if (totalsize < FRAME_HEADER)
+		    break;
+		unsigned int len = DataBlock::ntoh4(reinterpret_cast<uint8_t*>(buffer));
+		if (len >= m_buffer.length() - FRAME_HEADER) {
+		    Debug(&__plugin,DebugWarn,"%s frame of %u octets overflows buffer of length %u, closing [%p]",
+			desc(),len,m_buffer.length(),this);
+		    return;
+		}
+		readsize = len + FRAME_HEADER;
+		if (readsize > totalsize)
+		    break;
+		invalid = false;
+		if (!use())
+		    return;
+		bool goOut = processFrame(buffer + FRAME_HEADER,len);
+		if (unuse() || goOut)
+		    return;
+		if (totalsize >= (int)m_buffer.length()) {
+		    Debug(&__plugin,DebugWarn,"%s lost data shrinking read buffer to %u, closing [%p]",
+			desc(),m_buffer.length(),this);
+		    return;
+		}
+		totalsize -= readsize;
+		buffer = static_cast<char*>(m_buffer.data());
+		::memmove(buffer,buffer+readsize,totalsize+1);
+		continue;
+	    }
 	    char *eoline = ::strchr(buffer,'\n');
 	    if (!eoline && ((int)::strlen(buffer) < totalsize))
 		eoline=buffer+::strlen(buffer);
@@ -1313,65 +1767,110 @@ bool ExtModReceiver::outputLine(const char* line)
     if (TelEngine::null(line))
 	return true;
     int len = ::strlen(line);
-    if (m_dead || !m_out || !m_out->valid() || !use())
+    if (!lockOutput(len))
 	return false;
-    uint64_t tout = (m_timeout > 0) ? (Time::now() + 1000 * (uint64_t)m_timeout) : 0;
+    bool ok = writeLine(line,len);
+    unlockOutput();
+    return ok;
+}
+
+bool ExtModReceiver::outputMessage(const Message& msg, const char* id, int accepted)
+{
+    // encode outside the writer lock, redo it if framing changed meanwhile
+    bool binary = m_binary;
+    String line;
+    DataBlock frame;
     for (;;) {
-	Lock mylock(this);
-	if (m_dead || !m_out || !m_out->valid()) {
-	    unuse();
-	    return false;
-	}
-	if (!m_writing) {
-	    m_writing = true;
-	    break;
+	if (binary) {
+	    if (accepted < 0)
+		encodeFrame(frame,"%%>message",id,String((unsigned int)msg.msgTime().sec()),msg);
+	    else
+		encodeFrame(frame,"%%<message",id,String::boolText(accepted > 0),msg);
 	}
-	if (tout && tout < Time::now()) {
-	    if (!m_quit)
-		Alarm(&__plugin,"performance",DebugWarn,"%s timeout %d msec for %d characters [%p]",
-		    desc(),m_timeout,len,this);
-	    unuse();
+	else
+	    line = (accepted < 0) ? msg.encode(id) : msg.encode(accepted > 0,id);
+	if (!lockOutput(binary ? frame.length() : line.length()))
 	    return false;
-	}
-	mylock.drop();
-	Thread::idle();
+	if (binary == m_binary)
+	    break;
+	unlockOutput();
+	binary = m_binary;
     }
-    bool ok = outputLineInternal(line,len);
-    m_writing = false;
-    unuse();
+    bool ok = binary ? writeData(frame.data(),frame.length()) : writeLine(line,line.length());
+    unlockOutput();
     return ok;
 }
 
-bool ExtModReceiver::outputLineInternal(const char* line, int len)
+// Switch framing while holding the writer so nothing else gets between
+bool ExtModReceiver::switchFraming(const char* line, bool binary)
+{
+    if (!lockOutput(::strlen(line)))
+	return false;
+    bool ok = writeLine(line,::strlen(line));
+    if (ok)
+	m_binary = binary;
+    unlockOutput();
+    return ok;
+}
+
+bool ExtModReceiver::lockOutput(int len)
+{
+    if (m_dead || !m_out || !m_out->valid() || !use())
+	return false;
+    if (m_writeMutex.lock((m_timeout > 0) ? (1000 * (long)m_timeout) : -1)) {
+	if (!m_dead)
+	    return true;
+	m_writeMutex.unlock();
+    }
+    else if (!m_quit)
+	Alarm(&__plugin,"performance",DebugWarn,"%s timeout %d msec for %d octets [%p]",
+	    desc(),m_timeout,len,this);
+    unuse();
+    return false;
+}
+
+void ExtModReceiver::unlockOutput()
+{
+    m_writeMutex.unlock();
+    unuse();
+}
+
+bool ExtModReceiver::writeLine(const char* line, int len)
 {
     DDebug(&__plugin,DebugAll,"%s outputLine len=%d '%s' [%p]",desc(),len,line,this);
+    // write everything at once, a lone trailing segment may be delayed by Nagle
+    if (m_binary) {
+	DataBlock frame(0,FRAME_HEADER + len);
+	uint8_t* buf = static_cast<uint8_t*>(frame.data());
+	DataBlock::hton4(buf,len);
+	::memcpy(buf + FRAME_HEADER,line,len);
+	return writeData(buf,frame.length());
+    }
+    String buf(line,len);
+    buf << "\n";
+    return writeData(buf.c_str(),buf.length());
+}
+
+bool ExtModReceiver::writeData(const void* data, int len)
+{
+    const char* buf = static_cast<const char*>(data);
     // since m_out can be non-blocking (the socket) we have to loop
-    while (m_out && m_out->valid() && (len > 0) && !m_dead) {
-	int w = m_out->writeData(line,len);
+    while (len > 0) {
+	if (m_dead || !m_out || !m_out->valid())
+	    return false;
+	int w = m_out->writeData(buf,len);
 	if (w < 0) {
 	    if (m_dead || !m_out || !m_out->canRetry())
 		return false;
 	}
 	else {
-	    line += w;
+	    buf += w;
 	    len -= w;
 	}
 	if (len > 0)
 	    Thread::idle();
     }
-    char nl = '\n';
-    for (;;) {
-	if (m_dead || !m_out)
-	    return false;
-	int w = m_out->writeData(&nl,1);
-	if ((w < 0) && m_out && m_out->canRetry())
-	    w = 0;
-	if (w > 0)
-	    return true;
-	if (w < 0)
-	    return false;
-	Thread::idle();
-    }
+    return true;
 }
 
 void ExtModReceiver::reportError(const char* line)
@@ -1382,8 +1881,7 @@ void ExtModReceiver::reportError(const char* line)
 
 void ExtModReceiver::returnMsg(const Message* msg, const char* id, bool accepted)
 {
-    String ret(msg->encode(accepted,id));
-    if (!outputLine(ret) && m_timebomb)
+    if (!outputMessage(*msg,id,accepted ? 1 : 0) && m_timebomb)
 	die();
 }
 
@@ -1440,7 +1938,7 @@ bool ExtModReceiver::processLine(const char* line)
 		m_role = RoleGlobal;
 		return false;
 	    }
-	    else if (role == "channel") {
+	    else if (role == "channel" && !m_pool) {
 		m_role = RoleChannel;
 		return false;
 	    }
@@ -1452,23 +1950,13 @@ bool ExtModReceiver::processLine(const char* line)
 	return true;
     }
     else if (id.startsWith("%%<message:")) {
+	// we generated the id so it never needs unescaping
+	int sep = id.find(':',11);
 	Lock mylock(this);
-	ObjList *p = &m_waiting;
-	for (; p; p=p->next()) {
-	    MsgHolder *msg = static_cast<MsgHolder *>(p->get());
-	    if (msg && msg->decode(line)) {
-		DDebug(&__plugin,DebugInfo,"%s matched message %p [%p]",desc(),msg->msg(),this);
-		if (m_chan && (m_chan->waitMsg() == msg->msg())) {
-		    DDebug(&__plugin,DebugNote,"%s entering wait mode on channel %p [%p]",
-			desc(),m_chan,this);
-		    m_chan->waitMsg(0);
-		    m_chan->waiting(true);
-		}
-		msg->unlock();
-		if (p->remove(false) && (m_qLength > 0))
-		    m_qLength--;
-		return false;
-	    }
+	MsgHolder* h = (sep > 11) ? findWaiting(id.substr(11,sep - 11)) : 0;
+	if (h && h->decode(line)) {
+	    answered(h);
+	    return false;
 	}
 	Debug(&__plugin,(m_dead ? DebugInfo : DebugWarn),
 	    "%s unmatched%s message: %s [%p]",desc(),(m_dead ? " dead" : ""),line,this);
@@ -1489,7 +1977,12 @@ bool ExtModReceiver::processLine(const char* line)
 	// sanity checks
 	lock();
 	bool ok = id && !m_dead && !m_relays.find(id);
-	if (ok) {
+	if (ok && m_pool) {
+	    unlock();
+	    ok = m_pool->install(this,id,prio,fname,fvalue);
+	    lock();
+	}
+	else if (ok) {
 	    MessageRelay *r = new MessageRelay(id,this,0,prio,m_trackName);
 	    if (fname)
 		r->setFilter(fname,fvalue);
@@ -1511,9 +2004,9 @@ bool ExtModReceiver::processLine(const char* line)
     }
     else if (id.startSkip("%%>uninstall:",false)) {
 	int prio = 0;
-	bool ok = false;
+	bool ok = m_pool && m_pool->uninstall(this,id,prio);
 	lock();
-	ObjList *p = &m_relays;
+	ObjList *p = ok ? 0 : &m_relays;
 	for (; p; p=p->next()) {
 	    MessageRelay *r = static_cast<MessageRelay *>(p->get());
 	    if (r && (*r == id)) {
@@ -1566,6 +2059,7 @@ bool ExtModReceiver::processLine(const char* line)
 	    val.trimBlanks();
 	    id = id.substr(0,col);
 	    bool ok = false;
+	    int framing = -1;
 	    Lock mylock(this);
 	    if (m_dead)
 		return false;
@@ -1642,6 +2136,15 @@ bool ExtModReceiver::processLine(const char* line)
 		val = m_selfWatch;
 		ok = true;
 	    }
+	    else if (id == YSTRING("framing")) {
+		if (val == YSTRING("binary"))
+		    framing = 1;
+		else if (val == YSTRING("text"))
+		    framing = 0;
+		ok = val.null() || (framing >= 0);
+		if (framing < 0)
+		    val = m_binary ? "binary" : "text";
+	    }
 	    else if (id.startsWith("engine.")) {
 		// keep the index in substr in sync with length of "engine."
 		const NamedString* param = Engine::runParams().getParam(id.substr(7));
@@ -1696,7 +2199,11 @@ bool ExtModReceiver::processLine(const char* line)
 		desc(),id.c_str(),val.c_str(),ok ? "ok" : "failed",this);
 	    String out("%%<setlocal:");
 	    out << id << ":" << val << ":" << ok;
-	    outputLine(out);
+	    // the answer still goes out with the old framing
+	    if (framing >= 0)
+		switchFraming(out,(framing > 0));
+	    else
+		outputLine(out);
 	    return false;
 	}
     }
@@ -1707,61 +2214,116 @@ bool ExtModReceiver::processLine(const char* line)
     }
     else {
 	ExtMessage* m = new ExtMessage;
-	if (m->decode(line) == -2) {
-	    DDebug(&__plugin,DebugAll,"%s created message %p '%s' [%p]",desc(),m,m->c_str(),this);
-	    lock();
-	    bool note = true;
-	    while (!m_dead && m_chan && m_chan->waiting()) {
-		if (note) {
-		    note = false;
-		    Debug(&__plugin,DebugNote,
-			"%s waiting before enqueueing new message %p '%s' [%p]",
-			desc(),m,m->c_str(),this);
-		}
-		unlock();
-		Thread::yield();
-		if (m_dead) {
-		    m->destruct();
-		    return false;
-		}
-		lock();
-	    }
-	    ExtModChan* chan = 0;
-	    if ((m_role == RoleChannel) && !m_chan && m_setdata && (*m == "call.execute")) {
-		// we delayed channel creation as there was nothing to ref() it
-		chan = new ExtModChan(this);
-		m_chan = chan;
-		m->setParam("id",chan->id());
-	    }
-	    if (m_setdata)
-		m->userData(m_chan);
-	    // now the newly created channel is referenced by the message
-	    if (chan)
-		chan->deref();
-	    id = m->id();
-	    if (id && !chan) {
-		// Copy the user data pointer from waiting message with same id
-		ObjList *p = &m_waiting;
-		for (; p; p=p->next()) {
-		    MsgHolder *h = static_cast<MsgHolder *>(p->get());
-		    if (h && (h->m_id == id)) {
-			RefObject* ud = h->m_msg.userData();
-			Debug(&__plugin,DebugAll,"%s copying data pointer %p from %p '%s' [%p]",
-			    desc(),ud,h->msg(),h->msg()->c_str(),this);
-			m->userData(ud);
-			break;
-		    }
-		}
-	    }
-	    if (m_settime || !m->msgTime())
-		m->msgTime() = Time::now();
-	    m->startup(this);
-	    unlock();
+	if (m->decode(line) == -2)
+	    return startMessage(m);
+	m->destruct();
+    }
+    reportError(line);
+    return false;
+}
+
+bool ExtModReceiver::processFrame(const char* data, unsigned int len)
+{
+    if (m_dead)
+	return false;
+    if (m_quit)
+	return true;
+    // frames without any separator carry a regular command line
+    if (!::memchr(data,0,len))
+	return processLine(String(data,len));
+    FrameReader frame(data,len);
+    String key;
+    frame.next(key);
+    XDebug(&__plugin,DebugAll,"%s processFrame '%s' len=%u [%p]",desc(),key.c_str(),len,this);
+    if (key == YSTRING("%%<message")) {
+	String id;
+	Lock mylock(this);
+	MsgHolder* h = frame.next(id) ? findWaiting(id) : 0;
+	if (h && h->decode(frame)) {
+	    answered(h);
 	    return false;
 	}
+	Debug(&__plugin,(m_dead ? DebugInfo : DebugWarn),
+	    "%s unmatched%s message frame id '%s' [%p]",desc(),(m_dead ? " dead" : ""),id.c_str(),this);
+	return false;
+    }
+    else if (key == YSTRING("%%>message")) {
+	ExtMessage* m = new ExtMessage;
+	if (m->decode(frame))
+	    return startMessage(m);
 	m->destruct();
     }
-    reportError(line);
+    reportError(key);
+    return false;
+}
+
+// Called with the receiver locked when the application answered a message
+void ExtModReceiver::answered(MsgHolder* h)
+{
+    DDebug(&__plugin,DebugInfo,"%s matched message %p [%p]",desc(),h->msg(),this);
+    if (m_chan && (m_chan->waitMsg() == h->msg())) {
+	DDebug(&__plugin,DebugNote,"%s entering wait mode on channel %p [%p]",
+	    desc(),m_chan,this);
+	m_chan->waitMsg(0);
+	m_chan->waiting(true);
+    }
+    if (m_waiting.remove(h,false,true) && (m_qLength > 0))
+	m_qLength--;
+    u_int64_t ms = (Time::now() - h->m_start) / 1000;
+    unsigned int i = 0;
+    while ((i < LATENCY_BUCKETS - 1) && (ms >= s_latency[i]))
+	i++;
+    m_latency[i]++;
+    h->m_done = true;
+    h->unlock();
+}
+
+bool ExtModReceiver::startMessage(ExtMessage* m)
+{
+    DDebug(&__plugin,DebugAll,"%s created message %p '%s' [%p]",desc(),m,m->c_str(),this);
+    lock();
+    bool note = true;
+    while (!m_dead && m_chan && m_chan->waiting()) {
+	if (note) {
+	    note = false;
+	    Debug(&__plugin,DebugNote,
+		"%s waiting before enqueueing new message %p '%s' [%p]",
+		desc(),m,m->c_str(),this);
+	}
+	unlock();
+	Thread::yield();
+	if (m_dead) {
+	    m->destruct();
+	    return false;
+	}
+	lock();
+    }
+    ExtModChan* chan = 0;
+    if ((m_role == RoleChannel) && !m_chan && m_setdata && (*m == "call.execute")) {
+	// we delayed channel creation as there was nothing to ref() it
+	chan = new ExtModChan(this);
+	m_chan = chan;
+	m->setParam("id",chan->id());
+    }
+    if (m_setdata)
+	m->userData(m_chan);
+    // now the newly created channel is referenced by the message
+    if (chan)
+	chan->deref();
+    if (m->id() && !chan) {
+	// Copy the user data pointer from waiting message with same id
+	MsgHolder* h = findWaiting(m->id());
+	if (h) {
+	    RefObject* ud = h->m_msg.userData();
+	    Debug(&__plugin,DebugAll,"%s copying data pointer %p from %p '%s' [%p]",
+		desc(),ud,h->msg(),h->msg()->c_str(),this);
+	    m->userData(ud);
+	}
+    }
+    if (m_settime || !m->msgTime())
+	m->msgTime() = Time::now();
+    m->startup(this);
+    unlock();
     return false;
 }
 
@@ -1788,11 +2350,27 @@ void ExtModReceiver::describe(String& rval) const
 	rval << ", has channel";
     if (m_restart)
 	rval << ", autorestart";
+    if (m_binary)
+	rval << ", binary";
     if (m_pid > 0)
 	rval << ", pid=" << m_pid;
     rval << "\r\n";
 }
 
+void ExtModReceiver::statistics(String& rval) const
+{
+    rval << m_qLength << "|" << m_dispatched << "|" << m_timeouts << "|";
+    for (unsigned int i = 0; i < LATENCY_BUCKETS; i++) {
+	if (i)
+	    rval << "/";
+	if (i < LATENCY_BUCKETS - 1)
+	    rval << s_latency[i] << "ms:";
+	else
+	    rval << "more:";
+	rval << m_latency[i];
+    }
+}
+
 void ExtModReceiver::debugMsgInstResult(bool ok, const char* oper, const char* name,
     const char* extra)
 {
@@ -1871,7 +2449,7 @@ bool ExtModHandler::received(Message& msg)
 
 ExtListener::ExtListener(const char* name)
     : Thread("ExtMod Listener"),
-      m_name(name), m_role(ExtModReceiver::RoleUnknown)
+      m_name(name), m_role(ExtModReceiver::RoleUnknown), m_pool(0)
 {
 }
 
@@ -1886,6 +2464,13 @@ bool ExtListener::init(const NamedList& sect)
 	Debug(&__plugin,DebugConf,"Unknown role '%s' of listener '%s'",role.c_str(),m_name.c_str());
 	return false;
     }
+    if (sect.getBoolValue(YSTRING("pool"))) {
+	// only global connections can share the message handlers
+	if (m_role == ExtModReceiver::RoleChannel) {
+	    Debug(&__plugin,DebugConf,"Listener '%s' cannot pool channel connections",m_name.c_str());
+	    return false;
+	}
+    }
     String type(sect.getValue("type"));
     SocketAddr addr;
     if (type.null())
@@ -1920,6 +2505,14 @@ bool ExtListener::init(const NamedList& sect)
     }
     if (!m_socket.setBlocking(false) || !m_socket.listen())
 	return false;
+    if (sect.getBoolValue(YSTRING("pool"))) {
+	Lock lck(s_mutex);
+	m_pool = static_cast<ExtModPool*>(s_pools[m_name]);
+	if (!m_pool) {
+	    m_pool = new ExtModPool(m_name);
+	    s_pools.append(m_pool);
+	}
+    }
     return startup();
 }
 
@@ -1945,7 +2538,7 @@ void ExtListener::run()
 	    case ExtModReceiver::RoleUnknown:
 	    case ExtModReceiver::RoleGlobal:
 	    case ExtModReceiver::RoleChannel:
-		ExtModReceiver::build(m_name,skt,0,m_role,tmp);
+		ExtModReceiver::build(m_name,skt,0,m_role,tmp,m_pool);
 		break;
 	    default:
 		Debug(&__plugin,DebugWarn,"Listener '%s' hit invalid role %d",m_name.c_str(),m_role);
@@ -2183,10 +2776,27 @@ bool ExtModulePlugin::commandComplete(Message& msg, const String& partLine, cons
     return false;
 }
 
+void ExtModulePlugin::statusModule(String& str)
+{
+    Module::statusModule(str);
+    str.append("format=Queue|Dispatched|Timeouts|Latency",",");
+}
+
 void ExtModulePlugin::statusParams(String& str)
 {
     Lock lck(s_mutex);
     str << "scripts=" << s_modules.count() << ",chans=" << s_chans.count();
+    unsigned int pooled = 0;
+    for (ObjList* o = s_pools.skipNull(); o; o = o->skipNext())
+	pooled += static_cast<ExtModPool*>(o->get())->members();
+    str << ",pools=" << s_pools.count() << ",pooled=" << pooled;
+}
+
+void ExtModulePlugin::statusDetail(String& str)
+{
+    Lock lck(s_mutex);
+    for (ObjList* o = s_pools.skipNull(); o; o = o->skipNext())
+	static_cast<ExtModPool*>(o->get())->statusDetail(str);
 }
 
 bool ExtModulePlugin::received(Message& msg, int id)
@@ -2223,6 +2833,9 @@ void ExtModulePlugin::cleanup(bool fromDestruct)
     s_modules.clear();
     // the receivers destroyed above should also clear chans but better be sure
     s_chans.clear();
+    // listener threads using the pools were killed before unloading
+    if (fromDestruct)
+	s_pools.clear();
     s_mutex.unlock();
 }
 
@@ -2104,11 +2104,40 @@ static bool s_engineStop = false;
 static bool s_allowAbort = false;
 static bool s_allowTrace = false;
 static bool s_allowLink = true;
+static bool s_allowOptimize = false;
+static String s_imagePath;
 static bool s_trackObj = false;
 static unsigned int s_trackCreation = 0;
 static bool s_autoExt = true;
 static unsigned int s_maxFile = 500000;
 
+// Scripts parsed from source or loaded from precompiled image and time spent
+static Mutex s_parseMutex(false,"JsParseStats");
+static unsigned int s_parsed = 0;
+static unsigned int s_loaded = 0;
+static u_int64_t s_parseTime = 0;
+static u_int64_t s_loadTime = 0;
+
+// Parse a script file and account the time spent in it
+static bool parseScript(JsParser& parser, const char* file)
+{
+    u_int64_t t = Time::now();
+    bool ok = parser.parseFile(file);
+    t = Time::now() - t;
+    if (ok) {
+	Lock lck(s_parseMutex);
+	if (parser.fromImage()) {
+	    s_loaded++;
+	    s_loadTime += t;
+	}
+	else {
+	    s_parsed++;
+	    s_parseTime += t;
+	}
+    }
+    return ok;
+}
+
 const TokenDict ScriptInfo::s_type[] = {
     {"static",  Static},
     {"dynamic", Dynamic},
@@ -6232,7 +6261,8 @@ bool JsXML::runNative(ObjList& stack, const ExpOperation& oper, GenObject* conte
 	    JsObject* jso = YOBJECT(JsObject,name);
 	    if (!jso)
 		return false;
-	    const ObjList* o = jso->params().paramList()->skipNull();
+	    const NamedList& attrs = jso->params();
+	    const ObjList* o = attrs.paramList()->skipNull();
 	    for (; o; o = o->skipNext()) {
 		const NamedString* ns = static_cast<const NamedString*>(o->get());
 		if (ns->name() != JsObject::protoName())
@@ -7451,8 +7481,9 @@ void JsJSON::replaceParams(GenObject* obj, const NamedList& params, bool sqlEsc,
 	}
     }
     else if (jso) {
-	NamedString* proto = jso->params().getParam(protoName());
-	for (ObjList* o = jso->params().paramList()->skipNull(); o; o = o->skipNext()) {
+	const NamedList& props = jso->params();
+	const NamedString* proto = props.getParam(protoName());
+	for (ObjList* o = props.paramList()->skipNull(); o; o = o->skipNext()) {
 	    NamedString* p = static_cast<NamedString*>(o->get());
 	    if (p != proto)
 		replaceParams(p,params,sqlEsc,extraEsc);
@@ -8462,6 +8493,8 @@ JsGlobal::JsGlobal(const char* scriptName, const char* fileName, int type, bool
 	m_jsCode.adjustPath(*this);
     m_jsCode.setMaxFileLen(s_maxFile);
     m_jsCode.link(s_allowLink);
+    m_jsCode.optimize(s_allowOptimize);
+    m_jsCode.imagePath(s_imagePath);
     m_jsCode.trace(s_allowTrace);
 }
 
@@ -8474,7 +8507,7 @@ JsGlobal::~JsGlobal()
 bool JsGlobal::load()
 {
     DDebug(&__plugin,DebugAll,"Loading %s script '%s' from '%s'",typeName(),name().c_str(),c_str());
-    if (m_jsCode.parseFile(*this)) {
+    if (parseScript(m_jsCode,*this)) {
 	Debug(&__plugin,DebugInfo,"Parsed %s script '%s': %s",typeName(),name().c_str(),c_str());
 	return true;
     }
@@ -8938,6 +8971,9 @@ void JsModule::statusParams(String& str)
 	<< ",posthooks=" << JsGlobal::posthooks().count();
     lck.acquire(this);
     str << ",routing=" << calls().count();
+    lck.acquire(s_parseMutex);
+    str << ",parsed=" << s_parsed << ",parsetime=" << (unsigned int)(s_parseTime / 1000)
+	<< ",loaded=" << s_loaded << ",loadtime=" << (unsigned int)(s_loadTime / 1000);
 }
 
 bool JsModule::commandExecute(String& retVal, const String& line)
@@ -9124,6 +9160,7 @@ bool JsModule::evalContext(String& retVal, const String& cmd, ScriptContext* con
     parser.basePath(s_basePath,s_libsPath);
     parser.setMaxFileLen(s_maxFile);
     parser.link(s_allowLink);
+    parser.optimize(s_allowOptimize);
     parser.trace(s_allowTrace);
     if (!parser.parse(cmd)) {
 	retVal << "parsing failed\r\n";
@@ -9373,6 +9410,15 @@ void JsModule::initialize()
 	s_allowLink = !s_allowLink;
 	changed = true;
     }
+    if (cfg.getBoolValue("general","optimize") != s_allowOptimize) {
+	s_allowOptimize = !s_allowOptimize;
+	changed = true;
+    }
+    tmp = cfg.getValue("general","image_cache");
+    Engine::runParams().replaceParams(tmp);
+    if (tmp && !tmp.endsWith(Engine::pathSeparator()))
+	tmp += Engine::pathSeparator();
+    s_imagePath = tmp;
     tmp = cfg.getValue("general","routing");
     Engine::runParams().replaceParams(tmp);
     Lock lck(JsGlobal::s_mutex);
@@ -9380,10 +9426,12 @@ void JsModule::initialize()
 	m_assistCode.clear();
 	m_assistCode.setMaxFileLen(s_maxFile);
 	m_assistCode.link(s_allowLink);
+	m_assistCode.optimize(s_allowOptimize);
+	m_assistCode.imagePath(s_imagePath);
 	m_assistCode.trace(s_allowTrace);
 	m_assistCode.basePath(s_basePath,s_libsPath);
 	m_assistCode.adjustPath(tmp);
-	if (m_assistCode.parseFile(tmp))
+	if (parseScript(m_assistCode,tmp))
 	    Debug(this,DebugInfo,"Parsed routing script: %s",tmp.c_str());
 	else if (tmp)
 	    Debug(this,DebugWarn,"Failed to parse script: %s",tmp.c_str());
@@ -484,8 +484,9 @@ void RadioTest::run()
 	np->takeData();
 	
 	NamedList files("");
-	for (ObjList* o = m_params.paramList()->skipNull(); o; o = o->skipNext()) {
-	    NamedString* ns = static_cast<NamedString*>(o->get());
+	const NamedList& params = m_params;
+	for (const ObjList* o = params.paramList()->skipNull(); o; o = o->skipNext()) {
+	    const NamedString* ns = static_cast<const NamedString*>(o->get());
 	    if (!ns->name().startsWith("file:"))
 		continue;
 	    String file = *ns;
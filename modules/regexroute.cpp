@@ -30,6 +30,7 @@ namespace { // anonymous
 #define DEFAULT_RULE "^\\(false\\|no\\|off\\|disable\\|f\\|0*\\)$^"
 #define BLOCK_STACK 10
 #define MAX_VAR_LEN 8100
+#define DEFAULT_INDEX 8
 
 class RegexConfig;
 class GenericHandler;
@@ -97,6 +98,160 @@ public:
     virtual bool received(Message &msg);
 };
 
+// One precompiled match condition, either the rule of a line or an if/and/or clause
+class RegexMatch : public GenObject
+{
+public:
+    enum Type {
+	Plain,
+	Param,
+	Function,
+	BadParam,
+	BadFunction,
+	MissingParam,
+	MissingRule,
+    };
+    RegexMatch(const String& rule, const RegexConfig& cfg);
+    bool matches(Message& msg, String& match, const String& context, unsigned int rule,
+	const String& trace, ObjList* traceLst) const;
+    inline const String& text() const
+	{ return m_text; }
+    bool prefix(String& prefix) const;
+private:
+    int m_type;
+    String m_text;
+    String m_param;
+    String m_default;
+    ParamTemplate m_function;
+    Regexp m_reg;
+    bool m_reverse;
+};
+
+// A secondary if/and/or clause of a rule
+class RegexClause : public GenObject
+{
+public:
+    inline RegexClause(bool alternative, bool noValue)
+	: m_alternative(alternative), m_noValue(noValue), m_match(0)
+	{ }
+    virtual ~RegexClause()
+	{ TelEngine::destruct(m_match); }
+    // true for an 'or' clause, false for 'if' or 'and'
+    bool m_alternative;
+    // the clause had no '=' at all
+    bool m_noValue;
+    // compiled condition, NULL if the clause is malformed
+    RegexMatch* m_match;
+};
+
+// One ';' separated part of a rule's value, pre-parsed when it needs no substitutions
+class RegexPart : public String
+{
+public:
+    RegexPart(const String& text);
+    inline bool substitute() const
+	{ return m_substitute; }
+    void apply(Message& target) const;
+    void replace(const String& match, const Message& msg, String& str) const;
+private:
+    bool m_substitute;
+    bool m_matches;
+    ParamTemplate m_params;
+    bool m_assign;
+    bool m_variable;
+    String m_name;
+    String m_value;
+};
+
+// One node of a prefix tree, holds the positions of rules requiring its prefix
+class RegexNode
+{
+public:
+    inline RegexNode(char c = 0)
+	: m_char(c), m_child(0), m_next(0)
+	{ }
+    ~RegexNode();
+    RegexNode* append(char c);
+    const RegexNode* child(char c) const;
+    unsigned int first(unsigned int pos, unsigned int end) const;
+    inline void add(unsigned int pos)
+	{ m_rules.append(&pos,sizeof(pos)); }
+private:
+    char m_char;
+    RegexNode* m_child;
+    RegexNode* m_next;
+    DataBlock m_rules;
+};
+
+// A run of consecutive rules indexed by the literal prefix they match on
+class RegexIndex : public GenObject
+{
+public:
+    RegexIndex(unsigned int start, unsigned int end)
+	: m_start(start), m_end(end)
+	{ }
+    void add(unsigned int pos, const String& prefix);
+    unsigned int find(const String& str, unsigned int pos) const;
+    inline unsigned int end() const
+	{ return m_end; }
+private:
+    unsigned int m_start;
+    unsigned int m_end;
+    RegexNode m_root;
+};
+
+// A precompiled line of a context
+class RegexRule : public GenObject
+{
+public:
+    enum Action {
+	ActNone,
+	ActSet,
+	ActEcho,
+	ActBlock,
+	ActDispatch,
+	ActEnqueue,
+    };
+    RegexRule(const NamedString& line, unsigned int index, const RegexConfig& cfg);
+    virtual ~RegexRule()
+	{ TelEngine::destruct(m_match); }
+    bool matches(Message& msg, const String& str, String& match, const String& context,
+	const String& trace, ObjList* traceLst) const;
+    bool alternative() const;
+    const NamedString& m_line;
+    unsigned int m_index;
+    bool m_closes;
+    bool m_opens;
+    RegexMatch* m_match;
+    ObjList m_clauses;
+    const RegexIndex* m_group;
+    int m_action;
+    int m_level;
+    String m_text;
+    ObjList m_parts;
+};
+
+// All the precompiled lines of a configuration section
+class RegexContext : public GenObject
+{
+public:
+    RegexContext(const NamedList& sect, const RegexConfig& cfg);
+    virtual const String& toString() const
+	{ return m_name; }
+    inline const RegexRule* rule(unsigned int pos) const
+	{ return static_cast<const RegexRule*>(m_rules.at(pos)); }
+    inline unsigned int count() const
+	{ return m_rules.length(); }
+    inline unsigned int indexed() const
+	{ return m_indexed; }
+private:
+    void index(unsigned int start, unsigned int end, unsigned int minRules);
+    String m_name;
+    ObjVector m_rules;
+    ObjList m_groups;
+    unsigned int m_indexed;
+};
+
 class RegexConfig: public RefObject
 {
 public:
@@ -107,17 +262,30 @@ public:
     };
     RegexConfig(const String& confName);
     void initialize(bool first);
-    void setDefault(Regexp& reg);
-    bool oneMatch(Message& msg, Regexp& reg, String& match, const String& context,
-        unsigned int rule, const String& trace = String::empty(), ObjList* traceLst = 0);
+    void setDefault(String& reg) const;
     bool oneContext(Message &msg, String &str, const String &context, String &ret,
 	const String& trace = String::empty(), int traceLevel = DebugNote, ObjList* traceLst = 0,
 	bool warn = false, int depth = 0);
     inline unsigned int sectCount() const
 	{ return m_cfg.count(); }
+    inline unsigned int ruleCount() const
+	{ return m_rules; }
+    inline unsigned int indexedCount() const
+	{ return m_indexed; }
+    inline bool extended() const
+	{ return m_extended; }
+    inline bool insensitive() const
+	{ return m_insensitive; }
+    inline unsigned int prefixIndex() const
+	{ return m_prefixIndex; }
 
 private:
+    void compile();
     Configuration m_cfg;
+    HashList m_contexts;
+    unsigned int m_rules;
+    unsigned int m_indexed;
+    unsigned int m_prefixIndex;
     bool m_extended;
     bool m_insensitive;
     int m_maxDepth;
@@ -131,7 +299,7 @@ public:
     virtual ~RegexRoutePlugin()
 	{ TelEngine::destruct(s_cfg); }
     virtual void initialize();
-    void initVars(NamedList* sect, bool replace = true);
+    void initVars(const NamedList* sect, bool replace = true);
     virtual void statusParams(String& str);
 
 private:
@@ -438,7 +606,8 @@ static void evalFunc(String& str, Message& msg)
 		if (par.null())
 		    par = ",";
 		str.clear();
-		for (const ObjList* l = msg.paramList()->skipNull(); l; l = l->skipNext())
+		const NamedList& params = msg;
+		for (const ObjList* l = params.paramList()->skipNull(); l; l = l->skipNext())
 		    str.append(static_cast<const NamedString*>(l->get())->name(),par);
 	    }
 	    else
@@ -461,7 +630,8 @@ static void evalFunc(String& str, Message& msg)
 		    par = ",";
 		str.clear();
 		Lock l(s_varsMtx);
-		for (const ObjList* l = s_vars.paramList()->skipNull(); l; l = l->skipNext()) {
+		const NamedList& vars = s_vars;
+		for (const ObjList* l = vars.paramList()->skipNull(); l; l = l->skipNext()) {
 		    if (str.length() > MAX_VAR_LEN) {
 			Debug(&__plugin,DebugWarn,"Truncating output of $(variables,list)");
 			str.append("...",par);
@@ -535,49 +705,63 @@ static void replaceFuncs(String &str, Message& msg)
     }
 }
 
-// handle ;paramname[=value] assignments
-static void setMessage(const String& match, Message& msg, String& line, Message* target = 0)
+// handle one paramname[=value] assignment
+static void setParam(String& s, Message* target)
+{
+    if (s.trimBlanks().null())
+	return;
+    int q = s.find('=');
+    if (q > 0) {
+	String n = s.substr(0,q);
+	String v = s.substr(q+1);
+	n.trimBlanks();
+	v.trimBlanks();
+	DDebug(&__plugin,DebugAll,"Setting '%s' to '%s'",n.c_str(),v.c_str());
+	if (n.startSkip("$",false))
+	    s_vars.setParam(n,v);
+	else
+	    target->setParam(n,v);
+    }
+    else {
+	DDebug(&__plugin,DebugAll,"Clearing parameter '%s'",s.c_str());
+	if (s.startSkip("$",false))
+	    s_vars.clearParam(s);
+	else
+	    target->clearParam(s);
+    }
+}
+
+// handle ;paramname[=value] assignments from a pre-split rule value
+static void setMessage(const String& match, Message& msg, const ObjList& parts, String& line,
+    Message* target = 0)
 {
     if (!target)
 	target = &msg;
-    ObjList *strs = line.split(';');
     bool first = true;
-    for (ObjList *p = strs; p; p=p->next()) {
-	String *s = static_cast<String*>(p->get());
+    for (ObjList* p = parts.skipNull(); p; p = p->skipNext()) {
+	const RegexPart* part = static_cast<const RegexPart*>(p->get());
 	Lock l(s_varsMtx);
-	if (s) {
-	    *s = match.replaceMatches(*s);
-	    msg.replaceParams(*s);
-	    replaceFuncs(*s,msg);
+	if (!part->substitute()) {
+	    if (first) {
+		first = false;
+		line = *part;
+	    }
+	    else
+		part->apply(*target);
+	    continue;
 	}
+	String s;
+	part->replace(match,msg,s);
+	replaceFuncs(s,msg);
 	if (first) {
 	    first = false;
-	    line = s ? *s : String::empty();
-	    continue;
-	}
-	if (s && !s->trimBlanks().null()) {
-	    int q = s->find('=');
-	    if (q > 0) {
-		String n = s->substr(0,q);
-		String v = s->substr(q+1);
-		n.trimBlanks();
-		v.trimBlanks();
-		DDebug(&__plugin,DebugAll,"Setting '%s' to '%s'",n.c_str(),v.c_str());
-		if (n.startSkip("$",false))
-		    s_vars.setParam(n,v);
-		else
-		    target->setParam(n,v);
-	    }
-	    else {
-		DDebug(&__plugin,DebugAll,"Clearing parameter '%s'",s->c_str());
-		if (s->startSkip("$",false))
-		    s_vars.clearParam(*s);
-		else
-		    target->clearParam(*s);
-	    }
+	    line = s;
 	}
+	else
+	    setParam(s,target);
     }
-    strs->destruct();
+    if (first)
+	line.clear();
 }
 
 #define CHECK_HANDLER(handler,classType,name,priority,trackName) \
@@ -606,7 +790,8 @@ static GenericHandler* findHandler(unsigned int hash)
 }
 
 RegexConfig::RegexConfig(const String& confName)
-    : m_extended(false), m_insensitive(false),
+    : m_contexts(64), m_rules(0), m_indexed(0), m_prefixIndex(DEFAULT_INDEX),
+    m_extended(false), m_insensitive(false),
     m_maxDepth(5)
 {
     Debug(&__plugin,DebugAll,"Creating new RegexConfig for configuration name '%s' [%p]",
@@ -631,6 +816,8 @@ void RegexConfig::initialize(bool first)
 	depth = 100;
     m_maxDepth = depth;
     m_defRule = m_cfg.getValue("priorities","defaultrule",DEFAULT_RULE);
+    m_prefixIndex = m_cfg.getIntValue("priorities","prefixindex",DEFAULT_INDEX,0);
+    compile();
 
     const char* trackName = m_cfg.getBoolValue("priorities","trackparam",true) ?
 	__plugin.name().c_str() : (const char*)0;
@@ -699,8 +886,25 @@ void RegexConfig::initialize(bool first)
 
 #undef CHECK_HANDLER
 
+// Build the rule program of all sections, it is never changed after this
+void RegexConfig::compile()
+{
+    u_int64_t t = Time::now();
+    for (unsigned int i = 0; i < m_cfg.sections(); i++) {
+	const NamedList* sect = m_cfg.getSection(i);
+	if (!sect)
+	    continue;
+	RegexContext* ctx = new RegexContext(*sect,*this);
+	m_rules += ctx->count();
+	m_indexed += ctx->indexed();
+	m_contexts.append(ctx);
+    }
+    Debug(&__plugin,DebugInfo,"Compiled %u rules (%u prefix indexed) in %u contexts in " FMT64U " usec",
+	m_rules,m_indexed,m_cfg.sections(),Time::now() - t);
+}
+
 // helper function to set the default regexp
-void RegexConfig::setDefault(Regexp& reg)
+void RegexConfig::setDefault(String& reg) const
 {
     if (m_defRule.null())
 	return;
@@ -746,70 +950,434 @@ do { \
     } \
 } while (false)
 
-// helper function to process one match attempt
-bool RegexConfig::oneMatch(Message& msg, Regexp& reg, String& match, const String& context,
-        unsigned int rule, const String& trace, ObjList* traceLst)
+RegexMatch::RegexMatch(const String& rule, const RegexConfig& cfg)
+    : m_type(Plain), m_text(rule), m_reg((const char*)0,cfg.extended(),cfg.insensitive()),
+      m_reverse(false)
 {
-    if (reg.startsWith("${")) {
+    String reg;
+    if (rule.startsWith("${")) {
 	// handle special matching by param ${paramname}regexp
-	int p = reg.find('}');
+	int p = rule.find('}');
 	if (p < 3) {
-	    TRACE_DBG(DebugWarn,trace,traceLst,"Invalid parameter match '%s' in rule #%u in context '%s'",
-		reg.c_str(),rule,context.c_str());
-	    return false;
+	    m_type = BadParam;
+	    return;
 	}
-	match = reg.substr(2,p-2);
-	reg = reg.substr(p+1);
-	match.trimBlanks();
+	m_param = rule.substr(2,p-2);
+	reg = rule.substr(p+1);
+	m_param.trimBlanks();
 	reg.trimBlanks();
-	String def;
-	p = match.find('$');
+	p = m_param.find('$');
 	if (p >= 0) {
 	    // param is in ${<name>$<default>} format
-	    def = match.substr(p+1);
-	    match = match.substr(0,p);
-	    match.trimBlanks();
+	    m_default = m_param.substr(p+1);
+	    m_param = m_param.substr(0,p);
+	    m_param.trimBlanks();
 	}
-	setDefault(reg);
-	if (match.null() || reg.null()) {
-	    TRACE_DBG(DebugWarn,trace,traceLst,"Missing parameter or rule in rule #%u in context '%s'",
-		rule,context.c_str());
-	    return false;
+	cfg.setDefault(reg);
+	if (m_param.null() || reg.null()) {
+	    m_type = MissingParam;
+	    return;
 	}
-	DDebug(&__plugin,DebugAll,"Using message parameter '%s' default '%s'",
-	    match.c_str(),def.c_str());
-	match = msg.getValue(match,def);
+	m_type = Param;
     }
-    else if (reg.startsWith("$(")) {
+    else if (rule.startsWith("$(")) {
 	// handle special matching by param $(function)regexp
-	int p = reg.find(')');
+	int p = rule.find(')');
 	if (p < 3) {
-	    TRACE_DBG(DebugWarn,trace,traceLst,"Invalid function match '%s' in rule #%u in context '%s'",
-		reg.c_str(),rule,context.c_str());
-	    return false;
+	    m_type = BadFunction;
+	    return;
 	}
-	match = reg.substr(0,p+1);
-	reg = reg.substr(p+1);
+	m_param = rule.substr(0,p+1);
+	m_function = m_param;
+	reg = rule.substr(p+1);
 	reg.trimBlanks();
-	setDefault(reg);
+	cfg.setDefault(reg);
 	if (reg.null()) {
+	    m_type = MissingRule;
+	    return;
+	}
+	m_type = Function;
+    }
+    else
+	reg = rule;
+    if (reg.endsWith("^")) {
+	// reverse match on final ^ (makes no sense in a regexp)
+	m_reverse = true;
+	reg = reg.substr(0,reg.length()-1);
+    }
+    m_reg = reg;
+    // compile now, matching from many threads must not modify the expression
+    m_reg.compile();
+}
+
+// helper function to process one match attempt
+bool RegexMatch::matches(Message& msg, String& match, const String& context, unsigned int rule,
+    const String& trace, ObjList* traceLst) const
+{
+    switch (m_type) {
+	case BadParam:
+	    TRACE_DBG(DebugWarn,trace,traceLst,"Invalid parameter match '%s' in rule #%u in context '%s'",
+		m_text.c_str(),rule,context.c_str());
+	    return false;
+	case BadFunction:
+	    TRACE_DBG(DebugWarn,trace,traceLst,"Invalid function match '%s' in rule #%u in context '%s'",
+		m_text.c_str(),rule,context.c_str());
+	    return false;
+	case MissingParam:
+	    TRACE_DBG(DebugWarn,trace,traceLst,"Missing parameter or rule in rule #%u in context '%s'",
+		rule,context.c_str());
+	    return false;
+	case MissingRule:
 	    TRACE_DBG(DebugWarn,trace,traceLst,"Missing rule in rule #%u in context '%s'",
 		rule,context.c_str());
 	    return false;
-	}
-	DDebug(&__plugin,DebugAll,"Using function '%s'",match.c_str());
-	msg.replaceParams(match);
-	replaceFuncs(match,msg);
+	case Param:
+	    DDebug(&__plugin,DebugAll,"Using message parameter '%s' default '%s'",
+		m_param.c_str(),m_default.c_str());
+	    match = msg.getValue(m_param,m_default);
+	    break;
+	case Function:
+	    DDebug(&__plugin,DebugAll,"Using function '%s'",m_param.c_str());
+	    match.clear();
+	    m_function.render(msg,match);
+	    replaceFuncs(match,msg);
+	    break;
     }
     match.trimBlanks();
+    return (match.matches(m_reg) != m_reverse);
+}
 
-    bool doMatch = true;
-    if (reg.endsWith("^")) {
-	// reverse match on final ^ (makes no sense in a regexp)
-	doMatch = false;
-	reg = reg.substr(0,reg.length()-1);
+// Retrieve the literal prefix the matched string must start with, empty if unknown
+bool RegexMatch::prefix(String& prefix) const
+{
+    // parameters and functions are not matched against the indexed string
+    if ((Plain == m_type) && !m_reverse && m_reg.literalPrefix(prefix))
+	return true;
+    prefix.clear();
+    return false;
+}
+
+
+RegexNode::~RegexNode()
+{
+    delete m_child;
+    delete m_next;
+}
+
+// Find or create the child node of a character
+RegexNode* RegexNode::append(char c)
+{
+    RegexNode** n = &m_child;
+    for (; *n; n = &((*n)->m_next)) {
+	if ((*n)->m_char == c)
+	    return *n;
+    }
+    *n = new RegexNode(c);
+    return *n;
+}
+
+const RegexNode* RegexNode::child(char c) const
+{
+    for (const RegexNode* n = m_child; n; n = n->m_next) {
+	if (n->m_char == c)
+	    return n;
+    }
+    return 0;
+}
+
+// Find the first rule position not lower than pos, end if there is none
+unsigned int RegexNode::first(unsigned int pos, unsigned int end) const
+{
+    const unsigned int* rules = static_cast<const unsigned int*>(m_rules.data());
+    unsigned int lo = 0;
+    unsigned int hi = m_rules.length() / sizeof(unsigned int);
+    // positions were added in increasing order
+    while (lo < hi) {
+	unsigned int mid = (lo + hi) / 2;
+	if (rules[mid] < pos)
+	    lo = mid + 1;
+	else
+	    hi = mid;
     }
-    return (match.matches(reg) == doMatch);
+    if (lo < m_rules.length() / sizeof(unsigned int))
+	return rules[lo];
+    return end;
+}
+
+
+void RegexIndex::add(unsigned int pos, const String& prefix)
+{
+    RegexNode* n = &m_root;
+    for (const char* s = prefix.c_str(); s && *s; s++)
+	n = n->append(*s);
+    n->add(pos);
+}
+
+// Find the position of the first rule at or after pos that may match the string
+unsigned int RegexIndex::find(const String& str, unsigned int pos) const
+{
+    if (pos < m_start)
+	pos = m_start;
+    unsigned int found = m_end;
+    const char* s = str.c_str();
+    // rules match on the string with blanks trimmed
+    while (s && (*s == ' ' || *s == '\t'))
+	s++;
+    for (const RegexNode* n = &m_root; n; s++) {
+	unsigned int p = n->first(pos,m_end);
+	if (p < found) {
+	    found = p;
+	    // cannot do better than the current rule
+	    if (p == pos)
+		break;
+	}
+	if (!(s && *s))
+	    break;
+	n = n->child(*s);
+    }
+    return found;
+}
+
+
+RegexPart::RegexPart(const String& text)
+    : String(text),
+      m_substitute(true), m_matches(false), m_assign(false), m_variable(false)
+{
+    // matches, parameters or functions must be replaced for each message
+    m_matches = (find('\\') >= 0);
+    if (m_matches)
+	return;
+    if ((find("${") >= 0) || (find("$(") >= 0)) {
+	m_params = text;
+	return;
+    }
+    m_substitute = false;
+    m_name = text;
+    if (m_name.trimBlanks().null())
+	return;
+    int q = m_name.find('=');
+    if (q > 0) {
+	m_assign = true;
+	m_value = m_name.substr(q+1);
+	m_name = m_name.substr(0,q);
+	m_name.trimBlanks();
+	m_value.trimBlanks();
+    }
+    m_variable = m_name.startSkip("$",false);
+}
+
+// Replace matches and parameters, without matches the parameters are precompiled
+void RegexPart::replace(const String& match, const Message& msg, String& str) const
+{
+    if (m_matches) {
+	str = match.replaceMatches(*this);
+	msg.replaceParams(str);
+    }
+    else
+	m_params.render(msg,str);
+}
+
+// Set or clear a parameter or variable, the variables mutex must be held
+void RegexPart::apply(Message& target) const
+{
+    if (m_name.null())
+	return;
+    if (m_assign) {
+	DDebug(&__plugin,DebugAll,"Setting '%s' to '%s'",m_name.c_str(),m_value.c_str());
+	if (m_variable)
+	    s_vars.setParam(m_name,m_value);
+	else
+	    target.setParam(m_name,m_value);
+    }
+    else {
+	DDebug(&__plugin,DebugAll,"Clearing parameter '%s'",m_name.c_str());
+	if (m_variable)
+	    s_vars.clearParam(m_name);
+	else
+	    target.clearParam(m_name);
+    }
+}
+
+
+// Split a rule value in parts at ';' characters
+static void splitParts(ObjList& parts, const String& val)
+{
+    ObjList* strs = val.split(';');
+    ObjList* a = &parts;
+    for (ObjList* p = strs->skipNull(); p; p = p->skipNext())
+	a = a->append(new RegexPart(*static_cast<String*>(p->get())));
+    TelEngine::destruct(strs);
+}
+
+RegexRule::RegexRule(const NamedString& line, unsigned int index, const RegexConfig& cfg)
+    : m_line(line), m_index(index), m_closes(false), m_opens(false), m_match(0),
+      m_group(0), m_action(ActNone), m_level(0)
+{
+    String rule(line.name());
+    if (rule.startSkip("}",false)) {
+	m_closes = true;
+	if (rule.trimBlanks().null())
+	    rule = ".*";
+    }
+    static const Regexp s_blockStart("^\\(.*=[[:space:]]*\\)\\?{$");
+    m_opens = s_blockStart.matches(line);
+    m_match = new RegexMatch(rule,cfg);
+    // resolve the chain of secondary clauses, the rest of the value is the action
+    String val(line);
+    ObjList* c = &m_clauses;
+    for (;;) {
+	bool alt = val.startSkip("or");
+	if (!(alt || val.startSkip("if") || val.startSkip("and")))
+	    break;
+	int p = val.find('=');
+	RegexClause* clause = new RegexClause(alt,p < 0);
+	c = c->append(clause);
+	if (p < 0)
+	    // the rule can never match past this clause
+	    return;
+	String reg = val.substr(0,p);
+	val = val.substr(p+1);
+	reg.trimBlanks();
+	val.trimBlanks();
+	if ((p >= 1) && !reg.null())
+	    clause->m_match = new RegexMatch(reg,cfg);
+    }
+    int level = 0;
+    if (val.startSkip("echo") || val.startSkip("output")
+	    || (val.startSkip("debug") && ((level = DebugAll)))) {
+	if (level) {
+	    val >> level;
+	    val.trimBlanks();
+	    if (level < DebugTest)
+		level = DebugTest;
+	    else if (level > DebugAll)
+		level = DebugAll;
+	}
+	m_action = ActEcho;
+	m_level = level;
+	m_text = val;
+	return;
+    }
+    if (val == "{") {
+	m_action = ActBlock;
+	return;
+    }
+    bool disp = val.startSkip("dispatch");
+    if (disp || val.startSkip("enqueue")) {
+	// special case: enqueue or dispatch a new message
+	if (val && (val[0] != ';')) {
+	    m_action = disp ? ActDispatch : ActEnqueue;
+	    splitParts(m_parts,val);
+	}
+	return;
+    }
+    m_action = ActSet;
+    splitParts(m_parts,val);
+}
+
+// Evaluate the rule and all its secondary clauses
+bool RegexRule::matches(Message& msg, const String& str, String& match, const String& context,
+    const String& trace, ObjList* traceLst) const
+{
+    const RegexMatch* reg = m_match;
+    ObjList* c = m_clauses.skipNull();
+    bool ok;
+    for (;;) {
+	match = str;
+	ok = reg->matches(msg,match,context,m_index+1,trace,traceLst);
+	const RegexClause* clause = c ? static_cast<const RegexClause*>(c->get()) : 0;
+	if (ok) {
+	    if (clause && clause->m_alternative) {
+		// skip over all remaining clauses
+		for (; c; c = c->skipNext()) {
+		    if (static_cast<const RegexClause*>(c->get())->m_noValue) {
+			TRACE_DBG(DebugWarn,trace,traceLst,"Malformed 'or' rule #%u in context '%s'",
+			    m_index+1,context.c_str());
+			ok = false;
+			break;
+		    }
+		}
+		break;
+	    }
+	    if (!clause)
+		break;
+	}
+	else if (clause && clause->m_alternative)
+	    ok = true;
+	if (!ok)
+	    break;
+	c = c->skipNext();
+	if (clause->m_match) {
+	    reg = clause->m_match;
+	    NDebug(&__plugin,DebugAll,"Secondary match rule '%s' by rule #%u in context '%s'",
+		reg->text().c_str(),m_index+1,context.c_str());
+	    continue;
+	}
+	TRACE_DBG(DebugWarn,trace,traceLst,"Missing 'if' in rule #%u in context '%s'",
+	    m_index+1,context.c_str());
+	ok = false;
+	break;
+    }
+    return ok;
+}
+
+// Check if the rule has any 'or' clause
+bool RegexRule::alternative() const
+{
+    for (ObjList* c = m_clauses.skipNull(); c; c = c->skipNext()) {
+	if (static_cast<const RegexClause*>(c->get())->m_alternative)
+	    return true;
+    }
+    return false;
+}
+
+
+RegexContext::RegexContext(const NamedList& sect, const RegexConfig& cfg)
+    : m_name(sect), m_indexed(0)
+{
+    ObjList rules;
+    ObjList* a = &rules;
+    unsigned int len = sect.length();
+    for (unsigned int i = 0; i < len; i++) {
+	const NamedString* n = sect.getParam(i);
+	if (!n)
+	    continue;
+	a = a->append(new RegexRule(*n,i,cfg));
+    }
+    m_rules.assign(rules);
+    if (!cfg.prefixIndex())
+	return;
+    // block delimiters change state so only runs between them can be indexed
+    unsigned int start = 0;
+    for (unsigned int pos = 0; pos < count(); pos++) {
+	const RegexRule* r = rule(pos);
+	if (!(r->m_closes || r->m_opens))
+	    continue;
+	index(start,pos,cfg.prefixIndex());
+	start = pos + 1;
+    }
+    index(start,count(),cfg.prefixIndex());
+}
+
+// Build the prefix tree of a run of rules if it is long enough to be worth it
+void RegexContext::index(unsigned int start, unsigned int end, unsigned int minRules)
+{
+    if (end < start + minRules)
+	return;
+    RegexIndex* idx = new RegexIndex(start,end);
+    m_groups.append(idx);
+    String prefix;
+    for (unsigned int pos = start; pos < end; pos++) {
+	RegexRule* r = static_cast<RegexRule*>(m_rules.at(pos));
+	if (r->alternative())
+	    // an 'or' clause may match without the primary rule, keep it at the root
+	    prefix.clear();
+	else
+	    r->m_match->prefix(prefix);
+	idx->add(pos,prefix);
+	r->m_group = idx;
+    }
+    m_indexed += end - start;
 }
 
 // process one context, can call itself recursively
@@ -824,32 +1392,37 @@ bool RegexConfig::oneContext(Message &msg, String &str, const String &context, S
     }
 
     TRACE_RULE(traceLevel,trace,traceLst,"Searching match for %s",str.c_str());
-    NamedList *l = m_cfg.getSection(context);
-    if (l) {
+    const RegexContext* ctx = static_cast<const RegexContext*>(m_contexts[context]);
+    if (ctx) {
 	unsigned int blockDepth = 0;
 	BlockState blockStack[BLOCK_STACK];
-	unsigned int len = l->length();
-	for (unsigned int i = 0; i < len; i++) {
-	    const NamedString* n = l->getParam(i);
-	    if (!n)
-		continue;
+	// skipped rules must still be traced one by one
+	bool indexed = trace.null() && !traceLst;
+	for (unsigned int pos = 0; pos < ctx->count(); pos++) {
+	    const RegexRule* r = ctx->rule(pos);
+	    const NamedString* n = &r->m_line;
+	    unsigned int i = r->m_index;
 	    BlockState blockThis = (blockDepth > 0) ? blockStack[blockDepth-1] : BlockRun;
 	    BlockState blockLast = BlockSkip;
-	    Regexp reg(n->name(),m_extended,m_insensitive);
-	    if (reg.startSkip("}",false)) {
+	    if (indexed && r->m_group) {
+		// jump over the indexed rules that cannot match the current string
+		unsigned int next = (BlockRun == blockThis) ? r->m_group->find(str,pos) : r->m_group->end();
+		if (next != pos) {
+		    pos = next - 1;
+		    continue;
+		}
+	    }
+	    if (r->m_closes) {
 		if (!blockDepth) {
 		    TRACE_DBG(DebugWarn,trace,traceLst,"Got '}' outside block in line #%u in context '%s'",
 			i+1,context.c_str());
 		    continue;
 		}
-		if (reg.trimBlanks().null())
-		    reg = ".*";
 		blockDepth--;
 		blockLast = blockThis;
 		blockThis = (blockDepth > 0) ? blockStack[blockDepth-1] : BlockRun;
 	    }
-	    static Regexp s_blockStart("^\\(.*=[[:space:]]*\\)\\?{$");
-	    if (s_blockStart.matches(*n)) {
+	    if (r->m_opens) {
 		// start of a new block
 		if (blockDepth >= BLOCK_STACK) {
 		    TRACE_DBG(DebugWarn,trace,traceLst,"Block stack overflow in line #%u in context '%s'",
@@ -875,114 +1448,64 @@ bool RegexConfig::oneContext(Message &msg, String &str, const String &context, S
 	    if (BlockRun != blockThis)
 		continue;
 
-	    String val(*n);
 	    String match;
-	    bool ok;
-	    do {
-		match = str;
-		ok = oneMatch(msg,reg,match,context,i+1,trace,traceLst);
-		if (ok) {
-		    if (val.startSkip("or")) {
-			do {
-			    int p = val.find('=');
-			    if (p < 0) {
-				TRACE_DBG(DebugWarn,trace,traceLst,"Malformed 'or' rule #%u in context '%s'",
-				    i+1,context.c_str());
-				ok = false;
-				break;
-			    }
-			    val = val.substr(p+1);
-			    val.trimBlanks();
-			} while (ok && (val.startSkip("or") || val.startSkip("if") || val.startSkip("and")));
-			break;
-		    }
-		    if (!(val.startSkip("if") || val.startSkip("and")))
-			break;
-		}
-		else if (val.startSkip("or"))
-		    ok = true;
-		if (ok) {
-		    int p = val.find('=');
-		    if (p >= 1) {
-			reg = val.substr(0,p);
-			val = val.substr(p+1);
-			reg.trimBlanks();
-			val.trimBlanks();
-			if (!reg.null()) {
-			    NDebug(&__plugin,DebugAll,"Secondary match rule '%s' by rule #%u in context '%s'",
-				reg.c_str(),i+1,context.c_str());
-			    continue;
-			}
-		    }
-		    TRACE_DBG(DebugWarn,trace,traceLst,"Missing 'if' in rule #%u in context '%s'",
-			i+1,context.c_str());
-		    ok = false;
-		}
-	    } while (ok);
+	    bool ok = r->matches(msg,str,match,context,trace,traceLst);
 	    TRACE_RULE(traceLevel,trace,traceLst,"Matched:%s %s:%d - %s=%s",
 		     String::boolText(ok),context.c_str(),i,n->name().c_str(),n->safe());
 	    if (!ok)
 		continue;
 
-	    int level = 0;
-	    if (val.startSkip("echo") || val.startSkip("output")
-		    || (val.startSkip("debug") && ((level = DebugAll)))) {
-		if (level) {
-		    val >> level;
-		    val.trimBlanks();
-		    if (level < DebugTest)
-			level = DebugTest;
-		    else if (level > DebugAll)
-			level = DebugAll;
-		}
-		// special case: display the line but don't set params
-		val = match.replaceMatches(val);
-		msg.replaceParams(val);
-		replaceFuncs(val,msg);
-		if (!level)
-		    Output("%s",val.safe());
-		else if (!__plugin_debug.enabled())
-		    Debug(level,"%s",val.safe());
-		else if (__plugin_debug.filterDebug(val))
-		    Debug(&__plugin_debug,level,"%s",val.safe());
-		continue;
-	    }
-	    else if (val == "{") {
-		// mark block as being processed now
-		if (blockDepth)
-		    blockStack[blockDepth-1] = BlockRun;
-		else
-		    TRACE_DBG(DebugWarn,trace,traceLst,"Got '{' outside block in line #%u in context '%s'",
-			i+1,context.c_str());
-		continue;
-	    }
-	    bool disp = val.startSkip("dispatch");
-	    if (disp || val.startSkip("enqueue")) {
-		// special case: enqueue or dispatch a new message
-		if (val && (val[0] != ';')) {
-		    Message* m = new Message("");
-		    // parameters are set in the new message
-		    setMessage(match,msg,val,m);
-		    val.trimBlanks();
-		    if (val) {
-			*m = val;
-			m->userData(msg.userData());
-			NDebug(&__plugin,DebugAll,"%s new message '%s' by rule #%u '%s' in context '%s'",
-			    (disp ? "Dispatching" : "Enqueueing"),
-			    val.c_str(),i+1,n->name().c_str(),context.c_str());
-			if (disp) {
-			    s_dispatching.inc();
-			    Engine::dispatch(m);
-			    s_dispatching.dec();
+	    String val;
+	    switch (r->m_action) {
+		case RegexRule::ActNone:
+		    continue;
+		case RegexRule::ActEcho:
+		    // special case: display the line but don't set params
+		    val = match.replaceMatches(r->m_text);
+		    msg.replaceParams(val);
+		    replaceFuncs(val,msg);
+		    if (!r->m_level)
+			Output("%s",val.safe());
+		    else if (!__plugin_debug.enabled())
+			Debug(r->m_level,"%s",val.safe());
+		    else if (__plugin_debug.filterDebug(val))
+			Debug(&__plugin_debug,r->m_level,"%s",val.safe());
+		    continue;
+		case RegexRule::ActBlock:
+		    // mark block as being processed now
+		    if (blockDepth)
+			blockStack[blockDepth-1] = BlockRun;
+		    else
+			TRACE_DBG(DebugWarn,trace,traceLst,"Got '{' outside block in line #%u in context '%s'",
+			    i+1,context.c_str());
+		    continue;
+		case RegexRule::ActDispatch:
+		case RegexRule::ActEnqueue:
+		    {
+			bool disp = (RegexRule::ActDispatch == r->m_action);
+			Message* m = new Message("");
+			// parameters are set in the new message
+			setMessage(match,msg,r->m_parts,val,m);
+			val.trimBlanks();
+			if (val) {
+			    *m = val;
+			    m->userData(msg.userData());
+			    NDebug(&__plugin,DebugAll,"%s new message '%s' by rule #%u '%s' in context '%s'",
+				(disp ? "Dispatching" : "Enqueueing"),
+				val.c_str(),i+1,n->name().c_str(),context.c_str());
+			    if (disp) {
+				s_dispatching.inc();
+				Engine::dispatch(m);
+				s_dispatching.dec();
+			    }
+			    else if (Engine::enqueue(m))
+				m = 0;
 			}
-			else if (Engine::enqueue(m))
-			    m = 0;
+			TelEngine::destruct(m);
 		    }
-		    TelEngine::destruct(m);
-		}
-		continue;
+		    continue;
 	    }
-	    setMessage(match,msg,val);
+	    setMessage(match,msg,r->m_parts,val);
 	    warn = true;
 	    val.trimBlanks();
 	    if (val.null() || val.startSkip("noop")) {
@@ -1218,13 +1741,13 @@ RegexRoutePlugin::RegexRoutePlugin()
     Output("Loaded module RegexRoute");
 }
 
-void RegexRoutePlugin::initVars(NamedList* sect, bool replace)
+void RegexRoutePlugin::initVars(const NamedList* sect, bool replace)
 {
     if (!sect)
 	return;
     Lock l(s_varsMtx); // we want all set at the same time
-    for (ObjList* o = sect->paramList()->skipNull(); o; o = o->skipNext()) {
-	NamedString* n = static_cast<NamedString*>(o->get());
+    for (const ObjList* o = sect->paramList()->skipNull(); o; o = o->skipNext()) {
+	const NamedString* n = static_cast<const NamedString*>(o->get());
 	if (replace)
 	    s_vars.setParam(n->name(),*n);
 	else if (!s_vars.getParam(n->name()))
@@ -1270,7 +1793,8 @@ void RegexRoutePlugin::statusParams(String& str)
 {
     Lock lock(s_mutex);
     str.append("sections=",";");
-    str << s_cfg->sectCount() << ",extra=" << s_extra.count();
+    str << s_cfg->sectCount() << ",rules=" << s_cfg->ruleCount()
+	<< ",indexed=" << s_cfg->indexedCount() << ",extra=" << s_extra.count();
     lock.acquire(s_varsMtx);
     str << ",variables=" << s_vars.count();
     lock.drop();
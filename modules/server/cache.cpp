@@ -177,10 +177,11 @@ protected:
     String m_account;                    // Database account
     String m_accountLoadCache;           // Load cache account
     String m_queryLoadCache;             // Database load all cache query
-    String m_queryLoadItem;              // Database load a cache item query
+    ParamTemplate m_queryLoadItem;       // Database load a cache item query
     String m_queryLoadItemCmd;           // Database load item on command query
-    String m_querySave;                  // Database save query
+    ParamTemplate m_querySave;           // Database save query
     String m_queryExpire;                // Database expire query
+    bool m_bindParams;                   // Pass quoted query parameters separately
 };
 
 class CacheThread : public Thread, public GenObject
@@ -410,7 +411,7 @@ Cache::Cache(const String& name, int size, const NamedList& params)
     m_limitOverflow(0), m_loadChunk(0), m_prefixMin(0), m_prefixMask(0),
     m_loadPrio(Thread::Normal),
     m_loading(false), m_loadInterval(0), m_nextLoad(0),
-    m_reload(0), m_reloadItems(0)
+    m_reload(0), m_reloadItems(0), m_bindParams(false)
 
 {
     Debug(&__plugin,DebugInfo,"Cache(%s) size=%u [%p]",
@@ -497,12 +498,15 @@ bool Cache::copyParams(const String& id, NamedList& list, const String* cpParams
     CacheItem* item = findPrefix(id);
     if (!item && m_account && m_queryLoadItem) {
 	// Load from database
-	String query = m_queryLoadItem;
+	String query;
 	NamedList p("");
 	p.addParam("id",id);
-	p.replaceParams(query);
 	Message m("database");
 	m.addParam("account",m_account);
+	if (m_bindParams)
+	    m_queryLoadItem.bind(p,query,m);
+	else
+	    m_queryLoadItem.render(p,query);
 	m.addParam("query",query);
 	unlock();
 	bool ok = Engine::dispatch(m);
@@ -863,6 +867,7 @@ void Cache::doUpdate(const NamedList& params, bool first)
     m_queryLoadItemCmd = params.getValue("query_loaditem_command",m_queryLoadItem);
     m_querySave = params.getValue("query_save");
     m_queryExpire = params.getValue("query_expire");
+    m_bindParams = params.getBoolValue("bind_params");
     // Minimum sanity check for cache load
     if (m_loadChunk && m_queryLoadCache) {
 	String tmp = m_queryLoadCache;
@@ -975,13 +980,16 @@ CacheItem* Cache::addUnsafe(const String& id, const NamedList& params, const Str
     if (len > 0 && len <= 32)
 	m_prefixMask |= (1 << (len - 1));
     if (dbSave && m_account && m_querySave) {
-	String query = m_querySave;
+	String query;
 	NamedList p(*item);
 	p.setParam("id",item->toString());
 	p.setParam("expires",String((unsigned int)(m_cacheTtl / 1000000)));
-	p.replaceParams(query);
 	Message* m = new Message("database");
 	m->addParam("account",m_account);
+	if (m_bindParams)
+	    m_querySave.bind(p,query,*m);
+	else
+	    m_querySave.render(p,query);
 	m->addParam("query",query);
 	m->addParam("results",String::boolText(false));
 	Engine::enqueue(m);
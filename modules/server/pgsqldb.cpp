@@ -22,18 +22,84 @@
 #include <yatephone.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <libpq-fe.h>
 
+// Asynchronous mode needs pipelining (libpq 14+) and poll()
+#if defined(LIBPQ_HAS_PIPELINING) && !defined(_WINDOWS)
+#define PG_ASYNC
+#include <poll.h>
+#endif
+
+// Number of recent query durations kept for latency percentiles
+#define PG_LATENCY_SAMPLES 1024
+
 using namespace TelEngine;
 namespace { // anonymous
 
 class PGConn;                            // A database connection
 class PgAccount;                         // Database account holding the connection(s)
+class PgQuery;                           // A query executed asynchronously
+class PgIoThread;                        // Account thread running asynchronous queries
 
 static ObjList s_accounts;
 Mutex s_conmutex(false,"PgSQL::acc");
 static unsigned int s_failedConns;
 
+// A prepared statement kept in a connection cache, named by its query text
+class PgStmt : public String
+{
+public:
+    inline PgStmt(const String& query, const String& name)
+	: String(query), m_name(name)
+	{ }
+    inline const String& name() const
+	{ return m_name; }
+private:
+    String m_name;
+};
+
+// Positional parameter values bound from "arg.1" ... "arg.N", missing ones are NULL
+class PgParams
+{
+public:
+    PgParams(const NamedList& params);
+    ~PgParams();
+    int m_count;
+    const char** m_values;
+    int* m_lengths;
+    int* m_formats;
+};
+
+// A query executed asynchronously in the pipeline of a connection
+// The query parameters and results are kept in a private message
+//  as the waiting thread may give up before the query completes
+class PgQuery : public RefObject
+{
+public:
+    enum Kind {
+	Query,
+	Prepare,
+	Deallocate
+    };
+    PgQuery(const String& query, const Message* msg, Kind kind = Query,
+	const String& stmt = String::empty());
+    String m_query;
+    Kind m_kind;
+    String m_stmt;
+    Message m_result;
+    int m_rows;
+    int m_affected;
+    bool m_error;
+    bool m_finished;
+    bool m_cancelled;
+    bool m_ended;
+    u_int64_t m_start;
+    u_int64_t m_sent;
+    Semaphore m_done;
+};
+
 // A database connection
 class PgConn : public String
 {
@@ -57,19 +123,66 @@ public:
 private:
     // Init DB connection
     bool initDbInternal(int retry);
+    // Set up a connection that just succeeded, drop it on failure
+    bool connected();
     // Perform the query, fill the message with data
     // Return number of rows, -1 for non-retryable errors and -2 to retry
     int queryDbInternal(const char* query, Message* dest);
+    // Send a query with parameters bound from "arg.N" in message
+    // Return 0 on success, -1 for non-retryable errors and -2 to retry
+    int sendBound(const String& query, Message* dest, u_int64_t timeout);
+    // Flush the query, return false and drop the connection on error
+    bool flush(Message* dest);
+    // Collect the results of the query, fill the message with data
+    // Return number of rows or -2 to retry, set error if any result failed
+    int getResults(const char* query, Message* dest, u_int64_t timeout, bool* error = 0);
+    // Process one result of a query, fill the message with data
+    void addResult(PGresult* res, const char* query, Message* dest,
+	int& totalRows, int& affectedRows, bool* error);
+    // Find a cached statement and make it the most recently used
+    PgStmt* findStmt(const String& query);
+    // Add a statement to cache, return name of the one evicted to make room
+    PgStmt* addStmt(const String& query, String& evicted);
+    void dropStmt(const String& name);
+#ifdef PG_ASYNC
+    // Start connecting without blocking, pollConnect() completes the connection
+    bool connectAsync();
+    // Advance a connection started by connectAsync() when its socket is ready
+    // Return false if the connection failed
+    bool pollConnect();
+    // Send a query in the pipeline, take ownership of it
+    // Return false if the connection failed
+    bool sendAsync(PgQuery* q);
+    // Append a sent query to the pipeline and follow it by a sync point
+    bool pipeline(PgQuery* q, int sent);
+    // Flush pending output and collect available results
+    // Return false if the connection failed
+    bool processAsync(bool flushing, bool reading);
+    // Finish all queries in the pipeline with an error and drop the connection
+    void failAsync(const char* error);
+#endif
 
     PgAccount* m_account;
     bool m_busy;
     PGconn* m_conn;
+    ObjList m_stmts;
+    unsigned int m_stmtCount;
+    unsigned int m_stmtSeq;
+    // Queries sent in pipeline mode, oldest first
+    ObjList m_queue;
+    unsigned int m_queued;
+    bool m_flushing;
+    // Connection started by the I/O thread and not completed yet
+    bool m_connecting;
+    PostgresPollingStatusType m_polling;
+    u_int64_t m_connectTimeout;
 };
 
 // Database account holding the connection(s)
 class PgAccount : public RefObject, public Mutex
 {
     friend class PgConn;
+    friend class PgIoThread;
 public:
     PgAccount(const NamedList& sect);
     // Try to initialize DB connections. Return true if at least one of them is active
@@ -80,6 +193,9 @@ public:
     virtual const String& toString() const
 	{ return m_name; }
     virtual void destroyed();
+#ifdef PG_ASYNC
+    void stopIo();
+#endif
 
     inline unsigned int total()
 	{ return m_totalQueries; }
@@ -89,20 +205,42 @@ public:
 	{ return m_errorQueries; }
     inline unsigned int queryTime()
         { return (unsigned int) m_queryTime; }
+    inline unsigned int queued()
+	{ return m_queued; }
+    // Retrieve latency percentiles of recent queries in microseconds
+    // Stats mutex must be locked
+    void latency(unsigned int& p50, unsigned int& p90, unsigned int& p99);
 
 protected:
     inline void incErrorQueriesSafe() {
 	    Lock mylock(m_statsMutex);
 	    m_errorQueries++;
 	}
+    // Account a query start or end, stats mutex must be locked
+    inline void queryStarted()
+	{ m_queued++; }
+    void queryEnded(int res, u_int64_t duration);
 
 private:
     void dropDb();
+#ifdef PG_ASYNC
+    // Make a query through the pipeline of a connection and wait for it
+    int queryAsync(const char* query, Message* dest);
+    bool startIo();
+    void wakeIo();
+    // Run the asynchronous I/O loop
+    void runIo();
+    // Send pending queries to the least loaded connections
+    void dispatch();
+    // Finish a query, take ownership of it
+    void finishQuery(PgQuery* q);
+#endif
 
     String m_name;
     String m_connection;
     String m_encoding;
     int m_retry;
+    unsigned int m_stmtCache;
     u_int64_t m_timeout;
     PgConn* m_connPool;
     unsigned int m_connPoolSize;
@@ -112,8 +250,37 @@ private:
     unsigned int m_failedQueries;
     unsigned int m_errorQueries;
     u_int64_t m_queryTime;
+    unsigned int m_queued;
+    u_int32_t m_latency[PG_LATENCY_SAMPLES];
+    unsigned int m_latencyPos;
+    unsigned int m_latencyCount;
+    // asynchronous mode
+    bool m_async;
+    unsigned int m_depth;
+    bool m_exiting;
+    u_int64_t m_nextConnect;
+    ObjList m_pending;
+    Socket m_wakeRead;
+    Socket m_wakeWrite;
+    PgIoThread* m_thread;
 };
 
+#ifdef PG_ASYNC
+// Account thread multiplexing asynchronous queries over the connections
+class PgIoThread : public Thread
+{
+public:
+    inline PgIoThread(PgAccount* account)
+	: Thread("PgSQL I/O"), m_account(account)
+	{ }
+    ~PgIoThread();
+    virtual void run()
+	{ m_account->runIo(); }
+private:
+    PgAccount* m_account;
+};
+#endif
+
 class PgModule : public Module
 {
 public:
@@ -125,6 +292,7 @@ protected:
     virtual void statusParams(String& str);
     virtual void statusDetail(String& str);
     virtual void genUpdate(Message& msg);
+    virtual bool received(Message& msg, int id);
 private:
     bool m_init;
 };
@@ -142,12 +310,89 @@ public:
 };
 
 
+//
+// PgParams
+//
+PgParams::PgParams(const NamedList& params)
+    : m_count(params.getIntValue(YSTRING("args"),0,0,65535)),
+      m_values(0), m_lengths(0), m_formats(0)
+{
+    if (!m_count)
+	return;
+    m_values = new const char*[m_count];
+    m_lengths = new int[m_count];
+    m_formats = new int[m_count];
+    String name("arg.");
+    unsigned int len = name.length();
+    for (int i = 0; i < m_count; i++) {
+	name.assign(name,len) << (i + 1);
+	const String* val = params.getParam(name);
+	NamedPointer* np = YOBJECT(NamedPointer,val);
+	const DataBlock* data = np ? YOBJECT(DataBlock,np->userData()) : 0;
+	if (data) {
+	    m_values[i] = (const char*)data->data();
+	    m_lengths[i] = data->length();
+	    m_formats[i] = 1;
+	}
+	else {
+	    m_values[i] = val ? val->c_str() : 0;
+	    m_lengths[i] = val ? val->length() : 0;
+	    m_formats[i] = 0;
+	}
+    }
+}
+
+PgParams::~PgParams()
+{
+    delete[] m_values;
+    delete[] m_lengths;
+    delete[] m_formats;
+}
+
+
+//
+// PgQuery
+//
+PgQuery::PgQuery(const String& query, const Message* msg, Kind kind, const String& stmt)
+    : m_query(query), m_kind(kind), m_stmt(stmt), m_result("database"),
+      m_rows(0), m_affected(0), m_error(false),
+      m_finished(false), m_cancelled(false), m_ended(false),
+      m_start(Time::now()), m_sent(0),
+      m_done(1,"PgSQL::query")
+{
+    if (!msg)
+	return;
+    m_result.copyParam(*msg,YSTRING("results"));
+    // Positional parameters are copied as the message may go away
+    int n = msg->getIntValue(YSTRING("args"),-1,-1,65535);
+    if (n < 0)
+	return;
+    m_result.addParam("args",String(n));
+    String name("arg.");
+    unsigned int len = name.length();
+    for (int i = 1; i <= n; i++) {
+	name.assign(name,len) << i;
+	const NamedString* ns = msg->getParam(name);
+	if (!ns)
+	    continue;
+	NamedPointer* np = YOBJECT(NamedPointer,ns);
+	const DataBlock* data = np ? YOBJECT(DataBlock,np->userData()) : 0;
+	if (data)
+	    m_result.addParam(new NamedPointer(name,new DataBlock(*data)));
+	else
+	    m_result.addParam(name,*ns);
+    }
+}
+
+
 //
 // PgConn
 //
 PgConn::PgConn(PgAccount* account)
     : m_account(account), m_busy(false),
-    m_conn(0)
+    m_conn(0), m_stmtCount(0), m_stmtSeq(0),
+    m_queued(0), m_flushing(false),
+    m_connecting(false), m_polling(PGRES_POLLING_OK), m_connectTimeout(0)
 {
 }
 
@@ -177,6 +422,11 @@ void PgConn::dropDb()
 {
     if (!m_conn)
 	return;
+    // Prepared statements live only as long as their session
+    m_stmts.clear();
+    m_stmtCount = 0;
+    m_flushing = false;
+    m_connecting = false;
     PGconn* tmp = m_conn;
     m_conn = 0;
     XDebug(&module,DebugAll,"Connection '%s' dropped [%p]",c_str(),m_account);
@@ -268,12 +518,7 @@ bool PgConn::initDbInternal(int retry)
 		dropDb();
 		return false;
 	    case CONNECTION_OK:
-		Debug(&module,DebugAll,"Connection for '%s' succeeded [%p]",c_str(),m_account);
-		if (m_account->m_encoding && PQsetClientEncoding(m_conn,m_account->m_encoding))
-		    Debug(&module,DebugWarn,
-			"Failed to set encoding '%s' on connection '%s' [%p]",
-			m_account->m_encoding.c_str(),c_str(),m_account);
-		return true;
+		return connected();
 	    default:
 		break;
 	}
@@ -286,6 +531,27 @@ bool PgConn::initDbInternal(int retry)
     return false;
 }
 
+// Set up a connection that just succeeded, drop it on failure
+bool PgConn::connected()
+{
+    Debug(&module,DebugAll,"Connection for '%s' succeeded [%p]",c_str(),m_account);
+    // Connections started by the I/O thread sent the encoding at startup
+    if (!m_connecting && m_account->m_encoding && PQsetClientEncoding(m_conn,m_account->m_encoding))
+	Debug(&module,DebugWarn,
+	    "Failed to set encoding '%s' on connection '%s' [%p]",
+	    m_account->m_encoding.c_str(),c_str(),m_account);
+    m_connecting = false;
+#ifdef PG_ASYNC
+    if (m_account->m_async && !PQenterPipelineMode(m_conn)) {
+	Debug(&module,DebugWarn,"Failed to enter pipeline mode on '%s': %s [%p]",
+	    c_str(),PQerrorMessage(m_conn),m_account);
+	dropDb();
+	return false;
+    }
+#endif
+    return true;
+}
+
 // Perform the query, fill the message with data
 // Return number of rows, -1 for non-retryable errors and -2 to retry
 int PgConn::queryDbInternal(const char* query, Message* dest)
@@ -294,7 +560,12 @@ int PgConn::queryDbInternal(const char* query, Message* dest)
 	// no retry - initDb already tried and failed...
 	return -1;
     u_int64_t timeout = Time::now() + m_account->m_timeout;
-    if (!PQsendQuery(m_conn,query)) {
+    if (dest && dest->getParam(YSTRING("args"))) {
+	int res = sendBound(query,dest,timeout);
+	if (res < 0)
+	    return res;
+    }
+    else if (!PQsendQuery(m_conn,query)) {
 	// a connection failure cannot be detected at this point so any
 	//  error must be caused by the query itself - bad syntax or so
 	Debug(&module,DebugWarn,"Query '%s' for '%s' failed: %s [%p]",
@@ -304,16 +575,28 @@ int PgConn::queryDbInternal(const char* query, Message* dest)
 	// non-retryable, query should be fixed
 	return -1;
     }
-
-    if (PQflush(m_conn)) {
-	Debug(&module,DebugWarn,"Flush for '%s' failed: %s [%p]",
-	    c_str(),PQerrorMessage(m_conn),m_account);
-	dropDb();
-	if (dest)
-	    dest->setParam("error",PQerrorMessage(m_conn));
+    if (!flush(dest))
 	return -2;
-    }
+    return getResults(query,dest,timeout);
+}
+
+// Flush the query, return false and drop the connection on error
+bool PgConn::flush(Message* dest)
+{
+    if (!PQflush(m_conn))
+	return true;
+    Debug(&module,DebugWarn,"Flush for '%s' failed: %s [%p]",
+	c_str(),PQerrorMessage(m_conn),m_account);
+    if (dest)
+	dest->setParam("error",PQerrorMessage(m_conn));
+    dropDb();
+    return false;
+}
 
+// Collect the results of the query, fill the message with data
+// Return number of rows or -2 to retry, set error if any result failed
+int PgConn::getResults(const char* query, Message* dest, u_int64_t timeout, bool* error)
+{
     int totalRows = 0;
     int affectedRows = 0;
     while (Time::now() < timeout) {
@@ -333,80 +616,371 @@ int PgConn::queryDbInternal(const char* query, Message* dest)
 	    }
 	    return totalRows;
 	}
-	ExecStatusType stat = PQresultStatus(res);
-	switch (stat) {
-	    case PGRES_TUPLES_OK:
-		// we got some data - but maybe zero rows or binary...
-		if (dest) {
-		    affectedRows += String(PQcmdTuples(res)).toInteger();
-		    int columns = PQnfields(res);
-		    int rows = PQntuples(res);
-		    if (rows > 0) {
-			totalRows += rows;
-			dest->setParam("columns",String(columns));
-			if (dest->getBoolValue("results",true) && !PQbinaryTuples(res)) {
-			    Array *a = new Array(columns,rows+1);
-			    for (int k = 0; k < columns; k++) {
-				ObjList* column = a->getColumn(k);
-				if (column)
-				    column->set(new String(PQfname(res,k)));
-				else {
+	addResult(res,query,dest,totalRows,affectedRows,error);
+	PQclear(res);
+    }
+    Debug(&module,DebugWarn,"Query timed out for '%s' [%p]",c_str(),m_account);
+    if (dest)
+	dest->setParam("error","query timeout");
+    dropDb();
+    return -2;
+}
+
+// Process one result of a query, fill the message with data
+void PgConn::addResult(PGresult* res, const char* query, Message* dest,
+    int& totalRows, int& affectedRows, bool* error)
+{
+    switch (PQresultStatus(res)) {
+	case PGRES_TUPLES_OK:
+	    // we got some data - but maybe zero rows or binary...
+	    if (dest) {
+		affectedRows += String(PQcmdTuples(res)).toInteger();
+		int columns = PQnfields(res);
+		int rows = PQntuples(res);
+		if (rows > 0) {
+		    totalRows += rows;
+		    dest->setParam("columns",String(columns));
+		    if (dest->getBoolValue("results",true) && !PQbinaryTuples(res)) {
+			Array *a = new Array(columns,rows+1);
+			for (int k = 0; k < columns; k++) {
+			    ObjList* column = a->getColumn(k);
+			    if (column)
+				column->set(new String(PQfname(res,k)));
+			    else {
+				Debug(&module,DebugCrit,
+				    "Query '%s' for '%s': No array column for %d [%p]",
+				    query,c_str(),k,m_account);
+				continue;
+			    }
+			    for (int j = 0; j < rows; j++) {
+				column = column->next();
+				if (!column) {
+				    // Stop now: we won't get the next row
 				    Debug(&module,DebugCrit,
-					"Query '%s' for '%s': No array column for %d [%p]",
-					query,c_str(),k,m_account);
-				    continue;
-				}
-				for (int j = 0; j < rows; j++) {
-				    column = column->next();
-				    if (!column) {
-					// Stop now: we won't get the next row
-					Debug(&module,DebugCrit,
-					    "Query '%s' for '%s': No array row %d in column %d [%p]",
-					    query,c_str(),j + 1,k,m_account);
-					break;
-				    }
-				    // skip over NULL values
-				    if (PQgetisnull(res,j,k))
-					continue;
-				    GenObject* v = 0;
-				    if (PQfformat(res,k))
-					v = new DataBlock(PQgetvalue(res,j,k),PQgetlength(res,j,k));
-				    else
-					v = new String(PQgetvalue(res,j,k));
-				    column->set(v);
+					"Query '%s' for '%s': No array row %d in column %d [%p]",
+					query,c_str(),j + 1,k,m_account);
+				    break;
 				}
+				// skip over NULL values
+				if (PQgetisnull(res,j,k))
+				    continue;
+				GenObject* v = 0;
+				if (PQfformat(res,k))
+				    v = new DataBlock(PQgetvalue(res,j,k),PQgetlength(res,j,k));
+				else
+				    v = new String(PQgetvalue(res,j,k));
+				column->set(v);
 			    }
-			    dest->userData(a);
-			    a->deref();
 			}
+			dest->userData(a);
+			a->deref();
 		    }
 		}
+	    }
+	    break;
+	case PGRES_COMMAND_OK:
+	    if (dest)
+		affectedRows += String(PQcmdTuples(res)).toInteger();
+	    // no data returned
+	    break;
+	case PGRES_COPY_IN:
+	case PGRES_COPY_OUT:
+	    // data transfers - ignore them
+	    break;
+	default:
+	    Debug(&module,DebugWarn,"Query '%s' for '%s' error: %s [%p]",
+		query,c_str(),PQresultErrorMessage(res),m_account);
+	    if (error)
+		*error = true;
+	    if (dest)
+		dest->setParam("error",PQresultErrorMessage(res));
+	    m_account->incErrorQueriesSafe();
+	    module.changed();
+    }
+}
+
+// Find a cached statement and make it the most recently used
+PgStmt* PgConn::findStmt(const String& query)
+{
+    for (ObjList* o = m_stmts.skipNull(); o; o = o->skipNext()) {
+	PgStmt* st = static_cast<PgStmt*>(o->get());
+	if (*st != query)
+	    continue;
+	if (o != m_stmts.skipNull()) {
+	    o->remove(false);
+	    m_stmts.insert(st);
+	}
+	return st;
+    }
+    return 0;
+}
+
+// Add a statement to cache, drop the least recently used one to make room
+PgStmt* PgConn::addStmt(const String& query, String& evicted)
+{
+    if (m_stmtCount >= m_account->m_stmtCache) {
+	ObjList* last = m_stmts.skipNull();
+	for (ObjList* o = last; o; o = o->skipNext())
+	    last = o;
+	evicted = static_cast<PgStmt*>(last->get())->name();
+	last->remove();
+	m_stmtCount--;
+    }
+    String name("yate_");
+    name << ++m_stmtSeq;
+    PgStmt* st = new PgStmt(query,name);
+    m_stmts.insert(st);
+    m_stmtCount++;
+    return st;
+}
+
+// Forget a statement that failed to prepare
+void PgConn::dropStmt(const String& name)
+{
+    for (ObjList* o = m_stmts.skipNull(); o; o = o->skipNext()) {
+	if (static_cast<PgStmt*>(o->get())->name() != name)
+	    continue;
+	o->remove();
+	m_stmtCount--;
+	return;
+    }
+}
+
+// Prepare the query on first use, keeping it in a least recently used cache,
+//  then send it with positional parameters $1 ... $N bound from message
+//  parameters "arg.1" ... "arg.N", missing ones are NULL
+int PgConn::sendBound(const String& query, Message* dest, u_int64_t timeout)
+{
+    PgStmt* st = findStmt(query);
+    if (!st && m_account->m_stmtCache) {
+	String evicted;
+	st = addStmt(query,evicted);
+	if (evicted) {
+	    String sql("DEALLOCATE ");
+	    sql << evicted;
+	    if (!(PQsendQuery(m_conn,sql) && flush(0)))
+		return -2;
+	    if (getResults(sql,0,timeout) < 0)
+		return -2;
+	}
+	if (!PQsendPrepare(m_conn,st->name(),query,0,0)) {
+	    Debug(&module,DebugWarn,"Prepare '%s' for '%s' failed: %s [%p]",
+		query.c_str(),c_str(),PQerrorMessage(m_conn),m_account);
+	    dest->setParam("error",PQerrorMessage(m_conn));
+	    dropStmt(st->name());
+	    return -1;
+	}
+	if (!flush(dest))
+	    return -2;
+	bool error = false;
+	int res = getResults(query,dest,timeout,&error);
+	if (res < 0)
+	    return res;
+	if (error) {
+	    dropStmt(st->name());
+	    return -1;
+	}
+    }
+    PgParams p(*dest);
+    int ok = st ? PQsendQueryPrepared(m_conn,st->name(),p.m_count,p.m_values,p.m_lengths,p.m_formats,0)
+	: PQsendQueryParams(m_conn,query,p.m_count,0,p.m_values,p.m_lengths,p.m_formats,0);
+    if (!ok) {
+	Debug(&module,DebugWarn,"Query '%s' for '%s' failed: %s [%p]",
+	    query.c_str(),c_str(),PQerrorMessage(m_conn),m_account);
+	dest->setParam("error",PQerrorMessage(m_conn));
+	return -1;
+    }
+    return 0;
+}
+
+#ifdef PG_ASYNC
+// Start connecting without blocking the I/O thread
+// The encoding is sent in the startup packet as setting it later waits for a reply
+bool PgConn::connectAsync()
+{
+    dropDb();
+    Debug(&module,DebugAll,"'%s' intializing connection \"%s\" [%p]",
+	c_str(),m_account->m_connection.c_str(),m_account);
+    const char* keys[] = { "dbname", "client_encoding", 0 };
+    const char* values[] = { m_account->m_connection.c_str(), m_account->m_encoding.c_str(), 0 };
+    if (!m_account->m_encoding)
+	keys[1] = 0;
+    // Expand dbname so the connection string or URI is used as given
+    m_conn = PQconnectStartParams(keys,values,1);
+    if (!m_conn) {
+	Debug(&module,DebugCrit,"Could not start connection for '%s' [%p]",c_str(),m_account);
+	return false;
+    }
+    if (CONNECTION_BAD == PQstatus(m_conn)) {
+	Debug(&module,DebugWarn,"Connection for '%s' failed: %s [%p]",
+	    c_str(),PQerrorMessage(m_conn),m_account);
+	dropDb();
+	return false;
+    }
+    PQsetnonblocking(m_conn,1);
+    m_connecting = true;
+    // Wait for the socket to become writable before the first poll
+    m_polling = PGRES_POLLING_WRITING;
+    m_connectTimeout = Time::now() + m_account->m_timeout;
+    return true;
+}
+
+// Advance a connection started by connectAsync() when its socket is ready
+bool PgConn::pollConnect()
+{
+    m_polling = PQconnectPoll(m_conn);
+    switch (m_polling) {
+	case PGRES_POLLING_FAILED:
+	    Debug(&module,DebugWarn,"Connection for '%s' failed: %s [%p]",
+		c_str(),PQerrorMessage(m_conn),m_account);
+	    dropDb();
+	    return false;
+	case PGRES_POLLING_OK:
+	    return connected();
+	default:
+	    return true;
+    }
+}
+
+// Send a query in the pipeline, prepare it first if it carries parameters
+// Each query is followed by a sync point so an error aborts only that query
+bool PgConn::sendAsync(PgQuery* q)
+{
+    const String& query = q->m_query;
+    bool ok = true;
+    if (!q->m_result.getParam(YSTRING("args")))
+	ok = pipeline(q,PQsendQueryParams(m_conn,query,0,0,0,0,0,0));
+    else {
+	PgStmt* st = findStmt(query);
+	if (!st && m_account->m_stmtCache) {
+	    String evicted;
+	    st = addStmt(query,evicted);
+	    if (evicted) {
+		String sql("DEALLOCATE ");
+		sql << evicted;
+		PgQuery* d = new PgQuery(sql,0,PgQuery::Deallocate,evicted);
+		if (!pipeline(d,PQsendQueryParams(m_conn,sql,0,0,0,0,0,0)))
+		    ok = false;
+	    }
+	    if (ok) {
+		PgQuery* p = new PgQuery(query,0,PgQuery::Prepare,st->name());
+		ok = pipeline(p,PQsendPrepare(m_conn,st->name(),query,0,0));
+	    }
+	    if (!ok) {
+		dropStmt(st->name());
+		q->m_result.setParam("error",PQerrorMessage(m_conn));
+		q->m_error = true;
+		m_account->finishQuery(q);
+	    }
+	}
+	if (ok) {
+	    PgParams p(q->m_result);
+	    ok = pipeline(q,st ?
+		PQsendQueryPrepared(m_conn,st->name(),p.m_count,p.m_values,p.m_lengths,p.m_formats,0) :
+		PQsendQueryParams(m_conn,query,p.m_count,0,p.m_values,p.m_lengths,p.m_formats,0));
+	}
+    }
+    if (!ok) {
+	failAsync(PQerrorMessage(m_conn));
+	return false;
+    }
+    int res = PQflush(m_conn);
+    if (res < 0) {
+	Debug(&module,DebugWarn,"Flush for '%s' failed: %s [%p]",
+	    c_str(),PQerrorMessage(m_conn),m_account);
+	failAsync(PQerrorMessage(m_conn));
+	return false;
+    }
+    m_flushing = (res > 0);
+    return true;
+}
+
+// Append a sent query to the pipeline and follow it by a sync point
+// The query is finished with an error if sending failed
+bool PgConn::pipeline(PgQuery* q, int sent)
+{
+    if (!(sent && PQpipelineSync(m_conn))) {
+	Debug(&module,DebugWarn,"Query '%s' for '%s' failed: %s [%p]",
+	    q->m_query.c_str(),c_str(),PQerrorMessage(m_conn),m_account);
+	q->m_result.setParam("error",PQerrorMessage(m_conn));
+	q->m_error = true;
+	m_account->finishQuery(q);
+	return false;
+    }
+    q->m_sent = Time::now();
+    m_queue.append(q);
+    m_queued++;
+    return true;
+}
+
+// Flush pending output and collect available results in pipeline order
+// Results of a query are followed by NULL then by the sync point result
+bool PgConn::processAsync(bool flushing, bool reading)
+{
+    if (flushing && m_flushing) {
+	int res = PQflush(m_conn);
+	if (res < 0) {
+	    failAsync(PQerrorMessage(m_conn));
+	    return false;
+	}
+	m_flushing = (res > 0);
+    }
+    if (!reading)
+	return true;
+    if (!PQconsumeInput(m_conn)) {
+	Debug(&module,DebugWarn,"Connection '%s' failed: %s [%p]",
+	    c_str(),PQerrorMessage(m_conn),m_account);
+	failAsync(PQerrorMessage(m_conn));
+	return false;
+    }
+    while (PgQuery* q = static_cast<PgQuery*>(m_queue.get())) {
+	if (PQisBusy(m_conn))
+	    break;
+	PGresult* res = PQgetResult(m_conn);
+	if (!res) {
+	    if (q->m_ended)
 		break;
-	    case PGRES_COMMAND_OK:
-		if (dest)
-		    affectedRows += String(PQcmdTuples(res)).toInteger();
-		// no data returned
-		break;
-	    case PGRES_COPY_IN:
-	    case PGRES_COPY_OUT:
-		// data transfers - ignore them
-		break;
-	    default:
-		Debug(&module,DebugWarn,"Query '%s' for '%s' error: %s [%p]",
-		    query,c_str(),PQresultErrorMessage(res),m_account);
-		if (dest)
-		    dest->setParam("error",PQresultErrorMessage(res));
-		m_account->incErrorQueriesSafe();
-		module.changed();
+	    q->m_ended = true;
+	    continue;
+	}
+	if (PGRES_PIPELINE_SYNC == PQresultStatus(res)) {
+	    PQclear(res);
+	    m_queue.remove(q,false);
+	    m_queued--;
+	    if (q->m_error && (PgQuery::Prepare == q->m_kind))
+		dropStmt(q->m_stmt);
+	    XDebug(&module,DebugAll,"Query for '%s' returned %d rows, %d affected [%p]",
+		c_str(),q->m_rows,q->m_affected,m_account);
+	    q->m_result.setParam("rows",String(q->m_rows));
+	    q->m_result.setParam("affected",String(q->m_affected));
+	    m_account->finishQuery(q);
+	    continue;
 	}
+	addResult(res,q->m_query,&q->m_result,q->m_rows,q->m_affected,&q->m_error);
 	PQclear(res);
     }
-    Debug(&module,DebugWarn,"Query timed out for '%s' [%p]",c_str(),m_account);
-    if (dest)
-	dest->setParam("error","query timeout");
+    if (PQstatus(m_conn) != CONNECTION_OK) {
+	failAsync("connection lost");
+	return false;
+    }
+    return true;
+}
+
+// Finish all queries in the pipeline with an error and drop the connection
+void PgConn::failAsync(const char* error)
+{
+    if (TelEngine::null(error))
+	error = "failure";
+    while (PgQuery* q = static_cast<PgQuery*>(m_queue.remove(false))) {
+	if (!q->m_result.getParam(YSTRING("error")))
+	    q->m_result.setParam("error",error);
+	q->m_error = true;
+	m_account->finishQuery(q);
+    }
+    m_queued = 0;
     dropDb();
-    return -2;
 }
+#endif
 
 
 //
@@ -418,7 +992,10 @@ PgAccount::PgAccount(const NamedList& sect)
       m_connPool(0), m_connPoolSize(0),
       m_statsMutex(&s_conmutex),
       m_totalQueries(0), m_failedQueries(0),
-      m_errorQueries(0), m_queryTime(0)
+      m_errorQueries(0), m_queryTime(0),
+      m_queued(0), m_latencyPos(0), m_latencyCount(0),
+      m_async(false), m_depth(1), m_exiting(false), m_nextConnect(0),
+      m_thread(0)
 {
     m_connection = sect.getValue("connection");
     if (m_connection.null()) {
@@ -440,6 +1017,16 @@ PgAccount::PgAccount(const NamedList& sect)
     if (m_timeout < 500000)
 	m_timeout = 500000;
     m_retry = sect.getIntValue("retry",5);
+    m_stmtCache = sect.getIntValue("stmt_cache",16,0,1024);
+    m_async = sect.getBoolValue("async");
+    m_depth = sect.getIntValue("pipeline_depth",16,1,1024);
+#ifndef PG_ASYNC
+    if (m_async) {
+	Debug(&module,DebugConf,"Account '%s' asynchronous mode not supported by the client library",
+	    m_name.c_str());
+	m_async = false;
+    }
+#endif
     m_encoding = sect.getValue("encoding");
     m_connPoolSize = sect.getIntValue("poolsize",1,1);
     m_connPool = new PgConn[m_connPoolSize];
@@ -447,8 +1034,8 @@ PgAccount::PgAccount(const NamedList& sect)
 	m_connPool[i].m_account = this;
 	m_connPool[i].assign(m_name + "." + String(i + 1));
     }
-    Debug(&module,DebugInfo,"Database account '%s' created poolsize=%u [%p]",
-	m_name.c_str(),m_connPoolSize,this);
+    Debug(&module,DebugInfo,"Database account '%s' created poolsize=%u async=%s [%p]",
+	m_name.c_str(),m_connPoolSize,String::boolText(m_async),this);
 }
 
 // Init the connections the connection
@@ -457,6 +1044,12 @@ bool PgAccount::initDb()
     bool ok = false;
     for (unsigned int i = 0; i < m_connPoolSize; i++)
 	ok = m_connPool[i].initDb() || ok;
+#ifdef PG_ASYNC
+    if (m_async) {
+	Lock mylock(this);
+	ok = startIo() && ok;
+    }
+#endif
     return ok;
 }
 
@@ -465,6 +1058,9 @@ void PgAccount::destroyed()
     s_conmutex.lock();
     s_accounts.remove(this,false);
     s_conmutex.unlock();
+#ifdef PG_ASYNC
+    stopIo();
+#endif
     dropDb();
     if (m_connPool)
 	delete[] m_connPool;
@@ -492,6 +1088,13 @@ int PgAccount::queryDb(const char* query, Message* dest)
 	return -1;
     Debug(&module,DebugAll,"Performing query \"%s\" for '%s'",
 	query,m_name.c_str());
+#ifdef PG_ASYNC
+    if (m_async)
+	return queryAsync(query,dest);
+#endif
+    Lock stats(m_statsMutex);
+    queryStarted();
+    stats.drop();
     // Use a while() to break to the end to update statistics
     int res = -1;
     u_int64_t start = Time::now();
@@ -544,21 +1147,314 @@ int PgAccount::queryDb(const char* query, Message* dest)
 	}
 	break;
     }
-    Lock stats(m_statsMutex);
+    stats.acquire(m_statsMutex);
+    queryEnded(res,Time::now() - start);
+    stats.drop();
+    module.changed();
+    if (res < 0)
+	failure(dest);
+    return res;
+}
+
+// Account a finished query, keep its duration for latency percentiles
+void PgAccount::queryEnded(int res, u_int64_t duration)
+{
+    if (m_queued)
+	m_queued--;
     m_totalQueries++;
-    if (res > -2) {
-	if (res < 0)
-	    m_failedQueries++;
-	u_int64_t finish = Time::now() - start;
-	m_queryTime += finish;
+    if (res <= -2)
+	return;
+    if (res < 0)
+	m_failedQueries++;
+    m_queryTime += duration;
+    m_latency[m_latencyPos] = (duration < 0xffffffff) ? (u_int32_t)duration : 0xffffffff;
+    m_latencyPos = (m_latencyPos + 1) % PG_LATENCY_SAMPLES;
+    if (m_latencyCount < PG_LATENCY_SAMPLES)
+	m_latencyCount++;
+}
+
+static int latencyCompare(const void* a, const void* b)
+{
+    u_int32_t la = *(const u_int32_t*)a;
+    u_int32_t lb = *(const u_int32_t*)b;
+    return (la < lb) ? -1 : ((la > lb) ? 1 : 0);
+}
+
+static inline unsigned int percentile(const u_int32_t* sorted, unsigned int count,
+    unsigned int percent)
+{
+    unsigned int idx = (count * percent + 99) / 100;
+    return sorted[idx ? idx - 1 : 0];
+}
+
+// Retrieve latency percentiles of recent queries in microseconds
+void PgAccount::latency(unsigned int& p50, unsigned int& p90, unsigned int& p99)
+{
+    p50 = p90 = p99 = 0;
+    if (!m_latencyCount)
+	return;
+    u_int32_t tmp[PG_LATENCY_SAMPLES];
+    ::memcpy(tmp,m_latency,m_latencyCount * sizeof(u_int32_t));
+    ::qsort(tmp,m_latencyCount,sizeof(u_int32_t),latencyCompare);
+    p50 = percentile(tmp,m_latencyCount,50);
+    p90 = percentile(tmp,m_latencyCount,90);
+    p99 = percentile(tmp,m_latencyCount,99);
+}
+
+#ifdef PG_ASYNC
+// Queue the query to the I/O thread and wait for it to complete
+int PgAccount::queryAsync(const char* query, Message* dest)
+{
+    PgQuery* q = new PgQuery(query,dest);
+    Lock mylock(this);
+    if (m_exiting || !startIo()) {
+	mylock.drop();
+	TelEngine::destruct(q);
+	failure(dest);
+	return -1;
     }
+    Lock stats(m_statsMutex);
+    queryStarted();
     stats.drop();
-    module.changed();
+    q->ref();
+    m_pending.append(q);
+    mylock.drop();
+    wakeIo();
+    u_int64_t timeout = Time::now() + m_timeout;
+    bool done = false;
+    while (true) {
+	q->m_done.lock(Thread::idleUsec());
+	Lock lck(this);
+	if (q->m_finished) {
+	    done = true;
+	    break;
+	}
+	if (Time::now() > timeout || Thread::check(false)) {
+	    // The I/O thread will discard the results
+	    q->m_cancelled = true;
+	    break;
+	}
+    }
+    int res = -2;
+    if (done) {
+	res = q->m_error ? -1 : q->m_rows;
+	if (dest) {
+	    dest->copyParams(q->m_result,"rows,columns,affected,error",0,true,false);
+	    if (q->m_result.userData())
+		dest->userData(q->m_result.userData());
+	}
+    }
+    else {
+	Debug(&module,DebugWarn,"Query timed out for '%s' [%p]",m_name.c_str(),this);
+	if (dest)
+	    dest->setParam("error","query timeout");
+    }
+    TelEngine::destruct(q);
     if (res < 0)
 	failure(dest);
     return res;
 }
 
+// Start the I/O thread if not already running, account must be locked
+bool PgAccount::startIo()
+{
+    if (m_thread)
+	return true;
+    if (!m_wakeRead.valid()) {
+	if (!(Socket::createPair(m_wakeRead,m_wakeWrite) &&
+		m_wakeRead.setBlocking(false) && m_wakeWrite.setBlocking(false))) {
+	    Debug(&module,DebugWarn,"Account '%s' failed to create I/O wakeup sockets [%p]",
+		m_name.c_str(),this);
+	    m_wakeRead.terminate();
+	    m_wakeWrite.terminate();
+	    return false;
+	}
+    }
+    m_thread = new PgIoThread(this);
+    if (m_thread->startup())
+	return true;
+    Debug(&module,DebugWarn,"Account '%s' failed to start I/O thread [%p]",
+	m_name.c_str(),this);
+    delete m_thread;
+    return false;
+}
+
+// Stop the I/O thread and wait for it to finish, no more queries are accepted
+void PgAccount::stopIo()
+{
+    lock();
+    m_exiting = true;
+    unlock();
+    wakeIo();
+    while (true) {
+	Lock mylock(this);
+	if (!m_thread)
+	    break;
+	mylock.drop();
+	Thread::idle();
+    }
+}
+
+void PgAccount::wakeIo()
+{
+    if (m_wakeWrite.valid())
+	m_wakeWrite.writeData("",1);
+}
+
+// Multiplex the queries of all connections, wake up periodically
+//  to expire queries and reconnect
+void PgAccount::runIo()
+{
+    Debug(&module,DebugInfo,"Account '%s' I/O thread started [%p]",m_name.c_str(),this);
+    struct pollfd* fds = new struct pollfd[m_connPoolSize + 1];
+    PgConn** conns = new PgConn*[m_connPoolSize + 1];
+    while (!(m_exiting || Thread::check(false))) {
+	dispatch();
+	unsigned int n = 0;
+	fds[n].fd = m_wakeRead.handle();
+	fds[n].events = POLLIN;
+	fds[n].revents = 0;
+	n++;
+	for (unsigned int i = 0; i < m_connPoolSize; i++) {
+	    PgConn* conn = &(m_connPool[i]);
+	    if (conn->m_connecting)
+		fds[n].events = (PGRES_POLLING_WRITING == conn->m_polling) ? POLLOUT : POLLIN;
+	    else if (conn->testDb())
+		fds[n].events = conn->m_flushing ? (POLLIN | POLLOUT) : POLLIN;
+	    else
+		continue;
+	    conns[n] = conn;
+	    fds[n].fd = PQsocket(conn->m_conn);
+	    fds[n].revents = 0;
+	    n++;
+	}
+	if (::poll(fds,n,100) < 0) {
+	    if (errno != EINTR) {
+		Debug(&module,DebugWarn,"Account '%s' poll failed: %d %s [%p]",
+		    m_name.c_str(),errno,::strerror(errno),this);
+		Thread::idle();
+	    }
+	    continue;
+	}
+	if (fds[0].revents) {
+	    char buf[64];
+	    while (m_wakeRead.readData(buf,sizeof(buf)) > 0)
+		;
+	}
+	for (unsigned int i = 1; i < n; i++) {
+	    short ev = fds[i].revents;
+	    if (!ev)
+		continue;
+	    if (!conns[i]->m_connecting)
+		conns[i]->processAsync(0 != (ev & POLLOUT),0 != (ev & (POLLIN | POLLERR | POLLHUP)));
+	    else if (!conns[i]->pollConnect())
+		m_nextConnect = Time::now() + 1000000;
+	}
+	// Drop connections that stopped answering
+	u_int64_t now = Time::now();
+	for (unsigned int i = 0; i < m_connPoolSize; i++) {
+	    if (m_connPool[i].m_connecting && (m_connPool[i].m_connectTimeout < now)) {
+		Debug(&module,DebugWarn,"Connection for '%s' timed out [%p]",
+		    m_connPool[i].c_str(),this);
+		m_connPool[i].dropDb();
+		m_nextConnect = now + 1000000;
+		continue;
+	    }
+	    PgQuery* q = static_cast<PgQuery*>(m_connPool[i].m_queue.get());
+	    if (q && (q->m_sent + m_timeout < now)) {
+		Debug(&module,DebugWarn,"Query timed out for '%s' [%p]",
+		    m_connPool[i].c_str(),this);
+		m_connPool[i].failAsync("query timeout");
+	    }
+	}
+    }
+    for (unsigned int i = 0; i < m_connPoolSize; i++) {
+	if (m_connPool[i].m_queue.get())
+	    m_connPool[i].failAsync("failure");
+    }
+    lock();
+    while (PgQuery* q = static_cast<PgQuery*>(m_pending.remove(false))) {
+	q->m_result.setParam("error","failure");
+	q->m_error = true;
+	finishQuery(q);
+    }
+    unlock();
+    delete[] fds;
+    delete[] conns;
+    Debug(&module,DebugInfo,"Account '%s' I/O thread stopped [%p]",m_name.c_str(),this);
+}
+
+// Send pending queries to the least loaded connections
+// Start a reconnect only if no connected one can take more queries,
+//  runIo() completes it without blocking
+void PgAccount::dispatch()
+{
+    u_int64_t now = Time::now();
+    Lock mylock(this);
+    while (PgQuery* q = static_cast<PgQuery*>(m_pending.get())) {
+	if (q->m_cancelled || (q->m_start + m_timeout < now)) {
+	    m_pending.remove(false);
+	    q->m_result.setParam("error","query timeout");
+	    q->m_error = true;
+	    finishQuery(q);
+	    continue;
+	}
+	PgConn* conn = 0;
+	PgConn* notConnected = 0;
+	bool connecting = false;
+	for (unsigned int i = 0; i < m_connPoolSize; i++) {
+	    PgConn* c = &(m_connPool[i]);
+	    if (c->m_connecting) {
+		connecting = true;
+		continue;
+	    }
+	    if (!c->testDb()) {
+		if (!notConnected)
+		    notConnected = c;
+		continue;
+	    }
+	    if (c->m_queued < m_depth && (!conn || c->m_queued < conn->m_queued))
+		conn = c;
+	}
+	if (!conn) {
+	    // Let a connection in progress complete before starting another one
+	    if (connecting || !notConnected || now < m_nextConnect)
+		break;
+	    mylock.drop();
+	    bool ok = notConnected->connectAsync();
+	    mylock.acquire(this);
+	    if (!ok)
+		m_nextConnect = Time::now() + 1000000;
+	    break;
+	}
+	m_pending.remove(false);
+	mylock.drop();
+	conn->sendAsync(q);
+	mylock.acquire(this);
+    }
+}
+
+// Finish a query, wake up the thread waiting for it
+void PgAccount::finishQuery(PgQuery* q)
+{
+    if (PgQuery::Query != q->m_kind) {
+	TelEngine::destruct(q);
+	return;
+    }
+    Lock stats(m_statsMutex);
+    queryEnded(q->m_error ? -1 : q->m_rows,Time::now() - q->m_start);
+    stats.drop();
+    module.changed();
+    lock();
+    q->m_finished = true;
+    bool cancelled = q->m_cancelled;
+    unlock();
+    if (!cancelled)
+	q->m_done.unlock();
+    TelEngine::destruct(q);
+}
+#endif
+
 bool PgAccount::hasConn()
 {
     for (unsigned int i = 0; i < m_connPoolSize; i++)
@@ -567,6 +1463,17 @@ bool PgAccount::hasConn()
     return false;
 }
 
+#ifdef PG_ASYNC
+//
+// PgIoThread
+//
+PgIoThread::~PgIoThread()
+{
+    Lock mylock(m_account);
+    m_account->m_thread = 0;
+}
+#endif
+
 static PgAccount* findDb(const String& account)
 {
     if (account.null())
@@ -607,7 +1514,7 @@ PgModule::~PgModule()
 void PgModule::statusModule(String& str)
 {
     Module::statusModule(str);
-    str.append("format=Total|Failed|Errors|AvgExecTime",",");
+    str.append("format=Total|Failed|Errors|AvgExecTime|Queued|Latency50|Latency90|Latency99",",");
 }
 
 void PgModule::statusParams(String& str)
@@ -618,6 +1525,14 @@ void PgModule::statusParams(String& str)
     s_conmutex.unlock();
 }
 
+// Append microseconds as miliseconds with 3 decimals
+static void appendMsec(String& str, unsigned int usec)
+{
+    char buf[32];
+    ::snprintf(buf,sizeof(buf),"%u.%03u",usec / 1000,usec % 1000);
+    str << buf;
+}
+
 void PgModule::statusDetail(String& str)
 {
     s_conmutex.lock();
@@ -629,6 +1544,13 @@ void PgModule::statusDetail(String& str)
 	    str << (acc->queryTime() / (acc->total() - acc->failed()) / 1000); //miliseconds
         else
 	    str << "0";
+	// latency percentiles of recent queries in miliseconds
+	unsigned int p50, p90, p99;
+	acc->latency(p50,p90,p99);
+	str << "|" << acc->queued();
+	appendMsec(str << "|",p50);
+	appendMsec(str << "|",p90);
+	appendMsec(str << "|",p99);
     }
     s_conmutex.unlock();
 }
@@ -642,6 +1564,7 @@ void PgModule::initialize()
     Output("Initializing module PostgreSQL");
     Configuration cfg(Engine::configFile("pgsqldb"));
     Engine::install(new PgHandler(cfg.getIntValue("general","priority",100)));
+    installRelay(Halt);
     unsigned int i;
     for (i = 0; i < cfg.sections(); i++) {
 	NamedList* sec = cfg.getSection(i);
@@ -659,6 +1582,26 @@ void PgModule::initialize()
     }
 }
 
+bool PgModule::received(Message& msg, int id)
+{
+#ifdef PG_ASYNC
+    if (id == Halt) {
+	// Stop the I/O threads before the engine cancels them
+	s_conmutex.lock();
+	ObjList accounts;
+	for (ObjList* o = s_accounts.skipNull(); o; o = o->skipNext()) {
+	    PgAccount* acc = static_cast<PgAccount*>(o->get());
+	    if (acc->ref())
+		accounts.append(acc);
+	}
+	s_conmutex.unlock();
+	for (ObjList* o = accounts.skipNull(); o; o = o->skipNext())
+	    static_cast<PgAccount*>(o->get())->stopIo();
+    }
+#endif
+    return Module::received(msg,id);
+}
+
 void PgModule::genUpdate(Message& msg)
 {
     unsigned int index = 0;
@@ -671,6 +1614,12 @@ void PgModule::genUpdate(Message& msg)
 	msg.setParam(String("errorred.") << index,String(acc->errorred()));
 	msg.setParam(String("hasconn.") << index,String::boolText(acc->hasConn()));
 	msg.setParam(String("querytime.") << index,String(acc->queryTime()));
+	msg.setParam(String("queued.") << index,String(acc->queued()));
+	unsigned int p50, p90, p99;
+	acc->latency(p50,p90,p99);
+	msg.setParam(String("latency50.") << index,String(p50));
+	msg.setParam(String("latency90.") << index,String(p90));
+	msg.setParam(String("latency99.") << index,String(p99));
 	index++;
     }
     s_conmutex.unlock();
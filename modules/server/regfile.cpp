@@ -21,6 +21,8 @@
 
 #include <yatengine.h>
 
+#include <string.h>
+
 using namespace TelEngine;
 namespace { // anonymous
 
@@ -35,13 +37,90 @@ private:
     bool m_init;
 };
 
+// A live registration, kept in the registration table by user name
+class RegUser : public NamedList
+{
+    friend class RegStore;
+public:
+    inline RegUser(const char* name)
+	: NamedList(name), m_expires(0), m_heapPos(-1)
+	{ }
+    inline unsigned int expires() const
+	{ return m_expires; }
+private:
+    unsigned int m_expires;
+    int m_heapPos;
+    String m_conn;
+};
+
+// Registrations made over the same connection
+class RegConn : public String
+{
+public:
+    inline RegConn(const String& id)
+	: String(id)
+	{ }
+    ObjList m_users;
+};
+
+// Hashed registration table with an expiry heap and a persistent journal
+// Changes are appended to the journal as they happen, the snapshot file
+//  is rewritten from the table when the journal is compacted or, if the
+//  journal can not be written, periodically as long as anything changed
+class RegStore
+{
+public:
+    RegStore();
+    ~RegStore();
+    void setup(unsigned int hashSize);
+    inline void persistence(unsigned int interval, unsigned int maxJournal)
+	{ m_interval = interval; m_maxJournal = maxJournal; }
+    void load(const String& file);
+    inline RegUser* find(const String& name) const
+	{ return m_users ? static_cast<RegUser*>((*m_users)[name]) : 0; }
+    RegUser* create(const String& name);
+    void update(RegUser* user);
+    bool remove(const String& name);
+    void removeConn(const String& conn);
+    void expire(unsigned int now);
+    void persist(unsigned int now, bool force = false);
+    bool save();
+    inline unsigned int count() const
+	{ return m_count; }
+    inline const HashList* users() const
+	{ return m_users; }
+private:
+    void index(RegUser* user);
+    void unindex(RegUser* user);
+    void connRemove(RegUser* user);
+    void heapSet(unsigned int pos, RegUser* user);
+    void heapInsert(RegUser* user);
+    void heapUp(unsigned int pos);
+    void heapDown(unsigned int pos);
+    void heapRemove(RegUser* user);
+    void journal(const String& line);
+    unsigned int replay(const String& name);
+    HashList* m_users;
+    HashList m_conns;
+    RegUser** m_heap;
+    unsigned int m_heapLen;
+    unsigned int m_heapAlloc;
+    unsigned int m_count;
+    String m_file;
+    File m_journal;
+    unsigned int m_changed;
+    unsigned int m_journaled;
+    unsigned int m_maxJournal;
+    unsigned int m_interval;
+    unsigned int m_nextSave;
+};
+
 Mutex s_mutex(false,"RegFile");
 static Configuration s_cfg(Engine::configFile("regfile"));
-static Configuration s_accounts;
+static RegStore s_store;
 static bool s_create = false;
 static const String s_general = "general";
 static ObjList s_expand;
-static int s_count = 0;
 static ObjList s_skipParams;
 
 INIT_PLUGIN(RegfilePlugin);
@@ -136,13 +215,6 @@ static void clearListParams(NamedList& list, const char* name)
     TelEngine::destruct(l);
 }
 
-bool expired(const NamedList& list, unsigned int time)
-{
-    // If eTime is 0 the registration will never expire
-    unsigned int eTime = list.getIntValue("expires",0);
-    return eTime && eTime < time;
-}
-
 // Copy list parameters
 static inline void regfileCopyParams(NamedList& dest, NamedList& src, const String& params,
     const String& extra)
@@ -152,6 +224,367 @@ static inline void regfileCopyParams(NamedList& dest, NamedList& src, const Stri
     dest.copyParams(src,s);
 }
 
+RegStore::RegStore()
+    : m_users(0), m_conns(251), m_heap(0), m_heapLen(0), m_heapAlloc(0), m_count(0),
+      m_changed(0), m_journaled(0), m_maxJournal(10000), m_interval(300), m_nextSave(0)
+{
+}
+
+RegStore::~RegStore()
+{
+    delete[] m_heap;
+    delete m_users;
+}
+
+void RegStore::setup(unsigned int hashSize)
+{
+    if (!m_users)
+	m_users = new HashList(hashSize);
+}
+
+// Load the snapshot and replay the journal written since it was saved
+void RegStore::load(const String& file)
+{
+    if (file.null() || !m_users)
+	return;
+    m_file = file;
+    Configuration cfg(m_file,false);
+    // take sections from the head, indexing them one by one is quadratic
+    while (NamedList* sect = cfg.getSection(0)) {
+	if (*sect != s_general && !find(*sect)) {
+	    RegUser* user = new RegUser(*sect);
+	    user->copyParams(*sect);
+	    m_users->append(user);
+	    m_count++;
+	    index(user);
+	}
+	cfg.clearSection(*sect);
+    }
+    String name = m_file + ".journal";
+    unsigned int n = replay(name);
+    expire(Time::secNow());
+    if (!m_journal.openPath(name,true,false,true,true))
+	Debug(&__plugin,DebugWarn,"Could not open registration journal '%s'",name.c_str());
+    Debug(&__plugin,DebugInfo,"Loaded %u registrations from '%s', replayed %u changes",
+	m_count,m_file.c_str(),n);
+    if (n) {
+	m_journaled = n;
+	save();
+    }
+}
+
+// Apply the changes recorded in the journal
+unsigned int RegStore::replay(const String& name)
+{
+    File f;
+    if (!f.openPath(name))
+	return 0;
+    int64_t len = f.length();
+    if (len <= 0 || len >= 0x7fffffff)
+	return 0;
+    DataBlock buf(0,(unsigned int)len);
+    if (f.readData(buf.data(),buf.length()) != len)
+	return 0;
+    f.terminate();
+    unsigned int n = 0;
+    const char* start = (const char*)buf.data();
+    const char* end = start + buf.length();
+    // an unterminated last line was interrupted while written, ignore it
+    for (const char* eol = start; (eol = (const char*)::memchr(start,'\n',end - start)); start = eol + 1) {
+	String line(start,eol - start);
+	ObjList* items = line.split(':');
+	const String* op = static_cast<const String*>(items->get());
+	ObjList* o = items->skipNext();
+	if (op && o) {
+	    String user = o->get()->toString().msgUnescape(0,':');
+	    if (*op == YSTRING("+")) {
+		RegUser* u = create(user);
+		u->clearParams();
+		while ((o = o->skipNext())) {
+		    String pname = o->get()->toString().msgUnescape(0,':');
+		    if (!(o = o->skipNext()))
+			break;
+		    u->addParam(pname,o->get()->toString().msgUnescape(0,':'));
+		}
+		index(u);
+		n++;
+	    }
+	    else if (*op == YSTRING("-")) {
+		remove(user);
+		n++;
+	    }
+	}
+	TelEngine::destruct(items);
+    }
+    return n;
+}
+
+RegUser* RegStore::create(const String& name)
+{
+    RegUser* user = find(name);
+    if (!user && m_users) {
+	user = new RegUser(name);
+	m_users->append(user);
+	m_count++;
+    }
+    return user;
+}
+
+// Reindex a created or changed registration and record it in the journal
+void RegStore::update(RegUser* user)
+{
+    index(user);
+    m_changed++;
+    if (!m_journal.valid())
+	return;
+    String line("+:");
+    line << user->msgEscape(':');
+    unsigned int n = user->length();
+    for (unsigned int i = 0; i < n; i++) {
+	const NamedString* ns = user->getParam(i);
+	if (ns)
+	    line << ":" << ns->name().msgEscape(':') << ":" << ns->msgEscape(':');
+    }
+    journal(line);
+}
+
+bool RegStore::remove(const String& name)
+{
+    RegUser* user = find(name);
+    if (!user)
+	return false;
+    unindex(user);
+    m_changed++;
+    if (m_journal.valid())
+	journal("-:" + name.msgEscape(':'));
+    m_users->remove(user,true,true);
+    m_count--;
+    return true;
+}
+
+void RegStore::removeConn(const String& conn)
+{
+    RegConn* c = static_cast<RegConn*>(m_conns[conn]);
+    if (!c)
+	return;
+    // removing the last registration destroys the connection entry
+    ObjList names;
+    for (ObjList* l = c->m_users.skipNull(); l; l = l->skipNext())
+	names.append(new String(l->get()->toString()));
+    for (ObjList* l = names.skipNull(); l; l = l->skipNext()) {
+	const String& name = l->get()->toString();
+	Debug(&__plugin,DebugAll,"Removing user %s, reason connection down",name.c_str());
+	remove(name);
+    }
+}
+
+void RegStore::expire(unsigned int now)
+{
+    // If expires is 0 the registration will never expire and is not in heap
+    while (m_heapLen && m_heap[0]->m_expires < now) {
+	RegUser* user = m_heap[0];
+	Debug(&__plugin,DebugAll,"Removing user %s, Reason: Registration expired",user->c_str());
+	remove(*user);
+    }
+}
+
+// Compact the journal periodically or when it grew too large
+// Without a journal only the periodic snapshot keeps the changes
+void RegStore::persist(unsigned int now, bool force)
+{
+    if (!m_nextSave)
+	m_nextSave = now + m_interval;
+    if (!m_changed)
+	return;
+    if (!force && now < m_nextSave && !(m_maxJournal && m_journaled >= m_maxJournal))
+	return;
+    save();
+    m_nextSave = now + m_interval;
+}
+
+// Write a snapshot of the table and start a new journal
+bool RegStore::save()
+{
+    if (m_file.null() || !m_users)
+	return false;
+    String tmp = m_file + ".tmp";
+    File f;
+    if (!f.openPath(tmp,true,false,true)) {
+	Debug(&__plugin,DebugWarn,"Failed to save registrations to '%s'",tmp.c_str());
+	return false;
+    }
+    bool ok = true;
+    bool separ = false;
+    String buf;
+    for (unsigned int i = 0; ok && i < m_users->length(); i++) {
+	for (ObjList* l = m_users->getList(i); l; l = l->skipNext()) {
+	    const RegUser* user = static_cast<const RegUser*>(l->get());
+	    if (!user)
+		continue;
+	    if (separ)
+		buf << "\n";
+	    separ = true;
+	    buf << "[" << *user << "]\n";
+	    unsigned int n = user->length();
+	    for (unsigned int j = 0; j < n; j++) {
+		const NamedString* ns = user->getParam(j);
+		if (!ns)
+		    continue;
+		// same layout as Configuration::save() so the file loads back
+		buf << ns->name() << "=" << *ns;
+		if (ns->endsWith("\\",false))
+		    buf << " ";
+		buf << "\n";
+	    }
+	    if (buf.length() < 65536)
+		continue;
+	    ok = f.writeData(buf.c_str(),buf.length()) == (int)buf.length();
+	    buf.clear();
+	}
+    }
+    if (ok && buf)
+	ok = f.writeData(buf.c_str(),buf.length()) == (int)buf.length();
+    f.terminate();
+    if (ok)
+	ok = File::rename(tmp,m_file);
+    if (!ok) {
+	File::remove(tmp);
+	Debug(&__plugin,DebugWarn,"Failed to save registrations to '%s'",m_file.c_str());
+	return false;
+    }
+    // the snapshot holds everything, start the journal over
+    String name = m_file + ".journal";
+    m_journal.terminate();
+    if (!m_journal.openPath(name,true,false,true))
+	Debug(&__plugin,DebugWarn,"Could not open registration journal '%s'",name.c_str());
+    DDebug(&__plugin,DebugAll,"Saved %u registrations, compacted %u journal records",
+	m_count,m_journaled);
+    m_changed = 0;
+    m_journaled = 0;
+    return true;
+}
+
+void RegStore::journal(const String& line)
+{
+    String buf = line + "\n";
+    if (m_journal.writeData(buf.c_str(),buf.length()) != (int)buf.length()) {
+	Debug(&__plugin,DebugWarn,"Failed to write registration journal, disabling it");
+	m_journal.terminate();
+	return;
+    }
+    m_journaled++;
+}
+
+// Put a registration in the expiry heap and the connection index
+void RegStore::index(RegUser* user)
+{
+    unsigned int exp = user->getIntValue("expires",0);
+    if (exp != user->m_expires || (exp && user->m_heapPos < 0)) {
+	heapRemove(user);
+	user->m_expires = exp;
+	if (exp)
+	    heapInsert(user);
+    }
+    const String& conn = (*user)["connection_id"];
+    if (conn == user->m_conn)
+	return;
+    connRemove(user);
+    if (conn.null())
+	return;
+    RegConn* c = static_cast<RegConn*>(m_conns[conn]);
+    if (!c) {
+	c = new RegConn(conn);
+	m_conns.append(c);
+    }
+    c->m_users.append(user)->setDelete(false);
+    user->m_conn = conn;
+}
+
+// Take a registration out of the expiry heap and the connection index
+void RegStore::unindex(RegUser* user)
+{
+    heapRemove(user);
+    connRemove(user);
+}
+
+void RegStore::connRemove(RegUser* user)
+{
+    if (user->m_conn.null())
+	return;
+    RegConn* c = static_cast<RegConn*>(m_conns[user->m_conn]);
+    if (c) {
+	c->m_users.remove(user,false);
+	if (!c->m_users.skipNull())
+	    m_conns.remove(c);
+    }
+    user->m_conn.clear();
+}
+
+inline void RegStore::heapSet(unsigned int pos, RegUser* user)
+{
+    m_heap[pos] = user;
+    user->m_heapPos = pos;
+}
+
+void RegStore::heapInsert(RegUser* user)
+{
+    if (m_heapLen >= m_heapAlloc) {
+	m_heapAlloc = m_heapAlloc ? 2 * m_heapAlloc : 1024;
+	RegUser** heap = new RegUser*[m_heapAlloc];
+	for (unsigned int i = 0; i < m_heapLen; i++)
+	    heap[i] = m_heap[i];
+	delete[] m_heap;
+	m_heap = heap;
+    }
+    heapSet(m_heapLen,user);
+    heapUp(m_heapLen++);
+}
+
+void RegStore::heapUp(unsigned int pos)
+{
+    RegUser* user = m_heap[pos];
+    while (pos) {
+	unsigned int parent = (pos - 1) / 2;
+	if (m_heap[parent]->m_expires <= user->m_expires)
+	    break;
+	heapSet(pos,m_heap[parent]);
+	pos = parent;
+    }
+    heapSet(pos,user);
+}
+
+void RegStore::heapDown(unsigned int pos)
+{
+    RegUser* user = m_heap[pos];
+    for (;;) {
+	unsigned int child = 2 * pos + 1;
+	if (child >= m_heapLen)
+	    break;
+	if (child + 1 < m_heapLen && m_heap[child + 1]->m_expires < m_heap[child]->m_expires)
+	    child++;
+	if (user->m_expires <= m_heap[child]->m_expires)
+	    break;
+	heapSet(pos,m_heap[child]);
+	pos = child;
+    }
+    heapSet(pos,user);
+}
+
+void RegStore::heapRemove(RegUser* user)
+{
+    if (user->m_heapPos < 0)
+	return;
+    unsigned int pos = user->m_heapPos;
+    user->m_heapPos = -1;
+    if (pos == --m_heapLen)
+	return;
+    // move the last one in the hole and restore heap order from there
+    RegUser* last = m_heap[m_heapLen];
+    heapSet(pos,last);
+    heapUp(pos);
+    heapDown(last->m_heapPos);
+}
+
 
 bool AuthHandler::received(Message &msg)
 {
@@ -201,7 +634,7 @@ bool RegistHandler::received(Message &msg)
 	    return false;
 	Debug(&__plugin,DebugInfo,"Auto creating new user %s",username.c_str());
     }
-    NamedList* s = s_accounts.createSection(username);
+    RegUser* s = s_store.create(username);
     if (driver)
 	s->setParam("driver",driver);
     s->setParam("data",data);
@@ -216,6 +649,7 @@ bool RegistHandler::received(Message &msg)
     s->copyParams(msg,"connection",'_');
     if (expire)
 	s->setParam("expires",String(msg.msgTime().sec() + expire));
+    s_store.update(s);
 #ifdef DEBUG
     String tmp;
     s->dump(tmp," ");
@@ -235,29 +669,17 @@ bool UnRegistHandler::received(Message &msg)
 	if (username == s_general)
 	    return false;
 	Lock lock(s_mutex);
-	NamedList* nl = s_accounts.getSection(username);
-	if (!nl)
+	if (!s_store.find(username))
 	    return false;
 	Debug(&__plugin,DebugAll,"Removing user %s, reason unregistered",username.c_str());
-	s_accounts.clearSection(username);
+	s_store.remove(username);
 	return true;
     }
     const String& conn = msg["connection_id"];
     if (!conn)
 	return false;
     Lock lock(s_mutex);
-    ObjList remove;
-    unsigned int n = s_accounts.sections();
-    for (unsigned int i = 0; i < n; i++) {
-	NamedList* nl = s_accounts.getSection(i);
-	if (nl && (*nl)["connection_id"] == conn)
-	    remove.append(new String(*nl));
-    }
-    for (ObjList* o = remove.skipNull(); o; o = o->skipNext()) {
-	String* s = static_cast<String*>(o->get());
-	Debug(&__plugin,DebugAll,"Removing user %s, reason connection down",s->c_str());
-	s_accounts.clearSection(*s);
-    }
+    s_store.removeConn(conn);
     return false;
 }
 
@@ -286,7 +708,7 @@ bool RouteHandler::received(Message &msg)
     String username(msg.getValue("called"));
     if (username.null() || username == s_general)
 	return false;
-    NamedList* ac = s_accounts.getSection(username);
+    NamedList* ac = s_store.find(username);
     while (true) {
 	String data;
 	String extra;
@@ -307,7 +729,7 @@ bool RouteHandler::received(Message &msg)
 		String* s = static_cast<String*>(ob->get());
 		if (!s)
 		    continue;
-		NamedList* n = s_accounts.getSection(*s);
+		NamedList* n = s_store.find(*s);
 		if (!n)
 		    continue;
 		targets.append(n)->setDelete(false);
@@ -350,22 +772,10 @@ bool RouteHandler::received(Message &msg)
 
 bool ExpireHandler::received(Message &msg)
 {
-    if ((s_count = (s_count+1) % 30)) // Check for timeouts once at 30 seconds
-	return false;
     unsigned int time = msg.msgTime().sec();
     Lock lock(s_mutex);
-    int count = s_accounts.sections();
-    for (int i = 0;i < count;) {
-	NamedList* sec = s_accounts.getSection(i);
-	if (sec && *sec != s_general && expired(*sec,time)) {
-	    Debug(&__plugin,DebugAll,"Removing user %s, Reason: Registration expired",sec->c_str());
-	    s_accounts.clearSection(*sec);
-	    count--;
-	} else
-	   i++;
-    }
-    if (s_accounts)
-	s_accounts.save();
+    s_store.expire(time);
+    s_store.persist(time);
     return false;
 }
 
@@ -384,26 +794,28 @@ bool StatusHandler::received(Message &msg)
     unsigned int usrCount = 0;
     String tmp;
     bool details = msg.getBoolValue("details",true);
-    unsigned int count = s_accounts.sections();
-    for (unsigned int i = 0; i < count; i ++) {
-	NamedList* ac = s_accounts.getSection(i);
-	if (!ac)
-	    continue;
-	String data = ac->getValue("data");
-	if (data.null())
-	    continue;
-	usrCount++;
-	if (!details)
-	    continue;
-	if (tmp.null())
-	    tmp << ";";
-	else
-	    tmp << ",";
-	for (char* s = const_cast<char*>(data.c_str()); *s; s++) {
-	    if (*s < ' ' || *s == ',')
-		*s = '?';
+    const HashList* users = s_store.users();
+    for (unsigned int i = 0; users && i < users->length(); i++) {
+	for (ObjList* l = users->getList(i); l; l = l->skipNext()) {
+	    const NamedList* ac = static_cast<const NamedList*>(l->get());
+	    if (!ac)
+		continue;
+	    String data = ac->getValue("data");
+	    if (data.null())
+		continue;
+	    usrCount++;
+	    if (!details)
+		continue;
+	    if (tmp.null())
+		tmp << ";";
+	    else
+		tmp << ",";
+	    for (char* s = const_cast<char*>(data.c_str()); *s; s++) {
+		if (*s < ' ' || *s == ',')
+		    *s = '?';
+	    }
+	    tmp << *ac << "=" << data;
 	}
-	tmp << *ac << "=" << data;
     }
     msg.retValue() << ",users=" << usrCount;
     msg.retValue() << tmp << "\r\n";
@@ -432,8 +844,7 @@ RegfilePlugin::RegfilePlugin()
 RegfilePlugin::~RegfilePlugin()
 {
     Output("Unload module Registration from file");
-    if (s_accounts)
-	s_accounts.save();
+    s_store.persist(0,true);
 }
 
 void RegfilePlugin::initialize()
@@ -445,12 +856,10 @@ void RegfilePlugin::initialize()
     if (!m_init) {
 	m_init = true;
 	s_create = s_cfg.getBoolValue("general","autocreate",false);
+	s_store.setup(s_cfg.getIntValue("general","hash_size",1021,17,1024));
 	String conf = s_cfg.getValue("general","file");
 	Engine::self()->runParams().replaceParams(conf);
-	if (conf) {
-	    s_accounts = conf;
-	    s_accounts.load();
-	}
+	s_store.load(conf);
 	s_skipParams.append(new String("alternatives"));
 	s_skipParams.append(new String("password"));
 
@@ -462,6 +871,8 @@ void RegfilePlugin::initialize()
 	Engine::install(new CommandHandler("engine.command"));
 	Engine::install(new ExpireHandler());
     }
+    s_store.persistence(s_cfg.getIntValue("general","save_interval",300,1,86400),
+	s_cfg.getIntValue("general","journal_max",10000,0));
     populate(first);
 }
 
@@ -496,23 +907,26 @@ void RegfilePlugin::populate(bool first)
     }
     if (s_create)
 	return;
-    count = s_accounts.sections();
-    for (int i = 0;i < count;i++) {
-	NamedList* nl = s_accounts.getSection(i);
-	if (!nl)
-	    continue;
-	// Delete saved accounts logged in on reliable connections on first load
-	bool exist = s_cfg.getSection(*nl) != 0;
-	if (exist && !(first && nl->getBoolValue("connection_reliable"))) {
-	    DDebug(this,DebugAll,"Loaded saved account '%s'",nl->c_str());
-	    continue;
+    ObjList remove;
+    const HashList* users = s_store.users();
+    for (unsigned int i = 0; i < users->length(); i++) {
+	for (ObjList* l = users->getList(i); l; l = l->skipNext()) {
+	    const NamedList* nl = static_cast<const NamedList*>(l->get());
+	    if (!nl)
+		continue;
+	    // Delete saved accounts logged in on reliable connections on first load
+	    bool exist = s_cfg.getSection(*nl) != 0;
+	    if (exist && !(first && nl->getBoolValue("connection_reliable"))) {
+		DDebug(this,DebugAll,"Loaded saved account '%s'",nl->c_str());
+		continue;
+	    }
+	    DDebug(this,DebugAll,"Not loading saved account '%s': %s",
+		nl->c_str(),exist ? "logged in on reliable connection" : "account deleted");
+	    remove.append(new String(*nl));
 	}
-	DDebug(this,DebugAll,"Not loading saved account '%s': %s",
-	    nl->c_str(),exist ? "logged in on reliable connection" : "account deleted");
-	s_accounts.clearSection(*nl);
-	count--;
-	i--;
     }
+    for (ObjList* o = remove.skipNull(); o; o = o->skipNext())
+	s_store.remove(o->get()->toString());
 }
 
 }; // anonymous namespace
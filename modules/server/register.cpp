@@ -55,7 +55,8 @@ public:
     AAAHandler(const char* hname, int type, int prio = 50);
     virtual ~AAAHandler();
     void loadAccount();
-    static void prepareQuery(Message& msg, const String& account, const String& query, bool results);
+    static void prepareQuery(Message& msg, const String& account, const String& query, bool results,
+	const NamedList* args = 0);
     virtual const String& name() const;
     virtual bool received(Message& msg);
     virtual bool loadQuery();
@@ -64,10 +65,13 @@ public:
 
 protected:
     void indirectQuery(String& query);
+    // Build the query text, with positional parameters if configured so
+    void buildQuery(const ParamTemplate& tpl, const NamedList& params, String& query, NamedList& args);
     int m_type;
-    String m_query;
+    ParamTemplate m_query;
     String m_result;
-    String m_account;
+    ParamTemplate m_account;
+    bool m_bind;
 };
 
 class CDRHandler : public AAAHandler
@@ -81,10 +85,10 @@ public:
 
 protected:
     String m_name;
-    String m_queryInitialize;
-    String m_queryUpdate;
-    String m_queryStatus;
-    String m_queryCombined;
+    ParamTemplate m_queryInitialize;
+    ParamTemplate m_queryUpdate;
+    ParamTemplate m_queryStatus;
+    ParamTemplate m_queryCombined;
     bool m_critical;
 };
 
@@ -320,7 +324,8 @@ static bool copyParams(Message &msg, Array *a, const String& resultName)
 
 
 AAAHandler::AAAHandler(const char* hname, int type, int prio)
-    : MessageHandler(hname,prio),m_type(type)
+    : MessageHandler(hname,prio),m_type(type),
+      m_query(0,ParamTemplate::EscSql), m_account(0,ParamTemplate::EscSql), m_bind(false)
 {
 }
 
@@ -333,6 +338,7 @@ void AAAHandler::loadAccount()
 {
     m_result = s_cfg.getValue(name(),"result");
     m_account = s_cfg.getValue(name(),"account",s_cfg.getValue("default","account"));
+    m_bind = s_cfg.getBoolValue(name(),"bind_params",s_cfg.getBoolValue("default","bind_params"));
 }
 
 const String& AAAHandler::name() const
@@ -371,14 +377,26 @@ void AAAHandler::indirectQuery(String& query)
     Debug(&module,DebugInfo,"For '%s' fetched query '%s'",name().c_str(),query.c_str());
 }
 
-// add the account and query to the "database" message
-void AAAHandler::prepareQuery(Message& msg, const String& account, const String& query, bool results)
+// add the account, query and its parameters to the "database" message
+void AAAHandler::prepareQuery(Message& msg, const String& account, const String& query, bool results,
+    const NamedList* args)
 {
     Debug(&module,DebugInfo,"On account '%s' performing query '%s'%s",
 	account.c_str(),query.c_str(),(results ? " expects results" : ""));
     msg.setParam("account",account);
     msg.setParam("query",query);
     msg.setParam("results",String::boolText(results));
+    if (args)
+	msg.copyParams(*args);
+}
+
+// quoted parameters are bound to the query instead of being escaped in it
+void AAAHandler::buildQuery(const ParamTemplate& tpl, const NamedList& params, String& query, NamedList& args)
+{
+    if (m_bind)
+	tpl.bind(params,query,args);
+    else
+	tpl.render(params,query);
 }
 
 // run the initialization query
@@ -415,10 +433,11 @@ bool AAAHandler::received(Message& msg)
 {
     if (m_query.null() || m_account.null())
 	return false;
-    String query(m_query);
-    String account(m_account);
-    msg.replaceParams(query,true);
-    msg.replaceParams(account,true);
+    String query;
+    String account;
+    NamedList args("");
+    buildQuery(m_query,msg,query,args);
+    m_account.render(msg,account);
     if (query.null() || account.null())
 	return false;
 
@@ -431,7 +450,7 @@ bool AAAHandler::received(Message& msg)
 	    if (s_critical)
 		return failure(&msg);
 	    Message m("database");
-	    prepareQuery(m,account,query,true);
+	    prepareQuery(m,account,query,true,&args);
 	    if (Engine::dispatch(m))
 		if (m.getIntValue("affected") >= 1 || m.getIntValue("rows") >=1)
 		    return true;
@@ -443,7 +462,7 @@ bool AAAHandler::received(Message& msg)
 	    if (!msg.getBoolValue(YSTRING("auth_register"),true))
 		return false;
 	    Message m("database");
-	    prepareQuery(m,account,query,true);
+	    prepareQuery(m,account,query,true,&args);
 	    if (Engine::dispatch(m))
 		if (m.getIntValue("rows") >=1)
 		{
@@ -465,7 +484,7 @@ bool AAAHandler::received(Message& msg)
 	    if (s_critical)
 		return failure(&msg);
 	    Message m("database");
-	    prepareQuery(m,account,query,true);
+	    prepareQuery(m,account,query,true,&args);
 	    if (Engine::dispatch(m))
 		if (m.getIntValue("rows") >=1)
 		{
@@ -482,7 +501,7 @@ bool AAAHandler::received(Message& msg)
 	    if (s_critical)
 		return failure(&msg);
 	    Message m("database");
-	    prepareQuery(m,account,query,true);
+	    prepareQuery(m,account,query,true,&args);
 	    if (Engine::dispatch(m))
 		if (m.getIntValue("rows") >=1)
 		{
@@ -509,7 +528,7 @@ bool AAAHandler::received(Message& msg)
 		return false;
 	    // no error check needed on unregister - we return false
 	    Message m("database");
-	    prepareQuery(m,account,query,true);
+	    prepareQuery(m,account,query,true,&args);
 	    // we don't enqueue the message because we must assure ourselves that this message is processed synchronously
 	    Engine::dispatch(m);
 	}
@@ -524,7 +543,7 @@ bool AAAHandler::received(Message& msg)
 		return false;
 	    // no error check needed - we enqueue the query and return false
 	    Message* m = new Message("database");
-	    prepareQuery(*m,account,query,false);
+	    prepareQuery(*m,account,query,false,&args);
 	    Engine::enqueue(m);
 	}
 	break;
@@ -533,7 +552,9 @@ bool AAAHandler::received(Message& msg)
 }
 
 CDRHandler::CDRHandler(const char* hname, int prio)
-    : AAAHandler("call.cdr",Cdr,prio), m_name(hname)
+    : AAAHandler("call.cdr",Cdr,prio), m_name(hname),
+      m_queryInitialize(0,ParamTemplate::EscSql), m_queryUpdate(0,ParamTemplate::EscSql),
+      m_queryStatus(0,ParamTemplate::EscSql), m_queryCombined(0,ParamTemplate::EscSql)
 {
     m_critical = s_cfg.getBoolValue(m_name,"critical",(m_name == "call.cdr"));
 }
@@ -573,31 +594,34 @@ bool CDRHandler::received(Message& msg)
     // Don't update CDR if told so
     if (!msg.getBoolValue("cdrwrite",true))
 	return false;
-    String query(msg.getValue("operation"));
-    if (query == YSTRING("initialize"))
-	query = m_queryInitialize;
-    else if (query == YSTRING("update"))
-	query = m_queryUpdate;
-    else if (query == YSTRING("status"))
-	query = m_queryStatus;
-    else if (query == YSTRING("combined"))
-	query = m_queryCombined;
-    else if (query == YSTRING("finalize"))
-	query = m_query;
+    const String& op = msg[YSTRING("operation")];
+    const ParamTemplate* tpl = 0;
+    if (op == YSTRING("initialize"))
+	tpl = &m_queryInitialize;
+    else if (op == YSTRING("update"))
+	tpl = &m_queryUpdate;
+    else if (op == YSTRING("status"))
+	tpl = &m_queryStatus;
+    else if (op == YSTRING("combined"))
+	tpl = &m_queryCombined;
+    else if (op == YSTRING("finalize"))
+	tpl = &m_query;
     else
 	return false;
 
-    if (query.null())
+    if (tpl->null())
 	return false;
-    String account(m_account);
-    msg.replaceParams(query,true);
-    msg.replaceParams(account,true);
+    String query;
+    String account;
+    NamedList args("");
+    buildQuery(*tpl,msg,query,args);
+    m_account.render(msg,account);
     if (query.null() || account.null())
 	return false;
 
     // failure while accounting is critical
     Message m("database");
-    prepareQuery(m,account,query,true);
+    prepareQuery(m,account,query,true,&args);
     bool error = !Engine::dispatch(m) || m.getParam("error");
     if (m_critical && (s_critical != error)) {
 	s_critical = error;
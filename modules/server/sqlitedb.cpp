@@ -71,6 +71,7 @@ private:
     String m_database;
     String m_initialize;
     int m_retry;
+    unsigned int m_stmtCache;
     u_int64_t m_timeout;
     SqlConn* m_connPool;
     unsigned int m_connPoolSize;
@@ -82,6 +83,21 @@ private:
     u_int64_t m_queryTime;
 };
 
+// A prepared statement kept in a connection cache, named by its query text
+class SqlStmt : public String
+{
+public:
+    inline SqlStmt(const String& query, sqlite3_stmt* stmt)
+	: String(query), m_stmt(stmt)
+	{ }
+    virtual ~SqlStmt()
+	{ sqlite3_finalize(m_stmt); }
+    inline sqlite3_stmt* stmt() const
+	{ return m_stmt; }
+private:
+    sqlite3_stmt* m_stmt;
+};
+
 // A database connection
 class SqlConn : public String
 {
@@ -105,9 +121,18 @@ public:
     int queryDb(const char* query, Message* dest);
     virtual void destruct();
 private:
+    // Run a prepared statement with parameters bound from "arg.N" in message
+    int queryBound(const String& query, Message* dest);
+    // Find a cached statement or prepare a new one
+    int getStmt(const String& query, Message* dest, SqlStmt*& st);
+    // Step through a statement, collect results if needed
+    int stepStmt(sqlite3_stmt* stmt, const char* query, Message* dest, bool results, int& rows, int& cols);
+
     SqlAccount* m_account;
     bool m_busy;
     sqlite3* m_conn;
+    ObjList m_stmts;
+    unsigned int m_stmtCount;
 };
 
 class SqlModule : public Module
@@ -143,7 +168,7 @@ public:
 //
 SqlConn::SqlConn(SqlAccount* account)
     : m_account(account), m_busy(false),
-    m_conn(0)
+    m_conn(0), m_stmtCount(0)
 {
 }
 
@@ -174,6 +199,9 @@ void SqlConn::dropDb()
 {
     if (!m_conn)
 	return;
+    // Statements must be finalized before closing the database
+    m_stmts.clear();
+    m_stmtCount = 0;
     sqlite3* tmp = m_conn;
     m_conn = 0;
     XDebug(&module,DebugAll,"Database '%s' dropped [%p]",c_str(),m_account);
@@ -189,6 +217,8 @@ int SqlConn::queryDb(const char* query, Message* dest)
     if (!initDb())
 	// no retry - initDb already tried and failed...
 	return -1;
+    if (dest && dest->getParam(YSTRING("args")))
+	return queryBound(query,dest);
     bool results = dest && dest->getBoolValue("results",true);
     int changed = sqlite3_total_changes(m_conn);
     int rows = 0;
@@ -233,87 +263,12 @@ int SqlConn::queryDb(const char* query, Message* dest)
 		    return -1;
 	    }
 	}
-	int lr = 0;
-	int lc = 0;
-	Array* a = 0;
-	// Execute statement, collect results if needed
-	for (i = 0; i >= 0; ) {
-	    if (i)
-		Thread::idle();
-	    switch (sqlite3_step(stmt)) {
-		case SQLITE_DONE:
-		    if (lr || !rows) {
-			rows = lr;
-			cols = lc;
-			if (results) {
-			    dest->userData(a);
-			    TelEngine::destruct(a);
-			}
-		    }
-		    i = -2;
-		    break;
-		case SQLITE_ROW:
-		    if (!lr++)
-			lc = sqlite3_column_count(stmt);
-		    if (!results)
-			continue;
-		    if (!a) {
-			a = new Array(lc,2);
-			for (int j = 0; j < lc; j++)
-			    a->set(new String(sqlite3_column_name(stmt,j)),j,0);
-		    }
-		    else
-			a->addRow();
-		    for (int j = 0; j < lc; j++) {
-			GenObject* v = 0;
-			switch (sqlite3_column_type(stmt,j)) {
-			    case SQLITE_NULL:
-				break;
-			    case SQLITE_BLOB:
-				{
-				    // Must do this in two steps to guarantee call order
-				    void* data = const_cast<void*>(sqlite3_column_blob(stmt,j));
-				    v = new DataBlock(data,sqlite3_column_bytes(stmt,j));
-				}
-				break;
-			    default:
-				v = new String(reinterpret_cast<const char*>(sqlite3_column_text(stmt,j)));
-			}
-			a->set(v,j,lr);
-		    }
-		    continue;
-		case SQLITE_BUSY:
-		case SQLITE_LOCKED:
-		    if (i++ >= retry) {
-			sqlite3_reset(stmt);
-			sqlite3_finalize(stmt);
-			TelEngine::destruct(a);
-			if (results)
-			    dest->userData(0);
-			return -2;
-		    }
-		    continue;
-		default:
-		    {
-			const char* errStr = sqlite3_errmsg(m_conn);
-			Debug(&module,DebugWarn,"Query '%s' for '%s' execute error: %s [%p]",
-			    query,c_str(),errStr,m_account);
-			if (dest)
-			    dest->setParam("error",errStr);
-		    }
-		    sqlite3_reset(stmt);
-		    sqlite3_finalize(stmt);
-		    TelEngine::destruct(a);
-		    if (results)
-			dest->userData(0);
-		    m_account->incErrorQueriesSafe();
-		    return -1;
-	    }
-	}
-	// Clean up statement and advance to next one
+	i = stepStmt(stmt,query,dest,results,rows,cols);
 	sqlite3_reset(stmt);
 	sqlite3_finalize(stmt);
-	TelEngine::destruct(a);
+	if (i < 0)
+	    return i;
+	// Advance to next statement
 	query = tail;
     }
     changed = sqlite3_total_changes(m_conn) - changed;
@@ -326,6 +281,216 @@ int SqlConn::queryDb(const char* query, Message* dest)
     return rows;
 }
 
+// Run a single cached statement with positional parameters $1 ... $N bound
+//  from message parameters "arg.1" ... "arg.N", missing ones are NULL
+int SqlConn::queryBound(const String& query, Message* dest)
+{
+    bool results = dest->getBoolValue(YSTRING("results"),true);
+    int changed = sqlite3_total_changes(m_conn);
+    SqlStmt* st = 0;
+    int res = getStmt(query,dest,st);
+    if (res < 0) {
+	if (results)
+	    dest->userData(0);
+	return res;
+    }
+    sqlite3_stmt* stmt = st->stmt();
+    int n = sqlite3_bind_parameter_count(stmt);
+    String name("arg.");
+    unsigned int len = name.length();
+    for (int i = 1; i <= n; i++) {
+	// accept $N and ?N parameters, anonymous ? are taken in order
+	const char* pname = sqlite3_bind_parameter_name(stmt,i);
+	int idx = i;
+	if (pname)
+	    idx = ('$' == pname[0] || '?' == pname[0]) ? String(pname + 1).toInteger(0) : 0;
+	name.assign(name,len) << idx;
+	const String* val = dest->getParam(name);
+	if (!val) {
+	    sqlite3_bind_null(stmt,i);
+	    continue;
+	}
+	NamedPointer* np = YOBJECT(NamedPointer,val);
+	const DataBlock* data = np ? YOBJECT(DataBlock,np->userData()) : 0;
+	// values are kept in the message until the statement is reset
+	if (data)
+	    sqlite3_bind_blob(stmt,i,data->data(),data->length(),SQLITE_STATIC);
+	else
+	    sqlite3_bind_text(stmt,i,val->c_str(),val->length(),SQLITE_STATIC);
+    }
+    int rows = 0;
+    int cols = -1;
+    res = stepStmt(stmt,query,dest,results,rows,cols);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    if (!m_account->m_stmtCache) {
+	m_stmts.remove(st);
+	m_stmtCount--;
+    }
+    if (res < 0)
+	return res;
+    changed = sqlite3_total_changes(m_conn) - changed;
+    dest->setParam("rows",String(rows));
+    if (cols >= 0)
+	dest->setParam("columns",String(cols));
+    dest->setParam("affected",String(changed));
+    return rows;
+}
+
+// Find a statement in the cache and move it first or prepare and add a new one
+// Return 0 on success, -1 for non-retryable errors and -2 for busy / timeout
+int SqlConn::getStmt(const String& query, Message* dest, SqlStmt*& st)
+{
+    for (ObjList* o = m_stmts.skipNull(); o; o = o->skipNext()) {
+	st = static_cast<SqlStmt*>(o->get());
+	if (*st != query)
+	    continue;
+	if (o != m_stmts.skipNull()) {
+	    o->remove(false);
+	    m_stmts.insert(st);
+	}
+	return 0;
+    }
+    st = 0;
+    int retry = retries();
+    sqlite3_stmt* stmt = 0;
+    for (int i = 0; ; i++) {
+	if (i)
+	    Thread::idle();
+	stmt = 0;
+	const char* tail = 0;
+	switch (sqlite3_prepare_v2(m_conn,query,-1,&stmt,&tail)) {
+	    case SQLITE_OK:
+		if (!stmt) {
+		    if (dest)
+			dest->setParam("error","empty query");
+		    return -1;
+		}
+		while (tail && (';' == *tail || ' ' == *tail || '\t' == *tail || '\r' == *tail || '\n' == *tail))
+		    tail++;
+		if (!TelEngine::null(tail)) {
+		    Debug(&module,DebugWarn,"Query '%s' for '%s' has more than one statement [%p]",
+			query.c_str(),c_str(),m_account);
+		    if (dest)
+			dest->setParam("error","multiple statements");
+		    sqlite3_finalize(stmt);
+		    return -1;
+		}
+		break;
+	    case SQLITE_BUSY:
+	    case SQLITE_LOCKED:
+		sqlite3_finalize(stmt);
+		if (i >= retry)
+		    return -2;
+		continue;
+	    default:
+		{
+		    const char* errStr = sqlite3_errmsg(m_conn);
+		    Debug(&module,DebugWarn,"Query '%s' for '%s' prepare error: %s [%p]",
+			query.c_str(),c_str(),errStr,m_account);
+		    if (dest)
+			dest->setParam("error",errStr);
+		}
+		sqlite3_finalize(stmt);
+		return -1;
+	}
+	break;
+    }
+    st = new SqlStmt(query,stmt);
+    m_stmts.insert(st);
+    // Drop the least recently used statements
+    for (; m_stmtCount >= m_account->m_stmtCache && m_stmtCount; m_stmtCount--) {
+	ObjList* last = m_stmts.skipNull();
+	for (ObjList* o = last; o; o = o->skipNext())
+	    last = o;
+	last->remove();
+    }
+    m_stmtCount++;
+    return 0;
+}
+
+// Step through a prepared statement, collect results if requested
+// Return 0 on success, -1 for non-retryable errors and -2 for busy / timeout
+int SqlConn::stepStmt(sqlite3_stmt* stmt, const char* query, Message* dest, bool results, int& rows, int& cols)
+{
+    int retry = retries();
+    int lr = 0;
+    int lc = 0;
+    Array* a = 0;
+    // Execute statement, collect results if needed
+    for (int i = 0; i >= 0; ) {
+	if (i)
+	    Thread::idle();
+	switch (sqlite3_step(stmt)) {
+	    case SQLITE_DONE:
+		if (lr || !rows) {
+		    rows = lr;
+		    cols = lc;
+		    if (results) {
+			dest->userData(a);
+			TelEngine::destruct(a);
+		    }
+		}
+		i = -2;
+		break;
+	    case SQLITE_ROW:
+		if (!lr++)
+		    lc = sqlite3_column_count(stmt);
+		if (!results)
+		    continue;
+		if (!a) {
+		    a = new Array(lc,2);
+		    for (int j = 0; j < lc; j++)
+			a->set(new String(sqlite3_column_name(stmt,j)),j,0);
+		}
+		else
+		    a->addRow();
+		for (int j = 0; j < lc; j++) {
+		    GenObject* v = 0;
+		    switch (sqlite3_column_type(stmt,j)) {
+			case SQLITE_NULL:
+			    break;
+			case SQLITE_BLOB:
+			    {
+				// Must do this in two steps to guarantee call order
+				void* data = const_cast<void*>(sqlite3_column_blob(stmt,j));
+				v = new DataBlock(data,sqlite3_column_bytes(stmt,j));
+			    }
+			    break;
+			default:
+			    v = new String(reinterpret_cast<const char*>(sqlite3_column_text(stmt,j)));
+		    }
+		    a->set(v,j,lr);
+		}
+		continue;
+	    case SQLITE_BUSY:
+	    case SQLITE_LOCKED:
+		if (i++ >= retry) {
+		    TelEngine::destruct(a);
+		    if (results)
+			dest->userData(0);
+		    return -2;
+		}
+		continue;
+	    default:
+		{
+		    const char* errStr = sqlite3_errmsg(m_conn);
+		    Debug(&module,DebugWarn,"Query '%s' for '%s' execute error: %s [%p]",
+			query,c_str(),errStr,m_account);
+		    if (dest)
+			dest->setParam("error",errStr);
+		}
+		TelEngine::destruct(a);
+		if (results)
+		    dest->userData(0);
+		m_account->incErrorQueriesSafe();
+		return -1;
+	}
+    }
+    TelEngine::destruct(a);
+    return 0;
+}
+
 void SqlConn::destruct()
 {
     dropDb();
@@ -376,6 +541,7 @@ SqlAccount::SqlAccount(const NamedList& sect)
     if (m_timeout < 100000)
 	m_timeout = 100000;
     m_retry = sect.getIntValue("retry",5,0,100,false);
+    m_stmtCache = sect.getIntValue("stmt_cache",16,0,1024);
     // Can create just one connection to temporary or non shared cache in-memory databases
     bool shared = s_sharedCache && !m_database.null();
     shared = shared && (m_database.find(":memory:") < 0) && (m_database.find("mode=memory") < 0);
@@ -0,0 +1,128 @@
+/**
+ * benchmodule.h
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Common skeleton of the benchmark modules
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef __BENCHMODULE_H
+#define __BENCHMODULE_H
+
+#include <yatephone.h>
+
+using namespace TelEngine;
+namespace { // anonymous
+
+/**
+ * A benchmark module driven by a single rmanager command named as the module.
+ * It handles the load messages, command completion and help, derived classes
+ *  only need to run the benchmark itself.
+ */
+class BenchModule : public Module
+{
+public:
+    /**
+     * Constructor
+     * @param name Name of the module and of its command
+     * @param title Descriptive name used in load and unload messages
+     * @param help Text of the command help, lines ended by CR LF
+     */
+    inline BenchModule(const char* name, const char* title, const char* help)
+	: Module(name,"misc"), m_title(title), m_help(help), m_first(true)
+	{ Output("Loaded module %s",m_title.c_str()); }
+
+    virtual ~BenchModule()
+	{ Output("Unloading module %s",m_title.c_str()); }
+
+    virtual void initialize()
+	{
+	    Output("Initializing module %s",m_title.c_str());
+	    if (m_first) {
+		m_first = false;
+		setup();
+		installRelay(Help);
+	    }
+	}
+
+    virtual bool commandExecute(String& retVal, const String& line)
+	{
+	    String args = line;
+	    if (!args.startSkip(name()))
+		return false;
+	    execute(retVal,args.trimBlanks());
+	    return true;
+	}
+
+    virtual bool commandComplete(Message& msg, const String& partLine, const String& partWord)
+	{
+	    if (partLine.null() || partLine == YSTRING("help"))
+		itemComplete(msg.retValue(),name(),partWord);
+	    else if (partLine == name())
+		complete(msg.retValue(),partWord);
+	    return Module::commandComplete(msg,partLine,partWord);
+	}
+
+protected:
+    /**
+     * Run the benchmark
+     * @param retVal String to append the results to
+     * @param args Arguments of the command, blanks trimmed
+     */
+    virtual void execute(String& retVal, String& args) = 0;
+
+    /**
+     * Complete the first argument of the command
+     * @param ret String to append the completions to
+     * @param partWord Partial argument to complete
+     */
+    virtual void complete(String& ret, const String& partWord)
+	{ }
+
+    virtual bool received(Message& msg, int id)
+	{
+	    if (id == Help) {
+		const String& line = msg[YSTRING("line")];
+		if (line.null()) {
+		    msg.retValue() << m_help;
+		    return false;
+		}
+		if (line != name())
+		    return false;
+		msg.retValue() << m_help;
+		return true;
+	    }
+	    return Module::received(msg,id);
+	}
+
+    /**
+     * Retrieve the command help text
+     * @return Help text of the command
+     */
+    inline const char* help() const
+	{ return m_help; }
+
+private:
+    String m_title;
+    const char* m_help;
+    bool m_first;
+};
+
+}; // anonymous namespace
+
+#endif /* __BENCHMODULE_H */
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
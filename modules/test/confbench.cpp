@@ -0,0 +1,198 @@
+/**
+ * confbench.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Conference mixer benchmark
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "benchmodule.h"
+
+using namespace TelEngine;
+namespace { // anonymous
+
+// Samples in a 20ms frame of 8kHz signed linear
+#define FRAME_SAMPLES 160
+
+// Number of parties that generate speech, all others send low noise
+#define TALKERS 4
+
+// A consumer that counts and discards the mixed audio
+class BenchConsumer : public DataConsumer
+{
+public:
+    inline BenchConsumer()
+	: m_bytes(0)
+	{ }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{ m_bytes += data.length(); return invalidStamp(); }
+    inline u_int64_t bytes() const
+	{ return m_bytes; }
+private:
+    u_int64_t m_bytes;
+};
+
+// One conference participant
+class BenchParty : public CallEndpoint
+{
+public:
+    BenchParty(const String& room, const NamedList& params);
+    inline DataSource* source() const
+	{ return m_source; }
+    inline BenchConsumer* consumer() const
+	{ return m_consumer; }
+    inline bool joined() const
+	{ return 0 != getPeer(); }
+private:
+    RefPointer<DataSource> m_source;
+    RefPointer<BenchConsumer> m_consumer;
+};
+
+static const char s_help[] = "  confbench [rooms] [parties] [frames] [mixspeakers]\r\n"
+    "Measure conference mixing of 20ms frames with each mixer kernel\r\n";
+
+class ConfBench : public BenchModule
+{
+public:
+    inline ConfBench()
+	: BenchModule("confbench","Conference Benchmark",s_help), m_runs(0)
+	{ }
+protected:
+    virtual void execute(String& retVal, String& args);
+private:
+    void run(String& retVal, const char* mixer, unsigned int rooms, unsigned int parties,
+	unsigned int frames, unsigned int speakers);
+    unsigned int m_runs;
+};
+
+INIT_PLUGIN(ConfBench);
+
+
+BenchParty::BenchParty(const String& room, const NamedList& params)
+{
+    DataSource* src = new DataSource;
+    m_source = src;
+    src->deref();
+    BenchConsumer* cons = new BenchConsumer;
+    m_consumer = cons;
+    cons->deref();
+    setSource(m_source);
+    setConsumer(m_consumer);
+    Message m("call.execute");
+    m.copyParams(params);
+    m.addParam("callto","conf/" + room);
+    m.addParam("id",id());
+    m.userData(this);
+    Engine::dispatch(m);
+}
+
+// Build a frame of synthetic voice, a chirp with a slowly varying amplitude
+static void buildFrame(DataBlock& frame, unsigned int party, unsigned int idx)
+{
+    frame.assign(0,FRAME_SAMPLES * sizeof(int16_t));
+    int16_t* p = (int16_t*)frame.data();
+    if (party >= TALKERS) {
+	// low level noise that should stay under the speech detector
+	for (unsigned int i = 0; i < FRAME_SAMPLES; i++)
+	    p[i] = (int16_t)((Random::random() % 64) - 32);
+	return;
+    }
+    int amp = 2000 + 2000 * (int)((idx + party * 7) % 5);
+    unsigned int period = 16 + 4 * party;
+    for (unsigned int i = 0; i < FRAME_SAMPLES; i++) {
+	unsigned int ph = (idx * FRAME_SAMPLES + i) % period;
+	// triangle wave is cheap and has plenty of energy
+	int tri = (ph < period / 2) ? (int)ph : (int)(period - ph);
+	p[i] = (int16_t)(amp * (4 * tri - (int)period) / (int)period);
+    }
+}
+
+
+void ConfBench::run(String& retVal, const char* mixer, unsigned int rooms, unsigned int parties,
+    unsigned int frames, unsigned int speakers)
+{
+    NamedList params("");
+    params.addParam("mixer",mixer);
+    params.addParam("mixspeakers",String(speakers));
+    params.addParam("maxusers",String(parties + 1));
+    params.addParam("smart",String::boolText(true));
+    unsigned int total = rooms * parties;
+    BenchParty** party = new BenchParty*[total];
+    unsigned int joined = 0;
+    m_runs++;
+    for (unsigned int r = 0; r < rooms; r++) {
+	String room;
+	room << "confbench-" << m_runs << "-" << r;
+	for (unsigned int i = 0; i < parties; i++) {
+	    BenchParty* p = new BenchParty(room,params);
+	    party[r * parties + i] = p;
+	    if (p->joined())
+		joined++;
+	}
+    }
+    // prepare a few distinct frames per talker so the envelope moves
+    DataBlock* frame = new DataBlock[TALKERS * 5 + 1];
+    for (unsigned int i = 0; i < TALKERS * 5; i++)
+	buildFrame(frame[i],i / 5,i % 5);
+    buildFrame(frame[TALKERS * 5],TALKERS,0);
+    unsigned long stamp = 0;
+    u_int64_t t = Time::now();
+    for (unsigned int f = 0; f < frames; f++) {
+	for (unsigned int n = 0; n < total; n++) {
+	    unsigned int i = n % parties;
+	    const DataBlock& data = (i < TALKERS) ? frame[i * 5 + (f / 10) % 5] : frame[TALKERS * 5];
+	    party[n]->source()->Forward(data,stamp);
+	}
+	stamp += FRAME_SAMPLES;
+    }
+    u_int64_t usec = Time::now() - t;
+    u_int64_t bytes = 0;
+    for (unsigned int n = 0; n < total; n++) {
+	bytes += party[n]->consumer()->bytes();
+	party[n]->disconnect("finished");
+	TelEngine::destruct(party[n]);
+    }
+    delete[] party;
+    delete[] frame;
+    retVal << mixer << ": " << joined << "/" << total << " parties, " << frames << " frames in "
+	<< (unsigned int)(usec / 1000) << " ms";
+    if (usec) {
+	// audio time processed per second of CPU time, per party
+	u_int64_t audio = (u_int64_t)frames * 20000;
+	retVal << ", " << (unsigned int)(audio * joined / usec) << " parties/core";
+	retVal << " (" << (unsigned int)(audio * 100 / usec) << "% realtime)";
+    }
+    retVal << ", received " << (unsigned int)(bytes / (FRAME_SAMPLES * sizeof(int16_t)))
+	<< " frames\r\n";
+}
+
+void ConfBench::execute(String& retVal, String& args)
+{
+    ObjList* words = args.split(' ',false);
+    unsigned int val[4] = { 10, 20, 500, 0 };
+    unsigned int n = 0;
+    for (ObjList* a = words->skipNull(); a && n < 4; a = a->skipNext(), n++)
+	val[n] = static_cast<String*>(a->get())->toInteger(val[n],0,(n == 3) ? 0 : 1,100000);
+    TelEngine::destruct(words);
+    retVal << "Rooms: " << val[0] << ", parties: " << val[1] << ", mixspeakers: " << val[3] << "\r\n";
+    static const char* mixers[] = { "scalar", "sse2", "avx2", "auto" };
+    for (unsigned int i = 0; i < sizeof(mixers) / sizeof(mixers[0]); i++)
+	run(retVal,mixers[i],val[0],val[1],val[2],val[3]);
+}
+
+}; // anonymous namespace
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
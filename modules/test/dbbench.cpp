@@ -0,0 +1,112 @@
+/**
+ * dbbench.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Database query benchmark
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "benchmodule.h"
+
+using namespace TelEngine;
+namespace { // anonymous
+
+static const char s_help[] = "  dbbench account [queries] [query]\r\n"
+    "Run database queries built from a template with ${id} and ${n} references,\r\n"
+    "as escaped text and with bound parameters, and report queries/s\r\n";
+
+class DbBench : public BenchModule
+{
+public:
+    inline DbBench()
+	: BenchModule("dbbench","Database Benchmark",s_help)
+	{ }
+protected:
+    virtual void execute(String& retVal, String& args);
+private:
+    unsigned int run(const String& account, unsigned int queries, const ParamTemplate& query,
+	bool bind, unsigned int& failed);
+};
+
+INIT_PLUGIN(DbBench);
+
+static const char s_query[] = "SELECT '${id}' AS id,'${n}' AS n";
+
+
+// Build and dispatch database queries, return the elapsed time in usec
+unsigned int DbBench::run(const String& account, unsigned int queries, const ParamTemplate& query,
+    bool bind, unsigned int& failed)
+{
+    failed = 0;
+    u_int64_t t = Time::now();
+    for (unsigned int i = 0; i < queries; i++) {
+	NamedList params("");
+	String id("user");
+	id << (i % 1000);
+	params.addParam("id",id);
+	params.addParam("n",String(i));
+	Message m("database");
+	m.addParam("account",account);
+	String text;
+	if (bind)
+	    query.bind(params,text,m);
+	else
+	    query.render(params,text);
+	m.addParam("query",text);
+	if (!Engine::dispatch(m) || m.getParam(YSTRING("error")))
+	    failed++;
+    }
+    return (unsigned int)(Time::now() - t);
+}
+
+void DbBench::execute(String& retVal, String& args)
+{
+    int pos = args.find(' ');
+    String account = args.substr(0,pos);
+    args = (pos < 0) ? String::empty() : args.substr(pos + 1).trimBlanks();
+    if (account.null()) {
+	retVal << s_help;
+	return;
+    }
+    unsigned int queries = 10000;
+    pos = args.find(' ');
+    String tmp = args.substr(0,pos);
+    if (tmp) {
+	queries = tmp.toInteger(queries,0,1,10000000);
+	args = (pos < 0) ? String::empty() : args.substr(pos + 1).trimBlanks();
+    }
+    ParamTemplate query(args ? args.c_str() : s_query,ParamTemplate::EscSql);
+    unsigned int textFail = 0;
+    unsigned int text = run(account,queries,query,false,textFail);
+    unsigned int boundFail = 0;
+    unsigned int bound = run(account,queries,query,true,boundFail);
+    retVal << "Ran " << queries << " queries on '" << account << "': " << query << "\r\n";
+    retVal << "Text: " << (text / 1000) << " ms";
+    if (text)
+	retVal << " (" << (unsigned int)((u_int64_t)queries * 1000000 / text) << " queries/s)";
+    if (textFail)
+	retVal << ", " << textFail << " failed";
+    retVal << "\r\nBound: " << (bound / 1000) << " ms";
+    if (bound)
+	retVal << " (" << (unsigned int)((u_int64_t)queries * 1000000 / bound) << " queries/s)";
+    if (boundFail)
+	retVal << ", " << boundFail << " failed";
+    retVal << "\r\n";
+}
+
+}; // anonymous namespace
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
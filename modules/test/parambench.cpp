@@ -0,0 +1,154 @@
+/**
+ * parambench.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Message parameter access benchmark
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "benchmodule.h"
+
+using namespace TelEngine;
+namespace { // anonymous
+
+static const char s_help[] = "  parambench [messages] [params] [handlers]\r\n"
+    "Dispatch messages carrying many parameters to handlers that read them,\r\n"
+    "with and without the parameter name index, and report messages/s\r\n";
+
+class ParamBench : public BenchModule
+{
+public:
+    inline ParamBench()
+	: BenchModule("parambench","Parameter Benchmark",s_help)
+	{ }
+protected:
+    virtual void execute(String& retVal, String& args);
+private:
+    unsigned int run(unsigned int msgs, unsigned int params, unsigned int handlers);
+};
+
+// Handler that reads parameters like routing and accounting handlers do
+class ParamReader : public MessageHandler
+{
+public:
+    inline ParamReader(unsigned int priority)
+	: MessageHandler("parambench",priority,"parambench"), m_found(0)
+	{ }
+    virtual bool received(Message& msg);
+    unsigned int m_found;
+};
+
+INIT_PLUGIN(ParamBench);
+
+// Parameters a SIP channel puts in call.route before the extra headers
+static const char* s_sipParams[] = {
+    "id", "module", "status", "address", "billid", "answered", "direction",
+    "caller", "called", "callername", "ip_host", "ip_port", "ip_transport",
+    "connection_id", "connection_reliable", "sip_uri", "sip_from", "sip_to",
+    "sip_callid", "sip_contact", "sip_user-agent", "sip_allow", "sip_supported",
+    "sip_max-forwards", "sip_content-type", "device", "antiloop", "rtp_addr",
+    "media", "formats", "transport", "rtp_port", "rtp_forward", "sdp_raw",
+    "handlers", "callto", "line", "domain", "xsip_type", "xsip_dlgtag",
+    0
+};
+
+// Parameters each handler looks for, some of them are never present
+static const char* s_readParams[] = {
+    "caller", "called", "billid", "callername", "sip_from", "sip_to",
+    "connection_id", "rtp_forward", "formats", "line", "domain", "direction",
+    "osip_X-Custom-5", "osip_X-Custom-25", "osip_P-Asserted-Identity",
+    "osip_Diversion", "route_type", "calledname", "redirect", "pbxoper",
+    0
+};
+
+
+bool ParamReader::received(Message& msg)
+{
+    for (const char** p = s_readParams; *p; p++) {
+	if (msg.getParam(*p))
+	    m_found++;
+    }
+    msg.setParam("parambench_seen",(int)m_found);
+    return false;
+}
+
+
+// Build and dispatch messages, return the elapsed time in usec
+unsigned int ParamBench::run(unsigned int msgs, unsigned int params, unsigned int handlers)
+{
+    ObjList installed;
+    for (unsigned int i = 0; i < handlers; i++) {
+	ParamReader* h = new ParamReader(10 + i);
+	installed.append(h);
+	Engine::install(h);
+    }
+    u_int64_t t = Time::now();
+    for (unsigned int i = 0; i < msgs; i++) {
+	Message* m = new Message("parambench");
+	unsigned int n = 0;
+	for (const char** p = s_sipParams; *p && n < params; p++, n++)
+	    m->addParam(*p,"parambench");
+	for (unsigned int h = 0; n < params; h++, n++) {
+	    String name("osip_X-Custom-");
+	    name << h;
+	    m->addParam(name,"value");
+	}
+	m->setParam("called",String(i));
+	Engine::dispatch(m);
+	TelEngine::destruct(m);
+    }
+    t = Time::now() - t;
+    for (ObjList* o = installed.skipNull(); o; o = o->skipNext())
+	Engine::uninstall(static_cast<ParamReader*>(o->get()));
+    return (unsigned int)t;
+}
+
+void ParamBench::execute(String& retVal, String& args)
+{
+    ObjList* words = args.split(' ',false);
+    unsigned int msgs = 20000;
+    unsigned int params = 100;
+    unsigned int handlers = 10;
+    const String* s = static_cast<const String*>((*words)[0]);
+    if (s)
+	msgs = s->toInteger(msgs,0,1,10000000);
+    s = static_cast<const String*>((*words)[1]);
+    if (s)
+	params = s->toInteger(params,0,1,10000);
+    s = static_cast<const String*>((*words)[2]);
+    if (s)
+	handlers = s->toInteger(handlers,0,1,100);
+    TelEngine::destruct(words);
+    unsigned int threshold = NamedList::indexThreshold();
+    NamedList::indexThreshold(0);
+    unsigned int linear = run(msgs,params,handlers);
+    NamedList::indexThreshold(threshold ? threshold : 16);
+    unsigned int indexed = run(msgs,params,handlers);
+    NamedList::indexThreshold(threshold);
+    retVal << "Dispatched " << msgs << " messages with " << params << " parameters to "
+	<< handlers << " handlers\r\n";
+    retVal << "Linear: " << (linear / 1000) << " ms";
+    if (linear)
+	retVal << " (" << (unsigned int)((u_int64_t)msgs * 1000000 / linear) << " msg/s)";
+    retVal << "\r\nIndexed: " << (indexed / 1000) << " ms";
+    if (indexed)
+	retVal << " (" << (unsigned int)((u_int64_t)msgs * 1000000 / indexed) << " msg/s)";
+    retVal << "\r\n";
+}
+
+}; // anonymous namespace
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
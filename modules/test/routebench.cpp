@@ -0,0 +1,169 @@
+/**
+ * routebench.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Call routing benchmark
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "benchmodule.h"
+
+#include <stdio.h>
+
+using namespace TelEngine;
+namespace { // anonymous
+
+static const char s_help[] = "  routebench generate [rules]\r\n"
+    "Write a routebench.conf with a [routebench] context of synthetic rules\r\n"
+    "and reload regexroute, regexroute.conf must contain [$include routebench.conf]\r\n"
+    "  routebench [calls] [context]\r\n"
+    "Measure call.route for calls spread over the generated rules\r\n";
+
+class RouteBench : public BenchModule
+{
+public:
+    inline RouteBench()
+	: BenchModule("routebench","Route Benchmark",s_help), m_rules(5000)
+	{ }
+protected:
+    virtual void execute(String& retVal, String& args);
+    virtual void complete(String& ret, const String& partWord)
+	{ itemComplete(ret,"generate",partWord); }
+private:
+    void generate(String& retVal, unsigned int rules);
+    void run(String& retVal, unsigned int calls, const String& context);
+    unsigned int m_rules;
+};
+
+INIT_PLUGIN(RouteBench);
+
+// Build the called number that matches the rule with given index
+static String number(unsigned int idx)
+{
+    char buf[16];
+    ::snprintf(buf,sizeof(buf),"4%05u",idx);
+    return buf;
+}
+
+
+// Generate a context that looks like a large carrier routing table
+void RouteBench::generate(String& retVal, unsigned int rules)
+{
+    Configuration cfg(Engine::configFile("routebench"));
+    NamedList* sect = cfg.createSection("routebench");
+    sect->clearParams();
+    for (unsigned int i = 0; i < rules; i++) {
+	String rule;
+	String val;
+	switch (i % 10) {
+	    case 0:
+		// match on another parameter, then on the called number
+		rule << "${caller}^0";
+		val << "if ^" << number(i) << "\\(.*\\)$=sip/sip:\\1@10.0." << (i / 250) << "." << (i % 250);
+		break;
+	    case 5:
+		// conditional block with a parameter assignment
+		rule << "^" << number(i) << "\\(.*\\)$";
+		sect->addParam(rule,"{");
+		val << ";route_block=" << i;
+		sect->addParam("^.*$",val);
+		val.clear();
+		val << "sip/sip:${called}@10.1." << (i / 250) << "." << (i % 250);
+		sect->addParam("^.*$",val);
+		rule = "}";
+		val.clear();
+		break;
+	    case 7:
+		// alternative clause, the primary rule never matches the called number
+		rule << "^9" << number(i);
+		val << "or ^" << number(i) << "\\(.*\\)$=sip/sip:\\1@10.2." << (i / 250) << "." << (i % 250)
+		    << ";route_rule=" << i;
+		break;
+	    default:
+		rule << "^" << number(i) << "\\(.*\\)$";
+		val << "sip/sip:\\1@10.0." << (i / 250) << "." << (i % 250)
+		    << ";maxcall=30;route_rule=" << i;
+	}
+	sect->addParam(rule,val);
+    }
+    sect->addParam(".*","-;error=noroute");
+    if (!cfg.save()) {
+	retVal << "Could not write " << cfg << "\r\n";
+	return;
+    }
+    m_rules = rules;
+    retVal << "Wrote " << sect->count() << " lines to " << cfg << "\r\n";
+    u_int64_t t = Time::now();
+    Engine::init("regexroute");
+    retVal << "Reloaded regexroute in " << (unsigned int)((Time::now() - t) / 1000) << " ms\r\n";
+}
+
+void RouteBench::run(String& retVal, unsigned int calls, const String& context)
+{
+    unsigned int routed = 0;
+    unsigned int wrong = 0;
+    // the generated rules that set route_rule must be the ones that matched
+    bool check = (context == YSTRING("routebench"));
+    u_int64_t worst = 0;
+    u_int64_t t = Time::now();
+    for (unsigned int i = 0; i < calls; i++) {
+	// about 10% of the numbers are past the last rule and fall to the default
+	unsigned int idx = Random::random() % (m_rules + m_rules / 10 + 1);
+	Message m("call.route");
+	m.addParam("caller","0123");
+	m.addParam("called",number(idx) + "789");
+	m.addParam("context",context);
+	u_int64_t c = Time::now();
+	if (Engine::dispatch(m) && m.retValue() && (m.retValue() != YSTRING("-")))
+	    routed++;
+	c = Time::now() - c;
+	if (check && (idx < m_rules) && (idx % 5) && (m[YSTRING("route_rule")].toInteger(-1) != (int)idx))
+	    wrong++;
+	if (worst < c)
+	    worst = c;
+    }
+    u_int64_t usec = Time::now() - t;
+    retVal << "Routed " << routed << "/" << calls << " calls over " << m_rules
+	<< " rules in " << (unsigned int)(usec / 1000) << " ms";
+    if (usec && calls)
+	retVal << " (" << (unsigned int)((u_int64_t)calls * 1000000 / usec) << " calls/s, "
+	    << (unsigned int)(usec / calls) << " usec average, "
+	    << (unsigned int)worst << " usec worst)";
+    if (wrong)
+	retVal << ", " << wrong << " routed by the wrong rule";
+    retVal << "\r\n";
+}
+
+void RouteBench::execute(String& retVal, String& args)
+{
+    if (args.startSkip("generate")) {
+	generate(retVal,args.trimBlanks().toInteger(5000,0,1,100000));
+	return;
+    }
+    String context;
+    int sp = args.find(' ');
+    if (sp > 0) {
+	context = args.substr(sp + 1).trimBlanks();
+	args = args.substr(0,sp);
+    }
+    if (context.null())
+	context = "routebench";
+    run(retVal,args.toInteger(10000,0,1,10000000),context);
+}
+
+}; // anonymous namespace
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -0,0 +1,154 @@
+/**
+ * scriptbench.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Javascript evaluator benchmark
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "benchmodule.h"
+#include <yatescript.h>
+
+using namespace TelEngine;
+namespace { // anonymous
+
+static const char s_help[] = "  scriptbench [optimize] [calls] [loops] [file]\r\n"
+    "Call the route(called,caller,loops) function of a routing style script,\r\n"
+    "the built in one or the one in given file, and report operations/s\r\n";
+
+class ScriptBench : public BenchModule
+{
+public:
+    inline ScriptBench()
+	: BenchModule("scriptbench","Script Benchmark",s_help)
+	{ }
+protected:
+    virtual void execute(String& retVal, String& args);
+private:
+    void run(String& retVal, unsigned int calls, unsigned int loops, const String& file, bool optimize);
+};
+
+INIT_PLUGIN(ScriptBench);
+
+// A routing function that does what most routing scripts do with their
+//  numbers: integer arithmetic, comparisons, logical operators and some
+//  string work on the called and caller numbers
+static const char s_script[] =
+    "function route(called, caller, loops)\n"
+    "{\n"
+    "    var score = 0;\n"
+    "    var prefix = called.substr(0,3);\n"
+    "    var len = called.length;\n"
+    "    for (var i = 0; i < loops; i++) {\n"
+    "\tvar digit = (len + i) % 10;\n"
+    "\tif (digit == 0 || digit == 5)\n"
+    "\t    score += digit * 3;\n"
+    "\telse if (digit > 7 && i < 100)\n"
+    "\t    score -= 1;\n"
+    "\tvar prio = (i & 7) << 2;\n"
+    "\tif (prio >= 16 && score > 100)\n"
+    "\t    score = score - prio / 4;\n"
+    "\tif (!(i % 50) && prefix == \"400\")\n"
+    "\t    score += 2;\n"
+    "    }\n"
+    "    if (caller != \"\")\n"
+    "\tscore++;\n"
+    "    return \"sip/sip:\" + called + \"@10.0.0.\" + (score % 250);\n"
+    "}\n";
+
+
+void ScriptBench::run(String& retVal, unsigned int calls, unsigned int loops, const String& file, bool optimize)
+{
+    JsParser parser;
+    parser.optimize(optimize);
+    bool ok = false;
+    if (file) {
+	File f;
+	int64_t len = f.openPath(file) ? f.length() : -1;
+	if (len > 0 && len < 1048576) {
+	    DataBlock buf(0,(unsigned int)len);
+	    if (f.readData(buf.data(),buf.length()) == (int)len)
+		ok = parser.parse((const char*)buf.data(),false,file,(int)len);
+	}
+    }
+    else
+	ok = parser.parse(s_script);
+    if (!ok) {
+	retVal << "Could not parse " << (file ? file.c_str() : "built in script") << "\r\n";
+	return;
+    }
+    ScriptRun* runner = parser.createRunner(0,"scriptbench");
+    if (!runner || runner->run() != ScriptRun::Succeeded || !runner->callable("route")) {
+	TelEngine::destruct(runner);
+	retVal << "Script has no route(called,caller,loops) function\r\n";
+	return;
+    }
+    String result;
+    unsigned int failed = 0;
+    u_int64_t t = Time::now();
+    for (unsigned int i = 0; i < calls; i++) {
+	ObjList args;
+	String called;
+	called << "40" << (1000000 + i % 100000);
+	args.append(new ExpOperation(called,"called"));
+	args.append(new ExpOperation("0123","caller"));
+	args.append(new ExpOperation((int64_t)loops,"loops"));
+	if (runner->call("route",args) != ScriptRun::Succeeded) {
+	    failed++;
+	    continue;
+	}
+	ExpOperation* op = ExpEvaluator::popOne(runner->stack());
+	if (op)
+	    result = *op;
+	TelEngine::destruct(op);
+    }
+    u_int64_t usec = Time::now() - t;
+    TelEngine::destruct(runner);
+    retVal << "Ran " << calls << " calls of " << loops << " loops in "
+	<< (unsigned int)(usec / 1000) << " ms";
+    if (optimize)
+	retVal << " optimized";
+    if (usec)
+	retVal << " (" << (unsigned int)((u_int64_t)calls * 1000000 / usec) << " calls/s, "
+	    << (unsigned int)((u_int64_t)calls * loops * 1000000 / usec) << " loops/s)";
+    if (failed)
+	retVal << ", " << failed << " failed";
+    retVal << "\r\nLast result: " << result << "\r\n";
+}
+
+void ScriptBench::execute(String& retVal, String& args)
+{
+    bool optimize = args.startSkip("optimize");
+    ObjList* words = args.split(' ',false);
+    unsigned int calls = 10000;
+    unsigned int loops = 100;
+    String file;
+    const String* s = static_cast<const String*>((*words)[0]);
+    if (s)
+	calls = s->toInteger(calls,0,1,10000000);
+    s = static_cast<const String*>((*words)[1]);
+    if (s)
+	loops = s->toInteger(loops,0,0,1000000);
+    s = static_cast<const String*>((*words)[2]);
+    if (s)
+	file = *s;
+    TelEngine::destruct(words);
+    run(retVal,calls,loops,file,optimize);
+}
+
+}; // anonymous namespace
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
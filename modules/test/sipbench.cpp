@@ -0,0 +1,200 @@
+/**
+ * sipbench.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * SIP transaction matching benchmark
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "benchmodule.h"
+#include <yatesip.h>
+
+using namespace TelEngine;
+namespace { // anonymous
+
+// A party that silently discards everything sent to it
+class BenchParty : public SIPParty
+{
+public:
+    inline BenchParty()
+	{ setAddr("127.0.0.1",5060,true); setAddr("127.0.0.2",5060,false); }
+    virtual bool transmit(SIPEvent* event)
+	{ return true; }
+    virtual const char* getProtoName() const
+	{ return "UDP"; }
+    virtual bool setParty(const URI& uri)
+	{ return true; }
+    virtual void* getTransport()
+	{ return 0; }
+};
+
+class BenchEngine : public SIPEngine
+{
+public:
+    inline BenchEngine()
+	: SIPEngine("YATE/sipbench")
+	{ debugName("sipbench"); addAllowed("INVITE"); addAllowed("BYE"); }
+    virtual bool buildParty(SIPMessage* message);
+    virtual void allocTraceId(String& id)
+	{ }
+    virtual void traceMsg(SIPMessage* message, bool incoming = true)
+	{ }
+};
+
+static const char s_help[] = "  sipbench [count]\r\n"
+    "Measure SIP transaction matching with count parallel dialogs\r\n";
+
+class SipBench : public BenchModule
+{
+public:
+    inline SipBench()
+	: BenchModule("sipbench","SIP Benchmark",s_help)
+	{ }
+protected:
+    virtual void execute(String& retVal, String& args);
+private:
+    void run(String& retVal, unsigned int count);
+};
+
+INIT_PLUGIN(SipBench);
+
+
+bool BenchEngine::buildParty(SIPMessage* message)
+{
+    if (message->getParty())
+	return true;
+    BenchParty* p = new BenchParty;
+    message->setParty(p);
+    p->deref();
+    return true;
+}
+
+// Build a request as received from the network
+static SIPMessage* buildRequest(SIPParty* ep, const char* method, unsigned int idx,
+    const String& branch, int cseq, const String& toTag)
+{
+    String buf;
+    buf << method << " sip:bench@127.0.0.1 SIP/2.0\r\n";
+    buf << "Via: SIP/2.0/UDP 127.0.0.2:5060;branch=z9hG4bK" << branch << "\r\n";
+    buf << "From: <sip:caller" << idx << "@127.0.0.2>;tag=from" << idx << "\r\n";
+    buf << "To: <sip:bench@127.0.0.1>";
+    if (toTag)
+	buf << ";tag=" << toTag;
+    buf << "\r\n";
+    buf << "Call-ID: bench-" << idx << "@127.0.0.2\r\n";
+    buf << "CSeq: " << cseq << " " << method << "\r\n";
+    buf << "Contact: <sip:caller" << idx << "@127.0.0.2:5060>\r\n";
+    buf << "Max-Forwards: 70\r\n";
+    buf << "Content-Length: 0\r\n\r\n";
+    return SIPMessage::fromParsing(ep,buf.c_str(),buf.length());
+}
+
+// Feed a set of prepared messages to the engine, return the number matched or created
+static unsigned int feed(SIPEngine& engine, ObjList& msgs, u_int64_t& usec)
+{
+    unsigned int n = 0;
+    u_int64_t t = Time::now();
+    for (ObjList* l = msgs.skipNull(); l; l = l->skipNext()) {
+	if (engine.addMessage(static_cast<SIPMessage*>(l->get())))
+	    n++;
+    }
+    usec = Time::now() - t;
+    return n;
+}
+
+// Retrieve and discard all available events, return their number
+static unsigned int drain(SIPEngine& engine, u_int64_t& usec)
+{
+    unsigned int n = 0;
+    u_int64_t t = Time::now();
+    while (SIPEvent* e = engine.getEvent()) {
+	delete e;
+	n++;
+    }
+    usec = Time::now() - t;
+    return n;
+}
+
+static void report(String& retVal, const char* phase, unsigned int total, unsigned int n,
+    u_int64_t usec)
+{
+    retVal << phase << ": " << n << "/" << total << " in " << (unsigned int)(usec / 1000) << " ms";
+    if (usec)
+	retVal << " (" << (unsigned int)((u_int64_t)n * 1000000 / usec) << " pkt/s)";
+    retVal << "\r\n";
+}
+
+
+void SipBench::run(String& retVal, unsigned int count)
+{
+    BenchEngine engine;
+    BenchParty* ep = new BenchParty;
+    ObjList invites, acks, byes;
+    ObjList* ai = &invites;
+    ObjList* ab = &byes;
+    for (unsigned int i = 0; i < count; i++) {
+	String br;
+	br << "inv" << i;
+	ai = ai->append(buildRequest(ep,"INVITE",i,br,1,String::empty()));
+	br.clear();
+	br << "bye" << i;
+	ab = ab->append(buildRequest(ep,"BYE",i,br,2,String::empty()));
+    }
+    u_int64_t usec = 0;
+    unsigned int n = feed(engine,invites,usec);
+    report(retVal,"INVITE",count,n,usec);
+    n = drain(engine,usec);
+    report(retVal,"INVITE events",n,n,usec);
+    // answer all calls so 2xx ACKs can be matched
+    ObjList* aa = &acks;
+    unsigned int i = 0;
+    for (ObjList* l = invites.skipNull(); l; l = l->skipNext(), i++) {
+	SIPTransaction* t = engine.addMessage(static_cast<SIPMessage*>(l->get()));
+	if (!t)
+	    continue;
+	t->setResponse(200);
+	String br;
+	br << "ack" << i;
+	aa = aa->append(buildRequest(ep,"ACK",i,br,1,t->getDialogTag()));
+    }
+    n = drain(engine,usec);
+    report(retVal,"Answer events",n,n,usec);
+    n = feed(engine,invites,usec);
+    report(retVal,"INVITE retransmission",count,n,usec);
+    n = feed(engine,acks,usec);
+    report(retVal,"ACK",count,n,usec);
+    n = feed(engine,byes,usec);
+    report(retVal,"BYE",count,n,usec);
+    n = drain(engine,usec);
+    report(retVal,"ACK and BYE events",n,n,usec);
+    // all transactions are now waiting for timers
+    u_int64_t t = Time::now();
+    for (i = 0; i < count; i++)
+	engine.getEvent();
+    report(retVal,"Idle polls",count,count,Time::now() - t);
+    retVal << "Transactions: " << engine.transactionCount() << "\r\n";
+    engine.clearTransactions();
+    TelEngine::destruct(ep);
+}
+
+void SipBench::execute(String& retVal, String& args)
+{
+    run(retVal,args.toInteger(10000,0,1,1000000));
+}
+
+}; // anonymous namespace
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -111,6 +111,7 @@ static int s_udptlTimeout = 0;
 
 static int s_minJitter = 0;
 static int s_maxJitter = 0;
+static bool s_adaptiveJitter = false;
 
 class YRTPSource;
 class YRTPConsumer;
@@ -461,6 +462,8 @@ YRTPWrapper::~YRTPWrapper()
 	    Message* m = new Message("module.update");
 	    m->addParam("module",splugin.name());
 	    m_rtp->getStats(*m);
+	    if (m_rtp->group())
+		m_rtp->group()->getStats(*m);
 	    m->setParam("noaudio",String(m_noAudio));
 	    m->setParam("lostaudio",String(m_lostAudio));
 	    Engine::enqueue(m);
@@ -783,7 +786,8 @@ bool YRTPWrapper::startRTP(const char* raddr, unsigned int rport, Message& msg)
 	int minJitter = msg.getIntValue(YSTRING("minjitter"),s_minJitter);
 	int maxJitter = msg.getIntValue(YSTRING("maxjitter"),s_maxJitter);
 	if (minJitter >= 0 && maxJitter > 0)
-	    m_rtp->setDejitter(minJitter*1000,maxJitter*1000);
+	    m_rtp->setDejitter(minJitter*1000,maxJitter*1000,
+		msg.getBoolValue(YSTRING("adaptivejitter"),s_adaptiveJitter));
     }
     m_bufsize = s_bufsize;
     return true;
@@ -1628,6 +1632,14 @@ void YRTPPlugin::statusParams(String& str)
     s_mutex.lock();
     str.append("chans=",",") << s_calls.count();
     s_mutex.unlock();
+    NamedList stats("");
+    RTPGroup::getTotals(stats);
+    str << ",iomode=" << (RTPGroup::eventDrivenDefault() ? "events" : "polled");
+    str << ",groups=" << stats[YSTRING("iogroups")];
+    str << ",packets=" << stats[YSTRING("iopackets")];
+    str << ",syscalls=" << stats[YSTRING("iosyscalls")];
+    str << ",wakeups=" << stats[YSTRING("iowakeups")];
+    str << ",ticks=" << stats[YSTRING("ioticks")];
     s_refMutex.lock();
     str.append("mirrors=",",") << s_mirrors.count();
     s_refMutex.unlock();
@@ -1907,6 +1919,7 @@ void YRTPPlugin::initialize()
     s_bufsize = cfg.getIntValue("general","buffer",BUF_SIZE);
     s_minJitter = cfg.getIntValue("general","minjitter",50);
     s_maxJitter = cfg.getIntValue("general","maxjitter",Engine::clientMode() ? 120 : 0);
+    s_adaptiveJitter = cfg.getBoolValue("general","adaptivejitter",false);
     s_tos = cfg.getIntValue("general","tos",Socket::tosValues());
     s_udpbuf = cfg.getIntValue("general","udpbuf",0);
     s_localip = cfg.getValue("general","localip");
@@ -1919,6 +1932,8 @@ void YRTPPlugin::initialize()
     s_monitor = cfg.getBoolValue("general","monitoring",false);
     s_sleep = cfg.getIntValue("general","defsleep",5);
     RTPGroup::setMinSleep(cfg.getIntValue("general","minsleep"));
+    if (!RTPGroup::setEventDriven(cfg.getBoolValue("general","eventdriven",false)))
+	Debug(this,DebugNote,"Event driven RTP is not supported, using polled mode");
     s_priority = Thread::priority(cfg.getValue("general","thread"));
     s_affinity = cfg.getValue("general","affinity");
     s_rtpWarnSeq = cfg.getBoolValue("general","rtp_warn_seq",true);
@@ -42,6 +42,7 @@ class YateTCPParty;                      // A SIP TCP/TLS party
 class YateSIPEngine;                     // The SIP engine
 class YateSIPLine;                       // A line
 class YateSIPEndPoint;                   // Endpoint processor
+class YateSIPEngineWorker;               // Processor of one engine shard
 class SIPDriver;
 
 #define EXPIRES_MIN 60
@@ -547,6 +548,7 @@ protected:
     bool m_forceBind;
     bool m_errored;
     int m_bufferReq;
+    unsigned int m_floodReads;
 };
 
 // TCP/TLS transport
@@ -753,7 +755,7 @@ class SipHandler;
 class YateSIPEngine : public SIPEngine
 {
 public:
-    YateSIPEngine(YateSIPEndPoint* ep);
+    YateSIPEngine(YateSIPEndPoint* ep, unsigned int shards = 1);
     // Initialize the engine
     void initialize(NamedList* params);
     virtual bool buildParty(SIPMessage* message);
@@ -769,11 +771,6 @@ public:
     bool hasActiveTransaction(YateSIPTransport* trans);
     // Check if the engine has pending transactions
     bool hasInitialTransaction();
-    // Clear transactions
-    inline void clearTransactions() {
-	    Lock lck(this);
-	    m_transList.clear();
-	}
     inline bool update() const
 	{ return m_update; }
     inline bool prack() const
@@ -880,10 +877,14 @@ class YateSIPEndPoint : public Thread
     friend class YateSIPTCPListener;
 public:
     YateSIPEndPoint(Thread::Priority prio = Thread::Normal,
-	unsigned int partyMutexCount = 5);
+	unsigned int partyMutexCount = 5, unsigned int shards = 1);
     ~YateSIPEndPoint();
     bool Init(void);
     void run(void);
+    // Retrieve and handle engine events of a shard until cancelled
+    void processEvents(unsigned int shard);
+    // Remove a terminated shard worker from list
+    void workerTerminated(YateSIPEngineWorker* worker);
     bool incoming(SIPEvent* e, SIPTransaction* t);
     void invite(SIPEvent* e, SIPTransaction* t);
     void regReq(SIPEvent* e, SIPTransaction* t);
@@ -939,38 +940,57 @@ public:
 	{ return m_engine; }
     inline void incFailedAuths()
 	{ m_failedAuths++; }
+    // Retrieve and reset the counters, they are updated by all shard threads
     inline unsigned int failedAuths()
-    {
-	unsigned int tmp = m_failedAuths;
-	m_failedAuths = 0;
-	return tmp;
-    }
+	{ return resetCounter(m_failedAuths); }
     inline unsigned int timedOutTrs()
-    {
-	unsigned int tmp = m_timedOutTrs;
-	m_timedOutTrs = 0;
-	return tmp;
-    }
+	{ return resetCounter(m_timedOutTrs); }
     inline unsigned int timedOutByes()
-    {
-	unsigned int tmp = m_timedOutByes;
-	m_timedOutByes = 0;
-	return tmp;
-    }
+	{ return resetCounter(m_timedOutByes); }
     RWLockPool m_partyMutexPool;         // SIPParty mutex pool
     // Check if data is allowed to be read from socket(s) and processed
     static bool canRead();
-    static int s_evCount;
+    // Check if any shard is flooded with events
+    static inline bool flooded()
+	{ return s_flooded.valueAtomic() > 0; }
+    static AtomicInt s_flooded;          // Number of shards flooded with events
 private:
+    static inline unsigned int resetCounter(AtomicUInt& counter)
+    {
+	// keep the increments done since reading the value
+	unsigned int tmp = counter.valueAtomic();
+	counter.sub(tmp);
+	return tmp;
+    }
+    // Start processing threads for all shards except the first one
+    void startWorkers();
+    // Stop shard processing threads and wait for them to terminate
+    void stopWorkers();
+
     YateSIPEngine *m_engine;
-    Mutex m_mutex;                       // Protect transports and listeners
+    Thread::Priority m_prio;             // Priority of shard processing threads
+    unsigned int m_shards;               // Number of engine shards
+    ObjList m_workers;                   // Shard processing threads (not owned)
+    Mutex m_mutex;                       // Protect transports, listeners and workers
     ObjList m_transports;                // All transports (non UDP are not owned)
     YateSIPUDPTransport* m_defTransport; // Default transport (pointer to object in m_transports)
     ObjList m_listeners;                 // Listeners list
 
-    unsigned int m_failedAuths;
-    unsigned int m_timedOutTrs;
-    unsigned int m_timedOutByes;
+    AtomicUInt m_failedAuths;
+    AtomicUInt m_timedOutTrs;
+    AtomicUInt m_timedOutByes;
+};
+
+// Processes the events of an engine shard in its own thread
+class YateSIPEngineWorker : public Thread, public GenObject
+{
+public:
+    YateSIPEngineWorker(YateSIPEndPoint* ep, unsigned int shard, Thread::Priority prio);
+    ~YateSIPEngineWorker();
+    virtual void run();
+private:
+    YateSIPEndPoint* m_ep;
+    unsigned int m_shard;
 };
 
 // Handle transfer requests
@@ -1469,7 +1489,7 @@ static const String s_username = "username";
 
 static u_int64_t s_printFloodTime = 0;
 
-int YateSIPEndPoint::s_evCount = 0;
+AtomicInt YateSIPEndPoint::s_flooded;
 bool SIPDriver::s_trace = false;
 
 // DTMF methods
@@ -3671,7 +3691,7 @@ void YateSIPTransport::setProtoAddr(bool set)
 
 YateSIPUDPTransport::YateSIPUDPTransport(const String& id)
     : YateSIPTransport(Udp,id,0,Idle), YateSIPListener(id,Udp),
-    m_default(false), m_forceBind(true), m_errored(false), m_bufferReq(0)
+    m_default(false), m_forceBind(true), m_errored(false), m_bufferReq(0), m_floodReads(0)
 {
     Debug(&plugin,DebugAll,"Transport(%s) created [%p]",m_id.c_str(),this);
 }
@@ -3791,9 +3811,8 @@ int YateSIPUDPTransport::process()
 	    m_setRtpAddr = false;
 	}
     }
-    int& evc = YateSIPEndPoint::s_evCount;
-    // Do nothing if the endpoint is flooded with events or terminating
-    if (!(YateSIPEndPoint::canRead() || ((evc & 3) == 0)))
+    // Read only once in 4 calls if the endpoint is flooded with events or terminating
+    if (!(YateSIPEndPoint::canRead() || ((++m_floodReads & 3) == 0)))
 	return Thread::idleUsec();
     int retVal = 0;
     // Check if we can read (select is available)
@@ -3844,7 +3863,7 @@ int YateSIPUDPTransport::process()
 	printRecvMsg(b,res);
     }
 
-    if (s_floodProtection && s_floodEvents && evc >= s_floodEvents) {
+    if (s_floodProtection && YateSIPEndPoint::flooded()) {
 	if (!s_printFloodTime)
 	    Alarm(&plugin,"performance",DebugWarn,
 		"Flood detected, dropping INVITE/REGISTER/SUBSCRIBE/OPTIONS, allowing reINVITES");
@@ -5125,8 +5144,8 @@ void YateTCPParty::destroyed()
 }
 
 
-YateSIPEngine::YateSIPEngine(YateSIPEndPoint* ep)
-    : SIPEngine(s_cfg.getValue("general","useragent")),
+YateSIPEngine::YateSIPEngine(YateSIPEndPoint* ep, unsigned int shards)
+    : SIPEngine(s_cfg.getValue("general","useragent"),shards),
       m_ep(ep), m_update(false), m_prack(false), m_info(false), m_foreignAuth(false),
       m_traceIds(0)
 {
@@ -5213,16 +5232,19 @@ void YateSIPEngine::transportChangedStatus(YateSIPTransport* trans, int stat, co
     if (!(trans && stat == YateSIPTransport::Terminated))
 	return;
     // Clear transactions
-    Lock lock(this);
-    for (ObjList* l = m_transList.skipNull(); l; l = l->skipNext()) {
-	SIPTransaction* t = static_cast<SIPTransaction*>(l->get());
-	if (t->initialMessage() && t->initialMessage()->getParty() &&
-	    trans == t->initialMessage()->getParty()->getTransport()) {
-	    bool active = t->isActive();
-	    Debug(this,active ? DebugInfo : DebugAll,
-		"Clearing %stransaction (%p) transport terminated reason=%s",
-		active ? "active " : "",t,reason.c_str());
-	    t->setCleared();
+    for (unsigned int i = 0; i < shards(); i++) {
+	SIPShard* sh = shard(i);
+	Lock lock(sh);
+	for (ObjList* l = sh->transactions().skipNull(); l; l = l->skipNext()) {
+	    SIPTransaction* t = static_cast<SIPTransaction*>(l->get());
+	    if (t->initialMessage() && t->initialMessage()->getParty() &&
+		trans == t->initialMessage()->getParty()->getTransport()) {
+		bool active = t->isActive();
+		Debug(this,active ? DebugInfo : DebugAll,
+		    "Clearing %stransaction (%p) transport terminated reason=%s",
+		    active ? "active " : "",t,reason.c_str());
+		t->setCleared();
+	    }
 	}
     }
 }
@@ -5232,12 +5254,15 @@ bool YateSIPEngine::hasActiveTransaction(YateSIPTransport* trans)
 {
     if (!trans)
 	return false;
-    Lock lock(this);
-    for (ObjList* l = m_transList.skipNull(); l; l = l->skipNext()) {
-	SIPTransaction* t = static_cast<SIPTransaction*>(l->get());
-	if (t->isActive() && t->initialMessage() && t->initialMessage()->getParty() &&
-	    trans == t->initialMessage()->getParty()->getTransport())
-	    return true;
+    for (unsigned int i = 0; i < shards(); i++) {
+	SIPShard* sh = shard(i);
+	Lock lock(sh);
+	for (ObjList* l = sh->transactions().skipNull(); l; l = l->skipNext()) {
+	    SIPTransaction* t = static_cast<SIPTransaction*>(l->get());
+	    if (t->isActive() && t->initialMessage() && t->initialMessage()->getParty() &&
+		trans == t->initialMessage()->getParty()->getTransport())
+		return true;
+	}
     }
     return false;
 }
@@ -5245,11 +5270,14 @@ bool YateSIPEngine::hasActiveTransaction(YateSIPTransport* trans)
 // Check if the engine has pending transactions
 bool YateSIPEngine::hasInitialTransaction()
 {
-    Lock lock(this);
-    for (ObjList* l = m_transList.skipNull(); l; l = l->skipNext()) {
-	SIPTransaction* t = static_cast<SIPTransaction*>(l->get());
-	if (t->getState() == SIPTransaction::Initial)
-	    return true;
+    for (unsigned int i = 0; i < shards(); i++) {
+	SIPShard* sh = shard(i);
+	Lock lock(sh);
+	for (ObjList* l = sh->transactions().skipNull(); l; l = l->skipNext()) {
+	    SIPTransaction* t = static_cast<SIPTransaction*>(l->get());
+	    if (t->getState() == SIPTransaction::Initial)
+		return true;
+	}
     }
     return false;
 }
@@ -5430,14 +5458,16 @@ bool YateSIPEngine::checkUser(String& username, const String& realm, const Strin
 }
 
 
-YateSIPEndPoint::YateSIPEndPoint(Thread::Priority prio, unsigned int partyMutexCount)
+YateSIPEndPoint::YateSIPEndPoint(Thread::Priority prio, unsigned int partyMutexCount,
+    unsigned int shards)
     : Thread("YSIP EndPoint",prio),
       m_partyMutexPool(partyMutexCount,"SIPParty"),
-      m_engine(0), m_mutex(true,"YateSIPEndPoint"), m_defTransport(0),
+      m_engine(0), m_prio(prio), m_shards(shards),
+      m_mutex(true,"YateSIPEndPoint"), m_defTransport(0),
       m_failedAuths(0),m_timedOutTrs(0), m_timedOutByes(0)
 {
-    Debug(&plugin,DebugAll,"YateSIPEndPoint::YateSIPEndPoint(%s) [%p]",
-	Thread::priority(prio),this);
+    Debug(&plugin,DebugAll,"YateSIPEndPoint::YateSIPEndPoint(%s,%u) [%p]",
+	Thread::priority(prio),shards,this);
 }
 
 YateSIPEndPoint::~YateSIPEndPoint()
@@ -5880,7 +5910,7 @@ void YateSIPEndPoint::completeTransports(Message& msg, const String& partWord,
 
 bool YateSIPEndPoint::Init()
 {
-    m_engine = new YateSIPEngine(this);
+    m_engine = new YateSIPEngine(this,m_shards);
     m_engine->debugChain(&plugin);
     return true;
 }
@@ -5888,24 +5918,43 @@ bool YateSIPEndPoint::Init()
 // Check if data is allowed to be read from socket(s) and processed
 bool YateSIPEndPoint::canRead()
 {
-    return s_floodEvents <= 1 || (s_evCount < s_floodEvents) || Engine::exiting();
+    return s_floodEvents <= 1 || !flooded() || Engine::exiting();
 }
 
 void YateSIPEndPoint::run()
 {
+    startWorkers();
+    // the first shard is processed by this thread
+    processEvents(0);
+    stopWorkers();
+    plugin.epTerminated(this);
+}
+
+void YateSIPEndPoint::processEvents(unsigned int shard)
+{
+    int evCount = 0;
+    // the shard is counted in s_flooded while it handles events without pause
+    bool flood = false;
     for (;;)
     {
-	if (!canRead()) {
-	    if (s_evCount == s_floodEvents)
-	        Debug(&plugin,DebugMild,"Flood detected: %d handled events",s_evCount);
-	    else if ((s_evCount % s_floodEvents) == 0)
-	        Debug(&plugin,DebugWarn,"Severe flood detected: %d events",s_evCount);
+	if (evCount >= s_floodEvents && s_floodEvents > 1 && !Engine::exiting()) {
+	    if (evCount == s_floodEvents)
+	        Debug(&plugin,DebugMild,"Flood detected: %d handled events in shard %u",evCount,shard);
+	    else if ((evCount % s_floodEvents) == 0)
+	        Debug(&plugin,DebugWarn,"Severe flood detected: %d events in shard %u",evCount,shard);
 	}
-	SIPEvent* e = m_engine->getEvent();
+	SIPEvent* e = m_engine->getEvent(shard);
 	if (e)
-	    s_evCount++;
+	    evCount++;
 	else
-	    s_evCount = 0;
+	    evCount = 0;
+	if (flood != ((s_floodEvents > 0) && (evCount >= s_floodEvents))) {
+	    flood = !flood;
+	    if (flood)
+		s_flooded++;
+	    else
+		s_flooded--;
+	}
 	// hack: use a loop so we can use break and continue
 	for (; e; m_engine->processEvent(e),e = 0) {
 	    SIPTransaction* t = e->getTransaction();
@@ -5961,16 +6010,76 @@ void YateSIPEndPoint::run()
 		break;
 	    }
 	}
-	if (s_evCount || s_engineHalt) {
+	if (evCount || s_engineHalt) {
 	    if (Thread::check(false))
 		break;
 	}
 	else
 	    Thread::usleep(Thread::idleUsec());
     }
-    plugin.epTerminated(this);
+    if (flood)
+	s_flooded--;
+}
+
+void YateSIPEndPoint::startWorkers()
+{
+    for (unsigned int i = 1; i < m_engine->shards(); i++) {
+	YateSIPEngineWorker* w = new YateSIPEngineWorker(this,i,m_prio);
+	m_mutex.lock();
+	m_workers.append(w)->setDelete(false);
+	m_mutex.unlock();
+	if (!w->startup()) {
+	    Debug(&plugin,DebugWarn,"Failed to start worker for SIP shard %u",i);
+	    delete w;
+	}
+    }
+}
+
+void YateSIPEndPoint::stopWorkers()
+{
+    m_mutex.lock();
+    for (ObjList* o = m_workers.skipNull(); o; o = o->skipNext())
+	static_cast<YateSIPEngineWorker*>(o->get())->cancel();
+    m_mutex.unlock();
+    for (;;) {
+	Lock lck(m_mutex);
+	if (!m_workers.skipNull())
+	    break;
+	lck.drop();
+	Thread::idle();
+    }
+}
+
+void YateSIPEndPoint::workerTerminated(YateSIPEngineWorker* worker)
+{
+    Lock lck(m_mutex);
+    m_workers.remove(worker,false);
+}
+
+
+
+YateSIPEngineWorker::YateSIPEngineWorker(YateSIPEndPoint* ep, unsigned int shard,
+    Thread::Priority prio)
+    : Thread("YSIP Shard",prio),
+      m_ep(ep), m_shard(shard)
+{
+    XDebug(&plugin,DebugAll,"YateSIPEngineWorker(%p,%u) [%p]",ep,shard,this);
+}
+
+YateSIPEngineWorker::~YateSIPEngineWorker()
+{
+    XDebug(&plugin,DebugAll,"YateSIPEngineWorker::~YateSIPEngineWorker() shard=%u [%p]",m_shard,this);
+    m_ep->workerTerminated(this);
 }
 
+void YateSIPEngineWorker::run()
+{
+    DDebug(&plugin,DebugAll,"YateSIPEngineWorker for shard %u started [%p]",m_shard,this);
+    m_ep->processEvents(m_shard);
+    DDebug(&plugin,DebugAll,"YateSIPEngineWorker for shard %u terminated [%p]",m_shard,this);
+}
+
+
 bool YateSIPEndPoint::incoming(SIPEvent* e, SIPTransaction* t)
 {
     if (t->isInvite())
@@ -10376,7 +10485,8 @@ void SIPDriver::initialize()
     if (!m_endpoint) {
 	Thread::Priority prio = Thread::priority(s_cfg.getValue("general","thread"));
 	unsigned int partyMutexCount = s_cfg.getIntValue("general","party_mutexcount",47,13,101);
-	m_endpoint = new YateSIPEndPoint(prio,partyMutexCount);
+	unsigned int shards = s_cfg.getIntValue("general","shards",1,1,32);
+	m_endpoint = new YateSIPEndPoint(prio,partyMutexCount,shards);
 	if (!(m_endpoint->Init())) {
 	    delete m_endpoint;
 	    m_endpoint = 0;
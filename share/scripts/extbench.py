@@ -0,0 +1,281 @@
+#!/usr/bin/env python3
+"""
+ extbench.py
+ This file is part of the YATE Project http://YATE.null.ro
+
+ Yet Another Telephony Engine - a fully featured software PBX and IVR
+ Copyright (C) 2026 Null Team
+
+ This software is distributed under multiple licenses;
+ see the COPYING file in the main directory for licensing
+ information for this specific distribution.
+
+ This use of this software may be subject to additional restrictions.
+ See the LEGAL file in the main directory for details.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+ External module round trip benchmark.
+
+ The script installs a handler for "extbench.ping" and then dispatches the
+ same message itself, keeping a window of messages in flight. Every round
+ trip goes application -> engine -> application handler -> engine ->
+ application so it exercises both directions and the pending message table.
+
+ Run it from extmodule.conf:
+   [scripts]
+   extbench.py=count=20000 window=16 framing=binary
+
+ Or against a listener, from the command line:
+   extbench.py connect=127.0.0.1:5039 framing=text
+
+ Against a pool listener several connections can share the handler:
+   extbench.py connect=127.0.0.1:5039 connections=4 delay=2
+
+ Options (all optional, key=value):
+   count   - number of round trips to perform, default 10000
+   window  - maximum messages in flight, default 8
+   framing - "text" or "binary" protocol framing, default text
+   params  - number of parameters carried by each message, default 10
+   connect - host:port of a TCP listener or path of a UNIX listener
+   connections - number of connections to open to the listener, default 1
+   delay   - milliseconds each connection spends on a message it handles,
+             simulates a router that answers in order, default 0
+"""
+
+import os, sys, socket, struct, time, selectors
+
+
+def escape(s, extra=""):
+	r = []
+	for c in s:
+		if c == "%":
+			r.append("%%")
+		elif ord(c) < 32 or c == ":" or c == extra:
+			r.append("%" + chr(ord(c) + 64))
+		else:
+			r.append(c)
+	return "".join(r)
+
+def unescape(s):
+	r = []
+	i = 0
+	n = len(s)
+	while i < n:
+		c = s[i]
+		if c == "%" and i + 1 < n:
+			i += 1
+			c = s[i]
+			if c != "%":
+				c = chr(ord(c) - 64)
+		r.append(c)
+		i += 1
+	return "".join(r)
+
+
+class Link:
+	""" Framed or line oriented connection to the engine """
+
+	def __init__(self, connect):
+		self.sock = None
+		self.buf = b""
+		self.binary = False
+		if connect:
+			if ":" in connect:
+				host, port = connect.rsplit(":", 1)
+				self.sock = socket.create_connection((host, int(port)))
+				self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+			else:
+				self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+				self.sock.connect(connect)
+
+	def write(self, data):
+		if self.sock:
+			self.sock.sendall(data)
+			return
+		while data:
+			n = os.write(1, data)
+			data = data[n:]
+
+	def fileno(self):
+		if self.sock:
+			return self.sock.fileno()
+		return 0
+
+	def read(self):
+		if self.sock:
+			data = self.sock.recv(65536)
+		else:
+			data = os.read(0, 65536)
+		if not data:
+			raise EOFError
+		self.buf += data
+
+	def send_line(self, line):
+		data = line.encode("utf-8")
+		if self.binary:
+			self.write(struct.pack("!I", len(data)) + data)
+		else:
+			self.write(data + b"\n")
+
+	# kind is "%%>message" or "%%<message", params a list of (name, value)
+	def send_message(self, kind, mid, extra, name, retval, params):
+		if self.binary:
+			fields = [kind, mid, extra, name, retval]
+			fields += [k + "=" + v for k, v in params]
+			data = b"\0".join(f.encode("utf-8") for f in fields)
+			self.write(struct.pack("!I", len(data)) + data)
+			return
+		line = kind + ":" + escape(mid) + ":" + extra + ":" + escape(name) + ":" + escape(retval)
+		for k, v in params:
+			line += ":" + escape(k, "=") + "=" + escape(v)
+		self.write(line.encode("utf-8") + b"\n")
+
+	# Returns a list of fields for messages, a plain string for other lines
+	#  or None if nothing complete was received yet
+	def pop(self):
+		if self.binary:
+			if len(self.buf) < 4:
+				return None
+			n = struct.unpack("!I", self.buf[:4])[0]
+			if len(self.buf) < 4 + n:
+				return None
+			data = self.buf[4:4 + n]
+			self.buf = self.buf[4 + n:]
+			if b"\0" not in data:
+				return data.decode("utf-8", "replace")
+			return [f.decode("utf-8", "replace") for f in data.split(b"\0")]
+		pos = self.buf.find(b"\n")
+		if pos < 0:
+			return None
+		line = self.buf[:pos].decode("utf-8", "replace")
+		self.buf = self.buf[pos + 1:]
+		if line.startswith("%%>message:") or line.startswith("%%<message:"):
+			parts = line.split(":")
+			fields = [parts[0]] + [unescape(p) for p in parts[1:5]]
+			for p in parts[5:]:
+				k, sep, v = p.partition("=")
+				fields.append(unescape(k) + sep + unescape(v))
+			return fields
+		return line
+
+	def receive(self):
+		while True:
+			r = self.pop()
+			if r is not None:
+				return r
+			self.read()
+
+	def request(self, line, answer):
+		self.send_line(line)
+		while True:
+			r = self.receive()
+			if isinstance(r, str) and r.startswith(answer):
+				return r
+			sys.stderr.write("extbench: unexpected %r\n" % (r,))
+
+
+def main():
+	opts = { "count": "10000", "window": "8", "framing": "text", "params": "10", "connect": "",
+		"connections": "1", "delay": "0" }
+	for arg in " ".join(sys.argv[1:]).split():
+		k, sep, v = arg.partition("=")
+		if k not in opts:
+			sys.stderr.write("extbench: unknown option '%s'\n" % k)
+			return 1
+		opts[k] = v
+	count = int(opts["count"])
+	window = max(1, int(opts["window"]))
+	conns = max(1, int(opts["connections"]))
+	delay = float(opts["delay"]) / 1000
+	params = [("param%d" % i, "value:%d=%%" % i) for i in range(int(opts["params"]))]
+	if conns > 1 and not opts["connect"]:
+		sys.stderr.write("extbench: multiple connections need a listener\n")
+		return 1
+
+	links = []
+	for i in range(conns):
+		link = Link(opts["connect"])
+		if opts["connect"]:
+			link.send_line("%%>connect:global")
+		if opts["framing"] == "binary":
+			r = link.request("%%>setlocal:framing:binary", "%%<setlocal:framing:")
+			if not r.endswith(":true"):
+				sys.stderr.write("extbench: binary framing not supported: %s\n" % r)
+				return 1
+			link.binary = True
+		link.request("%%>setlocal:reenter:true", "%%<setlocal:reenter:")
+		link.request("%%>install:50:extbench.ping", "%%<install:")
+		link.handled = 0
+		link.busy = 0.0
+		link.pending = []
+		links.append(link)
+	sel = selectors.DefaultSelector()
+	for link in links:
+		sel.register(link.fileno(), selectors.EVENT_READ, link)
+	master = links[0]
+
+	sent = 0
+	done = 0
+	worst = 0.0
+	started = {}
+	t0 = time.time()
+	while done < count:
+		while sent < count and len(started) < window:
+			mid = "bench.%d" % sent
+			started[mid] = time.time()
+			master.send_message("%%>message", mid, str(int(t0)), "extbench.ping", "", params)
+			sent += 1
+		# answer the messages whose simulated processing is over
+		now = time.time()
+		wake = None
+		for link in links:
+			while link.pending and link.pending[0][0] <= now:
+				link.send_message("%%<message", link.pending.pop(0)[1], "true", "", "pong", [])
+			if link.pending and (wake is None or link.pending[0][0] < wake):
+				wake = link.pending[0][0]
+		timeout = None if wake is None else max(0, wake - now)
+		for key, ev in sel.select(timeout):
+			key.data.read()
+		for link in links:
+			while True:
+				r = link.pop()
+				if r is None:
+					break
+				if not isinstance(r, list):
+					sys.stderr.write("extbench: unexpected %r\n" % (r,))
+				elif r[0] == "%%>message":
+					# we are the handler, each connection works in order
+					link.handled += 1
+					if delay > 0:
+						link.busy = max(link.busy, time.time()) + delay
+						link.pending.append((link.busy, r[1]))
+					else:
+						link.send_message("%%<message", r[1], "true", "", "pong", [])
+				elif r[1] in started:
+					dt = time.time() - started.pop(r[1])
+					if dt > worst:
+						worst = dt
+					if r[2] != "true" or r[4] != "pong":
+						sys.stderr.write("extbench: message %s returned %s '%s'\n" % (r[1], r[2], r[4]))
+					done += 1
+	elapsed = time.time() - t0
+
+	for link in links:
+		link.request("%%>uninstall:extbench.ping", "%%<uninstall:")
+	rate = done / elapsed if elapsed > 0 else 0
+	master.send_line("%%%%>output:extbench: %d round trips in %.0f ms, %.0f/s, %s framing, window %d, worst %.2f ms, handled %s"
+		% (done, elapsed * 1000, rate, opts["framing"], window, worst * 1000,
+		"/".join(str(l.handled) for l in links)))
+	return 0
+
+
+if __name__ == "__main__":
+	try:
+		sys.exit(main())
+	except (EOFError, BrokenPipeError):
+		sys.exit(1)
+
+# vi: set ts=8 sw=8 sts=8 noet:
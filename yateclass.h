@@ -5329,6 +5329,15 @@ public:
      */
     bool isCaseInsensitive() const;
 
+    /**
+     * Retrieve the literal text that any value matching the expression starts with.
+     * This allows large sets of expressions to be preselected by a prefix tree.
+     * @param prefix String to fill with the required prefix, may be empty
+     * @return True if the expression is anchored and the prefix can be relied on,
+     *  false if the expression can match values starting with anything
+     */
+    bool literalPrefix(String& prefix) const;
+
 protected:
     /**
      * Called whenever the value changed (except in constructors) to recompile.
@@ -8522,6 +8531,7 @@ public:
 };
 
 class NamedIterator;
+class NamedListPrivate;
 
 /**
  * This class holds a named list of named strings
@@ -8564,6 +8574,11 @@ public:
      */
     NamedList(const char* name, const NamedList& original, const String& prefix);
 
+    /**
+     * Destructor
+     */
+    virtual ~NamedList();
+
     /**
      * Assignment operator
      * @param value New name and parameters to assign
@@ -8596,7 +8611,7 @@ public:
      * Clear all parameters
      */
     inline void clearParams()
-	{ m_params.clear(); }
+	{ m_params.clear(); resetIndex(); }
 
     /**
      * Add a named string to the parameter list.
@@ -9110,6 +9125,7 @@ public:
     {
 	if (!dest)
 	    dest = new NamedList("");
+	resetIndex();
 	m_params.move(dest->paramList(),lock,maxwait,compact);
 	return dest;
     }
@@ -9155,22 +9171,44 @@ public:
     static const NamedList& empty();
 
     /**
-     * Get the parameters list
+     * Get the parameters list for direct changes.
+     * This drops the name index, the next added parameter builds it again by
+     *  walking the whole list. Use the const version to only walk the list.
+     * Like any other change, it must not be used while other threads access the list
      * @return Pointer to the parameters list
      */
     inline ObjList* paramList()
-	{ return &m_params; }
+	{ resetIndex(); return &m_params; }
 
     /**
-     * Get the parameters list
+     * Get the parameters list to walk it, the name index is kept
      * @return Pointer to the parameters list
      */
     inline const ObjList* paramList() const
 	{ return &m_params; }
 
+    /**
+     * Get the number of parameters above which lists keep a hash index of names
+     * @return Parameter count that triggers indexing, 0 if indexing is disabled
+     */
+    static unsigned int indexThreshold();
+
+    /**
+     * Set the number of parameters above which new lists keep a hash index of names
+     * @param count Parameter count that triggers indexing, 0 to disable indexing
+     */
+    static void indexThreshold(unsigned int count);
+
 private:
     NamedList(); // no default constructor please
+    void resetIndex();
+    void checkIndex(unsigned int added);
+    void changedIndex();
+    ObjList* appendParam(NamedString* param);
+    NamedString* setParamCreate(const String& name, bool clearOther);
     ObjList m_params;
+    NamedListPrivate* m_index;
+    unsigned int m_indexCheck;
 };
 
 /**
@@ -9235,6 +9273,129 @@ private:
     const ObjList* m_item;
 };
 
+/**
+ * A text holding ${paramname} or ${paramname$default} references that is
+ *  parsed once in literal and parameter parts so it can be filled quickly
+ *  from many lists of parameters, see NamedList::replaceParams()
+ * @short Precompiled parameter substitution template
+ */
+class YATE_API ParamTemplate : public String
+{
+    YCLASS(ParamTemplate,String)
+public:
+    /**
+     * Escaping applied to parameter values
+     */
+    enum Escape {
+	EscNone = 0, // values are copied unchanged
+	EscSql,      // SQL escaping, like String::sqlEscape()
+	EscCsv,      // double quotes are doubled for quoted CSV fields
+    };
+
+    /**
+     * Constructor
+     * @param value Initial text of the template
+     * @param escape Escaping applied to all parameter values
+     * @param extraEsc Character to escape other than the SQL default ones
+     */
+    explicit ParamTemplate(const char* value = 0, int escape = EscNone, char extraEsc = 0);
+
+    /**
+     * Copy constructor
+     * @param original Template to copy text and escaping from
+     */
+    ParamTemplate(const ParamTemplate& original);
+
+    /**
+     * Destructor
+     */
+    virtual ~ParamTemplate();
+
+    /**
+     * Assignment from char* operator, the template is parsed again
+     */
+    inline ParamTemplate& operator=(const char* value)
+	{ String::operator=(value); return *this; }
+
+    /**
+     * Assignment operator, copies the text and escaping
+     */
+    ParamTemplate& operator=(const ParamTemplate& original);
+
+    /**
+     * Set the escaping of all parameter values
+     * @param escape Escaping applied to parameter values
+     * @param extraEsc Character to escape other than the SQL default ones
+     */
+    void setEscape(int escape, char extraEsc = 0);
+
+    /**
+     * Set the escaping of a single parameter reference, it is lost if the text changes
+     * @param index 0-based index of the reference in the template
+     * @param escape Escaping applied to the value of this reference
+     * @param extraEsc Character to escape other than the SQL default ones
+     * @return True if the reference exists, false if index is out of range
+     */
+    bool setEscape(unsigned int index, int escape, char extraEsc = 0);
+
+    /**
+     * Get the number of parameter references in the template
+     * @return Count of ${paramname} references
+     */
+    inline unsigned int params() const
+	{ return m_params; }
+
+    /**
+     * Check if the template holds an unterminated ${ reference
+     * @return True if a ${ is never closed, it is copied literally
+     */
+    inline bool malformed() const
+	{ return m_malformed; }
+
+    /**
+     * Append the template with references replaced by parameter values
+     * @param list Parameters to take values from
+     * @param str String to append the result to
+     * @return Number of replacements made, -1 if the template is malformed
+     */
+    int render(const NamedList& list, String& str) const;
+
+    /**
+     * Build the template with references replaced by parameter values
+     * @param list Parameters to take values from
+     * @return Resulting string
+     */
+    inline String render(const NamedList& list) const
+	{ String tmp; render(list,tmp); return tmp; }
+
+    /**
+     * Append the template as a query with positional parameters.
+     * References enclosed alone in single quotes, like '${name}', are replaced
+     *  together with the quotes by $1 ... $N and their raw values are set in
+     *  args as "arg.1" ... "arg.N" and the count as "args".
+     * Other references are replaced in the text as render() does.
+     * @param list Parameters to take values from
+     * @param query String to append the query text to
+     * @param args List to set the positional parameter values into
+     * @return Number of positional parameters, -1 if the template is malformed
+     */
+    int bind(const NamedList& list, String& query, NamedList& args) const;
+
+protected:
+    /**
+     * Called whenever the value changed (except in constructors) to parse it again
+     */
+    virtual void changed();
+
+private:
+    void parse();
+    ObjList m_items;
+    unsigned int m_params;
+    bool m_malformed;
+    int m_escape;
+    char m_extraEsc;
+};
+
 /**
  * Uniform Resource Identifier encapsulation and parser.
  * For efficiency reason the parsing is delayed as long as possible
@@ -12242,6 +12403,13 @@ public:
      */
     void clearFilters(bool del = true);
 
+    /**
+     * Check if any packet filter is installed in the socket
+     * @return True if received data must be passed through filters
+     */
+    inline bool filtered() const
+	{ return 0 != m_filters.skipNull(); }
+
     /**
      * Run whatever actions required on idle thread runs.
      * The default implementation calls @ref SocketFilter::timerTick()
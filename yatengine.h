@@ -54,6 +54,11 @@ public:
      */
     explicit Configuration(const char* filename, bool warn = true);
 
+    /**
+     * Destructor
+     */
+    virtual ~Configuration();
+
     /**
      * Assignment from string operator
      */
@@ -65,14 +70,14 @@ public:
      * @return Count of sections
      */
     inline unsigned int sections() const
-	{ return m_sections.length(); }
+	{ return (m_last->get() ? 0 : 1) + m_posLen; }
 
     /**
      * Get the number of non null sections
      * @return Count of sections
      */
     inline unsigned int count() const
-	{ return m_sections.count(); }
+	{ return m_posLen; }
 
     /**
      * Retrieve an entire section
@@ -237,10 +242,18 @@ private:
 	    return load(warn);
 	}
 
-    ObjList *getSectHolder(const String& sect) const;
-    ObjList *makeSectHolder(const String& sect);
+    NamedList* makeSection(const String& sect);
+    void clearIndex();
+    void indexSection(NamedList* sect);
+    void unindexSection(NamedList* sect);
     bool loadFile(const char* file, String sect, unsigned int depth, bool warn, void* priv);
     ObjList m_sections;
+    ObjList* m_last;
+    HashList* m_index;
+    NamedList** m_pos;
+    unsigned int m_posFirst;
+    unsigned int m_posLen;
+    unsigned int m_posAlloc;
     bool m_main;
 };
 
@@ -583,6 +596,8 @@ private:
     RefObject* m_data;
     bool m_notify;
     bool m_broadcast;
+    Message* m_queueNext;
+    AtomicInt m_queued;
     void commonEncode(String& str) const;
     int commonDecode(const char* str, int offs);
 };
@@ -968,9 +983,10 @@ public:
     bool dispatch(Message& msg);
 
     /**
-     * Put a message in the waiting queue for asynchronous dispatching
+     * Put a message in the waiting queue for asynchronous dispatching.
+     * Enqueueing does not lock the queue if atomic operations are available
      * @param msg The message to enqueue, will be destroyed after dispatching
-     * @return True if successfully queued, false otherwise
+     * @return True if successfully queued, false if already queued
      */
     bool enqueue(Message* msg);
 
@@ -985,6 +1001,14 @@ public:
      */
     bool dequeueOne();
 
+    /**
+     * Remove one message from the waiting queue without dispatching it.
+     * Queue statistics are updated as if the message was dispatched
+     * @return Message removed from queue that the caller must dispatch and
+     *  destroy, NULL if the queue is empty
+     */
+    Message* dequeueMessage();
+
     /**
      * Set a limit to generate warning when a message took too long to dispatch
      * @param usec Warning time limit in microseconds, zero to disable
@@ -1030,7 +1054,7 @@ public:
      * @return True if the queue holds at least one message
      */
     inline bool hasMessages() const
-	{ return m_messages.get() || m_messages.next(); }
+	{ return m_enqueueCount.valueAtomic() != m_dequeueCount.valueAtomic(); }
 
     /**
      * Check if there is at least one handler installed
@@ -1100,6 +1124,22 @@ public:
     u_int64_t messageAge(bool usec = false) const
 	{ return usec ? m_msgAvgAge : ((m_msgAvgAge + 500) / 1000); }
 
+    /**
+     * Get the total number of handlers visited while dispatching messages.
+     * Only handlers installed for the message name or for all messages are visited
+     * @return Count of handlers visited by all dispatched messages
+     */
+    u_int64_t handlersVisited() const
+	{ return m_handlersVisited; }
+
+    /**
+     * Get the total number of handlers a linear walk of the full handler list
+     *  would have visited while dispatching messages
+     * @return Sum of installed handlers over all dispatched messages
+     */
+    u_int64_t handlersLinear() const
+	{ return m_handlersLinear; }
+
     /**
      * Retrieve the handlers list lock object
      * @return Handlers list lock object reference
@@ -1157,22 +1197,30 @@ protected:
 	{ m_trackParam = paramName; }
 
 private:
+    void pushMessage(Message* msg);
+    Message* popMessage();
     ObjList m_handlers;
-    ObjList m_messages;
+    HashList m_handlersIndex;
+    ObjList m_handlersNull;
     ObjList m_hooks;
     RWLock m_handlersLock;
-    RWLock m_messagesLock;
+    Mutex m_messagesLock;
     RWLock m_hooksLock;
-    ObjList* m_msgAppend;
+    Message* m_msgHead;
+    Message* m_msgTail;
+    Message* m_msgStub;
     ObjList* m_hookAppend;
     String m_trackParam;
     unsigned int m_changes;
+    unsigned int m_handlerCount;
     u_int64_t m_warnTime;
-    u_int64_t m_enqueueCount;
-    u_int64_t m_dequeueCount;
+    AtomicUInt64 m_enqueueCount;
+    AtomicUInt64 m_dequeueCount;
     u_int64_t m_dispatchCount;
     u_int64_t m_queuedMax;
     u_int64_t m_msgAvgAge;
+    u_int64_t m_handlersVisited;
+    u_int64_t m_handlersLinear;
     bool m_traceTime;
     bool m_traceHandlerTime;
     int m_hookCount;
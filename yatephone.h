@@ -792,6 +792,13 @@ public:
      */
     static void setMaxChain(unsigned int maxChain);
 
+    /**
+     * Set the quality of the resamplers created from now on
+     * @param quality Quality level name: fast, low, medium or high
+     * @return True if the quality level was recognized and set
+     */
+    static bool setResampleQuality(const String& quality);
+
 protected:
     /**
      * Get access to the list of consumers of the data source